@@ -0,0 +1,350 @@
+/**
+ * @file latencyBench.c
+ * @brief This is a source file for the latency benchmark.
+ *
+ * This source file contains a host program that measures the time from an
+ * input of the BeaglePod to its effects, as the latency module does on the
+ * device (see latency.h): the first byte written to the display and the
+ * first samples of the song it started handed to the sound card.
+ *
+ * The whole BeaglePod runs, but for the menu and the hardware: the display
+ * and the audio player are built with their file backends, paced like the
+ * I2C bus and the sound card, writing to /dev/null unless BEAGLEPOD_LCD_FILE
+ * and BEAGLEPOD_PCM_DEVICE name files. Joystick presses are simulated and
+ * acted on like the songs menu does, timed from the press rather than from
+ * the poll that sees it. Commands are sent to the network module over UDP,
+ * timed from their arrival. A few short WAV files are generated for them to
+ * play.
+ *
+ * The latency histograms of each action are printed to stdout in the
+ * Prometheus text format; everything the BeaglePod prints itself is
+ * discarded. Build and run it with "make latency".
+ *
+ * @author Amirhossein Etaati
+ * @date 2023-04-19
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "songManager.h"
+#include "audio_player.h"
+#include "lcd_4line.h"
+#include "network.h"
+#include "latency.h"
+#include "metrics.h"
+#include "logger.h"
+#include "trace.h"
+
+#define NUM_SONGS 6
+#define SONG_SECONDS 5
+// Inputs sent, with a random pause in between
+#define NUM_INPUTS 60
+#define MIN_PAUSE_MS 150
+#define MAX_PAUSE_MS 400
+// A press lasts long enough for the menu to see it, shorter than its debounce
+#define PRESS_MS 40
+// Same as the menu manager and the network module
+#define MENU_POLL_MS 5
+#define NETWORK_PORT 12345
+#define METRICS_BUFFER_SIZE (64 * 1024)
+
+typedef enum
+{
+    INPUT_UP,
+    INPUT_DOWN,
+    INPUT_CENTER,
+    INPUT_SONG_NEXT,
+    INPUT_SONG_PREVIOUS,
+    NUM_INPUT_TYPES
+} input_t;
+
+// Joystick directions named like joystick.c does, then network commands
+static const char *input_names[NUM_INPUT_TYPES] = {"Up", "Down", "Center", "song_next", "song_previous"};
+// Out of 100, the rest are song_previous
+static const int input_weights[NUM_INPUT_TYPES - 1] = {20, 20, 20, 25};
+
+static FILE *results = NULL;
+static char songs_directory[] = "/tmp/latencyBench.XXXXXX";
+
+// Simulated joystick, pressed by the main thread and polled by the menu thread
+static pthread_mutex_t joystickMutex = PTHREAD_MUTEX_INITIALIZER;
+static int pressed = -1; // the input_t pressed, -1 while released
+static long long pressed_us = 0;
+static bool stoppingMenu = false;
+static pthread_t menuThreadId;
+
+// Private functions definitions
+static void writeSongs(void);
+static void removeSongs(void);
+static void *menuThread(void *arg);
+static void press(input_t input);
+static void sendCommand(int fd, const struct sockaddr_in *address, const char *command);
+static void report(void);
+static void sleepMs(long long ms);
+
+//------------------------------------------------
+///////////////// Simulated menu /////////////////
+//------------------------------------------------
+
+song_info *MenuManager_GetCurrentSongPlaying(void)
+{
+    return songManager_getCurrentSongPlaying();
+}
+
+// Acts on the presses like the songs menu of the menu manager
+static void *menuThread(void *arg)
+{
+    trace_nameThread("menu");
+    int previous = -1;
+    while (!__atomic_load_n(&stoppingMenu, __ATOMIC_ACQUIRE))
+    {
+        pthread_mutex_lock(&joystickMutex);
+        int input = pressed;
+        long long edge_us = pressed_us;
+        pthread_mutex_unlock(&joystickMutex);
+
+        if (input != -1 && input != previous)
+        {
+            latency_beginAction(LATENCY_SOURCE_JOYSTICK, input_names[input], edge_us);
+            switch (input)
+            {
+            case INPUT_UP:
+                songManager_moveCursorUp();
+                break;
+            case INPUT_DOWN:
+                songManager_moveCursorDown();
+                break;
+            case INPUT_CENTER:
+                songManager_playSong();
+                break;
+            default:
+                break;
+            }
+            latency_endAction();
+        }
+        previous = input;
+        sleepMs(MENU_POLL_MS);
+    }
+    return NULL;
+}
+
+//------------------------------------------------
+//////////////////// Benchmark ///////////////////
+//------------------------------------------------
+
+int main(void)
+{
+    // results go to the real stdout, the BeaglePod's own output nowhere
+    results = fdopen(dup(STDOUT_FILENO), "w");
+    if (results == NULL || freopen("/dev/null", "w", stdout) == NULL)
+    {
+        fprintf(stderr, "latencyBench: Error - Unable to redirect the output.\n");
+        exit(1);
+    }
+    writeSongs();
+    srand(433);
+
+    logger_init();
+    trace_init();
+    songManager_init();
+    for (int i = 0; i < NUM_SONGS; i++)
+    {
+        char path[64];
+        char title[32];
+        snprintf(path, sizeof(path), "%s/Song %d.wav", songs_directory, i);
+        snprintf(title, sizeof(title), "Song %d", i);
+        songManager_addSongBack(create_song_struct("Artist", "Album", path, title));
+    }
+    AudioPlayer_init();
+    LCD_init();
+    Network_init();
+    songManager_displaySongs();
+    pthread_create(&menuThreadId, NULL, menuThread, NULL);
+
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct timeval timeout = {.tv_sec = 1};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    struct sockaddr_in address = {.sin_family = AF_INET, .sin_port = htons(NETWORK_PORT)};
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    // a song plays first, so the skips go from song to song
+    press(INPUT_CENTER);
+    for (int i = 0; i < NUM_INPUTS; i++)
+    {
+        sleepMs(MIN_PAUSE_MS + rand() % (MAX_PAUSE_MS - MIN_PAUSE_MS));
+        int draw = rand() % 100;
+        input_t input = 0;
+        while (input < NUM_INPUT_TYPES - 1 && draw >= input_weights[input])
+        {
+            draw -= input_weights[input];
+            input++;
+        }
+        if (input < INPUT_SONG_NEXT)
+        {
+            press(input);
+        }
+        else
+        {
+            sendCommand(fd, &address, input_names[input]);
+        }
+    }
+    sleepMs(MAX_PAUSE_MS);
+    close(fd);
+
+    __atomic_store_n(&stoppingMenu, true, __ATOMIC_RELEASE);
+    pthread_join(menuThreadId, NULL);
+    Network_cleanup();
+    AudioPlayer_cleanup();
+    // the collectors of the metrics need the library
+    report();
+    LCD_cleanup();
+    songManager_cleanup();
+    trace_cleanup();
+    logger_cleanup();
+    removeSongs();
+    fclose(results);
+    return 0;
+}
+
+// Writes NUM_SONGS WAV files of SONG_SECONDS of a tone into songs_directory
+static void writeSongs(void)
+{
+    if (mkdtemp(songs_directory) == NULL)
+    {
+        fprintf(stderr, "latencyBench: Error - Unable to create %s.\n", songs_directory);
+        exit(1);
+    }
+    uint32_t data_size = SONG_SECONDS * SAMPLE_RATE * NUM_CHANNELS * SAMPLE_SIZE;
+    short *samples = malloc(data_size);
+    if (samples == NULL)
+    {
+        fprintf(stderr, "latencyBench: Error - There was a problem allocating memory.");
+        exit(1);
+    }
+    for (int i = 0; i < NUM_SONGS; i++)
+    {
+        // a square wave, a different pitch for each song
+        int period = SAMPLE_RATE / (220 * (i + 1));
+        for (int frame = 0; frame < SONG_SECONDS * SAMPLE_RATE; frame++)
+        {
+            short value = ((frame % period) < period / 2) ? 4000 : -4000;
+            samples[frame * NUM_CHANNELS] = value;
+            samples[frame * NUM_CHANNELS + 1] = value;
+        }
+
+        // the canonical 44 byte header, little endian like the host
+        uint32_t byte_rate = SAMPLE_RATE * NUM_CHANNELS * SAMPLE_SIZE;
+        uint32_t riff_size = 36 + data_size;
+        uint32_t format_size = 16;
+        uint16_t format = 1;
+        uint16_t channels = NUM_CHANNELS;
+        uint32_t rate = SAMPLE_RATE;
+        uint16_t block_align = NUM_CHANNELS * SAMPLE_SIZE;
+        uint16_t bits = 8 * SAMPLE_SIZE;
+        char path[64];
+        snprintf(path, sizeof(path), "%s/Song %d.wav", songs_directory, i);
+        FILE *file = fopen(path, "wb");
+        if (file == NULL)
+        {
+            fprintf(stderr, "latencyBench: Error - Unable to write %s.\n", path);
+            exit(1);
+        }
+        fwrite("RIFF", 1, 4, file);
+        fwrite(&riff_size, 4, 1, file);
+        fwrite("WAVEfmt ", 1, 8, file);
+        fwrite(&format_size, 4, 1, file);
+        fwrite(&format, 2, 1, file);
+        fwrite(&channels, 2, 1, file);
+        fwrite(&rate, 4, 1, file);
+        fwrite(&byte_rate, 4, 1, file);
+        fwrite(&block_align, 2, 1, file);
+        fwrite(&bits, 2, 1, file);
+        fwrite("data", 1, 4, file);
+        fwrite(&data_size, 4, 1, file);
+        fwrite(samples, 1, data_size, file);
+        fclose(file);
+    }
+    free(samples);
+}
+
+static void removeSongs(void)
+{
+    for (int i = 0; i < NUM_SONGS; i++)
+    {
+        char path[64];
+        snprintf(path, sizeof(path), "%s/Song %d.wav", songs_directory, i);
+        unlink(path);
+    }
+    rmdir(songs_directory);
+}
+
+// Holds the joystick in the direction of "input" for PRESS_MS
+static void press(input_t input)
+{
+    pthread_mutex_lock(&joystickMutex);
+    pressed = input;
+    pressed_us = metrics_getTimeInUs();
+    pthread_mutex_unlock(&joystickMutex);
+    sleepMs(PRESS_MS);
+    pthread_mutex_lock(&joystickMutex);
+    pressed = -1;
+    pthread_mutex_unlock(&joystickMutex);
+}
+
+// Sends "command" in the text protocol and waits for its reply
+static void sendCommand(int fd, const struct sockaddr_in *address, const char *command)
+{
+    char reply[1024];
+    if (sendto(fd, command, strlen(command), 0, (const struct sockaddr *)address, sizeof(*address)) < 0 ||
+        recv(fd, reply, sizeof(reply), 0) < 0)
+    {
+        fprintf(results, "# %s was not answered\n", command);
+    }
+}
+
+// Prints the latency metrics
+static void report(void)
+{
+    char *text = NULL;
+    size_t size = 0;
+    size_t length = METRICS_BUFFER_SIZE;
+    while (length >= size)
+    {
+        free(text);
+        size = length + 1024;
+        text = malloc(size);
+        if (text == NULL)
+        {
+            fprintf(results, "latencyBench: Error - There was a problem allocating memory.");
+            exit(1);
+        }
+        length = metrics_format(text, size);
+    }
+
+    char *save = NULL;
+    for (char *line = strtok_r(text, "\n", &save); line != NULL; line = strtok_r(NULL, "\n", &save))
+    {
+        if (strstr(line, "beaglepod_latency_") != NULL)
+        {
+            fprintf(results, "%s\n", line);
+        }
+    }
+    free(text);
+}
+
+static void sleepMs(long long ms)
+{
+    struct timespec delay = {.tv_sec = ms / 1000, .tv_nsec = (ms % 1000) * 1000000};
+    nanosleep(&delay, NULL);
+}
@@ -0,0 +1,238 @@
+/**
+ * @file libraryBench.c
+ * @brief This is a source file for the library benchmark.
+ *
+ * This source file contains a host program that fills the song manager
+ * with 1k, 10k and 100k synthetic songs and times the library operations
+ * (add, delete by id, index lookup, page render, next/previous) along with
+ * the heap used per song. The LCD and the audio player are stubbed out, so
+ * only the library layer is measured.
+ *
+ * Results are printed to stdout as "songs,metric,value,unit" CSV lines;
+ * everything the song manager prints itself is discarded.
+ * Build and run it with "make bench".
+ *
+ * @author Mehdi Esmaeilzadeh
+ * @date 2023-04-11
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <malloc.h>
+
+#include "songManager.h"
+#include "lcd_4line.h"
+
+// Artists and albums repeat across songs like in a real library
+#define NUM_ARTISTS 250
+#define NUM_ALBUMS 1000
+// Operations timed at each library size
+#define NUM_LOOKUPS 200000
+#define NUM_RENDERS 20000
+#define NUM_SKIPS 20000
+#define NUM_DELETES 20000
+
+static const int library_sizes[] = {1000, 10000, 100000};
+
+static FILE *results = NULL;
+
+// Private functions definitions
+static void benchLibrary(int num_songs);
+static void report(int num_songs, const char *metric, double value, const char *unit);
+static double getTimeInNs(void);
+static size_t getHeapBytes(void);
+
+//------------------------------------------------
+////////////////// Stubbed LCD ///////////////////
+//------------------------------------------------
+
+static size_t lcd_chars_written = 0;
+
+void LCD_clear(void)
+{
+}
+
+void LCD_writeChar(unsigned char character)
+{
+    lcd_chars_written++;
+}
+
+void LCD_writeString(char *string)
+{
+    lcd_chars_written += strlen(string);
+}
+
+void LCD_writeStringAtLine(char *string, LCD_LINE_NUM line_num)
+{
+    lcd_chars_written += strlen(string);
+}
+
+//------------------------------------------------
+/////////////// Stubbed audio player /////////////
+//------------------------------------------------
+
+void AudioPlayer_readWaveFileIntoMemory(char *fileName, wavedata_t *pSound)
+{
+    memset(pSound, 0, sizeof(*pSound));
+}
+
+void AudioPlayer_readWaveFileFrom(char *fileName, wavedata_t *pSound, int firstSample)
+{
+    memset(pSound, 0, sizeof(*pSound));
+}
+
+void AudioPlayer_freeWaveFileData(wavedata_t *pSound)
+{
+}
+
+void AudioPlayer_playWAVAt(wavedata_t *pSound, int location)
+{
+}
+
+//------------------------------------------------
+//////////////////// Benchmark ///////////////////
+//------------------------------------------------
+
+int main(void)
+{
+    // results go to the real stdout, the song manager's own output nowhere
+    results = fdopen(dup(STDOUT_FILENO), "w");
+    if (results == NULL || freopen("/dev/null", "w", stdout) == NULL)
+    {
+        fprintf(stderr, "libraryBench: Error - Unable to redirect the output.\n");
+        exit(1);
+    }
+
+    fprintf(results, "songs,metric,value,unit\n");
+    srand(433);
+    for (size_t i = 0; i < sizeof(library_sizes) / sizeof(library_sizes[0]); i++)
+    {
+        benchLibrary(library_sizes[i]);
+    }
+    fclose(results);
+    return 0;
+}
+
+static void benchLibrary(int num_songs)
+{
+    song_id_t *ids = malloc(num_songs * sizeof(*ids));
+    if (ids == NULL)
+    {
+        fprintf(stderr, "libraryBench: Error - There was a problem allocating memory.");
+        exit(1);
+    }
+    songManager_init();
+    size_t heap_before = getHeapBytes();
+
+    double start = getTimeInNs();
+    for (int i = 0; i < num_songs; i++)
+    {
+        char artist[32];
+        char album[32];
+        char path[64];
+        char title[32];
+        snprintf(artist, sizeof(artist), "Artist %d", i % NUM_ARTISTS);
+        snprintf(album, sizeof(album), "Album %d", i % NUM_ALBUMS);
+        snprintf(path, sizeof(path), "/mnt/remote/myApps/songs/Song %d.wav", i);
+        snprintf(title, sizeof(title), "Song %d", i);
+        song_info *song = create_song_struct(artist, album, path, title);
+        ids[i] = song->id;
+        songManager_addSongBack(song);
+    }
+    report(num_songs, "add", (getTimeInNs() - start) / num_songs, "ns/op");
+    report(num_songs, "memory", (double)(getHeapBytes() - heap_before) / num_songs, "bytes/song");
+
+    start = getTimeInNs();
+    size_t found = 0;
+    songManager_readLock();
+    for (int i = 0; i < NUM_LOOKUPS; i++)
+    {
+        found += songManager_getSongAt(rand() % num_songs) != NULL;
+    }
+    songManager_readUnlock();
+    report(num_songs, "index_lookup", (getTimeInNs() - start) / NUM_LOOKUPS, "ns/op");
+
+    start = getTimeInNs();
+    songManager_readLock();
+    for (int i = 0; i < NUM_LOOKUPS; i++)
+    {
+        found += songManager_findById(ids[rand() % num_songs]) != NULL;
+    }
+    songManager_readUnlock();
+    report(num_songs, "id_lookup", (getTimeInNs() - start) / NUM_LOOKUPS, "ns/op");
+    if (found != 2 * NUM_LOOKUPS)
+    {
+        fprintf(stderr, "libraryBench: Error - %zu of %d lookups found their song.\n", found, 2 * NUM_LOOKUPS);
+        exit(1);
+    }
+
+    // every move of the cursor redraws the page of songs around it
+    songManager_reset();
+    start = getTimeInNs();
+    for (int i = 0; i < NUM_RENDERS; i++)
+    {
+        songManager_moveCursorDown();
+    }
+    report(num_songs, "page_render", (getTimeInNs() - start) / NUM_RENDERS, "ns/op");
+    songManager_reset();
+
+    start = getTimeInNs();
+    for (int i = 0; i < NUM_SKIPS; i++)
+    {
+        songManager_playNext();
+    }
+    report(num_songs, "next", (getTimeInNs() - start) / NUM_SKIPS, "ns/op");
+
+    start = getTimeInNs();
+    for (int i = 0; i < NUM_SKIPS; i++)
+    {
+        songManager_playPrevious();
+    }
+    report(num_songs, "previous", (getTimeInNs() - start) / NUM_SKIPS, "ns/op");
+
+    // random songs, deleted while one is playing like on the BeaglePod
+    int num_deletes = (num_songs < NUM_DELETES) ? num_songs : NUM_DELETES;
+    for (int i = 0; i < num_deletes; i++)
+    {
+        int other = i + rand() % (num_songs - i);
+        song_id_t id = ids[i];
+        ids[i] = ids[other];
+        ids[other] = id;
+    }
+    start = getTimeInNs();
+    for (int i = 0; i < num_deletes; i++)
+    {
+        if (!songManager_deleteSongById(ids[i]))
+        {
+            fprintf(stderr, "libraryBench: Error - Song %d was not deleted.\n", i);
+            exit(1);
+        }
+    }
+    report(num_songs, "delete_by_id", (getTimeInNs() - start) / num_deletes, "ns/op");
+
+    songManager_cleanup();
+    free(ids);
+}
+
+static void report(int num_songs, const char *metric, double value, const char *unit)
+{
+    fprintf(results, "%d,%s,%.1f,%s\n", num_songs, metric, value, unit);
+    fflush(results);
+}
+
+static double getTimeInNs(void)
+{
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return spec.tv_sec * 1e9 + spec.tv_nsec;
+}
+
+static size_t getHeapBytes(void)
+{
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+}
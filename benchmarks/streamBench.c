@@ -0,0 +1,258 @@
+/**
+ * @file streamBench.c
+ * @brief This is a source file for the network stream benchmark.
+ *
+ * This source file contains a host program that sends an RTP stream to
+ * the networkInput module over loopback, through a network it makes
+ * worse on purpose, and follows how the module plays it (see
+ * networkInput.h).
+ *
+ * The audio player is built with its file backend: it writes to /dev/null
+ * at the pace of a simulated sound card whose clock runs slow (see
+ * AUDIO_PLAYER_DRIFT_VARIABLE), while the sender's runs fast, so the
+ * module has to resample to keep its buffer where it wants it. The sender
+ * sends L16 packets of PACKET_MS, each one late by a random jitter, and
+ * drops, duplicates or swaps a few of them with the next one.
+ *
+ * The stats of the module are printed to stdout every second as
+ * "second,state,packets,lost,late,duplicates,underruns,jitter_us,
+ * target_ms,delay_ms,correction_ppm", with what the sender did as
+ * comments; everything the BeaglePod prints itself is discarded. Build and
+ * run it with "make stream".
+ *
+ * @author Amirhossein Etaati
+ * @date 2023-04-15
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "songManager.h"
+#include "audio_player.h"
+#include "lcd_4line.h"
+#include "networkInput.h"
+#include "logger.h"
+#include "trace.h"
+
+#define RUN_SECONDS 30
+// Reports kept on after the stream, until it is over
+#define IDLE_SECONDS 2
+// Drift of the clocks, the module corrects up to NETWORK_INPUT_MAX_CORRECTION_PPM
+#define SENDER_DRIFT_PPM 300
+#define CARD_DRIFT_PPM -200
+// Impairments of the network
+#define MAX_JITTER_MS 15
+#define DROP_PERCENT 1
+#define DUPLICATE_PERCENT 1
+#define SWAP_PERCENT 1
+
+#define PACKET_MS 20
+#define PACKET_FRAMES (SAMPLE_RATE * PACKET_MS / 1000)
+#define RTP_HEADER_SIZE 12
+#define RTP_PAYLOAD_TYPE 96
+#define RTP_SSRC 0x42454147
+#define PACKET_SIZE (RTP_HEADER_SIZE + PACKET_FRAMES * NUM_CHANNELS * SAMPLE_SIZE)
+
+typedef struct
+{
+    long long sent;
+    long long dropped;
+    long long duplicated;
+    long long swapped;
+} sender_stats_t;
+
+static const char *state_names[] = {"idle", "buffering", "playing"};
+
+static FILE *results = NULL;
+static pthread_t senderThreadId;
+static sender_stats_t sender_stats;
+
+// Private functions definitions
+static void *senderThread(void *arg);
+static void buildPacket(unsigned char *packet, uint16_t sequence, uint32_t timestamp);
+static void sendPacket(int fd, const struct sockaddr_in *address, const unsigned char *packet);
+static void report(int second);
+static long long getTimeInUs(void);
+static void sleepUntilUs(long long time_us);
+
+//------------------------------------------------
+////////////////// Stubbed menu //////////////////
+//------------------------------------------------
+
+song_info *MenuManager_GetCurrentSongPlaying(void)
+{
+    return songManager_getCurrentSongPlaying();
+}
+
+//------------------------------------------------
+//////////////////// Benchmark ///////////////////
+//------------------------------------------------
+
+int main(void)
+{
+    // results go to the real stdout, the BeaglePod's own output nowhere
+    results = fdopen(dup(STDOUT_FILENO), "w");
+    if (results == NULL || freopen("/dev/null", "w", stdout) == NULL)
+    {
+        fprintf(stderr, "streamBench: Error - Unable to redirect the output.\n");
+        exit(1);
+    }
+    char drift[16];
+    snprintf(drift, sizeof(drift), "%d", CARD_DRIFT_PPM);
+    setenv(AUDIO_PLAYER_DRIFT_VARIABLE, drift, 1);
+    srand(433);
+
+    logger_init();
+    trace_init();
+    songManager_init();
+    AudioPlayer_init();
+    LCD_init();
+    networkInput_init();
+
+    fprintf(results, "# sender at %+d ppm, sound card at %+d ppm\n", SENDER_DRIFT_PPM, CARD_DRIFT_PPM);
+    fprintf(results, "# packets of %d ms, up to %d ms late, %d%% dropped, %d%% duplicated, %d%% swapped\n", PACKET_MS,
+            MAX_JITTER_MS, DROP_PERCENT, DUPLICATE_PERCENT, SWAP_PERCENT);
+    fprintf(results, "second,state,packets,lost,late,duplicates,underruns,jitter_us,target_ms,delay_ms,"
+                     "correction_ppm\n");
+    long long start_us = getTimeInUs();
+    pthread_create(&senderThreadId, NULL, senderThread, &start_us);
+    for (int second = 1; second <= RUN_SECONDS + IDLE_SECONDS; second++)
+    {
+        sleepUntilUs(start_us + second * 1000000LL);
+        report(second);
+    }
+    pthread_join(senderThreadId, NULL);
+    fprintf(results, "# sender: %lld packets, %lld dropped, %lld duplicated, %lld swapped\n", sender_stats.sent,
+            sender_stats.dropped, sender_stats.duplicated, sender_stats.swapped);
+
+    networkInput_cleanup();
+    AudioPlayer_cleanup();
+    LCD_cleanup();
+    songManager_cleanup();
+    trace_cleanup();
+    logger_cleanup();
+    fclose(results);
+    return 0;
+}
+
+// Sends the stream from "arg", the time it starts at, for RUN_SECONDS
+static void *senderThread(void *arg)
+{
+    long long start_us = *(long long *)arg;
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in address = {.sin_family = AF_INET, .sin_port = htons(NETWORK_INPUT_RTP_PORT)};
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    unsigned char packet[PACKET_SIZE];
+    unsigned char held[PACKET_SIZE];
+    bool holding = false;
+    // the sender's clock makes its packets last a little less, or more, than PACKET_MS
+    double period_us = PACKET_MS * 1000.0 / (1 + SENDER_DRIFT_PPM / 1000000.0);
+    int count = RUN_SECONDS * 1000 / PACKET_MS;
+    for (int i = 0; i < count; i++)
+    {
+        // late by up to MAX_JITTER_MS, a packet whose time went by meanwhile goes right after
+        sleepUntilUs(start_us + (long long)(i * period_us) + rand() % (MAX_JITTER_MS * 1000 + 1));
+        buildPacket(packet, i, (uint32_t)i * PACKET_FRAMES);
+        int draw = rand() % 100;
+        if (draw < DROP_PERCENT)
+        {
+            sender_stats.dropped++;
+        }
+        else if (draw < DROP_PERCENT + SWAP_PERCENT && !holding)
+        {
+            // sent after the next one
+            memcpy(held, packet, sizeof(held));
+            holding = true;
+            sender_stats.swapped++;
+        }
+        else
+        {
+            sendPacket(fd, &address, packet);
+            if (draw < DROP_PERCENT + SWAP_PERCENT + DUPLICATE_PERCENT)
+            {
+                sendPacket(fd, &address, packet);
+                sender_stats.duplicated++;
+            }
+            if (holding)
+            {
+                sendPacket(fd, &address, held);
+                holding = false;
+            }
+        }
+    }
+    if (holding)
+    {
+        sendPacket(fd, &address, held);
+    }
+    close(fd);
+    return NULL;
+}
+
+// Fills "packet" with the RTP packet "sequence", a square wave from "timestamp"
+static void buildPacket(unsigned char *packet, uint16_t sequence, uint32_t timestamp)
+{
+    packet[0] = 0x80; // version 2, no padding, no extension, no CSRC
+    packet[1] = RTP_PAYLOAD_TYPE | ((sequence == 0) ? 0x80 : 0);
+    packet[2] = sequence >> 8;
+    packet[3] = sequence & 0xFF;
+    for (int i = 0; i < 4; i++)
+    {
+        packet[4 + i] = timestamp >> (24 - 8 * i);
+        packet[8 + i] = RTP_SSRC >> (24 - 8 * i);
+    }
+
+    // L16 is big endian
+    int period = SAMPLE_RATE / 440;
+    unsigned char *payload = packet + RTP_HEADER_SIZE;
+    for (int frame = 0; frame < PACKET_FRAMES; frame++)
+    {
+        short value = (((timestamp + frame) % period) < period / 2) ? 4000 : -4000;
+        for (int channel = 0; channel < NUM_CHANNELS; channel++)
+        {
+            *payload++ = (unsigned short)value >> 8;
+            *payload++ = value & 0xFF;
+        }
+    }
+}
+
+static void sendPacket(int fd, const struct sockaddr_in *address, const unsigned char *packet)
+{
+    if (sendto(fd, packet, PACKET_SIZE, 0, (const struct sockaddr *)address, sizeof(*address)) < 0)
+    {
+        fprintf(stderr, "streamBench: Error - Unable to send a packet.\n");
+    }
+    sender_stats.sent++;
+}
+
+// Prints the stats of the module at "second"
+static void report(int second)
+{
+    networkInput_stats_t stats;
+    networkInput_getStats(&stats);
+    fprintf(results, "%d,%s,%lld,%lld,%lld,%lld,%lld,%d,%d,%d,%d\n", second, state_names[stats.state], stats.packets,
+            stats.lost, stats.late, stats.duplicates, stats.underruns, stats.jitter_us, stats.target_ms,
+            stats.delay_ms, stats.correction_ppm);
+}
+
+static long long getTimeInUs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+static void sleepUntilUs(long long time_us)
+{
+    struct timespec until = {.tv_sec = time_us / 1000000, .tv_nsec = (time_us % 1000000) * 1000};
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL);
+}
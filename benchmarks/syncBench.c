@@ -0,0 +1,491 @@
+/**
+ * @file syncBench.c
+ * @brief This is a source file for the room sync benchmark.
+ *
+ * This source file contains a host program that runs a leader and a
+ * follower BeaglePod in two processes and measures how far apart they
+ * play, as the roomSync module keeps them together (see roomSync.h).
+ *
+ * Each process runs the library, the audio player and roomSync, the audio
+ * player built with its file backend: it writes to /dev/null at the pace
+ * of a simulated sound card whose clock drifts by a different amount in
+ * each process (see AUDIO_PLAYER_DRIFT_VARIABLE). The follower follows
+ * the leader over loopback on ROOM_SYNC_DEFAULT_PORT. A few long WAV
+ * files are generated for them to play, at the same paths for both. The
+ * leader plays the first song, jumps ahead in it, then plays another.
+ *
+ * Both processes report the sample their audio player says was heard and
+ * when (see AudioPlayer_getPosition()); on one host they share
+ * CLOCK_MONOTONIC, so the leader's sample at the time of each report of
+ * the follower gives how far ahead of it the follower is. Every second is
+ * printed to stdout as "second,mean_error_us,max_error_us", the second of
+ * the jump including the reports until the follower jumped too, with the
+ * events and the stats of the follower as comments; everything the
+ * BeaglePods print themselves is discarded. Build and run it with
+ * "make sync".
+ *
+ * @author Amirhossein Etaati
+ * @date 2023-04-16
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/wait.h>
+
+#include "songManager.h"
+#include "audio_player.h"
+#include "lcd_4line.h"
+#include "roomSync.h"
+#include "metrics.h"
+#include "logger.h"
+#include "trace.h"
+
+#define NUM_SONGS 2
+#define SONG_SECONDS 60
+#define RUN_SECONDS 40
+// Scripted moves of the leader
+#define JUMP_AT_S 15
+#define JUMP_S 30
+#define SONG_CHANGE_AT_S 25
+// Drift of the simulated sound cards, the follower corrects up to ROOM_SYNC_MAX_CORRECTION_PPM
+#define LEADER_DRIFT_PPM 150
+#define FOLLOWER_DRIFT_PPM -350
+// Time between two checks of the position heard, shorter than a period of the audio player
+#define REPORT_MS 5
+// Longest gap between two reports of the leader the follower is compared over
+#define MAX_GAP_US 100000
+
+#define SAMPLES_PER_US (SAMPLE_RATE * NUM_CHANNELS / 1000000.0)
+
+typedef enum
+{
+    REPORT_POSITION,
+    REPORT_STATS // followed by the roomSync_stats_t of the follower, last of its reports
+} report_type_t;
+
+// What a BeaglePod heard, sent to the benchmark through a pipe
+typedef struct
+{
+    report_type_t type;
+    int song; // index of the song heard, -1 for none
+    long long time_us;
+    long long location;
+} report_t;
+
+typedef struct
+{
+    report_t *reports;
+    int count;
+    int capacity;
+    roomSync_stats_t stats;
+    bool has_stats;
+} series_t;
+
+static FILE *results = NULL;
+static char songs_directory[] = "/tmp/syncBench.XXXXXX";
+
+// Private functions definitions
+static void writeSongs(void);
+static void removeSongs(void);
+static pid_t startPod(bool leader, int *fd);
+static void runPod(bool leader, int fd);
+static void reportPosition(int fd, long long *last_us);
+static void readReports(int fd, series_t *series, bool *open);
+static void compare(const series_t *leader, const series_t *follower);
+static void songPath(int song, char *path, size_t size);
+static long long getTimeInUs(void);
+static void sleepMs(long long ms);
+
+//------------------------------------------------
+////////////////// Stubbed menu //////////////////
+//------------------------------------------------
+
+song_info *MenuManager_GetCurrentSongPlaying(void)
+{
+    return songManager_getCurrentSongPlaying();
+}
+
+//------------------------------------------------
+//////////////////// Benchmark ///////////////////
+//------------------------------------------------
+
+int main(void)
+{
+    results = stdout;
+    writeSongs();
+    fflush(results);
+
+    // forked before any thread is started
+    int fds[2];
+    pid_t pids[2];
+    pids[0] = startPod(true, &fds[0]);
+    pids[1] = startPod(false, &fds[1]);
+
+    series_t series[2];
+    memset(series, 0, sizeof(series));
+    bool open[2] = {true, true};
+    while (open[0] || open[1])
+    {
+        struct pollfd polled[2];
+        for (int i = 0; i < 2; i++)
+        {
+            polled[i] = (struct pollfd){.fd = open[i] ? fds[i] : -1, .events = POLLIN};
+        }
+        poll(polled, 2, -1);
+        for (int i = 0; i < 2; i++)
+        {
+            if (polled[i].revents != 0)
+            {
+                readReports(fds[i], &series[i], &open[i]);
+            }
+        }
+    }
+    for (int i = 0; i < 2; i++)
+    {
+        close(fds[i]);
+        waitpid(pids[i], NULL, 0);
+    }
+
+    fprintf(results, "# leader at %+d ppm, follower at %+d ppm\n", LEADER_DRIFT_PPM, FOLLOWER_DRIFT_PPM);
+    fprintf(results, "# %d s: the leader jumps %d s ahead, %d s: the leader plays another song\n", JUMP_AT_S, JUMP_S,
+            SONG_CHANGE_AT_S);
+    fprintf(results, "second,mean_error_us,max_error_us\n");
+    compare(&series[0], &series[1]);
+    if (series[1].has_stats)
+    {
+        const roomSync_stats_t *stats = &series[1].stats;
+        fprintf(results, "# follower: %lld requests, %lld replies, %lld seeks, %lld song changes, %lld missing\n",
+                stats->requests, stats->replies, stats->seeks, stats->song_changes, stats->missing);
+        fprintf(results, "# follower: error %d us, correction %+d ppm, rtt %d us\n", stats->error_us,
+                stats->correction_ppm, stats->rtt_us);
+    }
+
+    for (int i = 0; i < 2; i++)
+    {
+        free(series[i].reports);
+    }
+    removeSongs();
+    return 0;
+}
+
+// Starts a BeaglePod in a new process, whose reports are read from "fd"
+static pid_t startPod(bool leader, int *fd)
+{
+    int pipe_fds[2];
+    if (pipe(pipe_fds) != 0)
+    {
+        fprintf(stderr, "syncBench: Error - Unable to create a pipe.\n");
+        exit(1);
+    }
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        fprintf(stderr, "syncBench: Error - Unable to start a process.\n");
+        exit(1);
+    }
+    if (pid == 0)
+    {
+        close(pipe_fds[0]);
+        runPod(leader, pipe_fds[1]);
+        exit(0);
+    }
+    close(pipe_fds[1]);
+    *fd = pipe_fds[0];
+    return pid;
+}
+
+// Runs a BeaglePod for RUN_SECONDS, reporting what it hears into "fd"
+static void runPod(bool leader, int fd)
+{
+    if (freopen("/dev/null", "w", stdout) == NULL)
+    {
+        fprintf(stderr, "syncBench: Error - Unable to redirect the output.\n");
+        exit(1);
+    }
+    char drift[16];
+    snprintf(drift, sizeof(drift), "%d", leader ? LEADER_DRIFT_PPM : FOLLOWER_DRIFT_PPM);
+    setenv(AUDIO_PLAYER_DRIFT_VARIABLE, drift, 1);
+
+    logger_init();
+    trace_init();
+    songManager_init();
+    for (int i = 0; i < NUM_SONGS; i++)
+    {
+        char path[64];
+        char title[32];
+        songPath(i, path, sizeof(path));
+        snprintf(title, sizeof(title), "Song %d", i);
+        songManager_addSongBack(create_song_struct("Artist", "Album", path, title));
+    }
+    AudioPlayer_init();
+    LCD_init();
+    roomSync_init();
+
+    char path[64];
+    if (leader)
+    {
+        roomSync_lead(ROOM_SYNC_DEFAULT_PORT);
+        songPath(0, path, sizeof(path));
+        songManager_playPathAt(path, 0);
+    }
+    else
+    {
+        roomSync_follow("127.0.0.1", ROOM_SYNC_DEFAULT_PORT);
+    }
+
+    long long start_us = getTimeInUs();
+    long long last_us = 0;
+    bool jumped = false;
+    bool changed = false;
+    for (long long now = start_us; now - start_us < RUN_SECONDS * 1000000LL; now = getTimeInUs())
+    {
+        reportPosition(fd, &last_us);
+        if (leader && !jumped && now - start_us >= JUMP_AT_S * 1000000LL)
+        {
+            AudioPlayer_position_t position;
+            AudioPlayer_getPosition(&position);
+            songPath(0, path, sizeof(path));
+            songManager_playPathAt(path, position.location + JUMP_S * SAMPLE_RATE * NUM_CHANNELS);
+            jumped = true;
+        }
+        if (leader && !changed && now - start_us >= SONG_CHANGE_AT_S * 1000000LL)
+        {
+            songPath(1, path, sizeof(path));
+            songManager_playPathAt(path, 0);
+            changed = true;
+        }
+        sleepMs(REPORT_MS);
+    }
+
+    if (!leader)
+    {
+        report_t report = {.type = REPORT_STATS};
+        roomSync_stats_t stats;
+        roomSync_getStats(&stats);
+        if (write(fd, &report, sizeof(report)) != sizeof(report) || write(fd, &stats, sizeof(stats)) != sizeof(stats))
+        {
+            fprintf(stderr, "syncBench: Error - Unable to report the stats.\n");
+        }
+    }
+    close(fd);
+
+    roomSync_cleanup();
+    AudioPlayer_cleanup();
+    LCD_cleanup();
+    songManager_cleanup();
+    trace_cleanup();
+    logger_cleanup();
+}
+
+// Reports the position heard into "fd" if the audio player measured it again since "last_us"
+static void reportPosition(int fd, long long *last_us)
+{
+    AudioPlayer_position_t position;
+    AudioPlayer_getPosition(&position);
+    if (position.time_us == *last_us)
+    {
+        return;
+    }
+    *last_us = position.time_us;
+
+    report_t report = {.type = REPORT_POSITION, .song = -1, .time_us = position.time_us, .location = position.location};
+    song_info *song = songManager_getCurrentSongPlaying();
+    if (song != NULL)
+    {
+        for (int i = 0; i < NUM_SONGS && position.pSound == song->pSong_DWave; i++)
+        {
+            char path[64];
+            songPath(i, path, sizeof(path));
+            if (strcmp(song->song_path, path) == 0)
+            {
+                report.song = i;
+            }
+        }
+        songManager_releaseSong(song);
+    }
+    if (write(fd, &report, sizeof(report)) != sizeof(report))
+    {
+        fprintf(stderr, "syncBench: Error - Unable to report the position.\n");
+    }
+}
+
+// Appends the reports waiting in "fd" to "series", clears "open" at its end
+static void readReports(int fd, series_t *series, bool *open)
+{
+    report_t report;
+    ssize_t size = read(fd, &report, sizeof(report));
+    if (size != sizeof(report))
+    {
+        *open = false;
+        return;
+    }
+    if (report.type == REPORT_STATS)
+    {
+        series->has_stats = read(fd, &series->stats, sizeof(series->stats)) == sizeof(series->stats);
+        return;
+    }
+    if (series->count == series->capacity)
+    {
+        series->capacity = series->capacity ? 2 * series->capacity : 1024;
+        series->reports = realloc(series->reports, series->capacity * sizeof(*series->reports));
+        if (series->reports == NULL)
+        {
+            fprintf(stderr, "syncBench: Error - There was a problem allocating memory.");
+            exit(1);
+        }
+    }
+    series->reports[series->count++] = report;
+}
+
+// Prints how far ahead of the leader the follower was, for each second both heard the same song
+static void compare(const series_t *leader, const series_t *follower)
+{
+    if (leader->count == 0)
+    {
+        return;
+    }
+    long long start_us = leader->reports[0].time_us;
+    int second = -1;
+    double sum_us = 0;
+    double max_us = 0;
+    int count = 0;
+    int next = 1;
+    for (int i = 0; i < follower->count; i++)
+    {
+        const report_t *heard = &follower->reports[i];
+        while (next < leader->count && leader->reports[next].time_us < heard->time_us)
+        {
+            next++;
+        }
+        int report_second = (heard->time_us - start_us) / 1000000;
+        if (report_second != second)
+        {
+            if (count > 0)
+            {
+                fprintf(results, "%d,%.0f,%.0f\n", second, sum_us / count, max_us);
+            }
+            second = report_second;
+            sum_us = max_us = 0;
+            count = 0;
+        }
+        if (next == leader->count || heard->song < 0)
+        {
+            continue;
+        }
+        // the leader's sample at the time of the follower's, between the reports around it
+        const report_t *before = &leader->reports[next - 1];
+        const report_t *after = &leader->reports[next];
+        if (before->song != heard->song || after->song != heard->song || after->time_us - before->time_us > MAX_GAP_US ||
+            after->location < before->location)
+        {
+            continue;
+        }
+        double location = before->location + (double)(after->location - before->location) *
+                                                  (heard->time_us - before->time_us) /
+                                                  (after->time_us - before->time_us);
+        double error_us = (heard->location - location) / SAMPLES_PER_US;
+        sum_us += error_us;
+        max_us = (error_us > max_us || -error_us > max_us) ? ((error_us > 0) ? error_us : -error_us) : max_us;
+        count++;
+    }
+    if (count > 0)
+    {
+        fprintf(results, "%d,%.0f,%.0f\n", second, sum_us / count, max_us);
+    }
+}
+
+// Writes NUM_SONGS WAV files of SONG_SECONDS of a tone into songs_directory
+static void writeSongs(void)
+{
+    if (mkdtemp(songs_directory) == NULL)
+    {
+        fprintf(stderr, "syncBench: Error - Unable to create %s.\n", songs_directory);
+        exit(1);
+    }
+    uint32_t data_size = SONG_SECONDS * SAMPLE_RATE * NUM_CHANNELS * SAMPLE_SIZE;
+    short *samples = malloc(data_size);
+    if (samples == NULL)
+    {
+        fprintf(stderr, "syncBench: Error - There was a problem allocating memory.");
+        exit(1);
+    }
+    for (int i = 0; i < NUM_SONGS; i++)
+    {
+        // a square wave, a different pitch for each song
+        int period = SAMPLE_RATE / (220 * (i + 1));
+        for (int frame = 0; frame < SONG_SECONDS * SAMPLE_RATE; frame++)
+        {
+            short value = ((frame % period) < period / 2) ? 4000 : -4000;
+            samples[frame * NUM_CHANNELS] = value;
+            samples[frame * NUM_CHANNELS + 1] = value;
+        }
+
+        // the canonical 44 byte header, little endian like the host
+        uint32_t byte_rate = SAMPLE_RATE * NUM_CHANNELS * SAMPLE_SIZE;
+        uint32_t riff_size = 36 + data_size;
+        uint32_t format_size = 16;
+        uint16_t format = 1;
+        uint16_t channels = NUM_CHANNELS;
+        uint32_t rate = SAMPLE_RATE;
+        uint16_t block_align = NUM_CHANNELS * SAMPLE_SIZE;
+        uint16_t bits = 8 * SAMPLE_SIZE;
+        char path[64];
+        songPath(i, path, sizeof(path));
+        FILE *file = fopen(path, "wb");
+        if (file == NULL)
+        {
+            fprintf(stderr, "syncBench: Error - Unable to write %s.\n", path);
+            exit(1);
+        }
+        fwrite("RIFF", 1, 4, file);
+        fwrite(&riff_size, 4, 1, file);
+        fwrite("WAVEfmt ", 1, 8, file);
+        fwrite(&format_size, 4, 1, file);
+        fwrite(&format, 2, 1, file);
+        fwrite(&channels, 2, 1, file);
+        fwrite(&rate, 4, 1, file);
+        fwrite(&byte_rate, 4, 1, file);
+        fwrite(&block_align, 2, 1, file);
+        fwrite(&bits, 2, 1, file);
+        fwrite("data", 1, 4, file);
+        fwrite(&data_size, 4, 1, file);
+        fwrite(samples, 1, data_size, file);
+        fclose(file);
+    }
+    free(samples);
+}
+
+static void removeSongs(void)
+{
+    for (int i = 0; i < NUM_SONGS; i++)
+    {
+        char path[64];
+        songPath(i, path, sizeof(path));
+        unlink(path);
+    }
+    rmdir(songs_directory);
+}
+
+static void songPath(int song, char *path, size_t size)
+{
+    snprintf(path, size, "%s/Song %d.wav", songs_directory, song);
+}
+
+static long long getTimeInUs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+static void sleepMs(long long ms)
+{
+    struct timespec delay = {.tv_sec = ms / 1000, .tv_nsec = (ms % 1000) * 1000000};
+    nanosleep(&delay, NULL);
+}
@@ -11,7 +11,15 @@
  */
 
 #include <time.h>
+#if !defined(AUDIO_PLAYER_FILE_BACKEND)
 #include <alsa/asoundlib.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <stdbool.h>
 #include <pthread.h>
 #include <limits.h>
@@ -21,18 +29,62 @@
 
 #include "songManager.h"
 #include "audio_player.h"
+#include "metrics.h"
+#include "logger.h"
+#include "trace.h"
+#include "latency.h"
+
+// The PCM data in a wave file starts after the header:
+#define PCM_DATA_OFFSET 44
+// Samples read before AudioPlayer_readWaveFileFrom() returns (2 seconds)
+#define PREBUFFER_SAMPLES (2 * SAMPLE_RATE * NUM_CHANNELS)
+// Samples the background reader makes available at a time (1/4 second)
+#define LOADER_CHUNK_SAMPLES (SAMPLE_RATE * NUM_CHANNELS / 4)
+// Audio written ahead of the sound card, asked of ALSA and kept by the file backend
+#define PCM_BUFFER_US 50000
 
 // Global Variables
+#if defined(AUDIO_PLAYER_FILE_BACKEND)
+static int pcmFd = -1;
+static double pcmEnd_us = 0; // when the samples written so far are all played
+static double pcmRate = SAMPLE_RATE; // frames the simulated sound card plays per second
+#else
 static snd_pcm_t *handle;
+#endif
 static unsigned long playbackBufferSize = 0;
 static short *playbackBuffer = NULL;
 static int volume = 0;
 
+// Metrics, see metrics.h
+static const long long fill_bounds_us[] = {25, 50, 100, 250, 500, 1000, 2500, 5000, 10000};
+static metrics_counter_t periods_metric;
+static metrics_counter_t recovered_metric;
+static metrics_counter_t short_writes_metric;
+static metrics_histogram_t fill_metric;
+static metrics_gauge_t delay_metric;
+static metrics_gauge_t rate_correction_metric;
+static metrics_gauge_t volume_metric;
+
 // Private functions definitions
+#if !defined(AUDIO_PLAYER_FILE_BACKEND)
 static int runCommand(char *command);
-static void *playbackThread(void *arg);
 static int getSinkIndexes(int *sink_indexes);
+#endif
+static void *playbackThread(void *arg);
 static void fillPlaybackBuffer(short *buff, int size);
+static FILE *openWaveFile(char *fileName, wavedata_t *pSound);
+static void readSamples(FILE *file, char *fileName, short *dest, int numSamples);
+static void *loaderThread(void *arg);
+static void stopLoader(void);
+static bool isLoaded(wavedata_t *pSound, int location);
+static int resampleSound(short *buff, int size, const short *source, int available, int ppm);
+static void recordPosition(void);
+static long long getTimeInUs(void);
+static void openPcm(const char *device);
+static long writePcm(const short *buffer, long frames);
+static long recoverPcm(long error);
+static long getPcmDelay(void);
+static void closePcm(void);
 
 typedef struct
 {
@@ -51,6 +103,27 @@ static pthread_t playbackThreadId;
 static pthread_mutex_t audioMutex = PTHREAD_MUTEX_INITIALIZER;
 static playbackSong_t current_sound;
 static bool SONG_PLAYED = false;
+static AudioPlayer_source_t inputSource = NULL;
+static AudioPlayer_sink_t outputSink = NULL;
+static int rateCorrectionPpm = 0;
+static double resamplePhase = 0; // between the frame at current_sound.location and the next one
+static AudioPlayer_position_t heardPosition;
+
+// What the last playback buffer was filled with, used by the playback thread only
+static wavedata_t *writtenSound = NULL;
+static int writtenLocation = 0;
+// The action that asked for current_sound, until its first samples are filled (see latency.h)
+static latency_token_t requestedLatency;
+// The action whose first samples are in the playback buffer, used by the playback thread only
+static latency_token_t filledLatency;
+
+// Background reading started by AudioPlayer_readWaveFileFrom()
+static pthread_mutex_t loaderMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t loaderThreadId;
+static wavedata_t *loadingSound = NULL;
+static FILE *loadingFile = NULL;
+static char loadingFileName[PATH_MAX];
+static bool stoppingLoader = false;
 
 //------------------------------------------------
 //////////////// Public Functions ////////////////
@@ -62,36 +135,31 @@ void AudioPlayer_init(void)
 	AudioPlayer_setVolume(DEFAULT_VOLUME);
 
 	// Open the PCM output
-	int err = snd_pcm_open(&handle, "default", SND_PCM_STREAM_PLAYBACK, 0);
-	if (err < 0)
+	const char *device = getenv(AUDIO_PLAYER_DEVICE_VARIABLE);
+	if (device == NULL || device[0] == '\0')
 	{
-		printf("Playback open error: %s\n", snd_strerror(err));
-		exit(EXIT_FAILURE);
+		device = AUDIO_PLAYER_DEFAULT_DEVICE;
 	}
+	openPcm(device);
 
-	// Configure parameters of PCM output
-	err = snd_pcm_set_params(handle,
-							 SND_PCM_FORMAT_S16_LE,
-							 SND_PCM_ACCESS_RW_INTERLEAVED,
-							 NUM_CHANNELS,
-							 SAMPLE_RATE,
-							 1,		 // Allow software resampling
-							 50000); // 0.05 seconds per buffer
-	if (err < 0)
-	{
-		printf("Playback open error: %s\n", snd_strerror(err));
-		exit(EXIT_FAILURE);
-	}
-
-	// Allocate this software's playback buffer to be the same size as the
-	// the hardware's playback buffers for efficient data transfers.
-	// ..get info on the hardware buffers:
-	unsigned long unusedBufferSize = 0;
-	snd_pcm_get_params(handle, &unusedBufferSize, &playbackBufferSize);
-	playbackBufferSize = playbackBufferSize;
 	// ..allocate playback buffer:
 	playbackBuffer = malloc(playbackBufferSize * sizeof(*playbackBuffer));
 
+	metrics_registerCounter(&periods_metric, "beaglepod_audio_periods_total", NULL,
+							"Playback buffers written to the sound card");
+	metrics_registerCounter(&recovered_metric, "beaglepod_audio_recovered_total", NULL,
+							"Failed writes to the sound card recovered from, mostly underruns");
+	metrics_registerCounter(&short_writes_metric, "beaglepod_audio_short_writes_total", NULL,
+							"Playback buffers the sound card took only part of");
+	metrics_registerHistogram(&fill_metric, "beaglepod_audio_fill_seconds", NULL,
+							  "Time taken to fill a playback buffer", fill_bounds_us,
+							  sizeof(fill_bounds_us) / sizeof(fill_bounds_us[0]));
+	metrics_registerGauge(&delay_metric, "beaglepod_audio_delay_frames", NULL,
+						  "Frames written to the sound card and not heard yet");
+	metrics_registerGauge(&rate_correction_metric, "beaglepod_audio_rate_correction_ppm", NULL,
+						  "Playback speed change, see AudioPlayer_setRateCorrection()");
+	metrics_registerGauge(&volume_metric, "beaglepod_audio_volume_percent", NULL, "Volume of the sound card");
+
 	// Launch playback thread:
 	pthread_create(&playbackThreadId, NULL, playbackThread, NULL);
 }
@@ -103,67 +171,89 @@ void AudioPlayer_readWaveFileIntoMemory(char *fileName, wavedata_t *pSound)
 	assert(pSound);
 	pthread_mutex_lock(&audioMutex);
 	{
-		// The PCM data in a wave file starts after the header:
-		const int PCM_DATA_OFFSET = 44;
-
-		// Open the wave file
-		FILE *file = fopen(fileName, "r");
-		if (file == NULL)
-		{
-			fprintf(stderr, "ERROR: Unable to open file <%s>.\n", fileName);
-			exit(EXIT_FAILURE);
-		}
-		printf("getting file size\n");
-		// Get file size
-		fseek(file, 0, SEEK_END);
-		int sizeInBytes = ftell(file) - PCM_DATA_OFFSET;
-		pSound->numSamples = sizeInBytes / (SAMPLE_SIZE);
-
-		// Search to the start of the data in the file
-		fseek(file, PCM_DATA_OFFSET, SEEK_SET);
-
-		// Allocate space to hold all PCM data
-		pSound->pData = malloc(sizeInBytes);
-		if (pSound->pData == 0)
-		{
-			fprintf(stderr, "ERROR: Unable to allocate %d bytes for file %s.\n",
-					sizeInBytes, fileName);
-			exit(EXIT_FAILURE);
-		}
-		printf("begin reading file\n");
+		FILE *file = openWaveFile(fileName, pSound);
+		LOG_DEBUG("begin reading file");
 		clock_t begin = clock();
 		// Read PCM data from wave file into memory
-		int samplesRead = fread(pSound->pData, SAMPLE_SIZE, pSound->numSamples, file);
-		if (samplesRead != pSound->numSamples)
-		{
-			fprintf(stderr, "ERROR: Unable to read %d samples from file %s (read %d).\n",
-					pSound->numSamples, fileName, samplesRead);
-			exit(EXIT_FAILURE);
-		}
+		readSamples(file, fileName, pSound->pData, pSound->numSamples);
+		pSound->firstLoaded = 0;
+		pSound->endLoaded = pSound->numSamples;
 		clock_t end = clock();
-		printf("finished reading, it took: %fs\n", (double)(end - begin) / CLOCKS_PER_SEC);
+		LOG_DEBUG("finished reading, it took: %fs", (double)(end - begin) / CLOCKS_PER_SEC);
 		fclose(file);
 	}
 	pthread_mutex_unlock(&audioMutex);
 }
 
+void AudioPlayer_readWaveFileFrom(char *fileName, wavedata_t *pSound, int firstSample)
+{
+	assert(pSound);
+	trace_begin("AudioPlayer_readWaveFileFrom");
+	pthread_mutex_lock(&loaderMutex);
+	stopLoader();
+
+	FILE *file = openWaveFile(fileName, pSound);
+	// start on a whole frame, from the start if the song was already over
+	firstSample -= firstSample % NUM_CHANNELS;
+	if (firstSample < 0 || firstSample >= pSound->numSamples)
+	{
+		firstSample = 0;
+	}
+	int prebuffered = pSound->numSamples - firstSample;
+	if (prebuffered > PREBUFFER_SAMPLES)
+	{
+		prebuffered = PREBUFFER_SAMPLES;
+	}
+	fseek(file, PCM_DATA_OFFSET + (long)firstSample * SAMPLE_SIZE, SEEK_SET);
+	readSamples(file, fileName, pSound->pData + firstSample, prebuffered);
+	pSound->firstLoaded = firstSample;
+	pSound->endLoaded = firstSample + prebuffered;
+
+	// the loader goes on from there to the end, then reads the part before firstSample
+	loadingSound = pSound;
+	loadingFile = file;
+	snprintf(loadingFileName, sizeof(loadingFileName), "%s", fileName);
+	stoppingLoader = false;
+	pthread_create(&loaderThreadId, NULL, loaderThread, NULL);
+	pthread_mutex_unlock(&loaderMutex);
+	trace_end("AudioPlayer_readWaveFileFrom");
+}
+
 void AudioPlayer_freeWaveFileData(wavedata_t *pSound)
 {
+	pthread_mutex_lock(&loaderMutex);
+	if (pSound == loadingSound)
+	{
+		stopLoader();
+	}
+	pthread_mutex_unlock(&loaderMutex);
 	pSound->numSamples = 0;
 	free(pSound->pData);
 	pSound->pData = NULL;
 }
 
 void AudioPlayer_playWAV(wavedata_t *pSound)
+{
+	AudioPlayer_playWAVAt(pSound, 0);
+}
+
+void AudioPlayer_playWAVAt(wavedata_t *pSound, int location)
 {
 	// Ensure we are only being asked to play "good" sounds:
 	assert(pSound->numSamples > 0);
 	assert(pSound->pData);
+	location -= location % NUM_CHANNELS;
+	if (location < 0 || location >= pSound->numSamples)
+	{
+		location = 0;
+	}
 	pthread_mutex_lock(&audioMutex);
 	{
 		// sample to list of sound bites
 		current_sound.pSound = pSound;
-		current_sound.location = 0;
+		current_sound.location = location;
+		resamplePhase = 0;
+		requestedLatency = latency_getAction();
 		pthread_mutex_unlock(&audioMutex);
 		return;
 	}
@@ -172,6 +262,45 @@ void AudioPlayer_playWAV(wavedata_t *pSound)
 	fprintf(stderr, "Failed to update current song\n");
 }
 
+int AudioPlayer_getLocation(wavedata_t *pSound)
+{
+	pthread_mutex_lock(&audioMutex);
+	int location = (current_sound.pSound == pSound) ? current_sound.location : -1;
+	pthread_mutex_unlock(&audioMutex);
+	return location;
+}
+
+void AudioPlayer_getPosition(AudioPlayer_position_t *position)
+{
+	pthread_mutex_lock(&audioMutex);
+	*position = heardPosition;
+	pthread_mutex_unlock(&audioMutex);
+}
+
+void AudioPlayer_setRateCorrection(int ppm)
+{
+	if (ppm > AUDIO_PLAYER_MAX_RATE_PPM)
+	{
+		ppm = AUDIO_PLAYER_MAX_RATE_PPM;
+	}
+	else if (ppm < -AUDIO_PLAYER_MAX_RATE_PPM)
+	{
+		ppm = -AUDIO_PLAYER_MAX_RATE_PPM;
+	}
+	__atomic_store_n(&rateCorrectionPpm, ppm, __ATOMIC_RELAXED);
+	metrics_set(&rate_correction_metric, ppm);
+}
+
+void AudioPlayer_setSource(AudioPlayer_source_t source)
+{
+	__atomic_store_n(&inputSource, source, __ATOMIC_RELEASE);
+}
+
+void AudioPlayer_setSink(AudioPlayer_sink_t sink)
+{
+	__atomic_store_n(&outputSink, sink, __ATOMIC_RELEASE);
+}
+
 void AudioPlayer_cleanup(void)
 {
 	printf("Stopping audio...\n");
@@ -179,10 +308,12 @@ void AudioPlayer_cleanup(void)
 	// Stop the PCM generation thread
 	stopping = true;
 	pthread_join(playbackThreadId, NULL);
+	pthread_mutex_lock(&loaderMutex);
+	stopLoader();
+	pthread_mutex_unlock(&loaderMutex);
 
 	// Shutdown the PCM output, allowing any pending sound to play out (drain)
-	snd_pcm_drain(handle);
-	snd_pcm_close(handle);
+	closePcm();
 
 	// Free playback buffer
 	// (note that any wave files read into wavedata_t records must be freed
@@ -205,6 +336,7 @@ int AudioPlayer_getVolume()
 void AudioPlayer_setVolume(double newVolume)
 {
 	// pthread_mutex_lock(&audioMutex);
+#if !defined(AUDIO_PLAYER_FILE_BACKEND)
 	{
 		int *sinks = malloc(2 * sizeof(int));
 		int valid = getSinkIndexes(sinks);
@@ -219,13 +351,15 @@ void AudioPlayer_setVolume(double newVolume)
 		command = strcat(strcat(strcat(command, tmp), sink_index), vol);
 
 		runCommand(command);
-		volume = (int)(newVolume * 100);
 
 		free(sinks);
 		sinks = NULL;
 		free(command);
 		command = NULL;
 	}
+#endif
+	volume = (int)(newVolume * 100);
+	metrics_set(&volume_metric, volume);
 	// pthread_mutex_unlock(&audioMutex);
 }
 
@@ -233,6 +367,7 @@ void AudioPlayer_setVolume(double newVolume)
 /////////////// Private Functions ////////////////
 //------------------------------------------------
 
+#if !defined(AUDIO_PLAYER_FILE_BACKEND)
 static int runCommand(char *command)
 {
 	FILE *pipe = popen(command, "r");
@@ -279,6 +414,7 @@ static int getSinkIndexes(int *sink_indexes)
 
 	return (valid);
 }
+#endif
 
 // Fill the `buff` array with new PCM values to output.
 //    `buff`: buffer to fill with new PCM data from sound bites.
@@ -287,28 +423,47 @@ static void fillPlaybackBuffer(short *buff, int size)
 {
 	// discard old pcm data
 	memset(buff, 0, size * SAMPLE_SIZE);
+	writtenSound = NULL;
+	filledLatency.action = NULL;
+
+	AudioPlayer_source_t source = __atomic_load_n(&inputSource, __ATOMIC_ACQUIRE);
+	if (source != NULL && source(buff, size))
+	{
+		return;
+	}
 
 	pthread_mutex_lock(&audioMutex);
 	{
 
 		wavedata_t *sound_data = current_sound.pSound;
-		if (sound_data != NULL && (sound_data->numSamples - current_sound.location) > 0)
+		if (sound_data != NULL && current_sound.location < sound_data->numSamples &&
+			!isLoaded(sound_data, current_sound.location))
 		{
-			printf("sound not null\n");
+			// the file is still being read up to here: silence until it is
+		}
+		else if (sound_data != NULL && (sound_data->numSamples - current_sound.location) > 0)
+		{
+			LOG_TRACE("sound not null");
 			SONG_PLAYED = true;
-			// copy into playback buff
-			int total_samples = sound_data->numSamples;
+			// copy into playback buff, as far as the file was read
+			int total_samples = __atomic_load_n(&sound_data->endLoaded, __ATOMIC_ACQUIRE);
 			int location = current_sound.location;
 			int samples_left = (total_samples - location);
 			short *start_copy = sound_data->pData + location;
 			short left_val, right_val;
+			int ppm = __atomic_load_n(&rateCorrectionPpm, __ATOMIC_RELAXED);
 
-			if (samples_left > size)
+			if (ppm != 0)
+			{
+				// played a little faster or slower, see AudioPlayer_setRateCorrection()
+				samples_left = resampleSound(buff, size, start_copy, samples_left, ppm);
+			}
+			else if (samples_left > size)
 			{
 				samples_left = size;
 			}
 
-			for (int i = 0; i < samples_left - 1; i += NUM_CHANNELS)
+			for (int i = 0; ppm == 0 && i < samples_left - 1; i += NUM_CHANNELS)
 			{
 
 				// get left sample
@@ -342,33 +497,191 @@ static void fillPlaybackBuffer(short *buff, int size)
 				*(buff + i + 1) = right_val;
 			}
 			current_sound.location += samples_left;
+			writtenSound = sound_data;
+			writtenLocation = current_sound.location;
+			filledLatency = requestedLatency;
+			requestedLatency.action = NULL;
 		}
 		else if (SONG_PLAYED)
 		{
+			// song finished: ask for the next one only once, it may be the end of the play order
+			SONG_PLAYED = false;
 			pthread_mutex_unlock(&audioMutex);
 			songManager_AutoPlayNext();
+			pthread_mutex_lock(&audioMutex);
+		}
+	}
+	pthread_mutex_unlock(&audioMutex);
+}
+
+// Opens "fileName", sizes pSound for its samples and leaves the file at the first one
+static FILE *openWaveFile(char *fileName, wavedata_t *pSound)
+{
+	// Open the wave file
+	FILE *file = fopen(fileName, "r");
+	if (file == NULL)
+	{
+		fprintf(stderr, "ERROR: Unable to open file <%s>.\n", fileName);
+		exit(EXIT_FAILURE);
+	}
+	LOG_DEBUG("getting file size");
+	// Get file size
+	fseek(file, 0, SEEK_END);
+	int sizeInBytes = ftell(file) - PCM_DATA_OFFSET;
+	pSound->numSamples = sizeInBytes / (SAMPLE_SIZE);
+	pSound->firstLoaded = 0;
+	pSound->endLoaded = 0;
+
+	// Search to the start of the data in the file
+	fseek(file, PCM_DATA_OFFSET, SEEK_SET);
+
+	// Allocate space to hold all PCM data
+	pSound->pData = malloc(sizeInBytes);
+	if (pSound->pData == 0)
+	{
+		fprintf(stderr, "ERROR: Unable to allocate %d bytes for file %s.\n",
+				sizeInBytes, fileName);
+		exit(EXIT_FAILURE);
+	}
+	return file;
+}
+
+static void readSamples(FILE *file, char *fileName, short *dest, int numSamples)
+{
+	int samplesRead = fread(dest, SAMPLE_SIZE, numSamples, file);
+	if (samplesRead != numSamples)
+	{
+		fprintf(stderr, "ERROR: Unable to read %d samples from file %s (read %d).\n",
+				numSamples, fileName, samplesRead);
+		exit(EXIT_FAILURE);
+	}
+}
+
+// Reads the rest of the file started by AudioPlayer_readWaveFileFrom(), publishing each chunk
+static void *loaderThread(void *arg)
+{
+	trace_nameThread("wave loader");
+	wavedata_t *pSound = loadingSound;
+	int firstSample = pSound->firstLoaded;
+	int end = pSound->endLoaded;
+	while (end < pSound->numSamples && !__atomic_load_n(&stoppingLoader, __ATOMIC_ACQUIRE))
+	{
+		int chunk = pSound->numSamples - end;
+		if (chunk > LOADER_CHUNK_SAMPLES)
+		{
+			chunk = LOADER_CHUNK_SAMPLES;
+		}
+		trace_begin("readSamples");
+		readSamples(loadingFile, loadingFileName, pSound->pData + end, chunk);
+		trace_end("readSamples");
+		end += chunk;
+		__atomic_store_n(&pSound->endLoaded, end, __ATOMIC_RELEASE);
+	}
+	if (firstSample > 0 && !__atomic_load_n(&stoppingLoader, __ATOMIC_ACQUIRE))
+	{
+		fseek(loadingFile, PCM_DATA_OFFSET, SEEK_SET);
+		readSamples(loadingFile, loadingFileName, pSound->pData, firstSample);
+		__atomic_store_n(&pSound->firstLoaded, 0, __ATOMIC_RELEASE);
+	}
+	return NULL;
+}
+
+// Waits for the background reading to end, cutting it short
+// Note: caller must hold loaderMutex
+static void stopLoader(void)
+{
+	if (loadingSound == NULL)
+	{
+		return;
+	}
+	__atomic_store_n(&stoppingLoader, true, __ATOMIC_RELEASE);
+	pthread_join(loaderThreadId, NULL);
+	fclose(loadingFile);
+	loadingFile = NULL;
+	loadingSound = NULL;
+}
+
+// Copies the frames of "source" into "buff", "ppm" parts per million faster, by linear interpolation
+// Returns the number of samples of "source" played, at most "available"
+// Note: caller must hold audioMutex
+static int resampleSound(short *buff, int size, const short *source, int available, int ppm)
+{
+	double step = 1 + ppm / 1000000.0;
+	int frames = available / NUM_CHANNELS;
+	int frame = 0;
+	for (int i = 0; i < size / NUM_CHANNELS && frame < frames; i++)
+	{
+		const short *current = source + frame * NUM_CHANNELS;
+		// the last frame read so far is played as is
+		const short *next = (frame + 1 < frames) ? current + NUM_CHANNELS : current;
+		for (int channel = 0; channel < NUM_CHANNELS; channel++)
+		{
+			buff[i * NUM_CHANNELS + channel] = current[channel] + (next[channel] - current[channel]) * resamplePhase;
+		}
+		resamplePhase += step;
+		while (resamplePhase >= 1)
+		{
+			frame++;
+			resamplePhase -= 1;
 		}
 	}
+	return frame * NUM_CHANNELS;
+}
+
+// Remembers the sample heard now: the last one written, less those the sound card still holds
+// Note: called from the playback thread after each write
+static void recordPosition(void)
+{
+	long delay = getPcmDelay();
+	long long now = getTimeInUs();
+	metrics_set(&delay_metric, delay);
+	pthread_mutex_lock(&audioMutex);
+	heardPosition.pSound = writtenSound;
+	heardPosition.location = writtenLocation - delay * NUM_CHANNELS;
+	heardPosition.time_us = now;
+	heardPosition.delay_samples = delay * NUM_CHANNELS;
+	heardPosition.buffer_samples = playbackBufferSize;
 	pthread_mutex_unlock(&audioMutex);
 }
 
+static long long getTimeInUs(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+// Note: caller must hold audioMutex
+static bool isLoaded(wavedata_t *pSound, int location)
+{
+	return location >= __atomic_load_n(&pSound->firstLoaded, __ATOMIC_ACQUIRE) &&
+		   location < __atomic_load_n(&pSound->endLoaded, __ATOMIC_ACQUIRE);
+}
+
 static void *playbackThread(void *arg)
 {
+	trace_nameThread("playback");
 
 	while (!stopping)
 	{
 		// Generate next block of audio
+		trace_begin("fillPlaybackBuffer");
+		long long fill_start = metrics_getTimeInUs();
 		fillPlaybackBuffer(playbackBuffer, playbackBufferSize);
+		metrics_observe(&fill_metric, metrics_getTimeInUs() - fill_start);
+		trace_end("fillPlaybackBuffer");
 
 		// Output the audio
-		snd_pcm_sframes_t frames = snd_pcm_writei(handle,
-												  playbackBuffer, playbackBufferSize / NUM_CHANNELS);
+		trace_begin("writePcm");
+		long frames = writePcm(playbackBuffer, playbackBufferSize / NUM_CHANNELS);
+		trace_end("writePcm");
 
 		// Check for (and handle) possible error conditions on output
 		if (frames < 0)
 		{
-			fprintf(stderr, "AudioPlayer: writei() returned %li\n", frames);
-			frames = snd_pcm_recover(handle, frames, 1);
+			LOG_WARNING("AudioPlayer: writei() returned %li", frames);
+			frames = recoverPcm(frames);
+			metrics_increment(&recovered_metric);
 		}
 		if (frames < 0)
 		{
@@ -378,10 +691,158 @@ static void *playbackThread(void *arg)
 		}
 		if (frames > 0 && frames < playbackBufferSize / NUM_CHANNELS)
 		{
-			printf("Short write (expected %li, wrote %li)\n",
-				   playbackBufferSize, frames);
+			LOG_WARNING("Short write (expected %li, wrote %li)", playbackBufferSize, frames);
+			metrics_increment(&short_writes_metric);
+		}
+		metrics_increment(&periods_metric);
+		recordPosition();
+		if (frames > 0)
+		{
+			latency_observeAudio(filledLatency);
+		}
+
+		AudioPlayer_sink_t sink = __atomic_load_n(&outputSink, __ATOMIC_ACQUIRE);
+		if (sink != NULL && frames > 0)
+		{
+			sink(playbackBuffer, frames * NUM_CHANNELS);
 		}
 	}
 
 	return NULL;
 }
+
+#if defined(AUDIO_PLAYER_FILE_BACKEND)
+
+// Opens the file "device" names, or AUDIO_PLAYER_DEFAULT_FILE for the default device, and sizes
+// playbackBuffer like ALSA would: a quarter of PCM_BUFFER_US; AUDIO_PLAYER_DRIFT_VARIABLE sets its speed
+static void openPcm(const char *device)
+{
+	if (strcmp(device, AUDIO_PLAYER_DEFAULT_DEVICE) == 0)
+	{
+		device = AUDIO_PLAYER_DEFAULT_FILE;
+	}
+	pcmFd = open(device, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (pcmFd < 0)
+	{
+		printf("Playback open error: %s\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	playbackBufferSize = (long long)SAMPLE_RATE * PCM_BUFFER_US / 1000000 / 4;
+	pcmEnd_us = getTimeInUs();
+	const char *drift = getenv(AUDIO_PLAYER_DRIFT_VARIABLE);
+	pcmRate = SAMPLE_RATE * (1 + ((drift != NULL) ? atof(drift) : 0) / 1000000);
+}
+
+// Writes "frames" frames of "buffer", waiting like snd_pcm_writei() until the sound card
+// would have room for them; returns the frames written or -errno
+static long writePcm(const short *buffer, long frames)
+{
+	double duration_us = frames * 1000000.0 / pcmRate;
+	long long now = getTimeInUs();
+	if (pcmEnd_us < now)
+	{
+		// underrun: the sound card played silence meanwhile
+		pcmEnd_us = now;
+	}
+	long long wait_until = pcmEnd_us + duration_us - PCM_BUFFER_US;
+	if (wait_until > now)
+	{
+		struct timespec deadline = {.tv_sec = wait_until / 1000000, .tv_nsec = (wait_until % 1000000) * 1000};
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR)
+		{
+		}
+	}
+
+	ssize_t size = frames * NUM_CHANNELS * SAMPLE_SIZE;
+	if (write(pcmFd, buffer, size) != size)
+	{
+		return -errno;
+	}
+	pcmEnd_us += duration_us;
+	return frames;
+}
+
+static long recoverPcm(long error)
+{
+	return error;
+}
+
+// Returns the frames written and not played yet
+static long getPcmDelay(void)
+{
+	double ahead_us = pcmEnd_us - getTimeInUs();
+	return (ahead_us > 0) ? ahead_us * pcmRate / 1000000 : 0;
+}
+
+static void closePcm(void)
+{
+	long long ahead_us = pcmEnd_us - getTimeInUs();
+	if (ahead_us > 0)
+	{
+		struct timespec drain = {.tv_sec = ahead_us / 1000000, .tv_nsec = (ahead_us % 1000000) * 1000};
+		nanosleep(&drain, NULL);
+	}
+	close(pcmFd);
+	pcmFd = -1;
+}
+
+#else
+
+static void openPcm(const char *device)
+{
+	int err = snd_pcm_open(&handle, device, SND_PCM_STREAM_PLAYBACK, 0);
+	if (err < 0)
+	{
+		printf("Playback open error: %s\n", snd_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+
+	// Configure parameters of PCM output
+	err = snd_pcm_set_params(handle,
+							 SND_PCM_FORMAT_S16_LE,
+							 SND_PCM_ACCESS_RW_INTERLEAVED,
+							 NUM_CHANNELS,
+							 SAMPLE_RATE,
+							 1,				 // Allow software resampling
+							 PCM_BUFFER_US); // 0.05 seconds per buffer
+	if (err < 0)
+	{
+		printf("Playback open error: %s\n", snd_strerror(err));
+		exit(EXIT_FAILURE);
+	}
+
+	// Allocate this software's playback buffer to be the same size as the
+	// the hardware's playback buffers for efficient data transfers.
+	// ..get info on the hardware buffers:
+	unsigned long unusedBufferSize = 0;
+	snd_pcm_get_params(handle, &unusedBufferSize, &playbackBufferSize);
+}
+
+static long writePcm(const short *buffer, long frames)
+{
+	return snd_pcm_writei(handle, buffer, frames);
+}
+
+static long recoverPcm(long error)
+{
+	return snd_pcm_recover(handle, error, 1);
+}
+
+// Returns the frames written and not played yet
+static long getPcmDelay(void)
+{
+	snd_pcm_sframes_t delay = 0;
+	if (snd_pcm_delay(handle, &delay) < 0 || delay < 0)
+	{
+		delay = 0;
+	}
+	return delay;
+}
+
+static void closePcm(void)
+{
+	snd_pcm_drain(handle);
+	snd_pcm_close(handle);
+}
+
+#endif
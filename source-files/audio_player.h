@@ -13,6 +13,8 @@
 #ifndef AUDIO_PLAYER_H
 #define AUDIO_PLAYER_H
 
+#include <stdbool.h>
+
 #define AUDIO_PLAYER_MAX_VOLUME 100
 #define AUDIO_PLAYER_MIN_VOLUME 0
 
@@ -25,12 +27,48 @@
 // will consist of NUM_CHANNELS samples
 #define SAMPLE_SIZE (sizeof(short))
 
+// ALSA device the sounds are played on, unless the environment variable
+// AUDIO_PLAYER_DEVICE_VARIABLE names another one
+#define AUDIO_PLAYER_DEFAULT_DEVICE "default"
+#define AUDIO_PLAYER_DEVICE_VARIABLE "BEAGLEPOD_PCM_DEVICE"
+// Built with -D AUDIO_PLAYER_FILE_BACKEND, the sounds are written to the file the variable names instead,
+// at the pace of a sound card, so the player runs on a host (see benchmarks/latencyBench.c)
+#define AUDIO_PLAYER_DEFAULT_FILE "/dev/null"
+// ...and the simulated sound card plays the parts per million this variable gives faster than
+// SAMPLE_RATE, slower if negative, like a sound card whose clock drifts (see benchmarks/syncBench.c)
+#define AUDIO_PLAYER_DRIFT_VARIABLE "BEAGLEPOD_PCM_DRIFT_PPM"
+// Largest change of the playback speed of the sounds (see AudioPlayer_setRateCorrection())
+#define AUDIO_PLAYER_MAX_RATE_PPM 2000
+
 typedef struct
 {
 	int numSamples;
 	short *pData;
+	// Samples in [firstLoaded, endLoaded) are in pData, the others are still being read
+	// (see AudioPlayer_readWaveFileFrom())
+	int firstLoaded;
+	int endLoaded;
 } wavedata_t;
 
+// Fills "buffer", which holds silence, with "numSamples" samples played instead of the sounds,
+// or returns false to let the sounds play
+// Note: called from the playback thread, at the pace of the sound card
+typedef bool (*AudioPlayer_source_t)(short *buffer, int numSamples);
+
+// Receives the "numSamples" samples of "buffer" right after they were written to the sound card
+// Note: called from the playback thread, at the pace of the sound card
+typedef void (*AudioPlayer_sink_t)(const short *buffer, int numSamples);
+
+typedef struct
+{
+	wavedata_t *pSound; // NULL while no sound is played
+	int location;		// sample of pSound heard at "time_us", below 0 while its start is not heard yet
+	long long time_us;	// CLOCK_MONOTONIC
+	int delay_samples;	// samples written to the sound card but not heard yet
+	int buffer_samples; // samples filled ahead of the sound card: a sound played at "time_us" is heard
+						// delay_samples + buffer_samples later
+} AudioPlayer_position_t;
+
 // init() must be called before any other functions,
 void AudioPlayer_init(void);
 
@@ -41,10 +79,29 @@ void AudioPlayer_cleanup(void);
 // the pData pointer in this structure will be dynamically allocated in
 // readWaveFileIntoMemory(), and is freed by calling freeWaveFileData().
 void AudioPlayer_readWaveFileIntoMemory(char *fileName, wavedata_t *pSound);
+// Same as readWaveFileIntoMemory() but returns as soon as a couple of seconds from
+// sample "firstSample" on are in memory; the rest of the file is read in the background.
+// Note: only one file is read in the background at a time
+void AudioPlayer_readWaveFileFrom(char *fileName, wavedata_t *pSound, int firstSample);
 void AudioPlayer_freeWaveFileData(wavedata_t *pSound);
 
 // Queue up another sound bite to play as soon as possible.
 void AudioPlayer_playWAV(wavedata_t *pSound);
+// Same as playWAV() but starts at sample "location" (from the start if it is past the end)
+void AudioPlayer_playWAVAt(wavedata_t *pSound, int location);
+// Returns the sample pSound is at if it is the sound playing, -1 otherwise
+int AudioPlayer_getLocation(wavedata_t *pSound);
+// Fills "position" with what was heard after the last write to the sound card
+void AudioPlayer_getPosition(AudioPlayer_position_t *position);
+// Plays the sounds "ppm" parts per million faster, slower if negative, by resampling them
+// Note: "ppm" is limited to AUDIO_PLAYER_MAX_RATE_PPM either way
+void AudioPlayer_setRateCorrection(int ppm);
+
+// Plays from "source" ahead of the sounds, which stay where they were while it plays
+// NULL removes the source
+void AudioPlayer_setSource(AudioPlayer_source_t source);
+// Hands what is played to "sink" as well, NULL removes the sink
+void AudioPlayer_setSink(AudioPlayer_sink_t sink);
 
 // Get/set the volume.
 // setVolume() function posted by StackOverflow user "trenki" at:
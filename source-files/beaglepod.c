@@ -20,24 +20,62 @@
 #include "lcd_4line.h"
 #include "network.h"
 #include "songManager.h"
+#include "songWatcher.h"
+#include "httpServer.h"
+#include "mp3ToWav.h"
+#include "playStats.h"
+#include "playbackState.h"
+#include "networkInput.h"
+#include "roomSync.h"
+#include "networkOutput.h"
+#include "logger.h"
+#include "trace.h"
 
 int main(int argc, char const *argv[])
 {
-
+    // every module logs through it, the playback thread included
+    logger_init();
+    // before any thread, which may trace
+    trace_init();
+    // statistics are loaded first so the first song played is counted
+    playStats_init(PLAY_STATS_DEFAULT_LOG);
+    // the library must exist before any thread can reach it
+    songManager_init();
     AudioPlayer_init();
+    networkInput_init();
+    networkOutput_init(NETWORK_OUTPUT_DEFAULT_SDP_FILE);
+    roomSync_init();
+    // music picks up where it stopped before the slower modules start
+    playbackState_init(PLAYBACK_STATE_DEFAULT_FILE);
     Potentiometer_init();
     MenuManager_init();
     Network_init();
-    songManager_init();
+    songWatcher_init(SONG_WATCHER_DEFAULT_DIR);
+    // uploads are handed to the song watcher
+    mp3ToWave_init();
+    httpServer_init(SONG_WATCHER_DEFAULT_DIR);
 
     Shutdown_init();
     Shutdown_waitForShutdown();
 
-    songManager_cleanup();
+    httpServer_cleanup();
+    mp3ToWave_cleanup();
+    songWatcher_cleanup();
     Network_cleanup();
     MenuManager_cleanup();
+    // saved while the song and the queue are still there
+    playbackState_cleanup();
     Potentiometer_cleanup();
+    roomSync_cleanup();
+    networkOutput_cleanup();
+    networkInput_cleanup();
     AudioPlayer_cleanup();
+    // nothing plays anymore, the last statistics can be written
+    playStats_cleanup();
+    // no thread can use the library anymore
+    songManager_cleanup();
+    trace_cleanup();
+    logger_cleanup();
 
     return 0;
 }
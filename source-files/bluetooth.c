@@ -12,6 +12,7 @@
 
 #include "bluetooth.h"
 #include "audio_player.h"
+#include "metrics.h"
 
 #include <stdbool.h>
 #include <stdio.h>
@@ -34,16 +35,45 @@
 int bt_adapter_id;
 int bt_adapter_fd;
 
+// Metrics, see metrics.h
+typedef enum
+{
+    BT_SCAN,
+    BT_PAIR,
+    BT_CONNECT,
+    BT_DISCONNECT,
+    BT_NUM_OPERATIONS
+} bt_operation_t;
+static const char *operation_labels[BT_NUM_OPERATIONS] = {
+    "operation=\"scan\"",
+    "operation=\"pair\"",
+    "operation=\"connect\"",
+    "operation=\"disconnect\""};
+static metrics_counter_t operations_metrics[BT_NUM_OPERATIONS];
+static metrics_counter_t failures_metrics[BT_NUM_OPERATIONS];
+
 // Private functions definitions
 static void openBT(void);
 static void closeBT(void);
 static void checkError(void);
 static int runCommand(char *command);
+static void countOperation(bt_operation_t operation, bool failed);
 
 //------------------------------------------------
 //////////////// Public Functions ////////////////
 //------------------------------------------------
 
+void Bluetooth_init(void)
+{
+    for (int i = 0; i < BT_NUM_OPERATIONS; i++)
+    {
+        metrics_registerCounter(&operations_metrics[i], "beaglepod_bluetooth_operations_total", operation_labels[i],
+                                "Bluetooth operations started, by operation");
+        metrics_registerCounter(&failures_metrics[i], "beaglepod_bluetooth_failures_total", operation_labels[i],
+                                "Bluetooth operations that failed, by operation");
+    }
+}
+
 void Bluetooth_printDevicesToConsole(inquiry_info *devices, int num_devices)
 {
     openBT();
@@ -96,6 +126,7 @@ int Bluetooth_pair(bdaddr_t *device_address)
     bt_command = NULL;
     closeBT();
 
+    countOperation(BT_PAIR, result != 0);
     return result;
 }
 
@@ -107,6 +138,7 @@ int Bluetooth_scan(bluetooth_scan_t *scanner)
     {
         fprintf(stderr, "failed to allocate memory for scanned devices\n");
         closeBT();
+        countOperation(BT_SCAN, true);
         return (-1);
     }
 
@@ -116,19 +148,22 @@ int Bluetooth_scan(bluetooth_scan_t *scanner)
     {
         fprintf(stderr, "hci_inquiry: error scanning devices");
         closeBT();
+        countOperation(BT_SCAN, true);
         return (-1);
     }
 
     scanner->num_devices = num_rsp;
     closeBT();
+    countOperation(BT_SCAN, false);
     return (1);
 }
 
 void Bluetooth_disconnect(void)
 {
     openBT();
-    runCommand("bluetoothctl disconnect");
+    int result = runCommand("bluetoothctl disconnect");
     closeBT();
+    countOperation(BT_DISCONNECT, result != 0);
 }
 
 int Bluetooth_connect(bdaddr_t *device_address)
@@ -146,6 +181,7 @@ int Bluetooth_connect(bdaddr_t *device_address)
     bt_command = NULL;
 
     closeBT();
+    countOperation(BT_CONNECT, result != 0);
     return result;
 }
 
@@ -192,6 +228,15 @@ static int runCommand(char *command)
     return (0);
 }
 
+static void countOperation(bt_operation_t operation, bool failed)
+{
+    metrics_increment(&operations_metrics[operation]);
+    if (failed)
+    {
+        metrics_increment(&failures_metrics[operation]);
+    }
+}
+
 static void checkError(void)
 {
     switch (errno)
@@ -31,6 +31,11 @@ typedef struct
     int num_devices;
 } bluetooth_scan_t;
 
+/**
+ * Registers the metrics of the module, see metrics.h
+ */
+void Bluetooth_init(void);
+
 /**
  * Iterates over a list of scanned devices, displaying each
  * devices human-readable name if available.
@@ -6,6 +6,13 @@
  * for the doublyLinkedList module, which provides the utilities
  * for storing and traversing song information.
  *
+ * Writers hold writeMutex and publish every pointer a reader can follow
+ * with a release store, so readers walking "next" pointers always see
+ * fully built nodes. Deleted nodes keep their "next" pointer and are only
+ * handed back through Epoch_retire(), so a reader standing on one can
+ * still walk off it. The position -> node table is an immutable snapshot
+ * that is replaced, not modified, when positions shift.
+ *
  * @author Amirhossein Etaati
  * @date 2023-03-17
  */
@@ -15,14 +22,33 @@
 #include <string.h>
 #include <stdbool.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include "doublyLinkedList.h"
+#include "epoch.h"
+
+#define LOAD(var) __atomic_load_n(&(var), __ATOMIC_ACQUIRE)
+#define STORE(var, value) __atomic_store_n(&(var), (value), __ATOMIC_RELEASE)
 
 struct Node
 {
     void *data;
     struct Node *next;
     struct Node *prev;
+    bool deleted;
+};
+
+// the data of a node is stored right after it, in the same allocation
+#define NODE_HEADER_SIZE ((sizeof(struct Node) + 15) & ~(size_t)15)
+#define NODE_OF(data) ((struct Node *)((char *)(data)-NODE_HEADER_SIZE))
+
+// position -> node table so lookups by index are O(1)
+struct Index
+{
+    int size;
+    int capacity;
+    unsigned long generation; // the list generation this table was built for
+    struct Node *nodes[];
 };
 
 struct List
@@ -30,36 +56,44 @@ struct List
     struct Node *head;
     struct Node *tail;
 
-    struct Node *current; // keeps track of the current element in the list
-    int curentIdx;        // -1 if there is no element in the list
+    int size;
 
-    struct Node *currentIterator;
+    // bumped whenever the position of existing elements shifts
+    unsigned long generation;
+    struct Index *index;
 
-    int size;
+    pthread_mutex_t writeMutex;
+    void (*free_data)(void *data);
 };
 
 static bool is_module_initialized = false;
 static struct List *list_ptr = NULL;
 
 // Private functions definitions
-static void push_to_head(void *src, unsigned int size);
-static void push_to_tail(void *src, unsigned int size);
-static void pop_from_head(void);
-static bool set_ptr_to_idx(int idx, struct Node *ptr);
+static struct Node *alloc_node(unsigned int size);
+static void push_to_head(struct Node *new_node);
+static void push_to_tail(struct Node *new_node);
+static void unlink_node(struct Node *node);
+static struct Node *walk_to_idx(int idx);
+static struct Index *alloc_index(int capacity);
+static void rebuild_index(void);
+static void append_to_index(struct Node *node);
+static void free_retired_node(void *ptr);
 
 //------------------------------------------------
 //////////////// Public Functions ////////////////
 //------------------------------------------------
 
-void doublyLinkedList_init(void)
+void doublyLinkedList_init(void (*free_data)(void *data))
 {
     list_ptr = (struct List *)malloc(sizeof(struct List));
     list_ptr->head = NULL;
     list_ptr->tail = NULL;
-    list_ptr->current = NULL;
-    list_ptr->curentIdx = -1;
-    list_ptr->currentIterator = NULL;
     list_ptr->size = 0;
+    list_ptr->generation = 0;
+    list_ptr->index = NULL;
+    list_ptr->free_data = free_data;
+    pthread_mutex_init(&list_ptr->writeMutex, NULL);
 
     is_module_initialized = true;
 }
@@ -67,63 +101,62 @@ void doublyLinkedList_init(void)
 bool doublyLinkedList_isEmpty(void)
 {
     assert(is_module_initialized);
-    return (!list_ptr->head || !list_ptr->tail);
+    return LOAD(list_ptr->size) == 0;
 }
 
-void doublyLinkedList_appendItem(void *src, unsigned int size)
+void *doublyLinkedList_allocElement(unsigned int size)
 {
-    assert(is_module_initialized);
-    push_to_tail(src, size);
+    return alloc_node(size)->data;
 }
 
-void doublyLinkedList_prependItem(void *src, unsigned int size)
+void doublyLinkedList_prependElement(void *data)
 {
     assert(is_module_initialized);
-    push_to_head(src, size);
+    pthread_mutex_lock(&list_ptr->writeMutex);
+    push_to_head(NODE_OF(data));
+    pthread_mutex_unlock(&list_ptr->writeMutex);
 }
 
-bool doublyLinkedList_next(void)
+void doublyLinkedList_appendElement(void *data)
 {
     assert(is_module_initialized);
-    if (list_ptr->current == NULL || list_ptr->current->next == NULL)
-    {
-        return false;
-    }
-    list_ptr->current = list_ptr->current->next;
-    list_ptr->curentIdx += 1;
-    return true;
+    pthread_mutex_lock(&list_ptr->writeMutex);
+    push_to_tail(NODE_OF(data));
+    pthread_mutex_unlock(&list_ptr->writeMutex);
 }
 
-bool doublyLinkedList_prev(void)
+void *doublyLinkedList_appendItem(void *src, unsigned int size)
 {
-    assert(is_module_initialized);
-    if (list_ptr->current == NULL || list_ptr->current->prev == NULL)
-    {
-        return false;
-    }
-    list_ptr->current = list_ptr->current->prev;
-    list_ptr->curentIdx -= 1;
-    return true;
+    void *data = doublyLinkedList_allocElement(size);
+    memcpy(data, src, size);
+    doublyLinkedList_appendElement(data);
+    return data;
 }
 
-void *doublyLinkedList_getCurrentElement(void)
+void *doublyLinkedList_prependItem(void *src, unsigned int size)
 {
-    assert(is_module_initialized);
-    if (!doublyLinkedList_isEmpty() && list_ptr->current != NULL)
-    {
-        return list_ptr->current->data;
-    }
-    return NULL;
+    void *data = doublyLinkedList_allocElement(size);
+    memcpy(data, src, size);
+    doublyLinkedList_prependElement(data);
+    return data;
 }
 
 void doublyLinkedList_cleanup(void)
 {
     assert(is_module_initialized);
-    while (!doublyLinkedList_isEmpty())
+    pthread_mutex_lock(&list_ptr->writeMutex);
+    struct Node *node = list_ptr->head;
+    while (node != NULL)
     {
-        pop_from_head();
+        struct Node *next = node->next;
+        free_retired_node(node);
+        node = next;
     }
+    free(list_ptr->index);
+    pthread_mutex_unlock(&list_ptr->writeMutex);
+    pthread_mutex_destroy(&list_ptr->writeMutex);
     free(list_ptr);
+    is_module_initialized = false;
 }
 
 void *doublyLinkedList_getElementAtIndex(int idx)
@@ -132,358 +165,269 @@ void *doublyLinkedList_getElementAtIndex(int idx)
     if (idx < 0)
         return NULL;
 
-    int counter = 0;
-    struct Node *node = list_ptr->head;
-
-    while (counter < idx && node != NULL)
+    void *data = NULL;
+    Epoch_enter();
+    struct Index *index = LOAD(list_ptr->index);
+    if (index == NULL || index->generation != LOAD(list_ptr->generation))
     {
-        node = node->next;
-        counter++;
+        // stale table: rebuild it unless a writer is busy, in which case walk the list
+        if (pthread_mutex_trylock(&list_ptr->writeMutex) == 0)
+        {
+            rebuild_index();
+            pthread_mutex_unlock(&list_ptr->writeMutex);
+            index = LOAD(list_ptr->index);
+        }
+        else
+        {
+            index = NULL;
+        }
     }
-    if (node == NULL)
-        return NULL;
-    return node->data;
-}
-
-// Sets the current pointer to point to the element at index "idx"
-// Returns false if idx is out of bounds or the list is empty, true if successful
-bool doublyLinkedList_setCurrent(int idx)
-{
-    assert(is_module_initialized);
-    return set_ptr_to_idx(idx, list_ptr->current);
-}
 
-// Returns the index of the current element
-// Note: returns -1 if the list is empty
-int doublyLinkedList_getCurrentIdx(void)
-{
-    assert(is_module_initialized);
-    if (list_ptr->head == NULL)
+    if (index != NULL)
     {
-        return -1;
+        if (idx < LOAD(index->size))
+        {
+            data = index->nodes[idx]->data;
+        }
     }
-    return list_ptr->curentIdx;
+    else
+    {
+        struct Node *node = walk_to_idx(idx);
+        if (node != NULL)
+        {
+            data = node->data;
+        }
+    }
+    Epoch_exit();
+    return data;
 }
 
 // Returns the number of elements currently in the list
 int doublyLinkedList_getSize(void)
 {
     assert(is_module_initialized);
-    return list_ptr->size;
+    return LOAD(list_ptr->size);
 }
 
-// Sets list's position to be displayed from to the Head
-// Note: Returns false if the list is empty
-bool doublyLinkedList_setIteratorStartPosition(void)
+bool doublyLinkedList_delete(int idx)
 {
     assert(is_module_initialized);
-    if (list_ptr->head == NULL)
+    bool deleted = false;
+    pthread_mutex_lock(&list_ptr->writeMutex);
+    struct Node *node = walk_to_idx(idx);
+    if (node != NULL)
     {
-        return false;
+        unlink_node(node);
+        deleted = true;
     }
-    list_ptr->currentIterator = list_ptr->head;
-    return true;
+    pthread_mutex_unlock(&list_ptr->writeMutex);
+    return deleted;
 }
 
-// Sets list's position to be displayed from to the Tail
-bool doublyLinkedList_setIteratorEndPosition(void)
+bool doublyLinkedList_deleteElement(void *data)
 {
     assert(is_module_initialized);
-    if (list_ptr->tail == NULL)
+    struct Node *node = NODE_OF(data);
+    bool deleted = false;
+    pthread_mutex_lock(&list_ptr->writeMutex);
+    if (!node->deleted)
     {
-        return false;
+        unlink_node(node);
+        deleted = true;
     }
-    list_ptr->currentIterator = list_ptr->tail;
-    return true;
+    pthread_mutex_unlock(&list_ptr->writeMutex);
+    return deleted;
 }
 
-// Moves the display one position to the right
-// Note: Returns false if the list is empty or there is no next element
-bool doublyLinkedList_iteratorNext(void)
+void *doublyLinkedList_getPreviousElement(void *data)
 {
     assert(is_module_initialized);
-    if (list_ptr->size == 0)
-    {
-        return false;
-    }
-    if ((list_ptr->currentIterator)->next != NULL)
-    {
-        list_ptr->currentIterator = (list_ptr->currentIterator)->next;
-        return true;
-    }
-    return false;
+    pthread_mutex_lock(&list_ptr->writeMutex);
+    struct Node *prev_node = NODE_OF(data)->prev;
+    pthread_mutex_unlock(&list_ptr->writeMutex);
+    return (prev_node != NULL) ? prev_node->data : NULL;
 }
 
-// Moves the display one position to the left and returns the data at the that position
-// Note: Returns false if the list is empty or there is no previous element
-bool doublyLinkedList_iteratorPrev(void)
+void doublyLinkedList_freeElement(void *data)
 {
-    assert(is_module_initialized);
-    if (list_ptr->size == 0)
-    {
-        return false;
-    }
-    if ((list_ptr->currentIterator)->prev != NULL)
-    {
-        list_ptr->currentIterator = (list_ptr->currentIterator)->prev;
-        return true;
-    }
-    return false;
+    free(NODE_OF(data));
 }
 
-// Returns the data of the "currentIterator"
-void *doublyLinkedList_getCurrentIteratorElement(void)
+//------------------------------------------------
+/////////////// Private Functions ////////////////
+//------------------------------------------------
+
+static struct Node *alloc_node(unsigned int size)
 {
-    assert(is_module_initialized);
-    if (list_ptr->currentIterator == NULL)
+    struct Node *new_node = malloc(NODE_HEADER_SIZE + size);
+    if (new_node == NULL)
     {
-        return NULL;
+        fprintf(stderr, "%s\n", "doublyLinkedList_alloc_node(): Error - There was a problem allocating memory.");
+        exit(1);
     }
-    return list_ptr->currentIterator->data;
+    new_node->data = (char *)new_node + NODE_HEADER_SIZE;
+    new_node->deleted = false;
+    return new_node;
 }
 
-bool doublyLinkedList_setIterator(int idx)
+// Note: caller must hold writeMutex
+static void push_to_head(struct Node *new_node)
 {
-    assert(is_module_initialized);
-    return doublyLinkedList_advanceIteratorNTimes(idx);
-}
+    (new_node->next) = (list_ptr->head);
+    (new_node->prev) = NULL;
 
-bool doublyLinkedList_advanceIteratorNTimes(int n)
-{
-    if (n <= 0 || list_ptr->tail == list_ptr->currentIterator)
+    if (list_ptr->head != NULL)
     {
-        return false;
+        list_ptr->head->prev = new_node;
     }
-    int counter = 0;
-    while (counter < n && doublyLinkedList_iteratorNext())
+    else
     {
-        counter++;
+        // List was previously empty
+        list_ptr->tail = new_node;
     }
-    return true;
+    STORE(list_ptr->head, new_node);
+
+    STORE(list_ptr->size, list_ptr->size + 1);
+    STORE(list_ptr->generation, list_ptr->generation + 1);
 }
 
-bool doublyLinkedList_rewindIteratorNTimes(int n)
+// Note: caller must hold writeMutex
+static void push_to_tail(struct Node *new_node)
 {
-    if (n <= 0 || list_ptr->head == list_ptr->currentIterator)
+    (new_node->next) = NULL;
+    (new_node->prev) = list_ptr->tail;
+
+    if (list_ptr->tail != NULL)
     {
-        return false;
+        STORE(list_ptr->tail->next, new_node);
     }
-    int counter = 0;
-    while (counter < n && doublyLinkedList_iteratorPrev())
+    else
     {
-        counter++;
+        STORE(list_ptr->head, new_node);
     }
-    return true;
+    list_ptr->tail = new_node;
+
+    // positions of the existing elements do not change: extend the table in place
+    append_to_index(new_node);
+    STORE(list_ptr->size, list_ptr->size + 1);
 }
 
-bool doublyLinkedList_delete(int idx)
+// Note: caller must hold writeMutex
+static void unlink_node(struct Node *node)
 {
-    if (list_ptr->size == 0)
-    {
-        return false;
-    }
-    if (idx == 0)
-    {
-        pop_from_head();
-        return true;
-    }
-    struct Node *temp = NULL;
-    if (set_ptr_to_idx(idx, temp) == false)
-    {
-        return false;
-    }
-    if (temp == list_ptr->current)
+    struct Node *prev_node = node->prev;
+    struct Node *next_node = node->next;
+
+    if (prev_node != NULL)
     {
-        list_ptr->current = list_ptr->current->next;
+        STORE(prev_node->next, next_node);
     }
-    struct Node *delete_node = temp;
-    struct Node *prev_node = temp->prev;
-    struct Node *next_node = NULL;
-    if (temp != list_ptr->tail)
+    else
     {
-        next_node = temp->next;
+        STORE(list_ptr->head, next_node);
     }
-    prev_node->next = temp->next;
     if (next_node != NULL)
     {
         next_node->prev = prev_node;
     }
-
-    if (list_ptr->tail == temp)
+    else
     {
         list_ptr->tail = prev_node;
     }
-    free(delete_node->data);
-    free(delete_node);
-    list_ptr->size -= 1;
-    return true;
-}
 
-//------------------------------------------------
-/////////////// Private Functions ////////////////
-//------------------------------------------------
+    node->deleted = true;
+    STORE(list_ptr->size, list_ptr->size - 1);
+    STORE(list_ptr->generation, list_ptr->generation + 1);
+    Epoch_retire(node, free_retired_node);
+}
 
-static void push_to_head(void *src, unsigned int size)
+// Note: caller must be in an Epoch read section or hold writeMutex
+static struct Node *walk_to_idx(int idx)
 {
-    struct Node *new_node = malloc(sizeof(struct Node));
-    if (new_node == NULL)
-    {
-        fprintf(stderr, "%s\n", "doublyLinkedList_push_to_head(): Error - There was a problem allocating memory.");
-        exit(1);
-    }
-    (new_node->data) = malloc(size);
-    if ((new_node->data) == NULL)
-    {
-        fprintf(stderr, "%s\n", "doublyLinkedList_push_to_head(): Error - There was a problem allocating memory for t");
-        exit(1);
-    }
-
-    memcpy((new_node->data), (src), size);
-    (new_node->next) = (list_ptr->head);
-    (new_node->prev) = NULL;
+    int counter = 0;
+    struct Node *node = LOAD(list_ptr->head);
 
-    if (list_ptr->head != NULL)
-    {
-        list_ptr->head->prev = new_node;
-        (list_ptr->head) = new_node;
-    }
-    else
+    while (counter < idx && node != NULL)
     {
-        // List was previously empty
-        list_ptr->tail = list_ptr->head = list_ptr->current = list_ptr->currentIterator = new_node;
-        list_ptr->curentIdx = 0;
+        node = LOAD(node->next);
+        counter++;
     }
-
-    list_ptr->size += 1;
+    return node;
 }
 
-static void push_to_tail(void *src, unsigned int size)
+static struct Index *alloc_index(int capacity)
 {
-    struct Node *new_node = malloc(sizeof(struct Node));
-    if (new_node == NULL)
+    struct Index *index = malloc(sizeof(struct Index) + capacity * sizeof(struct Node *));
+    if (index == NULL)
     {
-        fprintf(stderr, "%s\n", "doublyLinkedList_push_to_tail(): Error - There was a problem allocating memory.");
+        fprintf(stderr, "%s\n", "doublyLinkedList_alloc_index(): Error - There was a problem allocating memory.");
         exit(1);
     }
-    (new_node->data) = malloc(size);
-    if ((new_node->data) == NULL)
+    index->capacity = capacity;
+    return index;
+}
+
+// Note: caller must hold writeMutex
+static void rebuild_index(void)
+{
+    int capacity = 16;
+    while (capacity < list_ptr->size)
     {
-        fprintf(stderr, "%s\n", "doublyLinkedList_push_to_tail(): Error - There was a problem allocating memory for t");
-        exit(1);
+        capacity *= 2;
     }
+    struct Index *index = alloc_index(capacity);
 
-    memcpy((new_node->data), (src), size);
-    (new_node->next) = NULL;
-    (new_node->prev) = list_ptr->tail;
-
-    if (list_ptr->tail != NULL)
+    int idx = 0;
+    for (struct Node *node = list_ptr->head; node != NULL; node = node->next)
     {
-        (list_ptr->tail->next) = new_node;
-        list_ptr->tail = new_node;
+        index->nodes[idx++] = node;
     }
-    else
+    index->size = idx;
+    index->generation = list_ptr->generation;
+
+    struct Index *old_index = list_ptr->index;
+    STORE(list_ptr->index, index);
+    if (old_index != NULL)
     {
-        list_ptr->tail = list_ptr->head = list_ptr->current = list_ptr->currentIterator = new_node;
-        list_ptr->curentIdx = 0;
+        Epoch_retire(old_index, free);
     }
-
-    list_ptr->size += 1;
 }
 
-static void pop_from_head(void)
+// Note: caller must hold writeMutex
+static void append_to_index(struct Node *node)
 {
-    if ((list_ptr->head) == NULL)
+    struct Index *index = list_ptr->index;
+    if (index == NULL || index->generation != list_ptr->generation)
     {
-        fprintf(stderr, "%s\n", "doublyLinkedList_pop_from_head(): Error - The list is empty");
-        exit(1);
+        // already stale, the next lookup rebuilds it
+        return;
     }
-
-    if (list_ptr->current == list_ptr->head)
+    if (index->size < index->capacity)
     {
-        list_ptr->current = list_ptr->head->next; // if current is pointing to head, set it to the next element
-    }
-    if (list_ptr->currentIterator == list_ptr->head)
-    {
-        list_ptr->currentIterator = list_ptr->head->next; // if currentIterator is pointing to head, set it to the next element
+        // readers never look past "size", so the free slot can be filled in place
+        index->nodes[index->size] = node;
+        STORE(index->size, index->size + 1);
+        return;
     }
 
-    struct Node *first_node = (list_ptr->head);
-    (list_ptr->head) = list_ptr->head->next;
-    if (list_ptr->head != NULL)
-    {
-        list_ptr->head->prev = NULL;
-    }
-    free(first_node->data);
-    free(first_node);
-
-    list_ptr->size -= 0;
+    struct Index *new_index = alloc_index(index->capacity * 2);
+    memcpy(new_index->nodes, index->nodes, index->size * sizeof(struct Node *));
+    new_index->nodes[index->size] = node;
+    new_index->size = index->size + 1;
+    new_index->generation = index->generation;
+    STORE(list_ptr->index, new_index);
+    Epoch_retire(index, free);
 }
 
-static bool set_ptr_to_idx(int idx, struct Node *ptr)
+static void free_retired_node(void *ptr)
 {
-    int counter = 0;
-    struct Node *node = list_ptr->head;
-
-    while (counter < idx && node != NULL)
+    struct Node *node = ptr;
+    if (list_ptr->free_data != NULL)
     {
-        node = node->next;
-        counter++;
+        list_ptr->free_data(node->data);
     }
-    if (node == NULL)
-        return false;
-
-    if (ptr == list_ptr->current)
+    else
     {
-        list_ptr->curentIdx = idx;
+        free(node);
     }
-    ptr = node;
-    return true;
 }
-
-//------------------------------------------------
-//////////////// FOR TESTING ONLY ////////////////
-//------------------------------------------------
-
-// int main(int argc, char const *argv[])
-// {
-//     doublyLinkedList_init();
-
-//     doublyLinkedList_appendItem("Hello1", strlen("Hello1") + 1);
-//     doublyLinkedList_appendItem("Hello2", strlen("Hello2") + 1);
-//     doublyLinkedList_appendItem("Hello3", strlen("Hello3") + 1);
-
-//     // printf("current size if %d\n", doublyLinkedList_getSize());
-
-//     // char *result = doublyLinkedList_getElementAtIndex(3);
-//     // printf("==> the result is: %s\n", result);
-
-//     doublyLinkedList_advanceIteratorNTimes(3);
-//     if (doublyLinkedList_rewindIteratorNTimes(300))
-//     {
-//         printf("==> current iterator element is: %s\n", doublyLinkedList_getCurrentIteratorElement());
-//     }
-//     else
-//     {
-//         printf("doublyLinkedList_advanceIteratorNTimes() failed\n");
-//     }
-
-//     do
-//     {
-//         if (!doublyLinkedList_isEmpty())
-//         {
-//             printf("======> %s\n", (char *)doublyLinkedList_getCurrentElement());
-//         }
-//     } while (doublyLinkedList_next());
-
-//     do
-//     {
-//         if (!doublyLinkedList_isEmpty())
-//         {
-//             printf("======> %s\n", (char *)doublyLinkedList_getCurrentElement());
-//         }
-//     } while (doublyLinkedList_prev());
-
-//     doublyLinkedList_cleanup();
-
-//     return 0;
-// }
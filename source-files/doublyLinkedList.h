@@ -6,6 +6,11 @@
  * for the doublyLinkedList module, which provides the utilities
  * for storing and traversing song information.
  *
+ * Thread safety: adding and deleting are serialized internally and may
+ * run alongside any number of readers. Readers never take a lock; the
+ * element returned by a lookup stays valid until the caller leaves the
+ * Epoch read section (see epoch.h) it made the lookup in.
+ *
  * @author Amirhossein Etaati
  * @date 2023-03-17
  */
@@ -15,83 +20,59 @@
 
 #define bool _Bool
 
-// Returns a pointer to the newly allocated empty list
+// Allocates the empty list
+// "free_data" is called with an element once it was deleted and no reader can see it anymore;
+// it must eventually call doublyLinkedList_freeElement() on it (NULL frees the element right away)
 // Note: caller should call doublyLinkedList_cleanup() to free the memory
-void doublyLinkedList_init(void);
+void doublyLinkedList_init(void (*free_data)(void *data));
 
 // Returns true if the list is empty
 bool doublyLinkedList_isEmpty(void);
 
-// struct Node* doublyLinkedList_getHead(void);
+// Returns an unlinked element of "size" bytes, to be filled in and then added with
+// doublyLinkedList_prependElement() or doublyLinkedList_appendElement() without a copy
+// Note: an element that is never added must be freed with doublyLinkedList_freeElement()
+void *doublyLinkedList_allocElement(unsigned int size);
 
-// Adds the item "src" with size of "size" to the head of the list
-void doublyLinkedList_prependItem(void *src, unsigned int size);
+// Adds "data", an element from doublyLinkedList_allocElement(), to the head of the list
+void doublyLinkedList_prependElement(void *data);
 
-// Adds the item "src" with size of "size" to the tail of the list
-void doublyLinkedList_appendItem(void *src, unsigned int size);
+// Adds "data", an element from doublyLinkedList_allocElement(), to the tail of the list
+void doublyLinkedList_appendElement(void *data);
 
-// Updates the "current" field of the list to the next node
-// Returns true if update is successful, false if the list is empty
-bool doublyLinkedList_next(void);
+// Adds the item "src" with size of "size" to the head of the list
+// Returns the list's copy of the item
+void *doublyLinkedList_prependItem(void *src, unsigned int size);
 
-// Updates the "current" field of the list to the previous node
-// Returns true if update is successful, false if the list is empty
-bool doublyLinkedList_prev(void);
+// Adds the item "src" with size of "size" to the tail of the list
+// Returns the list's copy of the item
+void *doublyLinkedList_appendItem(void *src, unsigned int size);
 
 // Returns the element at index "idx" or NULL if idx is out of bounds
-// Note: the list is zero-indexed
+// Note: the list is zero-indexed. Lookups are O(1); the first lookup after an element
+// was prepended or deleted rebuilds the index table in O(n)
 void *doublyLinkedList_getElementAtIndex(int idx);
 
-// Returns the data of the "current"
-void *doublyLinkedList_getCurrentElement(void);
-
 // Frees the memory for all nodes, the data, and the List struct
+// Note: no reader may use the list anymore
 void doublyLinkedList_cleanup(void);
 
-// Resets the current pointer to point to the element
-// Returns false if idx is out of bounds or the list is empty
-bool doublyLinkedList_setCurrent(int idx);
-
-// Returns the index of the current element
-// Note: returns -1 if the list is empty
-int doublyLinkedList_getCurrentIdx(void);
-
 // Returns the number of elements currently in the list
 int doublyLinkedList_getSize(void);
 
-//////////// Iterator functions to maintain the modularity according to songManager's needs ////////////
-
-// Sets list's position to be displayed from to the Head
-// Note: Returns false if the list is empty
-bool doublyLinkedList_setIteratorStartPosition(void);
-
-// Sets list's position to be displayed from to the Tail
-bool doublyLinkedList_setIteratorEndPosition(void);
-
-// Moves the display one position to the right
-// Note: Returns false if the list is empty or there is no next element
-bool doublyLinkedList_iteratorNext(void);
-
-// Moves the display one position to the left and returns the data at the that position
-// Note: Returns false if the list is empty or there is no previous element
-bool doublyLinkedList_iteratorPrev(void);
-
-// Resets the current pointer to point to the element
-// Returns false if idx is out of bounds or the list is empty
-// TODO: Remove??
-bool doublyLinkedList_setIterator(int idx);
-
-// Returns the data of the "currentDisplay"
-void *doublyLinkedList_getCurrentIteratorElement(void);
+// Deletes the element at index "idx"
+// Returns false if idx is out of bounds
+bool doublyLinkedList_delete(int idx);
 
-// Moves the iterator "n" positions forward or to the last element if there aren't enough elements
-// Returns false if the iterator cannot be moved
-bool doublyLinkedList_advanceIteratorNTimes(int n);
+// Deletes "data", an element returned by the list, in O(1)
+// Returns false if it was already deleted
+bool doublyLinkedList_deleteElement(void *data);
 
-// Moves the iterator "n" positions backwards or to the last element if there aren't enough elements
-// Returns false if the iterator cannot be moved
-bool doublyLinkedList_rewindIteratorNTimes(int n);
+// Returns the element before "data", an element in the list, or NULL if it is the head
+// Note: O(1); the result is only stable while no other writer changes the list
+void *doublyLinkedList_getPreviousElement(void *data);
 
-bool doublyLinkedList_delete(int idx);
+// Frees the memory of an element handed to the "free_data" callback
+void doublyLinkedList_freeElement(void *data);
 
 #endif // DOUBLY_LINKED_LIST_H
@@ -0,0 +1,251 @@
+/**
+ * @file epoch.c
+ * @brief This is a source file for the epoch module.
+ *
+ * This source file contains the declaration of the functions
+ * for the epoch module, which provides epoch based reclamation:
+ * readers walk shared data without locks, and memory that writers
+ * unlink is only freed once no reader can still be looking at it.
+ *
+ * Every reader thread owns a slot where it publishes the global epoch
+ * it entered with. The global epoch only moves forward once every active
+ * reader has caught up with it, so memory retired in epoch "e" is safe to
+ * free once the global epoch reaches e + 2.
+ *
+ * A slot is given back when its thread exits, or earlier through
+ * Epoch_threadExit(). Threads that find no slot
+ * free share an overflow path instead: they count themselves, under a
+ * mutex, among the readers of the epoch they entered. Since the global
+ * epoch only moves once every reader is in it, readers are only ever in
+ * the current epoch or the one before, so a count per parity of the
+ * epoch is enough.
+ *
+ * @author Amirhossein Etaati
+ * @date 2023-04-06
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "epoch.h"
+
+struct Slot
+{
+    unsigned long epoch;
+    int active;
+    int in_use;
+    char padding[64 - sizeof(unsigned long) - 2 * sizeof(int)]; // one cache line per thread
+};
+
+struct Retired
+{
+    void *ptr;
+    void (*free_fn)(void *);
+    unsigned long epoch;
+    struct Retired *next;
+};
+
+static struct Slot slots[EPOCH_MAX_THREADS];
+static unsigned long global_epoch = 0;
+
+static __thread int thread_slot = -1;
+static __thread int thread_depth = 0;
+// the epoch a thread without a slot entered with
+static __thread unsigned long thread_overflow_epoch = 0;
+
+// gives the slot of a thread back as it exits
+static pthread_once_t keyOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t slot_key;
+
+// readers without a slot, per parity of the epoch they entered with
+static pthread_mutex_t overflowMutex = PTHREAD_MUTEX_INITIALIZER;
+static int overflow_readers[2] = {0, 0};
+
+static pthread_mutex_t retireMutex = PTHREAD_MUTEX_INITIALIZER;
+static struct Retired *retired = NULL;
+
+// Private functions definitions
+static void createKey(void);
+static int claimSlot(void);
+static void releaseSlot(void *slot);
+static bool tryAdvance(void);
+static void collect(void);
+
+//------------------------------------------------
+//////////////// Public Functions ////////////////
+//------------------------------------------------
+
+void Epoch_enter(void)
+{
+    if (thread_depth++ > 0)
+    {
+        return;
+    }
+    if (thread_slot < 0)
+    {
+        thread_slot = claimSlot();
+    }
+    if (thread_slot < 0)
+    {
+        pthread_mutex_lock(&overflowMutex);
+        thread_overflow_epoch = __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE);
+        overflow_readers[thread_overflow_epoch & 1]++;
+        pthread_mutex_unlock(&overflowMutex);
+        return;
+    }
+    struct Slot *slot = &slots[thread_slot];
+    __atomic_store_n(&slot->active, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->epoch, __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE), __ATOMIC_RELAXED);
+    // publish the slot before reading any shared pointer
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void Epoch_exit(void)
+{
+    if (--thread_depth > 0)
+    {
+        return;
+    }
+    if (thread_slot < 0)
+    {
+        pthread_mutex_lock(&overflowMutex);
+        overflow_readers[thread_overflow_epoch & 1]--;
+        pthread_mutex_unlock(&overflowMutex);
+        return;
+    }
+    __atomic_store_n(&slots[thread_slot].active, 0, __ATOMIC_RELEASE);
+}
+
+void Epoch_threadExit(void)
+{
+    if (thread_slot < 0)
+    {
+        return;
+    }
+    pthread_setspecific(slot_key, NULL);
+    releaseSlot(&slots[thread_slot]);
+    thread_slot = -1;
+}
+
+void Epoch_retire(void *ptr, void (*free_fn)(void *))
+{
+    struct Retired *item = malloc(sizeof(*item));
+    if (item == NULL)
+    {
+        fprintf(stderr, "%s\n", "Epoch_retire(): Error - There was a problem allocating memory.");
+        exit(1);
+    }
+    item->ptr = ptr;
+    item->free_fn = free_fn;
+
+    pthread_mutex_lock(&retireMutex);
+    item->epoch = __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE);
+    item->next = retired;
+    retired = item;
+
+    // with no reader in the way this frees "ptr" right away
+    if (tryAdvance())
+    {
+        tryAdvance();
+    }
+    collect();
+    pthread_mutex_unlock(&retireMutex);
+}
+
+void Epoch_cleanup(void)
+{
+    pthread_mutex_lock(&retireMutex);
+    while (retired != NULL)
+    {
+        struct Retired *item = retired;
+        retired = item->next;
+        item->free_fn(item->ptr);
+        free(item);
+    }
+    pthread_mutex_unlock(&retireMutex);
+}
+
+//------------------------------------------------
+/////////////// Private Functions ////////////////
+//------------------------------------------------
+
+static void createKey(void)
+{
+    pthread_key_create(&slot_key, releaseSlot);
+}
+
+// Returns the slot the calling thread claimed until it exits, -1 if none is free
+static int claimSlot(void)
+{
+    pthread_once(&keyOnce, createKey);
+    for (int i = 0; i < EPOCH_MAX_THREADS; i++)
+    {
+        int expected = 0;
+        if (__atomic_compare_exchange_n(&slots[i].in_use, &expected, 1, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+        {
+            pthread_setspecific(slot_key, &slots[i]);
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Called by a thread with a slot as it exits
+static void releaseSlot(void *slot)
+{
+    __atomic_store_n(&((struct Slot *)slot)->active, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&((struct Slot *)slot)->in_use, 0, __ATOMIC_RELEASE);
+}
+
+// Moves the global epoch forward if every active reader is in the current one
+// Note: caller must hold retireMutex
+static bool tryAdvance(void)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    unsigned long epoch = __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < EPOCH_MAX_THREADS; i++)
+    {
+        if (!__atomic_load_n(&slots[i].in_use, __ATOMIC_ACQUIRE))
+        {
+            continue;
+        }
+        if (__atomic_load_n(&slots[i].active, __ATOMIC_ACQUIRE) &&
+            __atomic_load_n(&slots[i].epoch, __ATOMIC_ACQUIRE) != epoch)
+        {
+            return false;
+        }
+    }
+    // readers without a slot enter under the same mutex, so none slips in with the previous epoch
+    pthread_mutex_lock(&overflowMutex);
+    bool advanced = overflow_readers[(epoch + 1) & 1] == 0;
+    if (advanced)
+    {
+        __atomic_store_n(&global_epoch, epoch + 1, __ATOMIC_SEQ_CST);
+    }
+    pthread_mutex_unlock(&overflowMutex);
+    return advanced;
+}
+
+// Frees what was retired at least two epochs ago
+// Note: caller must hold retireMutex
+static void collect(void)
+{
+    unsigned long epoch = __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE);
+    struct Retired **link = &retired;
+    while (*link != NULL)
+    {
+        struct Retired *item = *link;
+        if (item->epoch + 2 <= epoch)
+        {
+            *link = item->next;
+            item->free_fn(item->ptr);
+            free(item);
+        }
+        else
+        {
+            link = &item->next;
+        }
+    }
+}
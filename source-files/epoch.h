@@ -0,0 +1,41 @@
+/**
+ * @file epoch.h
+ * @brief This is a header file for the epoch module.
+ *
+ * This header file contains the definitions of the functions
+ * for the epoch module, which provides epoch based reclamation:
+ * readers walk shared data without locks, and memory that writers
+ * unlink is only freed once no reader can still be looking at it.
+ *
+ * @author Amirhossein Etaati
+ * @date 2023-04-06
+ */
+
+#if !defined(EPOCH_H)
+#define EPOCH_H
+
+// Threads that can be in read sections without locking, at once: a slot is given back when its thread
+// exits, and the threads beyond share a slower path under a mutex
+#define EPOCH_MAX_THREADS 32
+
+// Starts a read section: anything reachable from shared data stays allocated until Epoch_exit()
+// Note: never waits for a writer; sections can be nested
+void Epoch_enter(void);
+
+// Ends the read section started by the matching Epoch_enter()
+void Epoch_exit(void);
+
+// Gives the slot of the calling thread back before it exits, so a thread started in its place finds it
+// free; it is given back at the exit of the thread otherwise
+// Note: only call outside of a read section
+void Epoch_threadExit(void);
+
+// Frees "ptr" with "free_fn" once every read section that could have seen it has ended
+// Note: "ptr" must already be unreachable for new readers
+void Epoch_retire(void *ptr, void (*free_fn)(void *));
+
+// Frees everything still waiting to be reclaimed
+// Note: only call once no other thread can be inside a read section
+void Epoch_cleanup(void);
+
+#endif // EPOCH_H
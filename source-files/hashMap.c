@@ -0,0 +1,228 @@
+/**
+ * @file hashMap.c
+ * @brief This is a source file for the hashMap module.
+ *
+ * This source file contains the declaration of the functions
+ * for the hashMap module, which provides an open addressing
+ * hash table from 64-bit keys to pointers.
+ *
+ * Linear probing over a power of two table, kept at most 3/4 full.
+ * Removed entries leave a tombstone and slots are never reused, so a
+ * reader probing without a lock only ever sees a slot go from free to
+ * used to removed. Once the table fills up with used and removed slots
+ * it is rebuilt and the new copy is published; the old one is retired
+ * through the epoch module.
+ *
+ * @author Amirhossein Etaati
+ * @date 2023-04-04
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "hashMap.h"
+#include "epoch.h"
+
+// value of a removed entry
+static char tombstone;
+#define TOMBSTONE ((void *)&tombstone)
+
+struct Entry
+{
+    uint64_t key;
+    void *value; // NULL if the slot was never used
+};
+
+struct Table
+{
+    unsigned int capacity; // always a power of two
+    unsigned int used;     // slots holding an entry or a tombstone
+    struct Entry entries[];
+};
+
+struct hashMap
+{
+    struct Table *table;
+    unsigned int size;
+};
+
+// Private functions definitions
+static unsigned int slot_for(uint64_t key, unsigned int capacity);
+static struct Table *alloc_table(unsigned int capacity);
+static void rehash(hashMap_t *map);
+
+//------------------------------------------------
+//////////////// Public Functions ////////////////
+//------------------------------------------------
+
+hashMap_t *hashMap_create(unsigned int capacity)
+{
+    hashMap_t *map = malloc(sizeof(*map));
+    if (map == NULL)
+    {
+        fprintf(stderr, "%s\n", "hashMap_create(): Error - There was a problem allocating memory.");
+        exit(1);
+    }
+    unsigned int table_size = 16;
+    while (table_size < capacity + capacity / 3)
+    {
+        table_size *= 2;
+    }
+    map->table = alloc_table(table_size);
+    map->size = 0;
+    return map;
+}
+
+void hashMap_destroy(hashMap_t *map)
+{
+    if (map == NULL)
+    {
+        return;
+    }
+    free(map->table);
+    free(map);
+}
+
+void hashMap_put(hashMap_t *map, uint64_t key, void *value)
+{
+    if (value == NULL)
+    {
+        hashMap_remove(map, key);
+        return;
+    }
+    if ((map->table->used + 1) * 4 > map->table->capacity * 3)
+    {
+        rehash(map);
+    }
+
+    struct Table *table = map->table;
+    unsigned int mask = table->capacity - 1;
+    unsigned int slot = slot_for(key, table->capacity);
+    while (table->entries[slot].value != NULL)
+    {
+        if (table->entries[slot].key == key && table->entries[slot].value != TOMBSTONE)
+        {
+            __atomic_store_n(&table->entries[slot].value, value, __ATOMIC_RELEASE);
+            return;
+        }
+        slot = (slot + 1) & mask;
+    }
+    // the key must be in place before a reader can see the slot as used
+    table->entries[slot].key = key;
+    __atomic_store_n(&table->entries[slot].value, value, __ATOMIC_RELEASE);
+    table->used++;
+    __atomic_add_fetch(&map->size, 1, __ATOMIC_RELAXED);
+}
+
+void *hashMap_get(hashMap_t *map, uint64_t key)
+{
+    Epoch_enter();
+    struct Table *table = __atomic_load_n(&map->table, __ATOMIC_ACQUIRE);
+    unsigned int mask = table->capacity - 1;
+    unsigned int slot = slot_for(key, table->capacity);
+    void *found = NULL;
+    void *value;
+    while ((value = __atomic_load_n(&table->entries[slot].value, __ATOMIC_ACQUIRE)) != NULL)
+    {
+        if (value != TOMBSTONE && table->entries[slot].key == key)
+        {
+            found = value;
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+    Epoch_exit();
+    return found;
+}
+
+void *hashMap_remove(hashMap_t *map, uint64_t key)
+{
+    struct Table *table = map->table;
+    unsigned int mask = table->capacity - 1;
+    unsigned int slot = slot_for(key, table->capacity);
+    while (table->entries[slot].value != NULL)
+    {
+        void *value = table->entries[slot].value;
+        if (value != TOMBSTONE && table->entries[slot].key == key)
+        {
+            __atomic_store_n(&table->entries[slot].value, TOMBSTONE, __ATOMIC_RELEASE);
+            __atomic_sub_fetch(&map->size, 1, __ATOMIC_RELAXED);
+            return value;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return NULL;
+}
+
+unsigned int hashMap_getSize(hashMap_t *map)
+{
+    return __atomic_load_n(&map->size, __ATOMIC_RELAXED);
+}
+
+uint64_t hashMap_hashString(const char *str)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    while (*str != '\0')
+    {
+        hash ^= (unsigned char)*str;
+        hash *= 1099511628211ULL;
+        str++;
+    }
+    return hash;
+}
+
+//------------------------------------------------
+/////////////// Private Functions ////////////////
+//------------------------------------------------
+
+static unsigned int slot_for(uint64_t key, unsigned int capacity)
+{
+    // mix the bits so sequential keys do not cluster
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return (unsigned int)key & (capacity - 1);
+}
+
+static struct Table *alloc_table(unsigned int capacity)
+{
+    struct Table *table = calloc(1, sizeof(struct Table) + capacity * sizeof(struct Entry));
+    if (table == NULL)
+    {
+        fprintf(stderr, "%s\n", "hashMap_alloc_table(): Error - There was a problem allocating memory.");
+        exit(1);
+    }
+    table->capacity = capacity;
+    table->used = 0;
+    return table;
+}
+
+// Copies the live entries to a fresh table, doubling it if they fill more than half of it
+static void rehash(hashMap_t *map)
+{
+    struct Table *old_table = map->table;
+    unsigned int capacity = old_table->capacity;
+    if (map->size * 2 >= capacity)
+    {
+        capacity *= 2;
+    }
+    struct Table *table = alloc_table(capacity);
+    unsigned int mask = capacity - 1;
+    for (unsigned int i = 0; i < old_table->capacity; i++)
+    {
+        struct Entry *entry = &old_table->entries[i];
+        if (entry->value == NULL || entry->value == TOMBSTONE)
+        {
+            continue;
+        }
+        unsigned int slot = slot_for(entry->key, capacity);
+        while (table->entries[slot].value != NULL)
+        {
+            slot = (slot + 1) & mask;
+        }
+        table->entries[slot] = *entry;
+        table->used++;
+    }
+    __atomic_store_n(&map->table, table, __ATOMIC_RELEASE);
+    Epoch_retire(old_table, free);
+}
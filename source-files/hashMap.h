@@ -0,0 +1,47 @@
+/**
+ * @file hashMap.h
+ * @brief This is a header file for the hashMap module.
+ *
+ * This header file contains the definitions of the functions
+ * for the hashMap module, which provides an open addressing
+ * hash table from 64-bit keys to pointers.
+ *
+ * Thread safety: hashMap_get() never blocks and may run alongside a writer;
+ * calls that modify a map must be serialized by the caller. A value that
+ * was read stays valid only as long as its owner keeps it alive.
+ *
+ * @author Amirhossein Etaati
+ * @date 2023-04-04
+ */
+
+#if !defined(HASH_MAP_H)
+#define HASH_MAP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct hashMap hashMap_t;
+
+// Returns a newly allocated empty map that can hold "capacity" entries before growing
+// Note: caller should call hashMap_destroy() to free the memory
+hashMap_t *hashMap_create(unsigned int capacity);
+
+// Frees the map (the values are not freed)
+void hashMap_destroy(hashMap_t *map);
+
+// Adds or replaces the value stored for "key"
+void hashMap_put(hashMap_t *map, uint64_t key, void *value);
+
+// Returns the value stored for "key" or NULL if there is none
+void *hashMap_get(hashMap_t *map, uint64_t key);
+
+// Removes "key" from the map and returns its value, or NULL if there was none
+void *hashMap_remove(hashMap_t *map, uint64_t key);
+
+// Returns the number of entries in the map
+unsigned int hashMap_getSize(hashMap_t *map);
+
+// Returns the 64-bit FNV-1a hash of a null-terminated string, to be used as a key
+uint64_t hashMap_hashString(const char *str);
+
+#endif // HASH_MAP_H
@@ -0,0 +1,1675 @@
+/**
+ * @file httpServer.c
+ * @brief This is a source file for the httpServer module.
+ *
+ * This source file contains the declaration of the functions
+ * for the httpServer module, which serves the upload, delete and song
+ * requests of the web interface (see httpServer.h).
+ *
+ * A thread accepts the connections and hands each one to a thread of its
+ * own, at most HTTP_SERVER_MAX_CLIENTS plus HTTP_SERVER_MAX_STREAMS at a
+ * time, of which no more than the configured number may stream songs. A
+ * connection carries a single request. An upload never sits in memory: the multipart body goes
+ * through a BODY_BUFFER_SIZE buffer straight into a hidden file of the
+ * songs directory, which the songWatcher module ignores until the song is
+ * handed to it complete.
+ *
+ * Receiving, converting and writing an upload overlap. Once its first
+ * WAV_HEADER_SIZE bytes arrived, a WAV file in the format the audio player
+ * plays is written as is; anything else is piped into ffmpeg as it arrives,
+ * at the low priority of the queued conversions (see
+ * mp3ToWave_startStream()). The pipe is the bounded buffer between the
+ * stages: while ffmpeg is behind, writing into it blocks, the body is no
+ * longer read and TCP slows the client down. When the last byte arrived,
+ * only the tail of the conversion is left. The time spent in each stage is
+ * printed and sent back with the reply.
+ *
+ * A song is streamed with sendfile(), from the page cache to the socket
+ * without a copy in between, at most a send buffer at a time. The thread
+ * streaming it lowers its CPU and disk priority, so a stream is only
+ * served while the audio player has nothing to do, and a client that
+ * stops reading is dropped after SOCKET_TIMEOUT_S.
+ *
+ * @author Amirhossein Etaati
+ * @date 2023-04-13
+ */
+
+// for memmem(), accept4() and syscall()
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+
+#include "httpServer.h"
+#include "songManager.h"
+#include "songWatcher.h"
+#include "epoch.h"
+#include "mp3ToWav.h"
+#include "audio_player.h"
+#include "metrics.h"
+#include "logger.h"
+#include "trace.h"
+
+// Largest request line and headers
+#define HEADER_MAX_SIZE 8192
+// Part of an upload held in memory at a time
+#define BODY_BUFFER_SIZE (16 * 1024)
+// Largest delete request body
+#define DELETE_BODY_MAX_SIZE 1024
+// JSON reply of an upload or a delete, which names the uploaded file twice
+#define REPLY_MAX_SIZE (2 * NAME_MAX + 256)
+// Longest boundary allowed by RFC 2046
+#define BOUNDARY_MAX_LENGTH 70
+#define FIELD_MAX_SIZE 128
+// Time a client may stay silent before its connection is dropped
+#define SOCKET_TIMEOUT_S 10
+// Time between checks for cleanup while no connection arrives
+#define IDLE_POLL_MS 250
+// Body bytes read and dropped after an early reply, so the client gets the reply
+#define DRAIN_MAX_SIZE (64 * 1024)
+
+// Bytes of an uploaded file looked at before deciding whether it needs to be converted
+#define WAV_HEADER_SIZE 44
+#define UNKNOWN_ARTIST "Unknown artist"
+#define UNKNOWN_ALBUM "Unknown album"
+
+// Part of the song list built before it is sent
+#define LIST_BUFFER_SIZE (16 * 1024)
+#define SONGS_PATH "/songs"
+#define METRICS_PATH "/metrics"
+// Starting size of the metrics text, grown when the registry outgrows it
+#define METRICS_BUFFER_SIZE (16 * 1024)
+#define TRACE_PATH "/trace"
+#define ETAG_MAX_SIZE 64
+
+// Not in the C library (see ioprio_set(2))
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_CLASS_SHIFT 13
+
+typedef struct
+{
+    int fd; // -1 while the slot is free
+} client_t;
+
+typedef struct
+{
+    char head[HEADER_MAX_SIZE + 1];
+    size_t received;  // bytes of "head" received, may go past the headers
+    size_t head_size; // size of the request line and headers
+    const char *method;
+    const char *path;
+    const char *headers; // the header lines, null-terminated
+} request_t;
+
+typedef struct
+{
+    int fd;
+    char data[BODY_BUFFER_SIZE];
+    size_t length;
+    size_t remaining;     // not received yet
+    long long receive_us; // spent waiting for the body
+} body_reader_t;
+
+typedef enum
+{
+    PART_IGNORED,
+    PART_FILE,
+    PART_SINGER,
+    PART_ALBUM,
+    PART_SONG
+} part_t;
+
+typedef struct
+{
+    int status; // of the first error, 0 while there is none
+    const char *error;
+    char file_name[NAME_MAX + 1];
+    char song_name[NAME_MAX + 1]; // "file_name" as a WAV file
+    char temp_path[PATH_MAX]; // the WAV file until it is complete
+    int file_fd;              // of "temp_path", or the input of "stream"
+    bool has_file;
+    bool is_mp3;
+    bool output_started; // once the start of the file was looked at
+    bool converting;     // through "stream"
+    mp3ToWave_stream_t stream;
+    unsigned char header[WAV_HEADER_SIZE]; // the start of the file, until the output is chosen
+    size_t header_length;
+    size_t file_size;
+    char fields[PART_SONG + 1][FIELD_MAX_SIZE];
+    // time spent in each stage
+    long long write_us;  // writing the file or feeding the converter, waiting while it is behind
+    long long finish_us; // waiting for the converter after the last byte
+    long long ingest_us; // adding the song
+} upload_t;
+
+typedef struct
+{
+    int fd;
+    char data[LIST_BUFFER_SIZE];
+    size_t length;
+    bool failed; // once sending failed, nothing more is sent
+} writer_t;
+
+static pthread_t httpServerThreadId;
+static bool stoppingServer = false;
+static bool is_module_initialized = false;
+
+static char songs_directory[PATH_MAX];
+static int listen_fd = -1;
+static int next_upload = 0;
+
+static client_t clients[HTTP_SERVER_MAX_CLIENTS + HTTP_SERVER_MAX_STREAMS];
+static int num_clients = 0;
+static pthread_mutex_t clientsMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t clientsDone = PTHREAD_COND_INITIALIZER;
+
+// protected by clientsMutex
+static httpServer_streamStats_t stream_stats = {
+    .max_streams = HTTP_SERVER_DEFAULT_STREAMS,
+    .buffer_size = HTTP_SERVER_DEFAULT_STREAM_BUFFER_SIZE,
+};
+
+// Metrics, see metrics.h
+static metrics_counter_t requests_metric;
+static metrics_gauge_t streaming_metric;
+static metrics_counter_t served_metric;
+static metrics_counter_t rejected_metric;
+
+// Private functions definitions
+static void *httpServerThread(void *arg);
+static void *clientThread(void *arg);
+static bool startClient(int fd);
+static void serveClient(int fd);
+static int readRequestHead(int fd, request_t *request);
+static int serveUpload(body_reader_t *body, const char *boundary, char *reply, size_t size);
+static int serveDelete(body_reader_t *body, char *reply, size_t size);
+static void serveSongList(int fd, bool head_only);
+static void serveMetrics(int fd, bool head_only);
+static void serveTrace(int fd, bool head_only);
+static bool sendTrace(const char *text, size_t length, void *context);
+static void collectMetrics(void);
+static void serveSong(int fd, const request_t *request, song_id_t id, bool head_only);
+static bool startStream(int *buffer_size);
+static void stopStream(bool served);
+static int parseRange(const char *value, long long size, long long *first, long long *last);
+static bool sendFile(int fd, int file_fd, long long offset, long long size, int chunk_size);
+static void lowerPriority(void);
+static void writeText(writer_t *writer, const char *text, size_t length);
+static void writeJsonString(writer_t *writer, const char *string);
+static void flushWriter(writer_t *writer);
+static bool parseMultipart(body_reader_t *body, const char *boundary, upload_t *upload);
+static void startPart(upload_t *upload, const char *headers, part_t *part);
+static void writePart(upload_t *upload, part_t *part, const char *data, size_t size);
+static void startOutput(upload_t *upload);
+static void writeOutput(upload_t *upload, const void *data, size_t size);
+static void closeOutput(upload_t *upload);
+static void finishUpload(upload_t *upload);
+static void failUpload(upload_t *upload, int status, const char *error);
+static bool fillBody(body_reader_t *body);
+static void consumeBody(body_reader_t *body, size_t size);
+static bool getHeader(const char *headers, const char *name, char *value, size_t size);
+static bool getParameter(const char *value, const char *name, char *parameter, size_t size);
+static bool getJsonString(const char *json, const char *name, char *string, size_t size);
+static bool isValidFileName(const char *name);
+static bool isPlayableWav(const unsigned char *header, size_t size);
+static bool hasExtension(const char *name, const char *extension);
+static bool buildPath(const char *name, char *path, size_t size);
+static void sendResponse(int fd, int status, const char *body);
+static void sendMessage(int fd, int status, const char *message);
+static bool sendAll(int fd, const char *data, size_t size);
+static const char *getReason(int status);
+static long long getTimeInUs(void);
+
+//------------------------------------------------
+//////////////// Public Functions ////////////////
+//------------------------------------------------
+
+void httpServer_init(const char *songs_dir)
+{
+    snprintf(songs_directory, sizeof(songs_directory), "%s", songs_dir);
+    metrics_registerCounter(&requests_metric, "beaglepod_http_requests_total", NULL, "HTTP requests received");
+    metrics_registerGauge(&streaming_metric, "beaglepod_http_streams", NULL, "Songs being streamed");
+    metrics_registerCounter(&served_metric, "beaglepod_http_streams_served_total", NULL, "Streams sent completely");
+    metrics_registerCounter(&rejected_metric, "beaglepod_http_streams_rejected_total", NULL,
+                            "Streams answered with 503");
+    metrics_registerCollector(collectMetrics);
+    for (int i = 0; i < HTTP_SERVER_MAX_CLIENTS + HTTP_SERVER_MAX_STREAMS; i++)
+    {
+        clients[i].fd = -1;
+    }
+
+    struct sockaddr_in sin;
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_ANY);
+    sin.sin_port = htons(HTTP_SERVER_PORT);
+
+    listen_fd = socket(PF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int reuse = 1;
+    if (listen_fd < 0 || setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0 ||
+        bind(listen_fd, (struct sockaddr *)&sin, sizeof(sin)) != 0 || listen(listen_fd, HTTP_SERVER_MAX_CLIENTS) != 0)
+    {
+        LOG_ERROR("Unable to serve HTTP on port %d", HTTP_SERVER_PORT);
+        if (listen_fd >= 0)
+        {
+            close(listen_fd);
+            listen_fd = -1;
+        }
+        return;
+    }
+
+    stoppingServer = false;
+    pthread_create(&httpServerThreadId, NULL, httpServerThread, NULL);
+    is_module_initialized = true;
+}
+
+void httpServer_cleanup(void)
+{
+    if (!is_module_initialized)
+    {
+        return;
+    }
+    __atomic_store_n(&stoppingServer, true, __ATOMIC_RELEASE);
+    pthread_join(httpServerThreadId, NULL);
+    close(listen_fd);
+    listen_fd = -1;
+
+    // wake the clients waiting on their connection; a conversion still runs to its end
+    pthread_mutex_lock(&clientsMutex);
+    for (int i = 0; i < HTTP_SERVER_MAX_CLIENTS + HTTP_SERVER_MAX_STREAMS; i++)
+    {
+        if (clients[i].fd >= 0)
+        {
+            shutdown(clients[i].fd, SHUT_RDWR);
+        }
+    }
+    while (num_clients > 0)
+    {
+        pthread_cond_wait(&clientsDone, &clientsMutex);
+    }
+    pthread_mutex_unlock(&clientsMutex);
+    is_module_initialized = false;
+}
+
+void httpServer_setStreamLimits(int max_streams, int buffer_size)
+{
+    max_streams = (max_streams < 0) ? 0 : max_streams;
+    max_streams = (max_streams > HTTP_SERVER_MAX_STREAMS) ? HTTP_SERVER_MAX_STREAMS : max_streams;
+    buffer_size = (buffer_size < HTTP_SERVER_MIN_STREAM_BUFFER_SIZE) ? HTTP_SERVER_MIN_STREAM_BUFFER_SIZE : buffer_size;
+    buffer_size = (buffer_size > HTTP_SERVER_MAX_STREAM_BUFFER_SIZE) ? HTTP_SERVER_MAX_STREAM_BUFFER_SIZE : buffer_size;
+    pthread_mutex_lock(&clientsMutex);
+    stream_stats.max_streams = max_streams;
+    stream_stats.buffer_size = buffer_size;
+    pthread_mutex_unlock(&clientsMutex);
+}
+
+void httpServer_getStreamStats(httpServer_streamStats_t *stats)
+{
+    pthread_mutex_lock(&clientsMutex);
+    *stats = stream_stats;
+    pthread_mutex_unlock(&clientsMutex);
+}
+
+//------------------------------------------------
+/////////////// Private Functions ////////////////
+//------------------------------------------------
+
+static void *httpServerThread(void *arg)
+{
+    struct pollfd listener = {.fd = listen_fd, .events = POLLIN};
+    while (!__atomic_load_n(&stoppingServer, __ATOMIC_ACQUIRE))
+    {
+        if (poll(&listener, 1, IDLE_POLL_MS) <= 0)
+        {
+            continue;
+        }
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            continue;
+        }
+        struct timeval timeout = {.tv_sec = SOCKET_TIMEOUT_S};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        if (!startClient(fd))
+        {
+            sendMessage(fd, 503, "The BeaglePod is busy - Try again later");
+            close(fd);
+        }
+    }
+    return NULL;
+}
+
+static void *clientThread(void *arg)
+{
+    client_t *client = arg;
+    // a converter that gave up makes writes into its pipe fail instead of killing the BeaglePod
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    serveClient(client->fd);
+    // the thread of the next client takes the slot this one read the library with
+    Epoch_threadExit();
+
+    pthread_mutex_lock(&clientsMutex);
+    close(client->fd);
+    client->fd = -1;
+    num_clients--;
+    pthread_cond_signal(&clientsDone);
+    pthread_mutex_unlock(&clientsMutex);
+    return NULL;
+}
+
+// Returns false if all the client slots are taken
+static bool startClient(int fd)
+{
+    pthread_mutex_lock(&clientsMutex);
+    client_t *client = NULL;
+    for (int i = 0; i < HTTP_SERVER_MAX_CLIENTS + HTTP_SERVER_MAX_STREAMS && client == NULL; i++)
+    {
+        if (clients[i].fd < 0)
+        {
+            client = &clients[i];
+        }
+    }
+    bool started = false;
+    if (client != NULL)
+    {
+        client->fd = fd;
+        pthread_t thread;
+        pthread_attr_t attributes;
+        pthread_attr_init(&attributes);
+        pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+        started = pthread_create(&thread, &attributes, clientThread, client) == 0;
+        pthread_attr_destroy(&attributes);
+        if (started)
+        {
+            num_clients++;
+        }
+        else
+        {
+            client->fd = -1;
+        }
+    }
+    pthread_mutex_unlock(&clientsMutex);
+    return started;
+}
+
+static void serveClient(int fd)
+{
+    // big buffers, kept off the stacks of the client threads
+    request_t *request = malloc(sizeof(*request));
+    body_reader_t *body = malloc(sizeof(*body));
+    if (request == NULL || body == NULL)
+    {
+        fprintf(stderr, "httpServer: Error - There was a problem allocating memory.");
+        exit(1);
+    }
+
+    int status = readRequestHead(fd, request);
+    metrics_increment(&requests_metric);
+    char value[BOUNDARY_MAX_LENGTH + 64];
+    long long content_length = -1;
+    bool replied = false;
+    if (status == 0 && strcmp(request->method, "OPTIONS") == 0)
+    {
+        // the web interface may be served from another origin
+        const char *preflight = "HTTP/1.1 204 No Content\r\n"
+                                "Access-Control-Allow-Origin: *\r\n"
+                                "Access-Control-Allow-Methods: GET, HEAD, POST, OPTIONS\r\n"
+                                "Access-Control-Allow-Headers: Content-Type, Range\r\n"
+                                "Connection: close\r\n\r\n";
+        sendAll(fd, preflight, strlen(preflight));
+        status = 204;
+        replied = true;
+    }
+    else if (status == 0 && strcmp(request->path, METRICS_PATH) == 0)
+    {
+        bool head_only = strcmp(request->method, "HEAD") == 0;
+        if (strcmp(request->method, "GET") != 0 && !head_only)
+        {
+            status = 405;
+        }
+        else
+        {
+            serveMetrics(fd, head_only);
+            status = 200;
+            replied = true;
+        }
+    }
+    else if (status == 0 && strcmp(request->path, TRACE_PATH) == 0)
+    {
+        bool head_only = strcmp(request->method, "HEAD") == 0;
+        if (strcmp(request->method, "GET") != 0 && !head_only)
+        {
+            status = 405;
+        }
+        else
+        {
+            serveTrace(fd, head_only);
+            status = 200;
+            replied = true;
+        }
+    }
+    else if (status == 0 && strncmp(request->path, SONGS_PATH, strlen(SONGS_PATH)) == 0 &&
+             (request->path[strlen(SONGS_PATH)] == '\0' || request->path[strlen(SONGS_PATH)] == '/'))
+    {
+        bool head_only = strcmp(request->method, "HEAD") == 0;
+        const char *id_text = request->path + strlen(SONGS_PATH);
+        char *end = NULL;
+        unsigned long long id = (*id_text == '/') ? strtoull(id_text + 1, &end, 10) : 0;
+        if (strcmp(request->method, "GET") != 0 && !head_only)
+        {
+            status = 405;
+        }
+        else if (*id_text == '\0')
+        {
+            serveSongList(fd, head_only);
+            replied = true;
+        }
+        else if (end == id_text + 1 || *end != '\0' || id_text[1] < '0' || id_text[1] > '9' || id == SONG_ID_INVALID)
+        {
+            status = 404;
+        }
+        else
+        {
+            serveSong(fd, request, id, head_only);
+            replied = true;
+        }
+        status = replied ? 200 : status;
+    }
+    else if (status == 0 && strcmp(request->path, "/upload") != 0 && strcmp(request->path, "/delete") != 0)
+    {
+        status = 404;
+    }
+    else if (status == 0 && strcmp(request->method, "POST") != 0)
+    {
+        status = 405;
+    }
+    else if (status == 0 && (getHeader(request->headers, "Transfer-Encoding", value, sizeof(value)) ||
+                             !getHeader(request->headers, "Content-Length", value, sizeof(value))))
+    {
+        status = 411;
+    }
+    else if (status == 0)
+    {
+        char *end = NULL;
+        content_length = strtoll(value, &end, 10);
+        if (end == value || *end != '\0' || content_length < 0)
+        {
+            status = 400;
+        }
+        else if (content_length > HTTP_SERVER_MAX_UPLOAD_SIZE ||
+                 (strcmp(request->path, "/delete") == 0 && content_length > DELETE_BODY_MAX_SIZE))
+        {
+            status = 413;
+        }
+    }
+
+    body->fd = fd;
+    body->length = 0;
+    body->remaining = 0;
+    body->receive_us = 0;
+    if (status == 0)
+    {
+        // the body may start in the bytes received with the headers
+        size_t early = request->received - request->head_size;
+        body->length = ((long long)early < content_length) ? early : (size_t)content_length;
+        memcpy(body->data, request->head + request->head_size, body->length);
+        body->remaining = content_length - body->length;
+
+        if (getHeader(request->headers, "Expect", value, sizeof(value)) && strcasecmp(value, "100-continue") == 0)
+        {
+            const char *proceed = "HTTP/1.1 100 Continue\r\n\r\n";
+            sendAll(fd, proceed, strlen(proceed));
+        }
+
+        char reply[REPLY_MAX_SIZE];
+        if (strcmp(request->path, "/upload") == 0)
+        {
+            char boundary[BOUNDARY_MAX_LENGTH + 1];
+            if (!getHeader(request->headers, "Content-Type", value, sizeof(value)) ||
+                strncasecmp(value, "multipart/form-data", strlen("multipart/form-data")) != 0 ||
+                !getParameter(value, "boundary", boundary, sizeof(boundary)))
+            {
+                sendMessage(fd, 400, "No file uploaded - You need to select a file");
+            }
+            else
+            {
+                sendResponse(fd, serveUpload(body, boundary, reply, sizeof(reply)), reply);
+            }
+        }
+        else
+        {
+            sendResponse(fd, serveDelete(body, reply, sizeof(reply)), reply);
+        }
+    }
+    else if (status > 0 && !replied)
+    {
+        sendMessage(fd, status, getReason(status));
+    }
+
+    // a client still sending its body would see its connection reset instead of the reply
+    shutdown(fd, SHUT_WR);
+    size_t drained = 0;
+    while (body->remaining > 0 && drained < DRAIN_MAX_SIZE)
+    {
+        size_t size = (body->remaining < sizeof(body->data)) ? body->remaining : sizeof(body->data);
+        ssize_t length = recv(fd, body->data, size, 0);
+        if (length <= 0)
+        {
+            break;
+        }
+        body->remaining -= length;
+        drained += length;
+    }
+    free(request);
+    free(body);
+}
+
+// Returns 0 once the request line and headers were received, the status of the error otherwise
+// (-1 if the client left without a request)
+static int readRequestHead(int fd, request_t *request)
+{
+    request->received = 0;
+    char *end = NULL;
+    while (end == NULL)
+    {
+        if (request->received == HEADER_MAX_SIZE)
+        {
+            return 431;
+        }
+        ssize_t length = recv(fd, request->head + request->received, HEADER_MAX_SIZE - request->received, 0);
+        if (length <= 0)
+        {
+            return (request->received > 0) ? 400 : -1;
+        }
+        request->received += length;
+        request->head[request->received] = '\0';
+        end = memmem(request->head, request->received, "\r\n\r\n", 4);
+    }
+    request->head_size = end - request->head + 4;
+    // keeps the line break ending the last header
+    end[2] = '\0';
+
+    // "<method> <path> HTTP/1.1"
+    char *path = strchr(request->head, ' ');
+    char *line_end = strstr(request->head, "\r\n");
+    char *version = (path != NULL) ? strchr(path + 1, ' ') : NULL;
+    if (path == NULL || version == NULL || version > line_end || strncmp(version + 1, "HTTP/1.", 7) != 0)
+    {
+        return 400;
+    }
+    *path++ = '\0';
+    *version = '\0';
+    char *query = strchr(path, '?');
+    if (query != NULL)
+    {
+        *query = '\0';
+    }
+    request->method = request->head;
+    request->path = path;
+    request->headers = line_end + 2;
+    return 0;
+}
+
+// Stores the uploaded song and writes the reply into "reply", returns the status of the reply
+static int serveUpload(body_reader_t *body, const char *boundary, char *reply, size_t size)
+{
+    long long start_us = getTimeInUs();
+    upload_t upload;
+    memset(&upload, 0, sizeof(upload));
+    upload.file_fd = -1;
+
+    if (!parseMultipart(body, boundary, &upload))
+    {
+        failUpload(&upload, 400, "No file uploaded - The upload was cut short");
+    }
+    else if (!upload.has_file && upload.status == 0)
+    {
+        failUpload(&upload, 400, "No file uploaded - You need to select a file");
+    }
+    finishUpload(&upload);
+
+    if (upload.status != 0)
+    {
+        snprintf(reply, size, "{\"msg\":\"%s\"}", upload.error);
+        return upload.status;
+    }
+    long long total_us = getTimeInUs() - start_us;
+    LOG_INFO("upload of <%s>, %zu bytes%s in %lld ms", upload.file_name, upload.file_size,
+             upload.converting ? " converted" : "", total_us / 1000);
+    // the file name was checked to need no escaping
+    snprintf(reply, size,
+             "{\"result\":true,\"msg\":\"File uploaded\",\"fileName\":\"%s\",\"filePath\":\"/uploads/%s\","
+             "\"timing_ms\":{\"receive\":%lld,\"write\":%lld,\"finish\":%lld,\"ingest\":%lld,\"total\":%lld}}",
+             upload.file_name, upload.file_name, body->receive_us / 1000, upload.write_us / 1000,
+             upload.finish_us / 1000, upload.ingest_us / 1000, total_us / 1000);
+    return 200;
+}
+
+// Deletes the song named in the JSON body and writes the reply into "reply", returns the status of the reply
+static int serveDelete(body_reader_t *body, char *reply, size_t size)
+{
+    // the whole body fits, its size was checked
+    while (body->remaining > 0)
+    {
+        if (!fillBody(body))
+        {
+            snprintf(reply, size, "{\"msg\":\"%s\"}", getReason(400));
+            return 400;
+        }
+    }
+    body->data[body->length] = '\0';
+
+    char name[NAME_MAX + 1];
+    char path[PATH_MAX];
+    if (!getJsonString(body->data, "name", name, sizeof(name)) || !isValidFileName(name))
+    {
+        snprintf(reply, size, "{\"msg\":\"No song deleted - The name is not valid\"}");
+        return 400;
+    }
+    // the song of an uploaded MP3 file is its WAV file
+    char song_name[NAME_MAX + 1];
+    snprintf(song_name, sizeof(song_name), "%.*s.wav", (int)(strlen(name) - strlen(".mp3")), name);
+    if (buildPath(song_name, path, sizeof(path)))
+    {
+        songManager_deleteSongByPath(path);
+        unlink(path);
+    }
+    // files uploaded through the Node server kept their MP3 file
+    if (strcmp(name, song_name) != 0 && buildPath(name, path, sizeof(path)))
+    {
+        unlink(path);
+    }
+    snprintf(reply, size, "{\"result\":true,\"msg\":\"Song deleted!\"}");
+    return 200;
+}
+
+// Sends the songs of the library as a JSON array, without a Content-Length: the connection ends the body
+// Note: the ids are strings, they do not fit in a JavaScript number
+static void serveSongList(int fd, bool head_only)
+{
+    const char *head = "HTTP/1.1 200 OK\r\n"
+                       "Access-Control-Allow-Origin: *\r\n"
+                       "Content-Type: application/json\r\n"
+                       "Connection: close\r\n\r\n";
+    if (!sendAll(fd, head, strlen(head)) || head_only)
+    {
+        return;
+    }
+
+    writer_t *writer = malloc(sizeof(*writer));
+    if (writer == NULL)
+    {
+        fprintf(stderr, "httpServer: Error - There was a problem allocating memory.");
+        exit(1);
+    }
+    writer->fd = fd;
+    writer->length = 0;
+    writer->failed = false;
+    writeText(writer, "[", 1);
+    bool first = true;
+    songManager_readLock();
+    int count = songManager_getNumberSongs();
+    for (int i = 0; i < count && !writer->failed; i++)
+    {
+        song_info *song = songManager_getSongAt(i);
+        if (song == NULL)
+        {
+            continue;
+        }
+        char id[64];
+        int length = snprintf(id, sizeof(id), "%s{\"id\":\"%llu\",\"name\":", first ? "" : ",", (unsigned long long)song->id);
+        writeText(writer, id, length);
+        writeJsonString(writer, song->song_name);
+        writeText(writer, ",\"artist\":", strlen(",\"artist\":"));
+        writeJsonString(writer, song->author_name);
+        writeText(writer, ",\"album\":", strlen(",\"album\":"));
+        writeJsonString(writer, song->album);
+        writeText(writer, "}", 1);
+        first = false;
+    }
+    songManager_readUnlock();
+    writeText(writer, "]", 1);
+    flushWriter(writer);
+    free(writer);
+}
+
+// Sends the metrics of every module in the Prometheus text format
+static void serveMetrics(int fd, bool head_only)
+{
+    char *text = NULL;
+    size_t size = 0;
+    size_t length = METRICS_BUFFER_SIZE;
+    while (length >= size)
+    {
+        // too small, retried with the length asked for and some room for metrics registered meanwhile
+        free(text);
+        size = length + 1024;
+        text = malloc(size);
+        if (text == NULL)
+        {
+            fprintf(stderr, "httpServer: Error - There was a problem allocating memory.");
+            exit(1);
+        }
+        length = metrics_format(text, size);
+    }
+
+    char head[256];
+    int head_length = snprintf(head, sizeof(head),
+                               "HTTP/1.1 200 OK\r\n"
+                               "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                               "Content-Length: %zu\r\n"
+                               "Connection: close\r\n\r\n",
+                               length);
+    if (sendAll(fd, head, head_length) && !head_only)
+    {
+        sendAll(fd, text, length);
+    }
+    free(text);
+}
+
+// Sends the steps traced, its length is not known before: the end of the connection ends it
+static void serveTrace(int fd, bool head_only)
+{
+    const char *head = "HTTP/1.1 200 OK\r\n"
+                       "Content-Type: application/json\r\n"
+                       "Content-Disposition: attachment; filename=\"beaglepod-trace.json\"\r\n"
+                       "Access-Control-Allow-Origin: *\r\n"
+                       "Connection: close\r\n\r\n";
+    if (sendAll(fd, head, strlen(head)) && !head_only)
+    {
+        trace_dump(sendTrace, &fd);
+    }
+}
+
+static bool sendTrace(const char *text, size_t length, void *context)
+{
+    return sendAll(*(int *)context, text, length);
+}
+
+static void collectMetrics(void)
+{
+    httpServer_streamStats_t current;
+    httpServer_getStreamStats(&current);
+    metrics_set(&streaming_metric, current.streaming);
+    metrics_setCounter(&served_metric, current.served);
+    metrics_setCounter(&rejected_metric, current.rejected);
+}
+
+// Sends the song with "id", or the range of it asked for
+static void serveSong(int fd, const request_t *request, song_id_t id, bool head_only)
+{
+    int buffer_size = 0;
+    if (!startStream(&buffer_size))
+    {
+        sendMessage(fd, 503, "Too many songs are streamed - Try again later");
+        return;
+    }
+
+    // the open file stays readable even if the song is deleted meanwhile
+    char path[PATH_MAX] = "";
+    songManager_readLock();
+    song_info *song = songManager_findById(id);
+    if (song != NULL)
+    {
+        snprintf(path, sizeof(path), "%s", song->song_path);
+    }
+    songManager_readUnlock();
+    int file_fd = (song != NULL) ? open(path, O_RDONLY | O_CLOEXEC) : -1;
+    struct stat info;
+    if (file_fd < 0 || fstat(file_fd, &info) != 0 || !S_ISREG(info.st_mode))
+    {
+        sendMessage(fd, 404, "Song not found");
+        if (file_fd >= 0)
+        {
+            close(file_fd);
+        }
+        stopStream(false);
+        return;
+    }
+
+    long long size = info.st_size;
+    long long first = 0;
+    long long last = size - 1;
+    char etag[ETAG_MAX_SIZE];
+    snprintf(etag, sizeof(etag), "\"%llx-%llx-%llx\"", (unsigned long long)id, (unsigned long long)size,
+             (unsigned long long)info.st_mtime);
+    // a Range of a copy the client holds that changed since is ignored (RFC 9110, section 13.1.5)
+    char range[128];
+    char condition[ETAG_MAX_SIZE];
+    int range_status = 0;
+    if (getHeader(request->headers, "Range", range, sizeof(range)) &&
+        (!getHeader(request->headers, "If-Range", condition, sizeof(condition)) || strcmp(condition, etag) == 0))
+    {
+        range_status = parseRange(range, size, &first, &last);
+    }
+
+    char head[512];
+    int length = 0;
+    if (range_status < 0)
+    {
+        length = snprintf(head, sizeof(head),
+                          "HTTP/1.1 416 Range Not Satisfiable\r\n"
+                          "Access-Control-Allow-Origin: *\r\n"
+                          "Content-Range: bytes */%lld\r\n"
+                          "Content-Length: 0\r\n"
+                          "Connection: close\r\n\r\n",
+                          size);
+        sendAll(fd, head, length);
+        close(file_fd);
+        stopStream(false);
+        return;
+    }
+
+    char content_range[96] = "";
+    if (range_status > 0)
+    {
+        snprintf(content_range, sizeof(content_range), "Content-Range: bytes %lld-%lld/%lld\r\n", first, last, size);
+    }
+    length = snprintf(head, sizeof(head),
+                      "HTTP/1.1 %s\r\n"
+                      "Access-Control-Allow-Origin: *\r\n"
+                      "Access-Control-Expose-Headers: Accept-Ranges, Content-Range\r\n"
+                      "Accept-Ranges: bytes\r\n"
+                      "Content-Type: audio/wav\r\n"
+                      "ETag: %s\r\n"
+                      "%s"
+                      "Content-Length: %lld\r\n"
+                      "Connection: close\r\n\r\n",
+                      (range_status > 0) ? "206 Partial Content" : "200 OK", etag, content_range, last - first + 1);
+
+    lowerPriority();
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &buffer_size, sizeof(buffer_size));
+    posix_fadvise(file_fd, first, last - first + 1, POSIX_FADV_SEQUENTIAL);
+    bool served = sendAll(fd, head, length) && (head_only || sendFile(fd, file_fd, first, last - first + 1, buffer_size));
+    close(file_fd);
+    stopStream(served);
+}
+
+// Returns false if as many songs as allowed are streamed already, otherwise sets "buffer_size" for the new stream
+static bool startStream(int *buffer_size)
+{
+    pthread_mutex_lock(&clientsMutex);
+    bool started = stream_stats.streaming < stream_stats.max_streams;
+    if (started)
+    {
+        stream_stats.streaming++;
+        *buffer_size = stream_stats.buffer_size;
+    }
+    else
+    {
+        stream_stats.rejected++;
+    }
+    pthread_mutex_unlock(&clientsMutex);
+    return started;
+}
+
+static void stopStream(bool served)
+{
+    pthread_mutex_lock(&clientsMutex);
+    stream_stats.streaming--;
+    stream_stats.served += served;
+    pthread_mutex_unlock(&clientsMutex);
+}
+
+// Reads a single byte range of "bytes=<first>-<last>", "bytes=<first>-" or "bytes=-<suffix length>"
+// Returns 1 and sets "first" and "last" if it lies in the "size" bytes, -1 if it does not,
+// 0 if the Range should be ignored and the whole song sent (several ranges, or not understood)
+static int parseRange(const char *value, long long size, long long *first, long long *last)
+{
+    if (strncasecmp(value, "bytes=", strlen("bytes=")) != 0 || strchr(value, ',') != NULL)
+    {
+        return 0;
+    }
+    const char *start = value + strlen("bytes=");
+    const char *dash = strchr(start, '-');
+    if (dash == NULL)
+    {
+        return 0;
+    }
+    char *end = NULL;
+    if (dash == start)
+    {
+        if (dash[1] < '0' || dash[1] > '9')
+        {
+            return 0;
+        }
+        long long suffix = strtoll(dash + 1, &end, 10);
+        if (*end != '\0')
+        {
+            return 0;
+        }
+        if (suffix == 0 || size == 0)
+        {
+            return -1;
+        }
+        *first = (suffix < size) ? size - suffix : 0;
+        *last = size - 1;
+        return 1;
+    }
+
+    if (*start < '0' || *start > '9')
+    {
+        return 0;
+    }
+    long long from = strtoll(start, &end, 10);
+    if (end != dash)
+    {
+        return 0;
+    }
+    long long to = size - 1;
+    if (dash[1] != '\0')
+    {
+        if (dash[1] < '0' || dash[1] > '9')
+        {
+            return 0;
+        }
+        to = strtoll(dash + 1, &end, 10);
+        if (*end != '\0' || to < from)
+        {
+            return 0;
+        }
+    }
+    if (from >= size)
+    {
+        return -1;
+    }
+    *first = from;
+    *last = (to < size) ? to : size - 1;
+    return 1;
+}
+
+// Sends "size" bytes of "file_fd" from "offset" without copying them, "chunk_size" at a time
+// Returns false if the client left or took more than SOCKET_TIMEOUT_S to take in a chunk
+static bool sendFile(int fd, int file_fd, long long offset, long long size, int chunk_size)
+{
+    off_t position = offset;
+    // a client that lets a few bytes in now and then restarts the timeout of every call
+    off_t chunk_start = position;
+    long long deadline_us = getTimeInUs() + SOCKET_TIMEOUT_S * 1000000LL;
+    while (size > 0)
+    {
+        size_t count = (size < chunk_size) ? (size_t)size : (size_t)chunk_size;
+        ssize_t sent = sendfile(fd, file_fd, &position, count);
+        if (sent < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (sent <= 0)
+        {
+            return false;
+        }
+        size -= sent;
+        if (position - chunk_start >= chunk_size)
+        {
+            chunk_start = position;
+            deadline_us = getTimeInUs() + SOCKET_TIMEOUT_S * 1000000LL;
+        }
+        else if (getTimeInUs() > deadline_us)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Lets the audio player go first, for the CPU and the disk; the thread ends with the stream
+static void lowerPriority(void)
+{
+    pid_t thread = syscall(SYS_gettid);
+    if (setpriority(PRIO_PROCESS, thread, HTTP_SERVER_STREAM_NICE) != 0 ||
+        syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, thread, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) != 0)
+    {
+        perror("httpServer: Unable to lower the priority of a stream");
+    }
+}
+
+// Appends "text" to what "writer" sends, sending what it holds once it is full
+static void writeText(writer_t *writer, const char *text, size_t length)
+{
+    while (length > 0 && !writer->failed)
+    {
+        size_t size = sizeof(writer->data) - writer->length;
+        size = (length < size) ? length : size;
+        memcpy(writer->data + writer->length, text, size);
+        writer->length += size;
+        text += size;
+        length -= size;
+        if (writer->length == sizeof(writer->data))
+        {
+            flushWriter(writer);
+        }
+    }
+}
+
+// Appends "string" as a JSON string
+static void writeJsonString(writer_t *writer, const char *string)
+{
+    writeText(writer, "\"", 1);
+    for (const char *character = (string != NULL) ? string : ""; *character != '\0'; character++)
+    {
+        char escaped[8];
+        unsigned char byte = *character;
+        if (byte == '"' || byte == '\\')
+        {
+            escaped[0] = '\\';
+            escaped[1] = byte;
+            writeText(writer, escaped, 2);
+        }
+        else if (byte < 0x20)
+        {
+            writeText(writer, escaped, snprintf(escaped, sizeof(escaped), "\\u%04x", byte));
+        }
+        else
+        {
+            writeText(writer, character, 1);
+        }
+    }
+    writeText(writer, "\"", 1);
+}
+
+static void flushWriter(writer_t *writer)
+{
+    if (!writer->failed && !sendAll(writer->fd, writer->data, writer->length))
+    {
+        writer->failed = true;
+    }
+    writer->length = 0;
+}
+
+// Streams the parts of the multipart body into "upload"
+// Returns false if the body ended before its closing boundary
+static bool parseMultipart(body_reader_t *body, const char *boundary, upload_t *upload)
+{
+    char delimiter[BOUNDARY_MAX_LENGTH + 5];
+    size_t delimiter_length = snprintf(delimiter, sizeof(delimiter), "\r\n--%s", boundary);
+    // the first delimiter has no line break before it
+    memmove(body->data + 2, body->data, body->length);
+    memcpy(body->data, "\r\n", 2);
+    body->length += 2;
+
+    bool in_part = false; // false in the preamble
+    part_t part = PART_IGNORED;
+    for (;;)
+    {
+        char *found = memmem(body->data, body->length, delimiter, delimiter_length);
+        // the end of the data may be the start of a delimiter
+        size_t data_size = (found != NULL)                      ? (size_t)(found - body->data)
+                           : (body->length >= delimiter_length) ? body->length - delimiter_length + 1
+                                                                : 0;
+        if (in_part)
+        {
+            writePart(upload, &part, body->data, data_size);
+        }
+        consumeBody(body, data_size);
+        if (found == NULL)
+        {
+            if (!fillBody(body))
+            {
+                return false;
+            }
+            continue;
+        }
+
+        while (body->length < delimiter_length + 2)
+        {
+            if (!fillBody(body))
+            {
+                return false;
+            }
+        }
+        if (in_part && part == PART_FILE)
+        {
+            // the conversion finishes while the rest of the form is read
+            closeOutput(upload);
+            upload->has_file = true;
+        }
+        if (memcmp(body->data + delimiter_length, "--", 2) == 0)
+        {
+            return true;
+        }
+        consumeBody(body, delimiter_length);
+
+        // the part headers, from the line break ending the delimiter line
+        char *headers_end = NULL;
+        while ((headers_end = memmem(body->data, body->length, "\r\n\r\n", 4)) == NULL)
+        {
+            if (!fillBody(body))
+            {
+                return false;
+            }
+        }
+        *headers_end = '\0';
+        startPart(upload, (headers_end > body->data) ? body->data + 2 : "", &part);
+        consumeBody(body, headers_end - body->data + 4);
+        in_part = true;
+    }
+}
+
+// Finds out what the part with "headers" holds and gets ready to store it
+static void startPart(upload_t *upload, const char *headers, part_t *part)
+{
+    static const char *field_names[] = {[PART_SINGER] = "singer", [PART_ALBUM] = "album", [PART_SONG] = "song"};
+    char disposition[HEADER_MAX_SIZE];
+    char name[FIELD_MAX_SIZE];
+    char file_name[NAME_MAX + 1];
+    *part = PART_IGNORED;
+    if (!getHeader(headers, "Content-Disposition", disposition, sizeof(disposition)) ||
+        !getParameter(disposition, "name", name, sizeof(name)))
+    {
+        return;
+    }
+    for (part_t field = PART_SINGER; field <= PART_SONG; field++)
+    {
+        if (strcmp(name, field_names[field]) == 0)
+        {
+            *part = field;
+            return;
+        }
+    }
+    if (strcmp(name, "file") != 0 || upload->has_file || upload->status != 0)
+    {
+        return;
+    }
+
+    if (!getParameter(disposition, "filename", file_name, sizeof(file_name)) || file_name[0] == '\0')
+    {
+        failUpload(upload, 400, "No file uploaded - You need to select a file");
+        return;
+    }
+    if (!isValidFileName(file_name))
+    {
+        failUpload(upload, 400, "No file uploaded - The file should be mp3 or wav");
+        return;
+    }
+    snprintf(upload->file_name, sizeof(upload->file_name), "%s", file_name);
+    snprintf(upload->song_name, sizeof(upload->song_name), "%.*s.wav", (int)(strlen(file_name) - strlen(".mp3")), file_name);
+    upload->is_mp3 = hasExtension(file_name, ".mp3");
+
+    char path[PATH_MAX];
+    struct stat info;
+    if (!buildPath(upload->song_name, path, sizeof(path)))
+    {
+        failUpload(upload, 400, "No file uploaded - The file name is too long");
+        return;
+    }
+    if (stat(path, &info) == 0)
+    {
+        failUpload(upload, 400, "No file uploaded - The file is already uploaded!");
+        return;
+    }
+
+    char temp_name[NAME_MAX + 1];
+    snprintf(temp_name, sizeof(temp_name), ".upload-%d.wav", __atomic_fetch_add(&next_upload, 1, __ATOMIC_RELAXED));
+    buildPath(temp_name, upload->temp_path, sizeof(upload->temp_path));
+    *part = PART_FILE;
+}
+
+// Stores "size" bytes of "data" of the current part
+static void writePart(upload_t *upload, part_t *part, const char *data, size_t size)
+{
+    if (*part == PART_FILE)
+    {
+        upload->file_size += size;
+        if (upload->header_length < WAV_HEADER_SIZE)
+        {
+            size_t copied = (size < WAV_HEADER_SIZE - upload->header_length) ? size : WAV_HEADER_SIZE - upload->header_length;
+            memcpy(upload->header + upload->header_length, data, copied);
+            upload->header_length += copied;
+            data += copied;
+            size -= copied;
+            if (upload->header_length < WAV_HEADER_SIZE)
+            {
+                return;
+            }
+            startOutput(upload);
+        }
+        writeOutput(upload, data, size);
+        if (upload->status != 0)
+        {
+            *part = PART_IGNORED;
+        }
+    }
+    else if (*part != PART_IGNORED)
+    {
+        // longer values are cut
+        char *field = upload->fields[*part];
+        size_t length = strlen(field);
+        size_t copied = (size < FIELD_MAX_SIZE - 1 - length) ? size : FIELD_MAX_SIZE - 1 - length;
+        memcpy(field + length, data, copied);
+        field[length + copied] = '\0';
+    }
+}
+
+// Writes the file as is if it is a WAV file the audio player plays, otherwise starts converting it,
+// and writes the start of the file that was held back to decide
+static void startOutput(upload_t *upload)
+{
+    upload->output_started = true;
+    bool is_wav = upload->header_length >= 12 && memcmp(upload->header, "RIFF", 4) == 0 &&
+                  memcmp(upload->header + 8, "WAVE", 4) == 0;
+    if (!upload->is_mp3 && !is_wav)
+    {
+        failUpload(upload, 400, "No file uploaded - The file should be mp3 or wav");
+        return;
+    }
+    if (!upload->is_mp3 && isPlayableWav(upload->header, upload->header_length))
+    {
+        upload->file_fd = open(upload->temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (upload->file_fd < 0)
+        {
+            LOG_ERROR("Unable to create <%s>", upload->temp_path);
+            failUpload(upload, 500, getReason(500));
+            return;
+        }
+    }
+    else
+    {
+        if (!mp3ToWave_startStream(upload->temp_path, &upload->stream))
+        {
+            failUpload(upload, 500, getReason(500));
+            return;
+        }
+        upload->converting = true;
+        upload->file_fd = upload->stream.input_fd;
+    }
+    writeOutput(upload, upload->header, upload->header_length);
+}
+
+// Writes "size" bytes of the file, blocking while the converter is behind
+static void writeOutput(upload_t *upload, const void *data, size_t size)
+{
+    if (upload->file_fd < 0)
+    {
+        return;
+    }
+    long long start_us = getTimeInUs();
+    const char *bytes = data;
+    while (size > 0)
+    {
+        ssize_t written = write(upload->file_fd, bytes, size);
+        if (written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (written <= 0)
+        {
+            if (upload->converting)
+            {
+                // the converter gave up on the file
+                failUpload(upload, 400, "No file uploaded - The file could not be converted");
+            }
+            else
+            {
+                LOG_ERROR("Unable to write <%s>", upload->temp_path);
+                failUpload(upload, 500, getReason(500));
+            }
+            break;
+        }
+        bytes += written;
+        size -= written;
+    }
+    upload->write_us += getTimeInUs() - start_us;
+}
+
+// Completes the WAV file once the whole file arrived, or stops writing it after an error
+static void closeOutput(upload_t *upload)
+{
+    if (!upload->output_started && upload->header_length > 0 && upload->status == 0)
+    {
+        // a file shorter than a WAV header
+        startOutput(upload);
+    }
+    if (upload->file_fd < 0)
+    {
+        return;
+    }
+    if (upload->converting)
+    {
+        long long start_us = getTimeInUs();
+        bool converted = mp3ToWave_finishStream(&upload->stream);
+        upload->finish_us = getTimeInUs() - start_us;
+        if (!converted)
+        {
+            failUpload(upload, 400, "No file uploaded - The file could not be converted");
+        }
+    }
+    else
+    {
+        close(upload->file_fd);
+    }
+    upload->file_fd = -1;
+}
+
+// Hands the uploaded file to the library, or removes it after an error
+static void finishUpload(upload_t *upload)
+{
+    closeOutput(upload);
+    if (upload->temp_path[0] == '\0')
+    {
+        return;
+    }
+    if (upload->status != 0)
+    {
+        unlink(upload->temp_path);
+        return;
+    }
+
+    const char *artist = (upload->fields[PART_SINGER][0] != '\0') ? upload->fields[PART_SINGER] : UNKNOWN_ARTIST;
+    const char *album = (upload->fields[PART_ALBUM][0] != '\0') ? upload->fields[PART_ALBUM] : UNKNOWN_ALBUM;
+    char title[NAME_MAX + 1];
+    snprintf(title, sizeof(title), "%s", upload->fields[PART_SONG]);
+    if (title[0] == '\0')
+    {
+        snprintf(title, sizeof(title), "%.*s", (int)(strlen(upload->song_name) - strlen(".wav")), upload->song_name);
+    }
+    long long start_us = getTimeInUs();
+    if (!songWatcher_addFile(upload->temp_path, upload->song_name, artist, album, title))
+    {
+        unlink(upload->temp_path);
+        failUpload(upload, 400, "No file uploaded - The file should be mp3 or wav");
+    }
+    upload->ingest_us = getTimeInUs() - start_us;
+}
+
+// Keeps the first error of an upload
+static void failUpload(upload_t *upload, int status, const char *error)
+{
+    if (upload->status == 0)
+    {
+        upload->status = status;
+        upload->error = error;
+    }
+}
+
+// Receives more of the body after the bytes in the buffer
+// Returns false if the body or the connection ended, or the buffer is full
+static bool fillBody(body_reader_t *body)
+{
+    // one byte is kept for a null terminator
+    size_t space = sizeof(body->data) - 1 - body->length;
+    size_t size = (body->remaining < space) ? body->remaining : space;
+    if (size == 0)
+    {
+        return false;
+    }
+    long long start_us = getTimeInUs();
+    ssize_t length;
+    do
+    {
+        length = recv(body->fd, body->data + body->length, size, 0);
+    } while (length < 0 && errno == EINTR);
+    body->receive_us += getTimeInUs() - start_us;
+    if (length <= 0)
+    {
+        return false;
+    }
+    body->length += length;
+    body->remaining -= length;
+    return true;
+}
+
+// Drops the first "size" bytes of the buffer
+static void consumeBody(body_reader_t *body, size_t size)
+{
+    memmove(body->data, body->data + size, body->length - size);
+    body->length -= size;
+}
+
+// Copies the value of the header "name" into "value"
+// Returns false if it is missing or too long
+static bool getHeader(const char *headers, const char *name, char *value, size_t size)
+{
+    size_t name_length = strlen(name);
+    for (const char *line = headers; line != NULL && *line != '\0';)
+    {
+        const char *end = strstr(line, "\r\n");
+        size_t line_length = (end != NULL) ? (size_t)(end - line) : strlen(line);
+        if (line_length > name_length && strncasecmp(line, name, name_length) == 0 && line[name_length] == ':')
+        {
+            const char *start = line + name_length + 1;
+            const char *stop = line + line_length;
+            while (start < stop && (*start == ' ' || *start == '\t'))
+            {
+                start++;
+            }
+            while (stop > start && (stop[-1] == ' ' || stop[-1] == '\t'))
+            {
+                stop--;
+            }
+            if ((size_t)(stop - start) >= size)
+            {
+                return false;
+            }
+            memcpy(value, start, stop - start);
+            value[stop - start] = '\0';
+            return true;
+        }
+        line = (end != NULL) ? end + 2 : NULL;
+    }
+    return false;
+}
+
+// Copies the parameter "name" of a header value like 'form-data; name="file"' into "parameter"
+// Returns false if it is missing or too long
+static bool getParameter(const char *value, const char *name, char *parameter, size_t size)
+{
+    size_t name_length = strlen(name);
+    for (const char *start = strchr(value, ';'); start != NULL; start = strchr(start, ';'))
+    {
+        start++;
+        while (*start == ' ' || *start == '\t')
+        {
+            start++;
+        }
+        if (strncasecmp(start, name, name_length) != 0 || start[name_length] != '=')
+        {
+            continue;
+        }
+        start += name_length + 1;
+        bool quoted = *start == '"';
+        start += quoted;
+        const char *stop = quoted ? strchr(start, '"') : start + strcspn(start, "; \t");
+        if (stop == NULL || (size_t)(stop - start) >= size)
+        {
+            return false;
+        }
+        memcpy(parameter, start, stop - start);
+        parameter[stop - start] = '\0';
+        return true;
+    }
+    return false;
+}
+
+// Copies the string member "name" of the JSON object "json" into "string"
+// Note: only the escapes of quotes, backslashes and slashes are supported
+static bool getJsonString(const char *json, const char *name, char *string, size_t size)
+{
+    char key[FIELD_MAX_SIZE];
+    snprintf(key, sizeof(key), "\"%s\"", name);
+    const char *c = strstr(json, key);
+    if (c == NULL)
+    {
+        return false;
+    }
+    c += strlen(key);
+    c += strspn(c, " \t\r\n");
+    if (*c++ != ':')
+    {
+        return false;
+    }
+    c += strspn(c, " \t\r\n");
+    if (*c++ != '"')
+    {
+        return false;
+    }
+    size_t length = 0;
+    for (; *c != '"'; c++)
+    {
+        if (*c == '\\')
+        {
+            c++;
+            if (*c != '"' && *c != '\\' && *c != '/')
+            {
+                return false;
+            }
+        }
+        if (*c == '\0' || length + 1 >= size)
+        {
+            return false;
+        }
+        string[length++] = *c;
+    }
+    string[length] = '\0';
+    return true;
+}
+
+// A name stored in the songs directory: an MP3 or WAV file that is not hidden,
+// without path separators or characters the JSON replies would need to escape
+static bool isValidFileName(const char *name)
+{
+    if (name[0] == '.' || (!hasExtension(name, ".mp3") && !hasExtension(name, ".wav")))
+    {
+        return false;
+    }
+    for (const unsigned char *c = (const unsigned char *)name; *c != '\0'; c++)
+    {
+        if (*c < 0x20 || *c == 0x7F || *c == '/' || *c == '\\' || *c == '"')
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static uint32_t readLittleEndian(const unsigned char *bytes, int size)
+{
+    uint32_t value = 0;
+    for (int i = size - 1; i >= 0; i--)
+    {
+        value = (value << 8) | bytes[i];
+    }
+    return value;
+}
+
+// A plain 44 byte header of 16 bit PCM samples at the rate and channels the audio player plays
+static bool isPlayableWav(const unsigned char *header, size_t size)
+{
+    return size >= WAV_HEADER_SIZE && memcmp(header, "RIFF", 4) == 0 && memcmp(header + 8, "WAVE", 4) == 0 &&
+           memcmp(header + 12, "fmt ", 4) == 0 && readLittleEndian(header + 16, 4) == 16 &&
+           readLittleEndian(header + 20, 2) == 1 && readLittleEndian(header + 22, 2) == NUM_CHANNELS &&
+           readLittleEndian(header + 24, 4) == SAMPLE_RATE && readLittleEndian(header + 34, 2) == 16 &&
+           memcmp(header + 36, "data", 4) == 0;
+}
+
+static bool hasExtension(const char *name, const char *extension)
+{
+    size_t length = strlen(name);
+    return length > strlen(extension) && strcasecmp(name + length - strlen(extension), extension) == 0;
+}
+
+// Returns false if the path of "name" does not fit in "path"
+static bool buildPath(const char *name, char *path, size_t size)
+{
+    int length = snprintf(path, size, "%s/%s", songs_directory, name);
+    return length > 0 && (size_t)length < size;
+}
+
+static void sendResponse(int fd, int status, const char *body)
+{
+    char head[256];
+    int length = snprintf(head, sizeof(head),
+                          "HTTP/1.1 %d %s\r\n"
+                          "Access-Control-Allow-Origin: *\r\n"
+                          "Content-Type: application/json\r\n"
+                          "Content-Length: %zu\r\n"
+                          "Connection: close\r\n\r\n",
+                          status, getReason(status), strlen(body));
+    if (sendAll(fd, head, length))
+    {
+        sendAll(fd, body, strlen(body));
+    }
+}
+
+// Replies with {"msg":"<message>"}, like the Node server did for errors
+static void sendMessage(int fd, int status, const char *message)
+{
+    char body[256];
+    snprintf(body, sizeof(body), "{\"msg\":\"%s\"}", message);
+    sendResponse(fd, status, body);
+}
+
+static bool sendAll(int fd, const char *data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (sent <= 0)
+        {
+            return false;
+        }
+        data += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+static const char *getReason(int status)
+{
+    switch (status)
+    {
+    case 200:
+        return "OK";
+    case 204:
+        return "No Content";
+    case 400:
+        return "Bad Request";
+    case 404:
+        return "Not Found";
+    case 405:
+        return "Method Not Allowed";
+    case 411:
+        return "Length Required";
+    case 413:
+        return "Payload Too Large";
+    case 431:
+        return "Request Header Fields Too Large";
+    case 503:
+        return "Service Unavailable";
+    default:
+        return "Internal Server Error";
+    }
+}
+
+static long long getTimeInUs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
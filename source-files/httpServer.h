@@ -0,0 +1,70 @@
+/**
+ * @file httpServer.h
+ * @brief This is a header file for the httpServer module.
+ *
+ * This header file contains the definitions of the functions
+ * for the httpServer module, which serves the upload and delete
+ * requests of the web interface over HTTP/1.1, in place of the
+ * Node server.
+ *
+ * POST /upload takes the multipart form of the web interface (file,
+ * singer, album and song) and streams the file into the songs directory
+ * through a bounded buffer; an MP3 file is converted to WAV. The song is
+ * added to the library with its metadata once the WAV file is complete.
+ * POST /delete takes {"name":"<uploaded file name>"} and deletes the song.
+ * Both reply with the same JSON as the Node server did.
+ *
+ * GET /songs lists the library as [{"id","name","artist","album"}] and
+ * GET /songs/<id> streams a song from the disk, with Range support so the
+ * browser can seek while previewing it. Streams are capped and run below
+ * the priority of the audio player.
+ *
+ * GET /metrics returns the metrics of every module (see metrics.h).
+ * GET /trace returns the steps traced, in the Chrome trace format (see trace.h).
+ *
+ * @author Amirhossein Etaati
+ * @date 2023-04-13
+ */
+
+#if !defined(HTTP_SERVER_H)
+#define HTTP_SERVER_H
+
+// The port the web interface used to reach the Node server on
+#define HTTP_SERVER_PORT 5000
+// Requests served at the same time, others are answered with 503
+#define HTTP_SERVER_MAX_CLIENTS 4
+// Largest upload accepted, larger ones are answered with 413
+#define HTTP_SERVER_MAX_UPLOAD_SIZE (256 * 1024 * 1024)
+// Songs streamed at the same time with the highest limit, on top of the other requests
+#define HTTP_SERVER_MAX_STREAMS 8
+#define HTTP_SERVER_DEFAULT_STREAMS 2
+// Socket send buffer of a stream, which is also the most sent at a time
+#define HTTP_SERVER_DEFAULT_STREAM_BUFFER_SIZE (64 * 1024)
+#define HTTP_SERVER_MIN_STREAM_BUFFER_SIZE (4 * 1024)
+#define HTTP_SERVER_MAX_STREAM_BUFFER_SIZE (1024 * 1024)
+// Nice value of the threads streaming songs
+#define HTTP_SERVER_STREAM_NICE 10
+
+typedef struct
+{
+    int max_streams;
+    int buffer_size;
+    int streaming; // songs being streamed
+    int served;    // streams sent completely
+    int rejected;  // streams answered with 503
+} httpServer_streamStats_t;
+
+// Starts serving requests, storing uploaded songs in "songs_dir"
+// Note: the songWatcher module must be initialized with the same directory
+void httpServer_init(const char *songs_dir);
+
+// Stops the server and waits for the requests being served
+void httpServer_cleanup(void);
+
+// Sets the number of songs streamed at the same time and the buffer of each stream,
+// clamped to the limits above; streams already running keep their buffer
+void httpServer_setStreamLimits(int max_streams, int buffer_size);
+
+void httpServer_getStreamStats(httpServer_streamStats_t *stats);
+
+#endif // HTTP_SERVER_H
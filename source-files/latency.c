@@ -0,0 +1,167 @@
+/**
+ * @file latency.c
+ * @brief This is a source file for the latency module.
+ *
+ * This source file contains the declaration of the functions
+ * for the latency module, which follows the inputs of the BeaglePod to
+ * the display and the sound card and keeps how long they took.
+ *
+ * The action types are registered the first time they arrive, like the
+ * metrics: an entry is written under the registry mutex and published by
+ * storing the new count with release semantics, so finding one takes no
+ * lock. The display is only locked once an action waits for it, and the
+ * playback thread only observes a latency it was handed.
+ *
+ * @author Amirhossein Etaati
+ * @date 2023-04-19
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "latency.h"
+#include "metrics.h"
+
+struct latency_action
+{
+    latency_source_t source;
+    const char *name;
+    char labels[64];
+    metrics_histogram_t display_metric;
+    metrics_histogram_t audio_metric;
+};
+
+static const char *source_names[LATENCY_SOURCE_COUNT] = {"joystick", "network"};
+static const long long latency_bounds_us[] = {1000,   2500,   5000,   10000,   25000,  50000,
+                                              100000, 250000, 500000, 1000000, 2000000};
+
+static pthread_mutex_t registryMutex = PTHREAD_MUTEX_INITIALIZER;
+static latency_action_t actions[LATENCY_MAX_ACTIONS];
+static int numActions = 0;
+
+// The last action that arrived, until a byte is written to the display
+static pthread_mutex_t displayMutex = PTHREAD_MUTEX_INITIALIZER;
+static latency_token_t displayAction;
+static bool displayWaiting = false;
+
+// The action of the calling thread, between latency_beginAction() and latency_endAction()
+static __thread latency_token_t threadAction;
+
+// Private functions definitions
+static latency_action_t *findAction(latency_source_t source, const char *name);
+static void observe(metrics_histogram_t *histogram, long long arrival_us, long long now_us);
+
+//------------------------------------------------
+//////////////// Public Functions ////////////////
+//------------------------------------------------
+
+void latency_beginAction(latency_source_t source, const char *name, long long arrival_us)
+{
+    latency_action_t *action = findAction(source, name);
+    threadAction.action = action;
+    threadAction.arrival_us = arrival_us;
+    if (action == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&displayMutex);
+    displayAction = threadAction;
+    __atomic_store_n(&displayWaiting, true, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&displayMutex);
+}
+
+void latency_endAction(void)
+{
+    threadAction.action = NULL;
+}
+
+latency_token_t latency_getAction(void)
+{
+    return threadAction;
+}
+
+void latency_markDisplay(void)
+{
+    if (!__atomic_load_n(&displayWaiting, __ATOMIC_ACQUIRE))
+    {
+        return;
+    }
+    long long now = metrics_getTimeInUs();
+    pthread_mutex_lock(&displayMutex);
+    if (displayWaiting)
+    {
+        observe(&displayAction.action->display_metric, displayAction.arrival_us, now);
+        __atomic_store_n(&displayWaiting, false, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&displayMutex);
+}
+
+void latency_observeAudio(latency_token_t token)
+{
+    if (token.action != NULL)
+    {
+        observe(&token.action->audio_metric, token.arrival_us, metrics_getTimeInUs());
+    }
+}
+
+//------------------------------------------------
+/////////////// Private Functions ////////////////
+//------------------------------------------------
+
+// Returns the action "name" of "source", registering it the first time, NULL once the table is full
+static latency_action_t *findAction(latency_source_t source, const char *name)
+{
+    int count = __atomic_load_n(&numActions, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < count; i++)
+    {
+        if (actions[i].source == source && strcmp(actions[i].name, name) == 0)
+        {
+            return &actions[i];
+        }
+    }
+
+    latency_action_t *action = NULL;
+    pthread_mutex_lock(&registryMutex);
+    // another thread may have registered it meanwhile
+    for (int i = count; i < numActions && action == NULL; i++)
+    {
+        if (actions[i].source == source && strcmp(actions[i].name, name) == 0)
+        {
+            action = &actions[i];
+        }
+    }
+    if (action == NULL && numActions < LATENCY_MAX_ACTIONS)
+    {
+        action = &actions[numActions];
+        action->source = source;
+        action->name = name;
+        snprintf(action->labels, sizeof(action->labels), "source=\"%s\",action=\"%s\"", source_names[source], name);
+        metrics_registerHistogram(&action->display_metric, "beaglepod_latency_display_seconds", action->labels,
+                                  "Time from an input to the first byte written to the display after it",
+                                  latency_bounds_us, sizeof(latency_bounds_us) / sizeof(latency_bounds_us[0]));
+        metrics_registerHistogram(&action->audio_metric, "beaglepod_latency_audio_seconds", action->labels,
+                                  "Time from an input to the first samples of the song it started handed to "
+                                  "the sound card",
+                                  latency_bounds_us, sizeof(latency_bounds_us) / sizeof(latency_bounds_us[0]));
+        __atomic_store_n(&numActions, numActions + 1, __ATOMIC_RELEASE);
+    }
+    else if (action == NULL)
+    {
+        fprintf(stderr, "latency: Error - Too many actions, %s is not measured.\n", name);
+    }
+    pthread_mutex_unlock(&registryMutex);
+    return action;
+}
+
+static void observe(metrics_histogram_t *histogram, long long arrival_us, long long now_us)
+{
+    long long latency_us = now_us - arrival_us;
+    if (latency_us <= LATENCY_TIMEOUT_MS * 1000LL)
+    {
+        metrics_observe(histogram, latency_us);
+    }
+}
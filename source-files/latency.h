@@ -0,0 +1,65 @@
+/**
+ * @file latency.h
+ * @brief This is a header file for the latency module.
+ *
+ * This header file contains the definitions of the functions
+ * for the latency module, which follows a joystick press or a network
+ * command from its arrival to its effects: the first byte written to the
+ * display after it, and the first samples of the song it started handed
+ * to the sound card.
+ *
+ * The thread acting on an input wraps the action in latency_beginAction()
+ * and latency_endAction(); a song asked for meanwhile carries the action
+ * to the playback thread (see latency_getAction()). The display is shared:
+ * the last action that arrived owns the next byte written to it, whichever
+ * thread writes it, unless LATENCY_TIMEOUT_MS went by.
+ *
+ * The latencies are histograms of the metrics module, per source and
+ * action: beaglepod_latency_display_seconds and
+ * beaglepod_latency_audio_seconds. benchmarks/latencyBench.c measures them
+ * on a host with simulated inputs ("make latency").
+ *
+ * @author Amirhossein Etaati
+ * @date 2023-04-19
+ */
+
+#if !defined(LATENCY_H)
+#define LATENCY_H
+
+// Action types followed, the others are not measured
+#define LATENCY_MAX_ACTIONS 24
+// An effect coming later than this after the action is left to the next one
+#define LATENCY_TIMEOUT_MS 2000
+
+typedef enum
+{
+    LATENCY_SOURCE_JOYSTICK,
+    LATENCY_SOURCE_NETWORK,
+    LATENCY_SOURCE_COUNT
+} latency_source_t;
+
+typedef struct latency_action latency_action_t;
+
+// An action on its way to its effects
+typedef struct
+{
+    latency_action_t *action; // NULL for no action
+    long long arrival_us;     // see metrics_getTimeInUs()
+} latency_token_t;
+
+// The calling thread acts on the input "name" of "source" that arrived at "arrival_us" (see
+// metrics_getTimeInUs()) until latency_endAction(); the next byte written to the display is its effect
+// "name" must outlive the module, e.g. a string literal
+void latency_beginAction(latency_source_t source, const char *name, long long arrival_us);
+void latency_endAction(void);
+
+// Returns the action the calling thread is acting on, with a NULL action outside of one
+latency_token_t latency_getAction(void);
+
+// A byte was written to the display
+void latency_markDisplay(void);
+
+// The first samples of the song "token" asked for were handed to the sound card
+void latency_observeAudio(latency_token_t token);
+
+#endif // LATENCY_H
@@ -21,6 +21,9 @@
 
 #include "lcd_4line.h"
 #include "sleep.h"
+#include "metrics.h"
+#include "trace.h"
+#include "latency.h"
 
 #define I2C_BUS "/dev/i2c-1"
 #define LCD_ADDR 0x27
@@ -28,6 +31,10 @@
 // GLOBALS
 static int i2cFd;
 
+// Metrics, see metrics.h
+static metrics_counter_t bytes_metric;
+static metrics_counter_t errors_metric;
+
 // Private Function Declarations
 static void setLineNum(LCD_LINE_NUM line_num);
 static void I2C_sendByte(unsigned char data);
@@ -41,6 +48,9 @@ static int runCommand(char *command);
 
 void LCD_init(void)
 {
+    metrics_registerCounter(&bytes_metric, "beaglepod_lcd_bytes_total", NULL, "Bytes written to the display over I2C");
+    metrics_registerCounter(&errors_metric, "beaglepod_lcd_errors_total", NULL,
+                            "Bytes the I2C bus of the display did not take");
 
     I2C_configPins();
     I2C_configBus();
@@ -137,10 +147,12 @@ void LCD_writeChar(unsigned char character)
 
 void LCD_clear(void)
 {
+    trace_begin("LCD_clear");
     I2C_sendByte(0b00000100);
     I2C_sendByte(0b00000000);
     I2C_sendByte(0b00010100);
     I2C_sendByte(0b00000000);
+    trace_end("LCD_clear");
 }
 
 void LCD_clearLine(LCD_LINE_NUM line)
@@ -171,6 +183,8 @@ void LCD_setCursorDirection(void)
 
 void LCD_writeString(char *string)
 {
+    // the I2C bytes of a string are traced as one step
+    trace_begin("LCD_writeString");
     // add ... to long strings
     if (strlen(string) > 20)
     {
@@ -192,6 +206,7 @@ void LCD_writeString(char *string)
             string++;
         }
     }
+    trace_end("LCD_writeString");
 }
 
 //------------------------------------------------
@@ -200,6 +215,10 @@ void LCD_writeString(char *string)
 
 static void I2C_configPins(void)
 {
+#if defined(LCD_FILE_BACKEND)
+    // no pins to configure
+    return;
+#endif
     // configure I2C1 SDA pin
     while (runCommand("config-pin P9_18 i2c") != 0)
     {
@@ -217,6 +236,19 @@ static void I2C_configPins(void)
 
 static void I2C_configBus(void)
 {
+#if defined(LCD_FILE_BACKEND)
+    const char *file = getenv(LCD_FILE_VARIABLE);
+    if (file == NULL || file[0] == '\0')
+    {
+        file = LCD_DEFAULT_FILE;
+    }
+    if ((i2cFd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+    {
+        printf("Error failed to open the display file [%s].\n", file);
+        exit(-1);
+    }
+    return;
+#endif
     if ((i2cFd = open(I2C_BUS, O_RDWR)) < 0)
     {
         printf("Error failed to open I2C bus [%s].\n", I2C_BUS);
@@ -234,7 +266,15 @@ static void I2C_sendByte(unsigned char data)
 {
     unsigned char byte[1];
     byte[0] = data;
-    write(i2cFd, byte, sizeof(byte));
+    if (write(i2cFd, byte, sizeof(byte)) == sizeof(byte))
+    {
+        metrics_increment(&bytes_metric);
+        latency_markDisplay();
+    }
+    else
+    {
+        metrics_increment(&errors_metric);
+    }
     /* -------------------------------------------------------------------- *
      * Below wait creates 1msec delay, needed by display to catch commands  *
      * -------------------------------------------------------------------- */
@@ -75,6 +75,15 @@
 
 #define LCD_RIGHT_ARROW 0x7E
 
+/**
+ * Built with -D LCD_FILE_BACKEND, the bytes meant for the display are
+ * written to the file the environment variable LCD_FILE_VARIABLE names
+ * (LCD_DEFAULT_FILE if unset), at the pace of the I2C bus, so the display
+ * code runs on a host (see benchmarks/latencyBench.c)
+ */
+#define LCD_FILE_VARIABLE "BEAGLEPOD_LCD_FILE"
+#define LCD_DEFAULT_FILE "/dev/null"
+
 /**
  * Used to specify the line number
  * to print to
@@ -0,0 +1,558 @@
+/**
+ * @file logger.c
+ * @brief This is a source file for the logger module.
+ *
+ * This source file contains the declaration of the functions
+ * for the logger module, which takes the messages of every thread
+ * without ever blocking it, and prints them from a thread of its own.
+ *
+ * Each thread claims a ring from a pool allocated by logger_init() the
+ * first time it logs, with a compare and swap, and gives it back when it
+ * exits. A ring has a single writer, its thread, and a single reader, the
+ * logger thread, so the head and the tail are plain counters published
+ * with release stores. The format is parsed when the message is logged
+ * only to know which arguments to copy; it is parsed again, and each
+ * conversion given to snprintf, by the logger thread.
+ *
+ * @author Amirhossein Etaati
+ * @date 2023-04-17
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "logger.h"
+
+// Bytes of a record left for the strings of its arguments, making records 512 bytes
+#define STRINGS_SIZE 424
+#define LINE_MAX_SIZE 512
+#define SPEC_MAX_SIZE 32
+
+typedef enum
+{
+    RING_FREE,
+    RING_OWNED,
+    RING_RELEASED // its thread exited, free once printed
+} ring_state_t;
+
+typedef enum
+{
+    ARG_NONE, // "%%", or a conversion that is not supported
+    ARG_INT,
+    ARG_UNSIGNED,
+    ARG_DOUBLE,
+    ARG_CHAR,
+    ARG_STRING,
+    ARG_POINTER
+} arg_type_t;
+
+typedef union
+{
+    long long i;
+    unsigned long long u;
+    double d;
+    const void *p;
+    int string; // where the copy starts in the strings of the record
+} argument_t;
+
+typedef struct
+{
+    long long time_us;
+    const char *format;
+    int level;
+    int num_args;
+    argument_t args[LOGGER_MAX_ARGS];
+    char strings[STRINGS_SIZE];
+} record_t;
+
+typedef struct
+{
+    record_t records[LOGGER_RING_RECORDS];
+    unsigned int head;      // next record written, by the thread of the ring
+    unsigned int tail;      // next record printed, by the logger thread
+    long long dropped;      // messages the full ring did not take
+    long long dropped_seen; // of those, reported by the logger thread
+    ring_state_t state;
+} ring_t;
+
+// A conversion of a format, e.g. "%-8.3lld"
+typedef struct
+{
+    size_t prefix_length; // of the '%', flags, width and precision
+    char length[3];       // length modifier, e.g. "ll"
+    char conversion;
+    int stars; // widths and precisions given as arguments
+    arg_type_t type;
+} conversion_t;
+
+static const char *level_names[] = {"ERROR", "WARNING", "INFO", "DEBUG", "TRACE"};
+
+static bool running = false;
+static pthread_t loggerThreadId;
+static bool stoppingLogger = false;
+static pthread_key_t ring_key;
+static ring_t *rings = NULL;
+// messages of threads that found no ring free
+static long long unowned_dropped = 0;
+static long long unowned_dropped_seen = 0;
+// serializes the printing of the rings, between the logger thread and exit()
+static pthread_mutex_t drainMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Private functions definitions
+static void *loggerThread(void *arg);
+static ring_t *getRing(void);
+static void releaseRing(void *ring);
+static void storeRecord(ring_t *ring, int level, const char *format, va_list args);
+static void drain(void);
+static void drainAtExit(void);
+static void reportDropped(long long *dropped, long long *seen);
+static void formatRecord(const record_t *record, char *message, size_t size);
+static const char *parseConversion(const char *percent, conversion_t *conversion);
+static void printLine(int level, long long time_us, const char *message);
+static long long getTimeInUs(void);
+
+//------------------------------------------------
+//////////////// Public Functions ////////////////
+//------------------------------------------------
+
+void logger_init(void)
+{
+    rings = calloc(LOGGER_MAX_THREADS, sizeof(*rings));
+    if (rings == NULL)
+    {
+        fprintf(stderr, "logger: Error - There was a problem allocating memory.");
+        exit(1);
+    }
+    pthread_key_create(&ring_key, releaseRing);
+    stoppingLogger = false;
+    pthread_create(&loggerThreadId, NULL, loggerThread, NULL);
+    __atomic_store_n(&running, true, __ATOMIC_RELEASE);
+
+    static bool exit_handler_set = false;
+    if (!exit_handler_set)
+    {
+        // messages logged right before exit() are printed too
+        atexit(drainAtExit);
+        exit_handler_set = true;
+    }
+}
+
+void logger_cleanup(void)
+{
+    if (!__atomic_load_n(&running, __ATOMIC_ACQUIRE))
+    {
+        return;
+    }
+    __atomic_store_n(&running, false, __ATOMIC_RELEASE);
+    __atomic_store_n(&stoppingLogger, true, __ATOMIC_RELEASE);
+    pthread_join(loggerThreadId, NULL);
+
+    pthread_mutex_lock(&drainMutex);
+    drain();
+    pthread_key_delete(ring_key);
+    free(rings);
+    rings = NULL;
+    pthread_mutex_unlock(&drainMutex);
+}
+
+void logger_write(int level, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    if (!__atomic_load_n(&running, __ATOMIC_ACQUIRE))
+    {
+        char message[LINE_MAX_SIZE];
+        vsnprintf(message, sizeof(message), format, args);
+        printLine(level, getTimeInUs(), message);
+        fflush((level <= LOGGER_LEVEL_WARNING) ? stderr : stdout);
+    }
+    else
+    {
+        ring_t *ring = getRing();
+        if (ring != NULL)
+        {
+            storeRecord(ring, level, format, args);
+        }
+        else
+        {
+            __atomic_fetch_add(&unowned_dropped, 1, __ATOMIC_RELAXED);
+        }
+    }
+    va_end(args);
+}
+
+//------------------------------------------------
+/////////////// Private Functions ////////////////
+//------------------------------------------------
+
+static void *loggerThread(void *arg)
+{
+    struct timespec interval = {0, LOGGER_FLUSH_MS * 1000000L};
+    while (!__atomic_load_n(&stoppingLogger, __ATOMIC_ACQUIRE))
+    {
+        nanosleep(&interval, NULL);
+        pthread_mutex_lock(&drainMutex);
+        drain();
+        pthread_mutex_unlock(&drainMutex);
+    }
+    return NULL;
+}
+
+// Returns the ring of the calling thread, claiming one the first time, NULL if none is free
+static ring_t *getRing(void)
+{
+    ring_t *ring = pthread_getspecific(ring_key);
+    for (int i = 0; i < LOGGER_MAX_THREADS && ring == NULL; i++)
+    {
+        ring_state_t expected = RING_FREE;
+        if (__atomic_compare_exchange_n(&rings[i].state, &expected, RING_OWNED, false, __ATOMIC_ACQUIRE,
+                                        __ATOMIC_RELAXED))
+        {
+            ring = &rings[i];
+            pthread_setspecific(ring_key, ring);
+        }
+    }
+    return ring;
+}
+
+// Called by a thread with a ring as it exits
+static void releaseRing(void *ring)
+{
+    __atomic_store_n(&((ring_t *)ring)->state, RING_RELEASED, __ATOMIC_RELEASE);
+}
+
+// Note: called by the thread of "ring" only
+static void storeRecord(ring_t *ring, int level, const char *format, va_list args)
+{
+    unsigned int head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= LOGGER_RING_RECORDS)
+    {
+        __atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    record_t *record = &ring->records[head % LOGGER_RING_RECORDS];
+    record->time_us = getTimeInUs();
+    record->format = format;
+    record->level = level;
+    record->strings[STRINGS_SIZE - 1] = '\0';
+    int count = 0;
+    size_t used = 0;
+    const char *c = format;
+    while (*c != '\0' && count < LOGGER_MAX_ARGS)
+    {
+        if (*c != '%')
+        {
+            c++;
+            continue;
+        }
+        conversion_t conversion;
+        c = parseConversion(c, &conversion);
+        if (conversion.type == ARG_NONE && conversion.conversion == '%')
+        {
+            continue;
+        }
+        if (conversion.type == ARG_NONE || count + conversion.stars >= LOGGER_MAX_ARGS)
+        {
+            // the arguments after one that is not understood or not stored cannot be found
+            break;
+        }
+        for (int i = 0; i < conversion.stars; i++)
+        {
+            record->args[count++].i = va_arg(args, int);
+        }
+
+        argument_t *argument = &record->args[count++];
+        const char *length = conversion.length;
+        switch (conversion.type)
+        {
+        case ARG_INT:
+            argument->i = (strcmp(length, "hh") == 0)  ? (signed char)va_arg(args, int)
+                          : (strcmp(length, "h") == 0) ? (short)va_arg(args, int)
+                          : (strcmp(length, "l") == 0) ? va_arg(args, long)
+                          : (strcmp(length, "ll") == 0) ? va_arg(args, long long)
+                          : (strcmp(length, "j") == 0) ? (long long)va_arg(args, intmax_t)
+                          : (strcmp(length, "z") == 0) ? (long long)va_arg(args, ssize_t)
+                          : (strcmp(length, "t") == 0) ? (long long)va_arg(args, ptrdiff_t)
+                                                       : va_arg(args, int);
+            break;
+        case ARG_UNSIGNED:
+            argument->u = (strcmp(length, "hh") == 0)  ? (unsigned char)va_arg(args, unsigned int)
+                          : (strcmp(length, "h") == 0) ? (unsigned short)va_arg(args, unsigned int)
+                          : (strcmp(length, "l") == 0) ? va_arg(args, unsigned long)
+                          : (strcmp(length, "ll") == 0) ? va_arg(args, unsigned long long)
+                          : (strcmp(length, "j") == 0) ? (unsigned long long)va_arg(args, uintmax_t)
+                          : (strcmp(length, "z") == 0) ? (unsigned long long)va_arg(args, size_t)
+                          : (strcmp(length, "t") == 0) ? (unsigned long long)va_arg(args, ptrdiff_t)
+                                                       : va_arg(args, unsigned int);
+            break;
+        case ARG_DOUBLE:
+            argument->d = (strcmp(length, "L") == 0) ? (double)va_arg(args, long double) : va_arg(args, double);
+            break;
+        case ARG_CHAR:
+            argument->i = va_arg(args, int);
+            break;
+        case ARG_POINTER:
+            argument->p = va_arg(args, void *);
+            break;
+        default:
+        {
+            // copied as far as there is room, an empty string after that
+            const char *string = va_arg(args, const char *);
+            string = (string != NULL) ? string : "(null)";
+            size_t room = STRINGS_SIZE - 1 - used;
+            size_t string_length = strnlen(string, room);
+            argument->string = (int)used;
+            memcpy(record->strings + used, string, string_length);
+            record->strings[used + string_length] = '\0';
+            used += (string_length < room) ? string_length + 1 : string_length;
+            break;
+        }
+        }
+    }
+    record->num_args = count;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+// Prints the records stored so far, oldest first over all the rings
+// Note: caller must hold drainMutex
+static void drain(void)
+{
+    unsigned int heads[LOGGER_MAX_THREADS];
+    ring_state_t states[LOGGER_MAX_THREADS];
+    for (int i = 0; i < LOGGER_MAX_THREADS; i++)
+    {
+        // a released ring gets no more records, those of its thread are all before the head
+        states[i] = __atomic_load_n(&rings[i].state, __ATOMIC_ACQUIRE);
+        heads[i] = __atomic_load_n(&rings[i].head, __ATOMIC_ACQUIRE);
+    }
+
+    char message[LINE_MAX_SIZE];
+    while (true)
+    {
+        ring_t *oldest = NULL;
+        for (int i = 0; i < LOGGER_MAX_THREADS; i++)
+        {
+            ring_t *ring = &rings[i];
+            if (ring->tail != heads[i] &&
+                (oldest == NULL ||
+                 ring->records[ring->tail % LOGGER_RING_RECORDS].time_us <
+                     oldest->records[oldest->tail % LOGGER_RING_RECORDS].time_us))
+            {
+                oldest = ring;
+            }
+        }
+        if (oldest == NULL)
+        {
+            break;
+        }
+        const record_t *record = &oldest->records[oldest->tail % LOGGER_RING_RECORDS];
+        formatRecord(record, message, sizeof(message));
+        printLine(record->level, record->time_us, message);
+        __atomic_store_n(&oldest->tail, oldest->tail + 1, __ATOMIC_RELEASE);
+    }
+
+    for (int i = 0; i < LOGGER_MAX_THREADS; i++)
+    {
+        reportDropped(&rings[i].dropped, &rings[i].dropped_seen);
+        if (states[i] == RING_RELEASED)
+        {
+            __atomic_store_n(&rings[i].state, RING_FREE, __ATOMIC_RELEASE);
+        }
+    }
+    reportDropped(&unowned_dropped, &unowned_dropped_seen);
+    fflush(stdout);
+    fflush(stderr);
+}
+
+static void drainAtExit(void)
+{
+    pthread_mutex_lock(&drainMutex);
+    if (rings != NULL)
+    {
+        drain();
+    }
+    pthread_mutex_unlock(&drainMutex);
+}
+
+// Note: caller must hold drainMutex
+static void reportDropped(long long *dropped, long long *seen)
+{
+    long long count = __atomic_load_n(dropped, __ATOMIC_RELAXED);
+    if (count != *seen)
+    {
+        char message[64];
+        snprintf(message, sizeof(message), "%lld messages were dropped", count - *seen);
+        printLine(LOGGER_LEVEL_WARNING, getTimeInUs(), message);
+        *seen = count;
+    }
+}
+
+static void formatRecord(const record_t *record, char *message, size_t size)
+{
+    size_t length = 0;
+    int next = 0;
+    const char *c = record->format;
+    while (*c != '\0' && length + 1 < size)
+    {
+        conversion_t conversion;
+        const char *end = (*c == '%') ? parseConversion(c, &conversion) : c + 1;
+        if (*c != '%' || conversion.type == ARG_NONE || next + conversion.stars >= record->num_args ||
+            conversion.prefix_length + 4 > SPEC_MAX_SIZE)
+        {
+            // text, "%%", or what was not stored, written as it is
+            bool percent = *c == '%' && conversion.conversion == '%';
+            message[length++] = *c;
+            c = percent ? end : c + 1;
+            continue;
+        }
+
+        // the stored values are the widest of their type
+        char spec[SPEC_MAX_SIZE];
+        memcpy(spec, c, conversion.prefix_length);
+        const char *modifier = (conversion.type == ARG_INT || conversion.type == ARG_UNSIGNED) ? "ll" : "";
+        snprintf(spec + conversion.prefix_length, sizeof(spec) - conversion.prefix_length, "%s%c", modifier,
+                 conversion.conversion);
+        int stars[2] = {0, 0};
+        for (int i = 0; i < conversion.stars; i++)
+        {
+            stars[i] = (int)record->args[next++].i;
+        }
+        const argument_t *argument = &record->args[next++];
+        char *out = message + length;
+        size_t room = size - length;
+        int written = 0;
+
+// snprintf with the widths and precisions of the conversion before its value
+#define FORMAT_VALUE(value)                                                      \
+    written = (conversion.stars == 0)   ? snprintf(out, room, spec, value)       \
+              : (conversion.stars == 1) ? snprintf(out, room, spec, stars[0], value) \
+                                        : snprintf(out, room, spec, stars[0], stars[1], value)
+        switch (conversion.type)
+        {
+        case ARG_INT:
+            FORMAT_VALUE(argument->i);
+            break;
+        case ARG_UNSIGNED:
+            FORMAT_VALUE(argument->u);
+            break;
+        case ARG_DOUBLE:
+            FORMAT_VALUE(argument->d);
+            break;
+        case ARG_CHAR:
+            FORMAT_VALUE((int)argument->i);
+            break;
+        case ARG_POINTER:
+            FORMAT_VALUE(argument->p);
+            break;
+        default:
+            FORMAT_VALUE(record->strings + argument->string);
+            break;
+        }
+#undef FORMAT_VALUE
+        length += (written < 0) ? 0 : ((size_t)written < room) ? (size_t)written : room - 1;
+        c = end;
+    }
+    // the line ends are added when printing
+    while (length > 0 && message[length - 1] == '\n')
+    {
+        length--;
+    }
+    message[length] = '\0';
+}
+
+// Parses the conversion starting at "percent", returns the first character after it
+static const char *parseConversion(const char *percent, conversion_t *conversion)
+{
+    memset(conversion, 0, sizeof(*conversion));
+    const char *c = percent + 1;
+    while (*c != '\0' && strchr("-+ #0", *c) != NULL)
+    {
+        c++;
+    }
+    for (int part = 0; part < 2; part++)
+    {
+        // the width, then the precision
+        if (part == 1 && *c != '.')
+        {
+            break;
+        }
+        c += part;
+        if (*c == '*')
+        {
+            conversion->stars++;
+            c++;
+        }
+        while (*c >= '0' && *c <= '9')
+        {
+            c++;
+        }
+    }
+    conversion->prefix_length = c - percent;
+
+    size_t length = 0;
+    while (length < 2 && *c != '\0' && strchr("hljztL", *c) != NULL &&
+           (length == 0 || *c == conversion->length[0]))
+    {
+        conversion->length[length++] = *c++;
+    }
+    conversion->conversion = *c;
+    switch (*c)
+    {
+    case 'd':
+    case 'i':
+        conversion->type = ARG_INT;
+        break;
+    case 'u':
+    case 'o':
+    case 'x':
+    case 'X':
+        conversion->type = ARG_UNSIGNED;
+        break;
+    case 'f':
+    case 'F':
+    case 'e':
+    case 'E':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A':
+        conversion->type = ARG_DOUBLE;
+        break;
+    case 'c':
+        conversion->type = ARG_CHAR;
+        break;
+    case 's':
+        conversion->type = ARG_STRING;
+        break;
+    case 'p':
+        conversion->type = ARG_POINTER;
+        break;
+    default:
+        conversion->type = ARG_NONE;
+        break;
+    }
+    return (*c != '\0') ? c + 1 : c;
+}
+
+static void printLine(int level, long long time_us, const char *message)
+{
+    FILE *out = (level <= LOGGER_LEVEL_WARNING) ? stderr : stdout;
+    const char *name = (level >= 0 && level <= LOGGER_LEVEL_TRACE) ? level_names[level] : "LOG";
+    fprintf(out, "[%lld.%06lld] %s: %s\n", time_us / 1000000, time_us % 1000000, name, message);
+}
+
+static long long getTimeInUs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
@@ -0,0 +1,85 @@
+/**
+ * @file logger.h
+ * @brief This is a header file for the logger module.
+ *
+ * This header file contains the definitions of the functions
+ * for the logger module, which takes the messages of every thread
+ * without ever blocking it, and prints them from a thread of its own.
+ *
+ * A message is stored as a binary record in a ring buffer of the thread
+ * that logs it: the time, the level, the format and the arguments, the
+ * strings copied. No lock is taken and nothing is allocated, so the
+ * playback thread can log. The logger thread formats the records of all
+ * the threads in the order they were logged, every LOGGER_FLUSH_MS,
+ * errors and warnings to stderr and the others to stdout. A full ring
+ * drops the new messages, which is reported once there is room again.
+ *
+ * The levels above LOGGER_LEVEL are not compiled at all, their arguments
+ * are not evaluated; e.g. -D LOGGER_LEVEL=LOGGER_LEVEL_TRACE keeps them all.
+ * Before logger_init() and after logger_cleanup(), messages are printed
+ * right away by the thread logging them.
+ *
+ * @author Amirhossein Etaati
+ * @date 2023-04-17
+ */
+
+#if !defined(LOGGER_H)
+#define LOGGER_H
+
+#define LOGGER_LEVEL_ERROR 0
+#define LOGGER_LEVEL_WARNING 1
+#define LOGGER_LEVEL_INFO 2
+#define LOGGER_LEVEL_DEBUG 3
+#define LOGGER_LEVEL_TRACE 4 // every period of the playback, every frame of the network
+
+#if !defined(LOGGER_LEVEL)
+#define LOGGER_LEVEL LOGGER_LEVEL_DEBUG
+#endif
+
+// Threads that can have a ring at the same time, the messages of the others are dropped
+#define LOGGER_MAX_THREADS 32
+// Messages a thread can log before the logger thread prints them, a power of 2
+#define LOGGER_RING_RECORDS 64
+// Arguments of a message, the others are dropped
+#define LOGGER_MAX_ARGS 8
+// Time between two runs of the logger thread
+#define LOGGER_FLUSH_MS 20
+
+#if LOGGER_LEVEL >= LOGGER_LEVEL_ERROR
+#define LOG_ERROR(...) logger_write(LOGGER_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LOG_ERROR(...) ((void)0)
+#endif
+#if LOGGER_LEVEL >= LOGGER_LEVEL_WARNING
+#define LOG_WARNING(...) logger_write(LOGGER_LEVEL_WARNING, __VA_ARGS__)
+#else
+#define LOG_WARNING(...) ((void)0)
+#endif
+#if LOGGER_LEVEL >= LOGGER_LEVEL_INFO
+#define LOG_INFO(...) logger_write(LOGGER_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...) ((void)0)
+#endif
+#if LOGGER_LEVEL >= LOGGER_LEVEL_DEBUG
+#define LOG_DEBUG(...) logger_write(LOGGER_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) ((void)0)
+#endif
+#if LOGGER_LEVEL >= LOGGER_LEVEL_TRACE
+#define LOG_TRACE(...) logger_write(LOGGER_LEVEL_TRACE, __VA_ARGS__)
+#else
+#define LOG_TRACE(...) ((void)0)
+#endif
+
+// Allocates the rings and starts the logger thread
+void logger_init(void);
+
+// Prints the messages left and stops the logger thread
+void logger_cleanup(void);
+
+// Logs a message, printed as "[<seconds since boot>] <LEVEL>: <message>\n"
+// "format" must be a string literal: it is formatted later, by the logger thread
+// Note: use the LOG_ macros so the levels can be compiled out
+void logger_write(int level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+#endif // LOGGER_H
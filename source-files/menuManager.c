@@ -21,6 +21,9 @@
 
 #include "menuManager.h"
 #include "songManager.h"
+#include "playOrder.h"
+#include "playlist.h"
+#include "playQueue.h"
 #include "audio_player.h"
 #include "joystick.h"
 #include "gpio.h"
@@ -28,6 +31,9 @@
 #include "bluetooth.h"
 #include "sleep.h"
 #include "lcd_4line.h"
+#include "metrics.h"
+#include "trace.h"
+#include "latency.h"
 
 #define INPUT_CHECK_WAIT_TIME 5
 #define DEBOUNCE_WAIT_TIME 100
@@ -44,6 +50,14 @@ static pthread_t menuManagerThreadId;
 static void *MenuManagerThread(void *arg);
 static pthread_mutex_t currentModeMutex = PTHREAD_MUTEX_INITIALIZER;
 
+/**
+ * Metrics, see metrics.h
+ */
+static const long long action_bounds_us[] = {1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000};
+static char direction_labels[JOYSTICK_NONE][32];
+static metrics_counter_t actions_metrics[JOYSTICK_NONE];
+static metrics_histogram_t action_metric;
+
 /**
  * Menu Manager
  */
@@ -57,10 +71,12 @@ static char *display_array[4] = {"", "", "", ""};
 static MAIN_OPTIONS MainMenu_currentOpt = SONGS_OPT;
 static char *MainMenu_option_strings[NUM_MAIN_OPTIONS] = {
     "Select Song",
+    "Playlists",
+    "Up Next",
     "Bluetooth",
     "Settings",
     "Poweroff"};
-static void MainMenu_setArrowAtLine(LCD_LINE_NUM line);
+static void MainMenu_setArrowAtOption(MAIN_OPTIONS option);
 static void displayMainMenu(void);
 static void MainMenu_changeMenu(MAIN_OPTIONS option);
 static void mainMenuJoystickAction(enum eJoystickDirections currentJoyStickDirection);
@@ -86,6 +102,33 @@ static void BTScanMenu_setArrowAtLine(LCD_LINE_NUM line);
 static void displayBTScanMenu(void);
 static void BTScanMenu_joystickAction(enum eJoystickDirections currentJoyStickDirection);
 static void setTimers(long long *timers, int idx, int wait_time);
+
+/**
+ * Playlists Menu
+ */
+static int playlistsMenu_currentPlaylist = 0;
+static void displayPlaylistsMenu(void);
+static void PlaylistsMenu_joystickAction(enum eJoystickDirections currentJoyStickDirection);
+
+/**
+ * Up Next Menu
+ */
+// position in the queue, the queue size selects the "Clear" entry after the last song
+static int upNextMenu_currentPosition = 0;
+static void displayUpNextMenu(void);
+static void UpNextMenu_joystickAction(enum eJoystickDirections currentJoyStickDirection);
+
+/**
+ * Settings Menu
+ */
+static SETTINGS_OPTIONS settingsMenu_currentOption;
+static char *RepeatMode_strings[NUM_REPEAT_MODES] = {
+    "Off",
+    "All",
+    "One"};
+static void displaySettingsMenu(void);
+static void SettingsMenu_setArrowAtLine(LCD_LINE_NUM line);
+static void SettingsMenu_joystickAction(enum eJoystickDirections currentJoyStickDirection);
 static void decrementTimers(long long *timers, int size);
 static bool isActionTriggered(long long *timers, int idx);
 
@@ -99,6 +142,18 @@ void MenuManager_init(void)
 
   Joystick_init();
 
+  Bluetooth_init();
+
+  for (int i = 0; i < JOYSTICK_NONE; i++)
+  {
+    snprintf(direction_labels[i], sizeof(direction_labels[i]), "direction=\"%s\"", Joystick_getDirectionName(i));
+    metrics_registerCounter(&actions_metrics[i], "beaglepod_input_actions_total", direction_labels[i],
+                            "Joystick presses acted on, by direction");
+  }
+  metrics_registerHistogram(&action_metric, "beaglepod_input_action_seconds", NULL,
+                            "Time taken to act on a joystick press, the display included", action_bounds_us,
+                            sizeof(action_bounds_us) / sizeof(action_bounds_us[0]));
+
   pthread_create(&menuManagerThreadId, NULL, MenuManagerThread, NULL);
 }
 
@@ -122,14 +177,6 @@ song_info *MenuManager_GetCurrentSongPlaying(void)
   return current_song;
 }
 
-/**
- * Settings Menu
- */
-static void displaySettingsMenu(void)
-{
-  LCD_clear();
-  LCD_writeStringAtLine("Settings Menu", LCD_LINE1);
-}
 
 /**
  * Song Menu
@@ -467,6 +514,254 @@ static void BTScanMenu_setArrowAtLine(LCD_LINE_NUM line)
   }
 }
 
+/* -------------------------------------------------------------------- *
+ * PLAYLISTS MENU                                                       *
+ * -------------------------------------------------------------------- */
+// Shows the page of 4 playlists that holds the selected one
+static void displayPlaylistsMenu(void)
+{
+  current_menu = PLAYLISTS_MENU;
+  int num_playlists = playlist_getNumberPlaylists();
+  LCD_clear();
+  if (num_playlists == 0)
+  {
+    LCD_writeStringAtLine("No playlists", LCD_LINE1);
+    return;
+  }
+  if (playlistsMenu_currentPlaylist >= num_playlists)
+  {
+    playlistsMenu_currentPlaylist = num_playlists - 1;
+  }
+
+  int page_start = playlistsMenu_currentPlaylist - (playlistsMenu_currentPlaylist % NUM_LINES);
+  char name[PLAYLIST_NAME_MAX_LEN];
+  for (int line = LCD_LINE1; line < NUM_LINES && page_start + line < num_playlists; line++)
+  {
+    playlist_getName(page_start + line, name, sizeof(name));
+    LCD_writeStringAtLine("", line);
+    if (page_start + line == playlistsMenu_currentPlaylist)
+    {
+      LCD_writeChar(LCD_RIGHT_ARROW);
+    }
+    LCD_writeString(name);
+  }
+}
+
+static void PlaylistsMenu_joystickAction(enum eJoystickDirections currentJoyStickDirection)
+{
+  switch (currentJoyStickDirection)
+  {
+  case JOYSTICK_UP:
+    if (playlistsMenu_currentPlaylist > 0)
+    {
+      playlistsMenu_currentPlaylist--;
+      displayPlaylistsMenu();
+    }
+    break;
+
+  case JOYSTICK_DOWN:
+    if (playlistsMenu_currentPlaylist < playlist_getNumberPlaylists() - 1)
+    {
+      playlistsMenu_currentPlaylist++;
+      displayPlaylistsMenu();
+    }
+    break;
+
+  case JOYSTICK_CENTER:
+    // play the selected playlist
+    if (playlist_getNumberPlaylists() > 0)
+    {
+      songManager_playPlaylist(playlistsMenu_currentPlaylist);
+    }
+    break;
+
+  case JOYSTICK_LEFT:
+    displayMainMenu();
+    break;
+
+  default:
+    // unsupported direction
+    break;
+  }
+}
+
+/* -------------------------------------------------------------------- *
+ * UP NEXT MENU                                                         *
+ * -------------------------------------------------------------------- */
+// Shows the page of 4 queued songs that holds the selected one, followed by a "Clear" entry
+static void displayUpNextMenu(void)
+{
+  current_menu = UP_NEXT_MENU;
+  int queue_size = playQueue_getSize();
+  LCD_clear();
+  if (queue_size == 0)
+  {
+    upNextMenu_currentPosition = 0;
+    LCD_writeStringAtLine("Up Next is empty", LCD_LINE1);
+    return;
+  }
+  if (upNextMenu_currentPosition > queue_size)
+  {
+    upNextMenu_currentPosition = queue_size;
+  }
+
+  int page_start = upNextMenu_currentPosition - (upNextMenu_currentPosition % NUM_LINES);
+  char entry[21];
+  for (int line = LCD_LINE1; line < NUM_LINES && page_start + line <= queue_size; line++)
+  {
+    int position = page_start + line;
+    if (position == queue_size)
+    {
+      snprintf(entry, sizeof(entry), "%s", "[Clear Up Next]");
+    }
+    else
+    {
+      songManager_readLock();
+      song_info *song = songManager_findById(playQueue_getAt(position));
+      snprintf(entry, sizeof(entry), "%s", (song != NULL) ? song->song_name : "(removed)");
+      songManager_readUnlock();
+    }
+    LCD_writeStringAtLine("", line);
+    if (position == upNextMenu_currentPosition)
+    {
+      LCD_writeChar(LCD_RIGHT_ARROW);
+    }
+    LCD_writeString(entry);
+  }
+}
+
+static void UpNextMenu_joystickAction(enum eJoystickDirections currentJoyStickDirection)
+{
+  int queue_size = playQueue_getSize();
+  switch (currentJoyStickDirection)
+  {
+  case JOYSTICK_UP:
+    if (upNextMenu_currentPosition > 0)
+    {
+      upNextMenu_currentPosition--;
+      displayUpNextMenu();
+    }
+    break;
+
+  case JOYSTICK_DOWN:
+    if (upNextMenu_currentPosition < queue_size)
+    {
+      upNextMenu_currentPosition++;
+      displayUpNextMenu();
+    }
+    break;
+
+  case JOYSTICK_CENTER:
+    // move the selected song to the front so it plays next, or clear the queue
+    if (upNextMenu_currentPosition == queue_size)
+    {
+      playQueue_clear();
+      upNextMenu_currentPosition = 0;
+    }
+    else
+    {
+      playQueue_move(upNextMenu_currentPosition, 0);
+      upNextMenu_currentPosition = 0;
+    }
+    displayUpNextMenu();
+    break;
+
+  case JOYSTICK_RIGHT:
+    // remove the selected song
+    playQueue_removeAt(upNextMenu_currentPosition);
+    displayUpNextMenu();
+    break;
+
+  case JOYSTICK_LEFT:
+    displayMainMenu();
+    break;
+
+  default:
+    // unsupported direction
+    break;
+  }
+}
+
+/* -------------------------------------------------------------------- *
+ * SETTINGS MENU                                                        *
+ * -------------------------------------------------------------------- */
+static void displaySettingsMenu(void)
+{
+  current_menu = SETTINGS_MENU;
+  settingsMenu_currentOption = SETTINGS_SHUFFLE;
+  SettingsMenu_setArrowAtLine(LCD_LINE1);
+}
+
+static void SettingsMenu_setArrowAtLine(LCD_LINE_NUM line)
+{
+  char option_strings[NUM_SETTINGS_OPTIONS][21];
+  snprintf(option_strings[SETTINGS_SHUFFLE], sizeof(option_strings[0]), "Shuffle: %s",
+           playOrder_isShuffle() ? "On" : "Off");
+  snprintf(option_strings[SETTINGS_REPEAT], sizeof(option_strings[0]), "Repeat: %s",
+           RepeatMode_strings[playOrder_getRepeatMode()]);
+  snprintf(option_strings[SETTINGS_ARTIST_SPREAD], sizeof(option_strings[0]), "Artist Spread: %s",
+           playOrder_isArtistSpread() ? "On" : "Off");
+
+  LCD_clear();
+  for (int i = 0; i < NUM_SETTINGS_OPTIONS; i++)
+  {
+    LCD_writeStringAtLine("", i);
+    if (i == line)
+    {
+      LCD_writeChar(LCD_RIGHT_ARROW);
+    }
+    LCD_writeString(option_strings[i]);
+  }
+  current_arrow_line = line;
+}
+
+static void SettingsMenu_joystickAction(enum eJoystickDirections currentJoyStickDirection)
+{
+  switch (currentJoyStickDirection)
+  {
+  case JOYSTICK_UP:
+    if (settingsMenu_currentOption != SETTINGS_SHUFFLE)
+    {
+      settingsMenu_currentOption--;
+      SettingsMenu_setArrowAtLine(settingsMenu_currentOption);
+    }
+    break;
+
+  case JOYSTICK_DOWN:
+    if (settingsMenu_currentOption != NUM_SETTINGS_OPTIONS - 1)
+    {
+      settingsMenu_currentOption++;
+      SettingsMenu_setArrowAtLine(settingsMenu_currentOption);
+    }
+    break;
+
+  case JOYSTICK_CENTER:
+    // toggle the selected option
+    if (settingsMenu_currentOption == SETTINGS_SHUFFLE)
+    {
+      playOrder_setShuffle(!playOrder_isShuffle());
+    }
+    else if (settingsMenu_currentOption == SETTINGS_REPEAT)
+    {
+      playOrder_setRepeatMode((playOrder_getRepeatMode() + 1) % NUM_REPEAT_MODES);
+    }
+    else if (settingsMenu_currentOption == SETTINGS_ARTIST_SPREAD)
+    {
+      playOrder_setArtistSpread(!playOrder_isArtistSpread());
+    }
+    SettingsMenu_setArrowAtLine(settingsMenu_currentOption);
+    break;
+
+  case JOYSTICK_LEFT:
+    displayMainMenu();
+    break;
+
+  default:
+    // unsupported direction
+    break;
+  }
+}
+
 /* -------------------------------------------------------------------- *
  * MAIN MENU                                                            *
  * -------------------------------------------------------------------- */
@@ -474,7 +769,7 @@ static void displayMainMenu(void)
 {
   current_menu = MAIN_MENU;
   MainMenu_currentOpt = SONGS_OPT;
-  MainMenu_setArrowAtLine(SONGS_OPT);
+  MainMenu_setArrowAtOption(SONGS_OPT);
 }
 
 static void MainMenu_changeMenu(MAIN_OPTIONS option)
@@ -485,6 +780,14 @@ static void MainMenu_changeMenu(MAIN_OPTIONS option)
     // song manager
     displaySongMenu();
     break;
+  case PLAYLISTS_OPT:
+    playlistsMenu_currentPlaylist = 0;
+    displayPlaylistsMenu();
+    break;
+  case UP_NEXT_OPT:
+    upNextMenu_currentPosition = 0;
+    displayUpNextMenu();
+    break;
   case BLUETOOTH_OPT:
     displayBluetoothMenu();
     break;
@@ -517,13 +820,13 @@ static void mainMenuJoystickAction(enum eJoystickDirections currentJoyStickDirec
     {
       MainMenu_currentOpt--;
     }
-    MainMenu_setArrowAtLine(MainMenu_currentOpt);
+    MainMenu_setArrowAtOption(MainMenu_currentOpt);
     break;
 
   case JOYSTICK_DOWN:
     // scroll down
     MainMenu_currentOpt = (MainMenu_currentOpt + 1) % NUM_MAIN_OPTIONS;
-    MainMenu_setArrowAtLine(MainMenu_currentOpt);
+    MainMenu_setArrowAtOption(MainMenu_currentOpt);
     break;
 
   case JOYSTICK_CENTER:
@@ -537,56 +840,20 @@ static void mainMenuJoystickAction(enum eJoystickDirections currentJoyStickDirec
   }
 }
 
-static void MainMenu_setArrowAtLine(LCD_LINE_NUM line)
+// Shows the page of 4 options that holds "option", with the arrow at "option"
+static void MainMenu_setArrowAtOption(MAIN_OPTIONS option)
 {
-  switch (line)
-  {
-  case LCD_LINE1:
-    // draw arrow on line 1
-    LCD_clear();
-    LCD_writeChar(LCD_RIGHT_ARROW);
-    LCD_writeString(MainMenu_option_strings[0]);
-    LCD_writeStringAtLine(MainMenu_option_strings[1], LCD_LINE2);
-    LCD_writeStringAtLine(MainMenu_option_strings[2], LCD_LINE3);
-    LCD_writeStringAtLine(MainMenu_option_strings[3], LCD_LINE4);
-
-    break;
-  case 1:
-    // draw arrow line 2
-    LCD_clear();
-    LCD_writeStringAtLine(MainMenu_option_strings[0], LCD_LINE1);
-    LCD_writeStringAtLine("", LCD_LINE2);
-    LCD_writeChar(LCD_RIGHT_ARROW);
-    LCD_writeString(MainMenu_option_strings[1]);
-    LCD_writeStringAtLine(MainMenu_option_strings[2], LCD_LINE3);
-    LCD_writeStringAtLine(MainMenu_option_strings[3], LCD_LINE4);
+  int page_start = option - (option % NUM_LINES);
 
-    break;
-  case 2:
-    // draw arrow line 3
-    LCD_clear();
-    LCD_writeString(MainMenu_option_strings[0]);
-    LCD_writeStringAtLine(MainMenu_option_strings[1], LCD_LINE2);
-    LCD_writeStringAtLine("", LCD_LINE3); // set cursor
-    LCD_writeChar(LCD_RIGHT_ARROW);
-    LCD_writeString(MainMenu_option_strings[2]);
-    LCD_writeStringAtLine(MainMenu_option_strings[3], LCD_LINE4);
-
-    break;
-  case 3:
-    // draw arrow on line 4
-    LCD_clear();
-    LCD_writeString(MainMenu_option_strings[0]);
-    LCD_writeStringAtLine(MainMenu_option_strings[1], LCD_LINE2);
-    LCD_writeStringAtLine(MainMenu_option_strings[2], LCD_LINE3);
-    LCD_writeStringAtLine("", LCD_LINE4);
-    LCD_writeChar(LCD_RIGHT_ARROW); // set cursor
-
-    LCD_writeString(MainMenu_option_strings[3]);
-
-    break;
-  default:
-    break;
+  LCD_clear();
+  for (int line = LCD_LINE1; line < NUM_LINES && page_start + line < NUM_MAIN_OPTIONS; line++)
+  {
+    LCD_writeStringAtLine("", line);
+    if (page_start + line == option)
+    {
+      LCD_writeChar(LCD_RIGHT_ARROW);
+    }
+    LCD_writeString(MainMenu_option_strings[page_start + line]);
   }
 }
 
@@ -610,6 +877,10 @@ static void songMenuJoystickAction(enum eJoystickDirections currentJoyStickDirec
   case JOYSTICK_CENTER:
     songManager_playSong();
     break;
+  case JOYSTICK_RIGHT:
+    // add to Up Next
+    songManager_enqueueSong();
+    break;
   default:
     // unsupported direction
     break;
@@ -629,14 +900,21 @@ static void *MenuManagerThread(void *arg)
     action_timers[i] = (long long)0;
   }
 
+  trace_nameThread("menu");
   displayMainMenu();
   while (!stoppingMenu && !Shutdown_isShutdown())
   {
+    trace_begin("Joystick_process_direction");
+    long long polled_us = metrics_getTimeInUs();
     enum eJoystickDirections currentJoyStickDirection = Joystick_process_direction();
+    trace_end("Joystick_process_direction");
 
     // Trigger action
     if (isActionTriggered(action_timers, currentJoyStickDirection) && currentJoyStickDirection != JOYSTICK_NONE)
     {
+      long long action_start = metrics_getTimeInUs();
+      trace_begin("joystick action");
+      latency_beginAction(LATENCY_SOURCE_JOYSTICK, Joystick_getDirectionName(currentJoyStickDirection), polled_us);
       switch (current_menu)
       {
       case MAIN_MENU:
@@ -645,6 +923,12 @@ static void *MenuManagerThread(void *arg)
       case SONGS_MENU:
         songMenuJoystickAction(currentJoyStickDirection);
         break;
+      case PLAYLISTS_MENU:
+        PlaylistsMenu_joystickAction(currentJoyStickDirection);
+        break;
+      case UP_NEXT_MENU:
+        UpNextMenu_joystickAction(currentJoyStickDirection);
+        break;
       case BLUETOOTH_MENU:
         BluetoothMenu_joystickAction(currentJoyStickDirection);
         break;
@@ -652,16 +936,33 @@ static void *MenuManagerThread(void *arg)
         BTScanMenu_joystickAction(currentJoyStickDirection);
         break;
       case SETTINGS_MENU:
+        SettingsMenu_joystickAction(currentJoyStickDirection);
         break;
       default:
         // invalid option
         break;
       }
+      latency_endAction();
+      trace_end("joystick action");
+      metrics_increment(&actions_metrics[currentJoyStickDirection]);
+      metrics_observe(&action_metric, metrics_getTimeInUs() - action_start);
 
       // Update current direction time
       setTimers(action_timers, currentJoyStickDirection, DEBOUNCE_WAIT_TIME);
     }
 
+    // songs added or deleted over the network
+    bool library_changed = songManager_consumeLibraryChanged();
+    if (library_changed && current_menu == SONGS_MENU)
+    {
+      songManager_displaySongs();
+    }
+    // the queue also changes when a song starts or from the network
+    if ((playQueue_consumeChanged() || library_changed) && current_menu == UP_NEXT_MENU)
+    {
+      displayUpNextMenu();
+    }
+
     // Adjust timers
     decrementTimers(action_timers, timer_size);
     Sleep_ms(INPUT_CHECK_WAIT_TIME);
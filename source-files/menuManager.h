@@ -20,6 +20,8 @@ typedef enum
 {
   MAIN_MENU,
   SONGS_MENU,
+  PLAYLISTS_MENU,
+  UP_NEXT_MENU,
   BLUETOOTH_MENU,
   BTSCAN_MENU,
   SETTINGS_MENU,
@@ -32,6 +34,8 @@ typedef enum
 typedef enum
 {
   SONGS_OPT,
+  PLAYLISTS_OPT,
+  UP_NEXT_OPT,
   BLUETOOTH_OPT,
   SETTINGS_OPT,
   POWEROFF_OPT,
@@ -48,6 +52,17 @@ typedef enum
   NUM_BT_OPTIONS
 } BLUETOOTH_OPTIONS;
 
+/**
+ * Enum to keep track of Settings menu options
+ */
+typedef enum
+{
+  SETTINGS_SHUFFLE,
+  SETTINGS_REPEAT,
+  SETTINGS_ARTIST_SPREAD,
+  NUM_SETTINGS_OPTIONS
+} SETTINGS_OPTIONS;
+
 #include "songManager.h"
 
 // Initialize all the modules used in the menu
@@ -57,6 +72,7 @@ void MenuManager_init(void);
 void MenuManager_cleanup(void);
 
 // Returns the current song playing by the user
+// Note: caller must call songManager_releaseSong() on the result
 song_info *MenuManager_GetCurrentSongPlaying();
 
 #endif // _MENUMANAGER_H
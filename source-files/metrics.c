@@ -0,0 +1,300 @@
+/**
+ * @file metrics.c
+ * @brief This is a source file for the metrics module.
+ *
+ * This source file contains the declaration of the functions
+ * for the metrics module, the one registry of the counters, gauges and
+ * histograms of every subsystem, exported in the Prometheus text format.
+ *
+ * The registry is a fixed array filled by the registrations and never
+ * emptied: an entry is written under the registry mutex, then published
+ * by storing the new count with release semantics, so the export reads
+ * the entries without taking the mutex. The metrics themselves are only
+ * touched with relaxed atomics; an export may see a histogram between the
+ * update of a bucket and of the sum, which the next one catches up with.
+ *
+ * @author Amirhossein Etaati
+ * @date 2023-04-17
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "metrics.h"
+
+typedef enum
+{
+    METRIC_COUNTER,
+    METRIC_GAUGE,
+    METRIC_HISTOGRAM
+} metric_type_t;
+
+typedef struct
+{
+    metric_type_t type;
+    const char *name;
+    const char *labels;
+    const char *help;
+    void *metric;
+} entry_t;
+
+// Text being written into the buffer of metrics_format(), counted on past its end
+typedef struct
+{
+    char *buffer;
+    size_t size;
+    size_t length;
+} text_t;
+
+static const char *type_names[] = {"counter", "gauge", "histogram"};
+
+static pthread_mutex_t registryMutex = PTHREAD_MUTEX_INITIALIZER;
+static entry_t entries[METRICS_MAX_METRICS];
+static int numEntries = 0;
+static metrics_collector_t collectors[METRICS_MAX_COLLECTORS];
+static int numCollectors = 0;
+
+// Private functions definitions
+static void registerMetric(metric_type_t type, void *metric, const char *name, const char *labels, const char *help);
+static void formatFamily(text_t *text, int first, int count);
+static void formatHistogram(text_t *text, const entry_t *entry);
+static void formatSeconds(long long us, char *seconds, size_t size);
+static void append(text_t *text, const char *format, ...);
+
+//------------------------------------------------
+//////////////// Public Functions ////////////////
+//------------------------------------------------
+
+void metrics_registerCounter(metrics_counter_t *counter, const char *name, const char *labels, const char *help)
+{
+    registerMetric(METRIC_COUNTER, counter, name, labels, help);
+}
+
+void metrics_registerGauge(metrics_gauge_t *gauge, const char *name, const char *labels, const char *help)
+{
+    registerMetric(METRIC_GAUGE, gauge, name, labels, help);
+}
+
+void metrics_registerHistogram(metrics_histogram_t *histogram, const char *name, const char *labels, const char *help,
+                               const long long *bounds_us, int num_bounds)
+{
+    if (num_bounds < 1 || num_bounds > METRICS_MAX_BUCKETS)
+    {
+        fprintf(stderr, "metrics: Error - %s has %d buckets, at most %d are supported.\n", name, num_bounds,
+                METRICS_MAX_BUCKETS);
+        return;
+    }
+    histogram->bounds_us = bounds_us;
+    histogram->num_bounds = num_bounds;
+    registerMetric(METRIC_HISTOGRAM, histogram, name, labels, help);
+}
+
+void metrics_registerCollector(metrics_collector_t collector)
+{
+    pthread_mutex_lock(&registryMutex);
+    if (numCollectors < METRICS_MAX_COLLECTORS)
+    {
+        collectors[numCollectors] = collector;
+        __atomic_store_n(&numCollectors, numCollectors + 1, __ATOMIC_RELEASE);
+    }
+    else
+    {
+        fprintf(stderr, "metrics: Error - Too many collectors, one is ignored.\n");
+    }
+    pthread_mutex_unlock(&registryMutex);
+}
+
+void metrics_add(metrics_counter_t *counter, long long amount)
+{
+    __atomic_fetch_add(&counter->value, amount, __ATOMIC_RELAXED);
+}
+
+void metrics_increment(metrics_counter_t *counter)
+{
+    __atomic_fetch_add(&counter->value, 1, __ATOMIC_RELAXED);
+}
+
+void metrics_setCounter(metrics_counter_t *counter, long long value)
+{
+    __atomic_store_n(&counter->value, value, __ATOMIC_RELAXED);
+}
+
+void metrics_set(metrics_gauge_t *gauge, long long value)
+{
+    __atomic_store_n(&gauge->value, value, __ATOMIC_RELAXED);
+}
+
+void metrics_observe(metrics_histogram_t *histogram, long long duration_us)
+{
+    int bucket = 0;
+    while (bucket < histogram->num_bounds && duration_us > histogram->bounds_us[bucket])
+    {
+        bucket++;
+    }
+    __atomic_fetch_add(&histogram->buckets[bucket], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->sum_us, duration_us, __ATOMIC_RELAXED);
+}
+
+long long metrics_getTimeInUs(void)
+{
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return spec.tv_sec * 1000000LL + spec.tv_nsec / 1000;
+}
+
+size_t metrics_format(char *buffer, size_t size)
+{
+    int collector_count = __atomic_load_n(&numCollectors, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < collector_count; i++)
+    {
+        collectors[i]();
+    }
+
+    text_t text = {buffer, size, 0};
+    if (size > 0)
+    {
+        buffer[0] = '\0';
+    }
+    int count = __atomic_load_n(&numEntries, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < count; i++)
+    {
+        // a family is written where its first metric was registered
+        bool written = false;
+        for (int j = 0; j < i && !written; j++)
+        {
+            written = strcmp(entries[j].name, entries[i].name) == 0;
+        }
+        if (!written)
+        {
+            formatFamily(&text, i, count);
+        }
+    }
+    return text.length;
+}
+
+//------------------------------------------------
+/////////////// Private Functions ////////////////
+//------------------------------------------------
+
+static void registerMetric(metric_type_t type, void *metric, const char *name, const char *labels, const char *help)
+{
+    pthread_mutex_lock(&registryMutex);
+    if (numEntries < METRICS_MAX_METRICS)
+    {
+        entries[numEntries].type = type;
+        entries[numEntries].name = name;
+        entries[numEntries].labels = (labels != NULL && labels[0] != '\0') ? labels : NULL;
+        entries[numEntries].help = help;
+        entries[numEntries].metric = metric;
+        __atomic_store_n(&numEntries, numEntries + 1, __ATOMIC_RELEASE);
+    }
+    else
+    {
+        fprintf(stderr, "metrics: Error - Too many metrics, %s is ignored.\n", name);
+    }
+    pthread_mutex_unlock(&registryMutex);
+}
+
+// Writes the metrics named like entries[first], among the first "count"
+static void formatFamily(text_t *text, int first, int count)
+{
+    const entry_t *family = &entries[first];
+    append(text, "# HELP %s %s\n# TYPE %s %s\n", family->name, family->help, family->name, type_names[family->type]);
+    for (int i = first; i < count; i++)
+    {
+        const entry_t *entry = &entries[i];
+        if (strcmp(entry->name, family->name) != 0 || entry->type != family->type)
+        {
+            continue;
+        }
+
+        if (entry->type == METRIC_HISTOGRAM)
+        {
+            formatHistogram(text, entry);
+            continue;
+        }
+        // counters and gauges have the same layout
+        long long value = __atomic_load_n(&((metrics_counter_t *)entry->metric)->value, __ATOMIC_RELAXED);
+        if (entry->labels != NULL)
+        {
+            append(text, "%s{%s} %lld\n", entry->name, entry->labels, value);
+        }
+        else
+        {
+            append(text, "%s %lld\n", entry->name, value);
+        }
+    }
+}
+
+static void formatHistogram(text_t *text, const entry_t *entry)
+{
+    const metrics_histogram_t *histogram = entry->metric;
+    const char *separator = (entry->labels != NULL) ? "," : "";
+    const char *labels = (entry->labels != NULL) ? entry->labels : "";
+    char seconds[32];
+
+    // the buckets are cumulative, and the count is their total so that both agree
+    long long total = 0;
+    for (int i = 0; i <= histogram->num_bounds; i++)
+    {
+        total += __atomic_load_n(&histogram->buckets[i], __ATOMIC_RELAXED);
+        if (i < histogram->num_bounds)
+        {
+            formatSeconds(histogram->bounds_us[i], seconds, sizeof(seconds));
+        }
+        else
+        {
+            snprintf(seconds, sizeof(seconds), "+Inf");
+        }
+        append(text, "%s_bucket{%s%sle=\"%s\"} %lld\n", entry->name, labels, separator, seconds, total);
+    }
+
+    formatSeconds(__atomic_load_n(&histogram->sum_us, __ATOMIC_RELAXED), seconds, sizeof(seconds));
+    if (entry->labels != NULL)
+    {
+        append(text, "%s_sum{%s} %s\n%s_count{%s} %lld\n", entry->name, labels, seconds, entry->name, labels, total);
+    }
+    else
+    {
+        append(text, "%s_sum %s\n%s_count %lld\n", entry->name, seconds, entry->name, total);
+    }
+}
+
+// Writes "us" in seconds, without the trailing zeros, e.g. "0.00025"
+static void formatSeconds(long long us, char *seconds, size_t size)
+{
+    const char *sign = (us < 0) ? "-" : "";
+    us = (us < 0) ? -us : us;
+    int length = snprintf(seconds, size, "%s%lld.%06lld", sign, us / 1000000, us % 1000000);
+    while (length > 0 && (size_t)length < size && seconds[length - 1] == '0')
+    {
+        length--;
+    }
+    if (length > 0 && (size_t)length < size && seconds[length - 1] == '.')
+    {
+        length--;
+    }
+    if (length > 0 && (size_t)length < size)
+    {
+        seconds[length] = '\0';
+    }
+}
+
+static void append(text_t *text, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    bool fits = text->length < text->size;
+    int length = vsnprintf(fits ? text->buffer + text->length : NULL, fits ? text->size - text->length : 0, format,
+                           args);
+    va_end(args);
+    if (length > 0)
+    {
+        text->length += length;
+    }
+}
@@ -0,0 +1,85 @@
+/**
+ * @file metrics.h
+ * @brief This is a header file for the metrics module.
+ *
+ * This header file contains the definitions of the functions
+ * for the metrics module, the one registry of the counters, gauges and
+ * histograms of every subsystem (audio, network, LCD, input, Bluetooth,
+ * library), exported in the Prometheus text format (version 0.0.4) by
+ * GET /metrics of the HTTP server.
+ *
+ * A module owns its metrics, usually as static variables, and registers
+ * them once, from its init function. Updating a metric is a relaxed
+ * atomic operation on it: no lock, no allocation and no system call, so
+ * the audio thread can count what it does. Values a module already keeps
+ * in a stats structure are copied into its metrics by a collector it
+ * registers, which is called each time the metrics are exported.
+ *
+ * Metrics with the same name form one family, told apart by their labels,
+ * e.g. "status=\"OK\"". Names follow the Prometheus conventions: a
+ * "beaglepod_<subsystem>_" prefix, "_total" for counters and the unit last.
+ *
+ * @author Amirhossein Etaati
+ * @date 2023-04-17
+ */
+
+#if !defined(METRICS_H)
+#define METRICS_H
+
+#include <stddef.h>
+
+// Metrics that can be registered, over all the modules
+#define METRICS_MAX_METRICS 192
+#define METRICS_MAX_COLLECTORS 16
+// Upper bounds of a histogram, the "+Inf" bucket excluded
+#define METRICS_MAX_BUCKETS 16
+
+// Only goes up, e.g. packets sent
+typedef struct
+{
+    long long value;
+} metrics_counter_t;
+
+// Goes up and down, e.g. songs in the library
+typedef struct
+{
+    long long value;
+} metrics_gauge_t;
+
+// Counts observed durations in fixed buckets
+typedef struct
+{
+    const long long *bounds_us; // increasing upper bounds of the buckets
+    int num_bounds;
+    long long buckets[METRICS_MAX_BUCKETS + 1]; // the last one counts what is above every bound
+    long long sum_us;
+} metrics_histogram_t;
+
+// Called when the metrics are exported, to update the metrics of a module from its stats
+typedef void (*metrics_collector_t)(void);
+
+// "name", "labels" (NULL for none) and "help" must outlive the registration, e.g. string literals;
+// the metrics of a family must have the same type and help
+void metrics_registerCounter(metrics_counter_t *counter, const char *name, const char *labels, const char *help);
+void metrics_registerGauge(metrics_gauge_t *gauge, const char *name, const char *labels, const char *help);
+// "bounds_us" holds "num_bounds" increasing durations, at most METRICS_MAX_BUCKETS, and must outlive the registration
+void metrics_registerHistogram(metrics_histogram_t *histogram, const char *name, const char *labels, const char *help,
+                               const long long *bounds_us, int num_bounds);
+void metrics_registerCollector(metrics_collector_t collector);
+
+// Thread safe and lock free
+void metrics_add(metrics_counter_t *counter, long long amount);
+void metrics_increment(metrics_counter_t *counter);
+// For a total a module already keeps, from its collector
+void metrics_setCounter(metrics_counter_t *counter, long long value);
+void metrics_set(metrics_gauge_t *gauge, long long value);
+void metrics_observe(metrics_histogram_t *histogram, long long duration_us);
+
+// Monotonic time the durations given to metrics_observe() are measured with
+long long metrics_getTimeInUs(void);
+
+// Writes the registered metrics in the Prometheus text format into "buffer", always terminated
+// Returns the length of the whole text like snprintf, which is "size" or more if it was truncated
+size_t metrics_format(char *buffer, size_t size);
+
+#endif // METRICS_H
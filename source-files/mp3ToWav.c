@@ -1,81 +1,450 @@
 /**
  * @file mp3ToWav.c
  * @brief This is a source file for the mp3ToWav module.
- * Note: This Module is not used - Found a more efficient way to convert using the ffmpeg javascript library
+ * Note: used by the httpServer module to convert uploaded MP3 files, and by
+ * the songWatcher module to import collections
  *
  * This source file contains the declaration of the functions
  * for the mp3ToWav module, which provides the utilities
  * for converting an MP3 file to WAV format
  *
+ * Queued conversions are run by a pool of worker threads, one per core up
+ * to MP3_TO_WAVE_MAX_WORKERS, each running one single-threaded ffmpeg at a
+ * time. The workers lower their own CPU (nice) and I/O (idle class)
+ * priority, which the ffmpeg processes they start inherit, so a bulk
+ * import only uses what the audio thread leaves. A streamed conversion
+ * is started the same way by the thread feeding it.
+ *
  * @author Amirhossein Etaati
  * @date 2023-03-07
  */
 
+// for pipe2() and syscall()
+#define _GNU_SOURCE
 
 #include "mp3ToWav.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <stdbool.h>
 #include <assert.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "audio_player.h"
+#include "metrics.h"
+
+#define CONVERT_COMMAND "ffmpeg"
+#define STR_HELPER(x) #x
+#define STR(x) STR_HELPER(x)
+
+// The arguments after the input: 16 bit samples at the rate and channels the audio player plays,
+// behind a plain 44 byte header (bitexact and no metadata leave out the LIST chunk)
+#define CONVERT_OUTPUT_ARGS "-map_metadata", "-1", "-fflags", "+bitexact", \
+                            "-ar", STR(SAMPLE_RATE), "-ac", STR(NUM_CHANNELS), "-acodec", "pcm_s16le"
+
+// From linux/ioprio.h, which older toolchains do not have
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_CLASS_SHIFT 13
+
+// What ffmpeg -progress reports the converted audio as
+#define PROGRESS_TIME_KEY "out_time_us="
+
+extern char **environ;
 
-#define CONVERT_COMMAND "ffmpeg -y -i "
+typedef struct job
+{
+    char *mp3_path;
+    char *wav_path;
+    mp3ToWave_progress_t on_progress;
+    mp3ToWave_done_t on_done;
+    void *context;
+    struct job *next;
+} job_t;
+
+static pthread_t workers[MP3_TO_WAVE_MAX_WORKERS];
+// ffmpeg run by each worker, -1 while it has none, stopped by mp3ToWave_cleanup()
+static pid_t worker_pids[MP3_TO_WAVE_MAX_WORKERS];
+static int num_workers = 0;
+static bool stoppingWorkers = false;
 
-#define MAX_STR_SIZE 4096
+static job_t *queue_head = NULL;
+static job_t *queue_tail = NULL;
+static mp3ToWave_stats_t stats;
+static pthread_mutex_t jobsMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t jobAvailable = PTHREAD_COND_INITIALIZER;
 
-// function to run linux command
-// Note: adapted from assignment one description
-static void runCommand(char* command)
+// Metrics, see metrics.h
+static metrics_gauge_t queued_metric;
+static metrics_gauge_t running_metric;
+static metrics_counter_t converted_metric;
+static metrics_counter_t failed_metric;
+static metrics_counter_t converted_ms_metric;
+
+// function to start the converter without a shell, so paths need no quoting
+// Its standard input is "input_fd" and its standard output "output_fd", unless they are -1
+// Returns its pid, -1 if it could not be started
+static pid_t startCommand(char *const args[], int input_fd, int output_fd)
 {
-    // Execute the shell command (output into pipe)
-    FILE *pipe = popen(command, "r");
-    // Ignore output of the command; but consume it
-    // so we don't get an error when closing the pipe.
-    char buffer[1024];
-    while (!feof(pipe) && !ferror(pipe)) {
-        if (fgets(buffer, sizeof(buffer), pipe) == NULL)
-            break;
-            // printf("--> %s", buffer); // Uncomment for debugging
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (input_fd >= 0)
+    {
+        posix_spawn_file_actions_adddup2(&actions, input_fd, STDIN_FILENO);
+    }
+    // Ignore output of the command
+    if (output_fd >= 0)
+    {
+        posix_spawn_file_actions_adddup2(&actions, output_fd, STDOUT_FILENO);
+    }
+    else
+    {
+        posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    }
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+
+    // the caller may block or ignore SIGPIPE, the command gets the default
+    posix_spawnattr_t attributes;
+    posix_spawnattr_init(&attributes);
+    sigset_t signals;
+    sigemptyset(&signals);
+    posix_spawnattr_setsigmask(&attributes, &signals);
+    sigaddset(&signals, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attributes, &signals);
+    posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+    pid_t pid = -1;
+    int error = posix_spawnp(&pid, args[0], &actions, &attributes, args, environ);
+    posix_spawnattr_destroy(&attributes);
+    posix_spawn_file_actions_destroy(&actions);
+    if (error != 0)
+    {
+        fprintf(stderr, "Unable to execute command: %s (%s)\n", args[0], strerror(error));
+        return -1;
+    }
+    return pid;
+}
+
+// Returns false if the command "pid" exited with an error
+static bool waitCommand(pid_t pid, const char *name)
+{
+    if (pid < 0)
+    {
+        return false;
+    }
+    int status = 0;
+    pid_t waited;
+    do
+    {
+        waited = waitpid(pid, &status, 0);
+    } while (waited < 0 && errno == EINTR);
+    int exitCode = (waited == pid && WIFEXITED(status)) ? WEXITSTATUS(status) : -1;
+    if (exitCode != 0)
+    {
+        printf("Unable to execute command: %s\n", name);
+        printf(" exit code: %d\n", exitCode);
+    }
+    return exitCode == 0;
+}
+
+// Linux keeps the nice value and I/O priority per thread and copies them to the processes it starts
+static void lowerPriority(void)
+{
+    pid_t thread = syscall(SYS_gettid);
+    if (setpriority(PRIO_PROCESS, thread, MP3_TO_WAVE_NICE) != 0 ||
+        syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, thread, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) != 0)
+    {
+        perror("mp3ToWav: Unable to lower the priority of the conversions");
+    }
+}
+
+// Converts the file of "job" with the converter of worker "worker", reporting its progress
+static bool runJob(job_t *job, int worker)
+{
+    // close-on-exec, so converters started by other threads do not keep the pipe open
+    int progress_fds[2];
+    if (pipe2(progress_fds, O_CLOEXEC) != 0)
+    {
+        perror("Unable to create pipe");
+        return false;
+    }
+    char *const args[] = {
+        CONVERT_COMMAND, "-y", "-loglevel", "error", "-nostats", "-progress", "pipe:1", "-threads", "1",
+        "-i", job->mp3_path, CONVERT_OUTPUT_ARGS, job->wav_path, NULL};
+    pid_t pid = startCommand(args, -1, progress_fds[1]);
+    close(progress_fds[1]);
+    pthread_mutex_lock(&jobsMutex);
+    worker_pids[worker] = pid;
+    if (stoppingWorkers && pid > 0)
+    {
+        kill(pid, SIGTERM);
+    }
+    pthread_mutex_unlock(&jobsMutex);
+
+    // "key=value" lines, a block of them every half second
+    FILE *progress = fdopen(progress_fds[0], "r");
+    char line[256];
+    long long reported_ms = 0;
+    while (progress != NULL && fgets(line, sizeof(line), progress) != NULL)
+    {
+        if (strncmp(line, PROGRESS_TIME_KEY, strlen(PROGRESS_TIME_KEY)) != 0)
+        {
+            continue;
+        }
+        long long converted_ms = strtoll(line + strlen(PROGRESS_TIME_KEY), NULL, 10) / 1000;
+        if (converted_ms <= reported_ms)
+        {
+            continue;
         }
-            // Get the exit code from the pipe; non-zero is an error:
-            int exitCode = WEXITSTATUS(pclose(pipe));
-            if (exitCode != 0) {
-            perror("Unable to execute command:");
-            printf(" command: %s\n", command);
-            printf(" exit code: %d\n", exitCode);
+        pthread_mutex_lock(&jobsMutex);
+        stats.converted_ms += converted_ms - reported_ms;
+        pthread_mutex_unlock(&jobsMutex);
+        reported_ms = converted_ms;
+        if (job->on_progress != NULL)
+        {
+            job->on_progress(job->mp3_path, (int)converted_ms, job->context);
         }
+    }
+    if (progress != NULL)
+    {
+        fclose(progress);
+    }
+    else
+    {
+        close(progress_fds[0]);
+    }
+
+    // not reaped yet, so a kill from mp3ToWave_cleanup() cannot reach another process
+    pthread_mutex_lock(&jobsMutex);
+    worker_pids[worker] = -1;
+    pthread_mutex_unlock(&jobsMutex);
+    return waitCommand(pid, CONVERT_COMMAND);
+}
+
+static void finishJob(job_t *job, bool converted)
+{
+    if (job->on_done != NULL)
+    {
+        job->on_done(job->mp3_path, job->wav_path, converted, job->context);
+    }
+    free(job->mp3_path);
+    free(job->wav_path);
+    free(job);
+}
+
+static void *workerThread(void *arg)
+{
+    int worker = (int)(intptr_t)arg;
+    lowerPriority();
+    for (;;)
+    {
+        pthread_mutex_lock(&jobsMutex);
+        while (!stoppingWorkers && queue_head == NULL)
+        {
+            pthread_cond_wait(&jobAvailable, &jobsMutex);
+        }
+        if (stoppingWorkers)
+        {
+            pthread_mutex_unlock(&jobsMutex);
+            return NULL;
+        }
+        job_t *job = queue_head;
+        queue_head = job->next;
+        if (queue_head == NULL)
+        {
+            queue_tail = NULL;
+        }
+        stats.queued--;
+        stats.running++;
+        pthread_mutex_unlock(&jobsMutex);
+
+        bool converted = runJob(job, worker);
+
+        pthread_mutex_lock(&jobsMutex);
+        stats.running--;
+        if (converted)
+        {
+            stats.converted++;
+        }
+        else
+        {
+            stats.failed++;
+        }
+        pthread_mutex_unlock(&jobsMutex);
+        finishJob(job, converted);
+    }
+}
+
+// copies the counts of the conversions into the metrics when they are exported
+static void collectMetrics(void)
+{
+    mp3ToWave_stats_t current;
+    mp3ToWave_getStats(&current);
+    metrics_set(&queued_metric, current.queued);
+    metrics_set(&running_metric, current.running);
+    metrics_setCounter(&converted_metric, current.converted);
+    metrics_setCounter(&failed_metric, current.failed);
+    metrics_setCounter(&converted_ms_metric, current.converted_ms);
 }
 
 bool isModuleInitialize = false;
 
-void mp3ToWave_init(void) 
+void mp3ToWave_init(void)
 {
+    memset(&stats, 0, sizeof(stats));
+    stoppingWorkers = false;
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    num_workers = (cores < 1) ? 1 : (cores > MP3_TO_WAVE_MAX_WORKERS) ? MP3_TO_WAVE_MAX_WORKERS : (int)cores;
+    for (int i = 0; i < num_workers; i++)
+    {
+        worker_pids[i] = -1;
+        pthread_create(&workers[i], NULL, workerThread, (void *)(intptr_t)i);
+    }
+    stats.workers = num_workers;
+
+    metrics_registerGauge(&queued_metric, "beaglepod_library_conversions_queued", NULL,
+                          "MP3 conversions waiting for a worker");
+    metrics_registerGauge(&running_metric, "beaglepod_library_conversions_running", NULL, "MP3 conversions running");
+    metrics_registerCounter(&converted_metric, "beaglepod_library_converted_total", NULL, "MP3 files converted to WAV");
+    metrics_registerCounter(&failed_metric, "beaglepod_library_conversion_failures_total", NULL,
+                            "MP3 conversions that failed or were stopped");
+    metrics_registerCounter(&converted_ms_metric, "beaglepod_library_converted_audio_ms_total", NULL,
+                            "Audio converted by the queued MP3 conversions so far, the running ones included");
+    metrics_registerCollector(collectMetrics);
     isModuleInitialize = true;
 }
 
-void mp3ToWave_convert(char *mp3_path, char *wav_path)
+bool mp3ToWave_startStream(const char *wav_path, mp3ToWave_stream_t *stream)
 {
     assert(isModuleInitialize);
 
-    char *str_command = malloc(sizeof(char)*MAX_STR_SIZE);
-    strcpy(str_command, CONVERT_COMMAND);
+    // close-on-exec, so converters started by other threads do not keep the pipe open
+    int pipe_fds[2];
+    if (pipe2(pipe_fds, O_CLOEXEC) != 0)
+    {
+        perror("Unable to create pipe");
+        return false;
+    }
+    char *const args[] = {
+        CONVERT_COMMAND, "-y", "-loglevel", "error", "-threads", "1", "-i", "pipe:0",
+        CONVERT_OUTPUT_ARGS, (char *)wav_path, NULL};
+    lowerPriority();
+    stream->pid = startCommand(args, pipe_fds[0], -1);
+    close(pipe_fds[0]);
+    if (stream->pid < 0)
+    {
+        close(pipe_fds[1]);
+        return false;
+    }
+    stream->input_fd = pipe_fds[1];
+    return true;
+}
 
-    strcat(str_command, mp3_path);
+bool mp3ToWave_finishStream(mp3ToWave_stream_t *stream)
+{
+    close(stream->input_fd);
+    stream->input_fd = -1;
+    return waitCommand(stream->pid, CONVERT_COMMAND);
+}
 
-    strcat(str_command, " ");
+bool mp3ToWave_queue(const char *mp3_path, const char *wav_path, mp3ToWave_progress_t on_progress,
+                     mp3ToWave_done_t on_done, void *context)
+{
+    assert(isModuleInitialize);
 
-    strcat(str_command, wav_path);
+    job_t *job = malloc(sizeof(*job));
+    if (job == NULL)
+    {
+        fprintf(stderr, "mp3ToWav: Error - There was a problem allocating memory.");
+        exit(1);
+    }
+    job->mp3_path = strdup(mp3_path);
+    job->wav_path = strdup(wav_path);
+    if (job->mp3_path == NULL || job->wav_path == NULL)
+    {
+        fprintf(stderr, "mp3ToWav: Error - There was a problem allocating memory.");
+        exit(1);
+    }
+    job->on_progress = on_progress;
+    job->on_done = on_done;
+    job->context = context;
+    job->next = NULL;
 
-    strcat(str_command, " 2> /dev/null");
+    pthread_mutex_lock(&jobsMutex);
+    bool queued = stats.queued < MP3_TO_WAVE_MAX_QUEUED;
+    if (queued)
+    {
+        if (queue_tail != NULL)
+        {
+            queue_tail->next = job;
+        }
+        else
+        {
+            queue_head = job;
+        }
+        queue_tail = job;
+        stats.queued++;
+        pthread_cond_signal(&jobAvailable);
+    }
+    pthread_mutex_unlock(&jobsMutex);
 
-    runCommand(str_command);
+    if (!queued)
+    {
+        free(job->mp3_path);
+        free(job->wav_path);
+        free(job);
+    }
+    return queued;
+}
 
-    free(str_command);
+void mp3ToWave_getStats(mp3ToWave_stats_t *current)
+{
+    pthread_mutex_lock(&jobsMutex);
+    *current = stats;
+    pthread_mutex_unlock(&jobsMutex);
 }
 
-void mp3ToWave_cleanup(void) 
+void mp3ToWave_cleanup(void)
 {
     assert(isModuleInitialize);
+
+    pthread_mutex_lock(&jobsMutex);
+    stoppingWorkers = true;
+    // the conversions running are cut short and reported as failed
+    for (int i = 0; i < num_workers; i++)
+    {
+        if (worker_pids[i] > 0)
+        {
+            kill(worker_pids[i], SIGTERM);
+        }
+    }
+    job_t *job = queue_head;
+    queue_head = NULL;
+    queue_tail = NULL;
+    stats.queued = 0;
+    pthread_cond_broadcast(&jobAvailable);
+    pthread_mutex_unlock(&jobsMutex);
+
+    for (int i = 0; i < num_workers; i++)
+    {
+        pthread_join(workers[i], NULL);
+    }
+    // the queued ones never ran
+    while (job != NULL)
+    {
+        job_t *next = job->next;
+        finishJob(job, false);
+        job = next;
+    }
+    num_workers = 0;
     isModuleInitialize = false;
 }
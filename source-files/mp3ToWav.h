@@ -1,7 +1,8 @@
 /**
  * @file mp3ToWav.h
  * @brief This is a header file for the mp3ToWav module.
- * Note: This Module is not used - Found a more efficient way to convert using the ffmpeg javascript library
+ * Note: used by the httpServer module to convert uploaded MP3 files, and by
+ * the songWatcher module to import collections
  *
  * This source file contains the definitions of the functions
  * for the mp3ToWav module, which provides the utilities
@@ -14,10 +15,63 @@
 #if !defined(MP3TOWAV_H)
 #define MP3TOWAV_H
 
+#include <stdbool.h>
+#include <sys/types.h>
+
+// Conversions run at the same time, at most one per core
+#define MP3_TO_WAVE_MAX_WORKERS 4
+// Conversions waiting for a worker, more are refused
+#define MP3_TO_WAVE_MAX_QUEUED 1024
+// Nice value of the queued conversions (the I/O priority is the idle class)
+#define MP3_TO_WAVE_NICE 19
+
+// A conversion fed through a pipe while its input arrives
+typedef struct
+{
+    pid_t pid;
+    int input_fd; // write the MP3 file here; writes block while the converter is behind
+} mp3ToWave_stream_t;
+
 void mp3ToWave_init(void);
 
-void mp3ToWave_convert(char *mp3_path, char *wav_path);
+// Starts converting what is written to "stream->input_fd" into a WAV file at "wav_path"
+// Note: any input ffmpeg reads from a pipe works, e.g. a WAV file in another format
+// Note: lowers the priority of the calling thread like the workers do, for ffmpeg to inherit it,
+// so the caller should be a thread that ends with the conversion
+// Note: writes fail with EPIPE (or raise SIGPIPE if it is not blocked) once the converter gave up
+// Returns false if ffmpeg could not be started
+bool mp3ToWave_startStream(const char *wav_path, mp3ToWave_stream_t *stream);
+
+// Ends the input of "stream" and waits for the WAV file to be complete
+// Returns false if the conversion failed
+bool mp3ToWave_finishStream(mp3ToWave_stream_t *stream);
+
+// Called from a worker thread as a queued conversion goes, with the audio converted so far
+typedef void (*mp3ToWave_progress_t)(const char *mp3_path, int converted_ms, void *context);
+// Called from a worker thread once a queued conversion ended; "wav_path" is complete if "converted"
+// Note: also called with "converted" false for the conversions dropped by mp3ToWave_cleanup()
+typedef void (*mp3ToWave_done_t)(const char *mp3_path, const char *wav_path, bool converted, void *context);
+
+typedef struct
+{
+    int workers;
+    int queued;
+    int running;
+    int converted;
+    int failed;
+    long long converted_ms; // audio converted by the queued conversions so far
+} mp3ToWave_stats_t;
+
+// Queues the conversion of "mp3_path" into a WAV file at "wav_path", run at a low priority
+// by the first worker free; either callback may be NULL
+// Returns false if MP3_TO_WAVE_MAX_QUEUED conversions are already waiting
+bool mp3ToWave_queue(const char *mp3_path, const char *wav_path, mp3ToWave_progress_t on_progress,
+                     mp3ToWave_done_t on_done, void *context);
+
+// Copies the counts of the queued conversions into "stats"
+void mp3ToWave_getStats(mp3ToWave_stats_t *stats);
 
+// Stops the running conversions and drops the queued ones
 void mp3ToWave_cleanup(void);
 
 #endif // MP3TOWAV_H
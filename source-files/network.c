@@ -6,6 +6,39 @@
  * for the network module, which provides the utilities
  * for sending, receiving, and parsing UDP packets.
  *
+ * Two protocols are spoken on the same port. A datagram starting with
+ * PROTOCOL_MAGIC is a binary frame (see protocol.h) and gets a binary
+ * reply with the same request id, PROTOCOL_STATUS_BAD_VERSION if it has
+ * another version. Anything else is the text protocol: the command and
+ * its arguments on separate lines, answered with the result lines, or
+ * with the status name ("ACK", "NOT_FOUND", ...) when the command has no
+ * result or failed.
+ *
+ * One thread runs an epoll loop over the UDP socket, a TCP socket on the
+ * same port, a Unix domain socket (NETWORK_UNIX_SOCKET_PATH), an eventfd
+ * that Network_cleanup() uses to stop it right away, and a timerfd that
+ * closes idle connections. On the stream sockets binary frames follow
+ * each other, and a text command ends with an empty line.
+ *
+ * add_song does not read the song on that thread: the songWatcher thread
+ * does, and the reply is sent once it wrote to another eventfd that the
+ * song is in the library. The commands a stream client sent after it wait
+ * for that reply, so its replies stay in order.
+ *
+ * The UDP socket is drained BATCH_SIZE datagrams at a time with
+ * recvmmsg(), and the commands of a batch are coalesced before they run:
+ * only the last volume_set is applied, and consecutive song_next (or
+ * song_previous) commands become one skip over as many songs. The
+ * dropped commands are still answered with ACK.
+ *
+ * Stream clients can "subscribe" to the playback status, which is then
+ * pushed to them at most every STATUS_INTERVAL_MS, only when something
+ * changed and only the fields that did (see statusStream.h): as binary
+ * PROTOCOL_OP_STATUS frames or JSON lines, after the ACK. Browsers get
+ * the JSON over a WebSocket opened on STATUS_STREAM_PATH of the TCP port.
+ * The update is sampled and encoded once per tick whatever the number
+ * of subscribers.
+ *
  * @author Amirhossein Etaati
  * @date 2023-03-10
  */
@@ -18,341 +51,1959 @@ Author: Amirhossein Etaati
 Date: 2023-03-16
 */
 
+// for recvmmsg() and sendmmsg()
+#define _GNU_SOURCE
+
 #include "network.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <netdb.h>
 #include <pthread.h>
 #include <stdbool.h>
-#include <string.h> // for strncmp()
+#include <string.h> // for strcmp()
 #include <unistd.h> // for close()
 #include <ctype.h>
 #include <assert.h>
-#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
 #include "songManager.h"
+#include "audio_player.h"
+#include "playlist.h"
+#include "playQueue.h"
+#include "playStats.h"
+#include "protocol.h"
+#include "statusStream.h"
+#include "webSocket.h"
+#include "songWatcher.h"
+#include "mp3ToWav.h"
+#include "httpServer.h"
+#include "networkInput.h"
+#include "roomSync.h"
+#include "networkOutput.h"
+#include "metrics.h"
+#include "logger.h"
+#include "trace.h"
+#include "latency.h"
+#include "shutdown.h"
 
-#define MSG_MAX_LEN 1024
-#define MSG_ACK "ACK"
-#define MSG_ACK_LEN 4
+#define MSG_MAX_LEN PROTOCOL_MAX_FRAME_SIZE
 #define PORT 12345
-#define MAX_SAMPLES_LINE 20
+// TCP and Unix domain clients connected at once, more are turned away
+#define MAX_CONNECTIONS 16
+// replies waiting for a slow client; one that lets more pile up is dropped
+#define CONNECTION_OUT_SIZE (4 * MSG_MAX_LEN)
+#define CONNECTION_IDLE_S 60
+// time between two status updates, and between checks for idle connections
+#define STATUS_INTERVAL_MS 250
+// largest status update, JSON with its WebSocket header
+#define STATUS_UPDATE_SIZE 2048
+#define STATUS_STREAM_PATH "/status"
+#define MAX_EVENTS 16
+// datagrams read with one recvmmsg() and coalesced together
+#define BATCH_SIZE 32
+// percent added or removed by volume_up and volume_down
+#define VOLUME_STEP 10
+// add_song commands waiting for their song to be read, more are answered with FAILED
+#define MAX_PENDING_ADDS 8
+
+// what an epoll event is for; connections use CONNECTION_TAG + their slot
+enum
+{
+    UDP_TAG,
+    TCP_LISTEN_TAG,
+    UNIX_LISTEN_TAG,
+    EVENT_TAG,
+    LOADED_TAG,
+    TIMER_TAG,
+    CONNECTION_TAG
+};
+
+// how the status is pushed to a client
+typedef enum
+{
+    SUBSCRIPTION_NONE,
+    SUBSCRIPTION_BINARY,     // PROTOCOL_OP_STATUS frames
+    SUBSCRIPTION_TEXT,       // JSON lines
+    SUBSCRIPTION_WEB_SOCKET, // JSON in WebSocket text frames
+    SUBSCRIPTION_COUNT
+} subscription_t;
+
+// a TCP or Unix domain client
+typedef struct
+{
+    int fd; // -1 while the slot is free
+    char in[MSG_MAX_LEN + 1];
+    size_t in_length;
+    char out[CONNECTION_OUT_SIZE];
+    size_t out_length;
+    time_t last_active;
+    subscription_t subscription;
+    uint32_t subscribe_request_id; // echoed in the binary status frames
+    bool needs_snapshot;           // the next status update it gets holds every field
+    bool closing;                  // closed once its replies are sent
+    bool loading;                  // its later commands wait for the reply of its add_song
+    unsigned generation;           // counts the clients the slot was given to
+} connection_t;
+
+// where a command came from, to answer it once it is done
+typedef struct
+{
+    connection_t *connection; // NULL for a datagram
+    unsigned generation;      // of "connection", another client may have its slot by then
+    struct sockaddr_in remote; // of a datagram
+    socklen_t remote_length;
+} command_sender_t;
 
-// #define MAX_HISTORY_STR_SIZE 32768
-#define MAX_LINE_STR_SIZE 256
+// a status update, encoded for one kind of subscriber
+typedef struct
+{
+    char data[STATUS_UPDATE_SIZE];
+    size_t size;
+} status_update_t;
 
 static pthread_t thread_id;
+static int epoll_fd = -1;
+static int udp_fd = -1;
+static int tcp_fd = -1;
+static int unix_fd = -1;
+static int event_fd = -1;
+static int loaded_fd = -1;
+static int timer_fd = -1;
+static connection_t connections[MAX_CONNECTIONS];
+static bool network_stopping = false;
+// last status pushed, the next update holds what changed since
+static statusStream_status_t sent_status;
 
 bool is_module_initialized = false;
 
-// to handle commands
-enum eWebCommands
-{
-    COMMAND_ADD_SONG = 0,
-    COMMAND_REMOVE_SONG,
-    COMMAND_VOLUME_UP,
-    COMMAND_VOLUME_DOWN,
-    COMMAND_SONG_NEXT,
-    COMMAND_SONG_PREVIOUS,
-    COMMAND_STOP,
-    UNKNOWN_COMMAND,
-    COMMAND_TOTAL_COUNT // Total number of available commands ??
-};
+// arguments of a command, pointing into the received message
+typedef struct
+{
+    int count;
+    protocol_field_t fields[PROTOCOL_MAX_FIELDS];
+    int repeat; // times the command was sent in a row, 0 once a later one made it useless
+} command_args_t;
+
+// a received command, parsed but not run yet
+typedef struct
+{
+    bool binary;
+    uint8_t opcode; // as received, echoed in the binary reply
+    uint32_t request_id;
+    protocol_status_t status; // not PROTOCOL_STATUS_OK if the message could not be parsed
+    command_args_t args;
+    long long arrival_us; // when it was received, see metrics_getTimeInUs()
+} command_request_t;
+
+// counts of the UDP batches, to see how much coalescing saves
+typedef struct
+{
+    uint64_t batches;
+    uint64_t datagrams;
+    uint64_t coalesced;
+    int largest_batch;
+} batch_stats_t;
+
+static batch_stats_t batch_stats;
+
+// Metrics, see metrics.h
+static const long long command_bounds_us[] = {50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 100000, 500000};
+static char status_labels[PROTOCOL_STATUS_COUNT][32];
+static metrics_counter_t commands_metrics[PROTOCOL_STATUS_COUNT];
+static metrics_histogram_t command_metric;
+static metrics_counter_t datagrams_metric;
+static metrics_counter_t coalesced_metric;
+
+// result of a command, written as a binary frame or as text lines
+typedef struct
+{
+    bool binary;
+    protocol_writer_t frame;
+    char *text;
+    size_t text_size;
+    size_t text_length;
+    bool line_started;
+    size_t line_start; // where the line being written starts, to drop it if it does not fit
+    bool full;
+    const command_request_t *request;
+    const command_sender_t *sender;
+    bool deferred; // answered by answer_loaded_songs() instead, nothing is sent now
+} command_reply_t;
+
+// an add_song whose song the songWatcher thread reads
+typedef struct
+{
+    bool in_use;
+    bool loaded; // set with "id" by the songWatcher thread
+    song_id_t id;
+    bool binary;
+    uint8_t opcode;
+    uint32_t request_id;
+    command_sender_t sender;
+} pending_add_t;
+
+static pending_add_t pending_adds[MAX_PENDING_ADDS];
+static pthread_mutex_t pendingAddsMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// a command; the reply is only sent if it returns PROTOCOL_STATUS_OK
+typedef protocol_status_t (*command_handler_t)(const command_args_t *args, command_reply_t *reply);
+
+typedef struct
+{
+    const char *name; // name in the text protocol
+    command_handler_t handler;
+    bool is_action; // changes what is shown or played, followed to it (see latency.h)
+} command_t;
 
-// parse the received command and return the appropriate eWebCommands enum value
-static enum eWebCommands parse_command(char messageRx[MSG_MAX_LEN])
+// returns the string argument at "index", NULL if it is missing or a number
+static const char *arg_string(const command_args_t *args, int index)
 {
-    if (strncmp(messageRx, "add_song", strlen("add_song")) == 0)
+    if (index >= args->count || args->fields[index].type != PROTOCOL_FIELD_STRING)
     {
-        printf("adding song\n");
-        return COMMAND_ADD_SONG;
+        return NULL;
     }
-    else if (strncmp(messageRx, "remove_song", strlen("remove_song")) == 0)
+    return args->fields[index].string;
+}
+
+// reads the number argument at "index", sent as a number field or as decimal text
+static bool arg_number(const command_args_t *args, int index, uint64_t *number)
+{
+    if (index >= args->count)
     {
-        return COMMAND_REMOVE_SONG;
+        return false;
     }
-    else if (strncmp(messageRx, "volume_up", strlen("volume_up")) == 0)
+    const protocol_field_t *field = &args->fields[index];
+    if (field->type == PROTOCOL_FIELD_NUMBER)
     {
-        return COMMAND_VOLUME_UP;
+        *number = field->number;
+        return true;
     }
-    else if (strncmp(messageRx, "volume_down", strlen("volume_down")) == 0)
+    char *end = NULL;
+    *number = strtoull(field->string, &end, 10);
+    return end != field->string && *end == '\0';
+}
+
+static bool arg_position(const command_args_t *args, int index, int *position)
+{
+    uint64_t number = 0;
+    if (!arg_number(args, index, &number) || number > INT32_MAX)
     {
-        return COMMAND_VOLUME_DOWN;
+        return false;
     }
-    else if (strncmp(messageRx, "song_next", strlen("song_next")) == 0)
+    *position = (int)number;
+    return true;
+}
+
+static void reply_text(command_reply_t *reply, const char *text)
+{
+    size_t length = strlen(text);
+    if (reply->full || length + 1 > reply->text_size - reply->text_length)
     {
-        return COMMAND_SONG_NEXT;
+        reply->full = true;
+        return;
     }
-    else if (strncmp(messageRx, "song_previous", strlen("song_previous")) == 0)
+    memcpy(reply->text + reply->text_length, text, length + 1);
+    reply->text_length += length;
+}
+
+// adds a value to the line being written; values of a line are space separated in text
+static void reply_number(command_reply_t *reply, uint64_t number)
+{
+    bool first = !reply->line_started;
+    if (first)
     {
-        return COMMAND_SONG_PREVIOUS;
+        reply->line_started = true;
+        reply->line_start = reply->binary ? reply->frame.length : reply->text_length;
     }
-    else if (strncmp(messageRx, "stop", strlen("stop")) == 0)
+    if (reply->binary)
     {
-        return COMMAND_STOP;
+        protocol_writeNumber(&reply->frame, number);
+        return;
     }
-    else
+    char text[24];
+    snprintf(text, sizeof(text), "%s%" PRIu64, first ? "" : " ", number);
+    reply_text(reply, text);
+}
+
+// ends the line being written; a line that did not fit whole is dropped and the reply is full
+static void reply_end_line(command_reply_t *reply)
+{
+    if (reply->binary && reply->frame.overflow)
     {
-        return UNKNOWN_COMMAND;
+        reply->frame.length = reply->line_start;
+        reply->frame.overflow = false;
+        reply->full = true;
     }
+    if (!reply->binary)
+    {
+        reply_text(reply, "\n");
+        if (reply->full)
+        {
+            reply->text_length = reply->line_start;
+            reply->text[reply->text_length] = '\0';
+        }
+    }
+    reply->line_started = false;
 }
 
-// run the commands and return the appropriate string to be sent back
-// returns NULL rerun is required
-// the caller should call free()
-static void run_command(enum eWebCommands cur_command, char *message)
+// adds a line holding "string" alone, which may contain spaces
+static void reply_line(command_reply_t *reply, const char *string)
 {
-    printf("current command: %d\n", cur_command);
-    // TODO: consider using an array of function pointers to respond to each command
-    // The array will be initialized in network_init ??
-    // The indices of the array will be the values of eWebCommands enum ??
-    // char *result = NULL;
-    // result = malloc(MSG_ACK_LEN * sizeof(char));
-    // snprintf(result, MSG_ACK_LEN, MSG_ACK);
-    if (cur_command == COMMAND_ADD_SONG)
+    reply->line_started = true;
+    reply->line_start = reply->binary ? reply->frame.length : reply->text_length;
+    if (reply->binary)
     {
-        // TODO call the call songManager module to add the new song
-        // TODO: SOS - need the path of the song ??
-        char *path;      // 0
-        char *song_name; // 1
-        char *singer;    // 2
-        char *album;     // 3
-
-        int iter = 0;
+        protocol_writeString(&reply->frame, string);
+    }
+    else
+    {
+        reply_text(reply, string);
+    }
+    reply_end_line(reply);
+}
 
-        while ((message = strtok(NULL, "\n")) != NULL)
+// write the statistics of the songs still in the library into "reply", one per line, as many as fit
+static void write_stats(const playStats_entry_t *entries, int size, command_reply_t *reply)
+{
+    for (int i = 0; i < size && !reply->full; i++)
+    {
+        song_id_t id = songManager_getIdByPathKey(entries[i].song_key);
+        if (id == SONG_ID_INVALID)
         {
+            continue;
+        }
+        reply_number(reply, id);
+        reply_number(reply, entries[i].plays);
+        reply_number(reply, entries[i].skips);
+        reply_number(reply, entries[i].last_played);
+        reply_end_line(reply);
+    }
+}
 
-            printf("%s\n", message);
-            printf("after printing\n");
+// called by the songWatcher thread once the song of the add_song "context" was read
+static void song_loaded(song_id_t id, void *context)
+{
+    pending_add_t *add = context;
+    pthread_mutex_lock(&pendingAddsMutex);
+    add->id = id;
+    add->loaded = true;
+    pthread_mutex_unlock(&pendingAddsMutex);
+    uint64_t loaded = 1;
+    if (write(loaded_fd, &loaded, sizeof(loaded)) != sizeof(loaded))
+    {
+        LOG_ERROR("Failed to wake the network thread up");
+    }
+}
 
-            if (iter == 0)
-            {
-                path = malloc(strlen(message) + 1);
-                strcpy(path, message);
-            }
-            else if (iter == 1)
-            {
-                song_name = malloc(strlen(message) + 1);
-                strcpy(song_name, message);
-            }
-            else if (iter == 3)
-            {
-                album = malloc(strlen(message) + 1);
-                strcpy(album, message);
-            }
-            else if (iter == 2)
-            {
-                singer = malloc(strlen(message) + 1);
-                strcpy(singer, message);
-            }
-            iter++;
+// add_song\n<path>\n<song name>\n<artist>\n<album>: replies with the song id once the song is read
+static protocol_status_t cmd_add_song(const command_args_t *args, command_reply_t *reply)
+{
+    // the fields point into the received message, songWatcher_loadSong() copies them
+    const char *path = arg_string(args, 0);
+    const char *song_name = arg_string(args, 1);
+    const char *singer = arg_string(args, 2);
+    const char *album = arg_string(args, 3);
+    if (path == NULL || song_name == NULL || singer == NULL || album == NULL)
+    {
+        LOG_ERROR("add_song needs a path, a name, an artist and an album");
+        return PROTOCOL_STATUS_BAD_REQUEST;
+    }
+    // reading a missing file would stop the player
+    if (access(path, R_OK) != 0)
+    {
+        return PROTOCOL_STATUS_NOT_FOUND;
+    }
+
+    // reading the whole file takes long, the other clients are answered meanwhile
+    pending_add_t *add = NULL;
+    pthread_mutex_lock(&pendingAddsMutex);
+    for (int i = 0; i < MAX_PENDING_ADDS && add == NULL; i++)
+    {
+        if (!pending_adds[i].in_use)
+        {
+            add = &pending_adds[i];
+            *add = (pending_add_t){.in_use = true, .binary = reply->request->binary, .opcode = reply->request->opcode,
+                                   .request_id = reply->request->request_id, .sender = *reply->sender};
         }
+    }
+    pthread_mutex_unlock(&pendingAddsMutex);
+    if (add == NULL)
+    {
+        LOG_WARNING("too many songs being added");
+        return PROTOCOL_STATUS_FAILED;
+    }
+    if (!songWatcher_loadSong(path, singer, album, song_name, song_loaded, add))
+    {
+        LOG_WARNING("the song <%s> could not be queued", path);
+        pthread_mutex_lock(&pendingAddsMutex);
+        add->in_use = false;
+        pthread_mutex_unlock(&pendingAddsMutex);
+        return PROTOCOL_STATUS_FAILED;
+    }
+    if (reply->sender->connection != NULL)
+    {
+        reply->sender->connection->loading = true;
+    }
+    LOG_DEBUG("add song");
+    reply->deferred = true;
+    return PROTOCOL_STATUS_OK;
+}
 
-        printf("after parsing\n");
-        // song_info * song = create_song
-        //  Create Song stuct
-        song_info *song_struct = create_song_struct(singer, album, path, song_name);
-        songManager_addSongBack(song_struct);
-        // add song into linked list back
-        printf("DEBUG: add song\n");
+// remove_song\n<id from the add_song reply>
+static protocol_status_t cmd_remove_song(const command_args_t *args, command_reply_t *reply)
+{
+    uint64_t id = SONG_ID_INVALID;
+    if (!arg_number(args, 0, &id))
+    {
+        return PROTOCOL_STATUS_BAD_REQUEST;
+    }
+    LOG_DEBUG("remove song");
+    return songManager_deleteSongById(id) ? PROTOCOL_STATUS_OK : PROTOCOL_STATUS_NOT_FOUND;
+}
 
-        // return result;
+// Changes the volume by "step" percent, within 0 and 100, and replies with the new one
+static protocol_status_t change_volume(int step, command_reply_t *reply)
+{
+    int volume = AudioPlayer_getVolume() + step;
+    if (volume < 0)
+    {
+        volume = 0;
+    }
+    else if (volume > 100)
+    {
+        volume = 100;
     }
-    else if (cur_command == COMMAND_REMOVE_SONG)
+    AudioPlayer_setVolume(volume / 100.0);
+    reply_number(reply, volume);
+    reply_end_line(reply);
+    return PROTOCOL_STATUS_OK;
+}
+
+// volume_up: replies with the new volume, in percent
+static protocol_status_t cmd_volume_up(const command_args_t *args, command_reply_t *reply)
+{
+    LOG_DEBUG("volume up");
+    return change_volume(VOLUME_STEP, reply);
+}
+
+// volume_down: replies with the new volume, in percent
+static protocol_status_t cmd_volume_down(const command_args_t *args, command_reply_t *reply)
+{
+    LOG_DEBUG("volume down");
+    return change_volume(-VOLUME_STEP, reply);
+}
+
+// reads the volume of volume_set, in percent
+static bool arg_volume(const command_args_t *args, int *volume)
+{
+    return arg_position(args, 0, volume) && *volume <= 100;
+}
+
+// volume_set\n<percent>
+static protocol_status_t cmd_volume_set(const command_args_t *args, command_reply_t *reply)
+{
+    int volume = 0;
+    if (!arg_volume(args, &volume))
     {
-        char *song_num = strtok(NULL, "\n");
-        int index = atoi(song_num);
+        return PROTOCOL_STATUS_BAD_REQUEST;
+    }
+    AudioPlayer_setVolume(volume / 100.0);
+    return PROTOCOL_STATUS_OK;
+}
+
+// song_next: skips as many songs as there were song_next in a row
+static protocol_status_t cmd_song_next(const command_args_t *args, command_reply_t *reply)
+{
+    songManager_skip(args->repeat);
+    LOG_DEBUG("next song");
+    return PROTOCOL_STATUS_OK;
+}
+
+static protocol_status_t cmd_song_previous(const command_args_t *args, command_reply_t *reply)
+{
+    songManager_skip(-args->repeat);
+    LOG_DEBUG("previous song");
+    return PROTOCOL_STATUS_OK;
+}
 
-        songManager_deleteSong(index);
-        // Delete a song number index
+// stop: the network thread stops once the reply is sent, main then cleans the other modules up
+static protocol_status_t cmd_stop(const command_args_t *args, command_reply_t *reply)
+{
+    LOG_DEBUG("stop");
+    network_stopping = true;
+    Shutdown_triggerForShutdown();
+    return PROTOCOL_STATUS_OK;
+}
 
-        // TODO call the call songManager module to remove the song
-        // TODO: SOS - need the path of the song ??
-        printf("DEBUG: remove song\n");
-        // return result;
+// playlist_create\n<name>
+static protocol_status_t cmd_playlist_create(const command_args_t *args, command_reply_t *reply)
+{
+    const char *name = arg_string(args, 0);
+    if (name == NULL)
+    {
+        return PROTOCOL_STATUS_BAD_REQUEST;
     }
-    else if (cur_command == COMMAND_VOLUME_UP)
+    if (playlist_create(name) < 0)
+    {
+        LOG_ERROR("unable to create playlist");
+        return PROTOCOL_STATUS_FAILED;
+    }
+    return PROTOCOL_STATUS_OK;
+}
+
+// playlist_delete\n<name>
+static protocol_status_t cmd_playlist_delete(const command_args_t *args, command_reply_t *reply)
+{
+    const char *name = arg_string(args, 0);
+    if (name == NULL)
     {
-        // TODO call the volume module to increase the volume
-        printf("DEBUG: volume up\n");
-        // return result;
+        return PROTOCOL_STATUS_BAD_REQUEST;
     }
-    else if (cur_command == COMMAND_VOLUME_DOWN)
+    if (!playlist_delete(playlist_findByName(name)))
     {
-        // TODO call the volume module to decrease the volume
-        printf("DEBUG: volume down\n");
-        // return result;
+        LOG_ERROR("unable to delete playlist");
+        return PROTOCOL_STATUS_NOT_FOUND;
     }
-    else if (cur_command == COMMAND_SONG_NEXT)
+    return PROTOCOL_STATUS_OK;
+}
+
+// playlist_add\n<name>\n<song path>
+static protocol_status_t cmd_playlist_add(const command_args_t *args, command_reply_t *reply)
+{
+    const char *name = arg_string(args, 0);
+    const char *path = arg_string(args, 1);
+    if (name == NULL || path == NULL)
     {
-        // TODO call the song module to go to the next song
-        printf("DEBUG: next song\n");
-        // return result;
+        return PROTOCOL_STATUS_BAD_REQUEST;
     }
-    else if (cur_command == COMMAND_SONG_PREVIOUS)
+    songManager_readLock();
+    song_info *song = songManager_findByPath(path);
+    song_id_t id = (song != NULL) ? song->id : SONG_ID_INVALID;
+    songManager_readUnlock();
+    if (id == SONG_ID_INVALID || !playlist_addSong(playlist_findByName(name), id))
     {
-        // TODO call the song module to the previous song
-        printf("DEBUG: previous song\n");
-        // return result;
+        LOG_ERROR("unable to add song to playlist");
+        return PROTOCOL_STATUS_NOT_FOUND;
     }
-    else if (cur_command == COMMAND_STOP)
+    return PROTOCOL_STATUS_OK;
+}
+
+// playlist_remove\n<name>\n<position>
+static protocol_status_t cmd_playlist_remove(const command_args_t *args, command_reply_t *reply)
+{
+    const char *name = arg_string(args, 0);
+    int position = 0;
+    if (name == NULL || !arg_position(args, 1, &position))
     {
-        // TODO stop all the other threads and modules
-        printf("DEBUG: stop\n");
-        // return result;
+        return PROTOCOL_STATUS_BAD_REQUEST;
     }
-    else
+    if (!playlist_removeSongAt(playlist_findByName(name), position))
     {
-        printf("DEBUG: unkown command\n");
-        // return NULL; // TODO: ??
-    }
-}
-// static int get_size_string(int start,char * str) {
-//     int size =0;
-//     for (size_t i = start; i < strlen(str); i++)
-//     {
-//         if (str[i] == '\n')
-//         {
-//             return size;
-//         }
-//         size++;
-//     }
-//     return size;
-// }
+        LOG_ERROR("unable to remove song from playlist");
+        return PROTOCOL_STATUS_NOT_FOUND;
+    }
+    return PROTOCOL_STATUS_OK;
+}
 
-static void network_logic(int socketDescriptor)
+// playlist_import\n<m3u path>\n<name>: replies with the number of songs not in the library
+static protocol_status_t cmd_playlist_import(const command_args_t *args, command_reply_t *reply)
 {
-    bool network_cond = true;
-    while (network_cond)
+    const char *path = arg_string(args, 0);
+    const char *name = arg_string(args, 1);
+    int unresolved = 0;
+    if (path == NULL || name == NULL)
+    {
+        return PROTOCOL_STATUS_BAD_REQUEST;
+    }
+    if (playlist_importM3U(path, name, &unresolved) < 0)
+    {
+        LOG_ERROR("unable to import playlist");
+        return PROTOCOL_STATUS_FAILED;
+    }
+    if (unresolved > 0)
     {
+        LOG_WARNING("%d songs of <%s> are not in the library", unresolved, path);
+    }
+    reply_number(reply, unresolved);
+    reply_end_line(reply);
+    return PROTOCOL_STATUS_OK;
+}
 
-        // create variables required for receiving
-        struct sockaddr_in sinRemote; // set to the sender/clients's address. Use to reply
-        unsigned int sin_len = sizeof(sinRemote);
-        char messageRx[MSG_MAX_LEN];
+// playlist_export\n<name>\n<m3u path>
+static protocol_status_t cmd_playlist_export(const command_args_t *args, command_reply_t *reply)
+{
+    const char *name = arg_string(args, 0);
+    const char *path = arg_string(args, 1);
+    if (name == NULL || path == NULL)
+    {
+        return PROTOCOL_STATUS_BAD_REQUEST;
+    }
+    if (playlist_exportM3U(playlist_findByName(name), path) < 0)
+    {
+        LOG_ERROR("unable to export playlist");
+        return PROTOCOL_STATUS_FAILED;
+    }
+    return PROTOCOL_STATUS_OK;
+}
 
-        // listen for the commands (blocking)
+// playlist_play\n<name>
+static protocol_status_t cmd_playlist_play(const command_args_t *args, command_reply_t *reply)
+{
+    const char *name = arg_string(args, 0);
+    if (name == NULL)
+    {
+        return PROTOCOL_STATUS_BAD_REQUEST;
+    }
+    int playlist = playlist_findByName(name);
+    if (playlist < 0)
+    {
+        return PROTOCOL_STATUS_NOT_FOUND;
+    }
+    songManager_playPlaylist(playlist);
+    return PROTOCOL_STATUS_OK;
+}
 
-        // buffer size: maximum length minus one to allow null termination (string data)
-        int buffer_size = MSG_MAX_LEN - 1;
-        printf("Before recieve \n");
-        int bytesRx = recvfrom(socketDescriptor, messageRx, buffer_size, 0, (struct sockaddr *)&sinRemote, &sin_len);
-        // Check for errors
-        if (bytesRx == -1)
-        {
-            printf("ERROR: Failed to receive. Data is not available and socket is in nonblocking mode\n");
-            exit(-1);
-        }
-        printf("After recieve \n");
+// memory_report: replies with the memory used by the library, one line of text per figure
+static protocol_status_t cmd_memory_report(const command_args_t *args, command_reply_t *reply)
+{
+    char *report = NULL;
+    size_t size = 0;
+    FILE *out = open_memstream(&report, &size);
+    if (out == NULL)
+    {
+        LOG_ERROR("unable to write the memory report");
+        return PROTOCOL_STATUS_FAILED;
+    }
+    songManager_printMemoryReport(out);
+    fclose(out);
 
-        // handle the received message ///////////////////////////////////////////////////////////////////////
+    char *save = NULL;
+    for (char *line = strtok_r(report, "\n", &save); line != NULL; line = strtok_r(NULL, "\n", &save))
+    {
+        reply_line(reply, line);
+    }
+    free(report);
+    return PROTOCOL_STATUS_OK;
+}
 
-        // make the received message null terminated so string functions work
-        messageRx[bytesRx] = 0;
+// queues the song whose id is the first argument, in front of the queued songs with "next"
+static protocol_status_t queue_song(const command_args_t *args, bool next)
+{
+    uint64_t id = SONG_ID_INVALID;
+    if (!arg_number(args, 0, &id))
+    {
+        return PROTOCOL_STATUS_BAD_REQUEST;
+    }
+    songManager_readLock();
+    bool known = songManager_findById(id) != NULL;
+    songManager_readUnlock();
+    if (!known)
+    {
+        return PROTOCOL_STATUS_NOT_FOUND;
+    }
+    bool queued = next ? playQueue_pushFront(id) : playQueue_pushBack(id);
+    return queued ? PROTOCOL_STATUS_OK : PROTOCOL_STATUS_FAILED;
+}
 
-        printf("Recieved Message <%s>\n", messageRx);
+// queue_next\n<song id>: plays it next
+static protocol_status_t cmd_queue_next(const command_args_t *args, command_reply_t *reply)
+{
+    return queue_song(args, true);
+}
 
-        // if command is not 'enter' (!= "\n")
+// queue_add\n<song id>: plays it after the queued songs
+static protocol_status_t cmd_queue_add(const command_args_t *args, command_reply_t *reply)
+{
+    return queue_song(args, false);
+}
 
-        // Command
-        // Path
-        //
+// queue_move\n<from position>\n<to position>
+static protocol_status_t cmd_queue_move(const command_args_t *args, command_reply_t *reply)
+{
+    int from = 0;
+    int to = 0;
+    if (!arg_position(args, 0, &from) || !arg_position(args, 1, &to))
+    {
+        return PROTOCOL_STATUS_BAD_REQUEST;
+    }
+    if (!playQueue_move(from, to))
+    {
+        LOG_ERROR("unable to move queued song");
+        return PROTOCOL_STATUS_NOT_FOUND;
+    }
+    return PROTOCOL_STATUS_OK;
+}
 
-        enum eWebCommands curr_command = UNKNOWN_COMMAND;
-        char *token = NULL;
-        if (bytesRx > 1)
-        {
+// queue_remove\n<position>
+static protocol_status_t cmd_queue_remove(const command_args_t *args, command_reply_t *reply)
+{
+    int position = 0;
+    if (!arg_position(args, 0, &position))
+    {
+        return PROTOCOL_STATUS_BAD_REQUEST;
+    }
+    if (!playQueue_removeAt(position))
+    {
+        LOG_ERROR("unable to remove queued song");
+        return PROTOCOL_STATUS_NOT_FOUND;
+    }
+    return PROTOCOL_STATUS_OK;
+}
 
-            token = strtok(messageRx, "\n");
-            curr_command = parse_command(token);
-        }
+static protocol_status_t cmd_queue_clear(const command_args_t *args, command_reply_t *reply)
+{
+    playQueue_clear();
+    return PROTOCOL_STATUS_OK;
+}
 
-        run_command(curr_command, token);
+// queue_list: replies with the queued ids, one per line, as many as fit
+static protocol_status_t cmd_queue_list(const command_args_t *args, command_reply_t *reply)
+{
+    song_id_t ids[PLAY_QUEUE_CAPACITY];
+    int size = playQueue_copyIds(ids, PLAY_QUEUE_CAPACITY);
+    for (int i = 0; i < size && !reply->full; i++)
+    {
+        reply_number(reply, ids[i]);
+        reply_end_line(reply);
+    }
+    return PROTOCOL_STATUS_OK;
+}
 
-        // extract the command from the message received
+// stats_top: replies with "<id> <plays> <skips> <last played>" lines of the most played songs
+static protocol_status_t cmd_stats_top(const command_args_t *args, command_reply_t *reply)
+{
+    playStats_entry_t entries[PLAY_STATS_VIEW_SIZE];
+    write_stats(entries, playStats_getMostPlayed(entries, PLAY_STATS_VIEW_SIZE), reply);
+    return PROTOCOL_STATUS_OK;
+}
 
-        // compose the response message
+// stats_recent: the same for the most recently played songs
+static protocol_status_t cmd_stats_recent(const command_args_t *args, command_reply_t *reply)
+{
+    playStats_entry_t entries[PLAY_STATS_VIEW_SIZE];
+    write_stats(entries, playStats_getRecentlyPlayed(entries, PLAY_STATS_VIEW_SIZE), reply);
+    return PROTOCOL_STATUS_OK;
+}
 
-        if (curr_command == UNKNOWN_COMMAND)
-        {
-            // unknown command
-            continue;
-        }
-        // char *response = run_command(curr_command);
+// network_stats: replies with "<batches> <datagrams> <coalesced> <largest batch>" for the UDP socket
+static protocol_status_t cmd_network_stats(const command_args_t *args, command_reply_t *reply)
+{
+    reply_number(reply, batch_stats.batches);
+    reply_number(reply, batch_stats.datagrams);
+    reply_number(reply, batch_stats.coalesced);
+    reply_number(reply, batch_stats.largest_batch);
+    reply_end_line(reply);
+    return PROTOCOL_STATUS_OK;
+}
 
-        // TODO: for now all the replies are ACK; Kept for potential later use
-        // if (strlen(response) <= MSG_MAX_LEN)
-        // {
-        //     // send in one packet
-        //     char messageTx[MSG_MAX_LEN];
-        //     snprintf(messageTx, MSG_MAX_LEN, "%s", response);
+// import_songs\n<directory>: converts the MP3 files found in the background, replies with their number
+static protocol_status_t cmd_import_songs(const command_args_t *args, command_reply_t *reply)
+{
+    const char *directory = arg_string(args, 0);
+    if (directory == NULL)
+    {
+        return PROTOCOL_STATUS_BAD_REQUEST;
+    }
+    int queued = songWatcher_importDirectory(directory);
+    if (queued < 0)
+    {
+        return PROTOCOL_STATUS_NOT_FOUND;
+    }
+    reply_number(reply, queued);
+    reply_end_line(reply);
+    return PROTOCOL_STATUS_OK;
+}
 
-        //     // transmit a reply:
-        //     sin_len = sizeof(sinRemote);
-        //     sendto(socketDescriptor, messageTx, strlen(messageTx), 0, (struct sockaddr *)&sinRemote, sin_len);
-        // }
+// import_status: replies with "<queued> <converting> <converted> <failed> <seconds of audio converted>"
+static protocol_status_t cmd_import_status(const command_args_t *args, command_reply_t *reply)
+{
+    mp3ToWave_stats_t stats;
+    mp3ToWave_getStats(&stats);
+    reply_number(reply, stats.queued);
+    reply_number(reply, stats.running);
+    reply_number(reply, stats.converted);
+    reply_number(reply, stats.failed);
+    reply_number(reply, stats.converted_ms / 1000);
+    reply_end_line(reply);
+    return PROTOCOL_STATUS_OK;
+}
 
-        // check termination condition
-        if (curr_command == COMMAND_STOP)
+// stream_limits[\n<max streams>\n<buffer KB>]: sets the limits of the songs streamed over HTTP if given,
+// replies with "<max streams> <buffer KB> <streaming> <served> <rejected>"
+static protocol_status_t cmd_stream_limits(const command_args_t *args, command_reply_t *reply)
+{
+    int max_streams = 0;
+    int buffer_kb = 0;
+    if (args->count > 0)
+    {
+        if (!arg_position(args, 0, &max_streams) || !arg_position(args, 1, &buffer_kb) ||
+            buffer_kb > HTTP_SERVER_MAX_STREAM_BUFFER_SIZE / 1024)
         {
-            network_cond = false;
+            return PROTOCOL_STATUS_BAD_REQUEST;
         }
+        httpServer_setStreamLimits(max_streams, buffer_kb * 1024);
     }
+    httpServer_streamStats_t stats;
+    httpServer_getStreamStats(&stats);
+    reply_number(reply, stats.max_streams);
+    reply_number(reply, stats.buffer_size / 1024);
+    reply_number(reply, stats.streaming);
+    reply_number(reply, stats.served);
+    reply_number(reply, stats.rejected);
+    reply_end_line(reply);
+    return PROTOCOL_STATUS_OK;
 }
 
-// thread function to manage networking logics
-static void *network_thread(void *params)
+// input_stats: replies with "<state> <packets> <lost> <late> <duplicates> <overflows> <rejected> <underruns>
+// <jitter us> <target ms> <delay ms> <speed>" for the audio received from the network, the playback speed
+// in parts per million, 1000000 when it is not corrected
+static protocol_status_t cmd_input_stats(const command_args_t *args, command_reply_t *reply)
 {
+    networkInput_stats_t stats;
+    networkInput_getStats(&stats);
+    reply_number(reply, stats.state);
+    reply_number(reply, stats.packets);
+    reply_number(reply, stats.lost);
+    reply_number(reply, stats.late);
+    reply_number(reply, stats.duplicates);
+    reply_number(reply, stats.overflows);
+    reply_number(reply, stats.rejected);
+    reply_number(reply, stats.underruns);
+    reply_number(reply, stats.jitter_us);
+    reply_number(reply, stats.target_ms);
+    reply_number(reply, stats.delay_ms);
+    reply_number(reply, 1000000 + stats.correction_ppm);
+    reply_end_line(reply);
+    return PROTOCOL_STATUS_OK;
+}
 
-    // UPD setups (server/receiver side)
-
-    // initialize Address
-    struct sockaddr_in sin;
-    memset(&sin, 0, sizeof(sin));
-    sin.sin_family = AF_INET;                // connection may be from network
-    sin.sin_addr.s_addr = htonl(INADDR_ANY); // host to network long
-    sin.sin_port = htons(PORT);              // host to network short
-
-    // create the socket for UDP
-    int socketDescriptor = socket(PF_INET, SOCK_DGRAM, 0);
-
-    // bind the specified port (PORT)
-    bind(socketDescriptor, (struct sockaddr *)&sin, sizeof(sin));
+// reads the optional port argument at "index" of the sync commands
+static bool arg_sync_port(const command_args_t *args, int index, int *port)
+{
+    *port = ROOM_SYNC_DEFAULT_PORT;
+    if (args->count <= index)
+    {
+        return true;
+    }
+    return arg_position(args, index, port) && *port > 0 && *port <= UINT16_MAX;
+}
 
-    // check for errors
-    if (socketDescriptor == -1)
+// sync_lead[\n<port>]: answers the BeaglePods that follow this one
+static protocol_status_t cmd_sync_lead(const command_args_t *args, command_reply_t *reply)
+{
+    int port = 0;
+    if (!arg_sync_port(args, 0, &port))
     {
-        printf("ERROR: Failed to create the socket\n");
-        exit(-1);
+        return PROTOCOL_STATUS_BAD_REQUEST;
     }
+    return roomSync_lead(port) ? PROTOCOL_STATUS_OK : PROTOCOL_STATUS_FAILED;
+}
 
-    // int n = -1;
+// sync_follow\n<leader address>[\n<port>]: plays in sync with the leader
+static protocol_status_t cmd_sync_follow(const command_args_t *args, command_reply_t *reply)
+{
+    const char *address = arg_string(args, 0);
+    int port = 0;
+    if (address == NULL || !arg_sync_port(args, 1, &port))
+    {
+        return PROTOCOL_STATUS_BAD_REQUEST;
+    }
+    return roomSync_follow(address, port) ? PROTOCOL_STATUS_OK : PROTOCOL_STATUS_NOT_FOUND;
+}
 
-    network_logic(socketDescriptor);
+static protocol_status_t cmd_sync_off(const command_args_t *args, command_reply_t *reply)
+{
+    roomSync_stop();
+    return PROTOCOL_STATUS_OK;
+}
 
-    // close the socket
-    close(socketDescriptor);
+// sync_stats: replies with "<role> <requests> <replies> <seeks> <song changes> <missing songs> <round trip us>
+// <error us> <ahead> <speed>" for the multi-room playback, the error being how far a follower is from its
+// leader, ahead of it if "ahead" is 1, and the speed in parts per million, 1000000 when it is not corrected
+static protocol_status_t cmd_sync_stats(const command_args_t *args, command_reply_t *reply)
+{
+    roomSync_stats_t stats;
+    roomSync_getStats(&stats);
+    reply_number(reply, stats.role);
+    reply_number(reply, stats.requests);
+    reply_number(reply, stats.replies);
+    reply_number(reply, stats.seeks);
+    reply_number(reply, stats.song_changes);
+    reply_number(reply, stats.missing);
+    reply_number(reply, stats.rtt_us);
+    reply_number(reply, (stats.error_us < 0) ? -stats.error_us : stats.error_us);
+    reply_number(reply, stats.error_us > 0);
+    reply_number(reply, 1000000 + stats.correction_ppm);
+    reply_end_line(reply);
+    return PROTOCOL_STATUS_OK;
+}
 
-    return NULL;
+// output_start\n<multicast group>[\n<port>[\n<compressed>]]: sends what is played to the group as RTP,
+// in mu-law if "compressed" is 1
+static protocol_status_t cmd_output_start(const command_args_t *args, command_reply_t *reply)
+{
+    const char *group = arg_string(args, 0);
+    int port = NETWORK_OUTPUT_DEFAULT_PORT;
+    int compressed = 0;
+    if (group == NULL || (args->count > 1 && (!arg_position(args, 1, &port) || port == 0 || port > UINT16_MAX)) ||
+        (args->count > 2 && (!arg_position(args, 2, &compressed) || compressed > 1)))
+    {
+        return PROTOCOL_STATUS_BAD_REQUEST;
+    }
+    return networkOutput_start(group, port, compressed) ? PROTOCOL_STATUS_OK : PROTOCOL_STATUS_FAILED;
 }
 
-// start a new thread to listen to the incoming packets and responds to the commands
-void Network_init()
+static protocol_status_t cmd_output_stop(const command_args_t *args, command_reply_t *reply)
 {
-    // start network thread
-    pthread_create(&thread_id, NULL, &network_thread, NULL);
+    networkOutput_stop();
+    return PROTOCOL_STATUS_OK;
+}
 
-    is_module_initialized = true;
+// output_stats: replies with "<sending> <compressed> <packets> <bytes> <errors> <overruns> <jitter us>"
+// for the audio sent to the network
+static protocol_status_t cmd_output_stats(const command_args_t *args, command_reply_t *reply)
+{
+    networkOutput_stats_t stats;
+    networkOutput_getStats(&stats);
+    reply_number(reply, stats.sending);
+    reply_number(reply, stats.compressed);
+    reply_number(reply, stats.packets);
+    reply_number(reply, stats.bytes);
+    reply_number(reply, stats.errors);
+    reply_number(reply, stats.overruns);
+    reply_number(reply, stats.jitter_us);
+    reply_end_line(reply);
+    return PROTOCOL_STATUS_OK;
 }
 
-// stop network thread
-void Network_cleanup()
+// trace_start: drops the steps traced so far and traces the new ones, see trace.h
+static protocol_status_t cmd_trace_start(const command_args_t *args, command_reply_t *reply)
 {
-    assert(is_module_initialized);
+    trace_start();
+    return PROTOCOL_STATUS_OK;
+}
 
-    // TODO: init function pointers of the commands
-    // wait for the thread to finish
+// trace_stop: keeps the steps traced until GET /trace or the next trace_start
+static protocol_status_t cmd_trace_stop(const command_args_t *args, command_reply_t *reply)
+{
+    trace_stop();
+    return PROTOCOL_STATUS_OK;
+}
+
+// subscribe / unsubscribe: only on TCP and Unix domain connections, which handle them
+// before they get here (see receive_commands())
+static protocol_status_t cmd_subscribe(const command_args_t *args, command_reply_t *reply)
+{
+    return PROTOCOL_STATUS_BAD_REQUEST;
+}
+
+// indexed by opcode; opcodes without a handler are unknown commands
+static const command_t commands[PROTOCOL_OP_COUNT] = {
+    [PROTOCOL_OP_ADD_SONG] = {"add_song", cmd_add_song, true},
+    [PROTOCOL_OP_REMOVE_SONG] = {"remove_song", cmd_remove_song, true},
+    [PROTOCOL_OP_VOLUME_UP] = {"volume_up", cmd_volume_up, true},
+    [PROTOCOL_OP_VOLUME_DOWN] = {"volume_down", cmd_volume_down, true},
+    [PROTOCOL_OP_SONG_NEXT] = {"song_next", cmd_song_next, true},
+    [PROTOCOL_OP_SONG_PREVIOUS] = {"song_previous", cmd_song_previous, true},
+    [PROTOCOL_OP_STOP] = {"stop", cmd_stop},
+    [PROTOCOL_OP_PLAYLIST_CREATE] = {"playlist_create", cmd_playlist_create},
+    [PROTOCOL_OP_PLAYLIST_DELETE] = {"playlist_delete", cmd_playlist_delete},
+    [PROTOCOL_OP_PLAYLIST_ADD] = {"playlist_add", cmd_playlist_add},
+    [PROTOCOL_OP_PLAYLIST_REMOVE] = {"playlist_remove", cmd_playlist_remove},
+    [PROTOCOL_OP_PLAYLIST_IMPORT] = {"playlist_import", cmd_playlist_import},
+    [PROTOCOL_OP_PLAYLIST_EXPORT] = {"playlist_export", cmd_playlist_export},
+    [PROTOCOL_OP_PLAYLIST_PLAY] = {"playlist_play", cmd_playlist_play, true},
+    [PROTOCOL_OP_MEMORY_REPORT] = {"memory_report", cmd_memory_report},
+    [PROTOCOL_OP_QUEUE_NEXT] = {"queue_next", cmd_queue_next, true},
+    [PROTOCOL_OP_QUEUE_ADD] = {"queue_add", cmd_queue_add, true},
+    [PROTOCOL_OP_QUEUE_MOVE] = {"queue_move", cmd_queue_move, true},
+    [PROTOCOL_OP_QUEUE_REMOVE] = {"queue_remove", cmd_queue_remove, true},
+    [PROTOCOL_OP_QUEUE_CLEAR] = {"queue_clear", cmd_queue_clear, true},
+    [PROTOCOL_OP_QUEUE_LIST] = {"queue_list", cmd_queue_list},
+    [PROTOCOL_OP_STATS_TOP] = {"stats_top", cmd_stats_top},
+    [PROTOCOL_OP_STATS_RECENT] = {"stats_recent", cmd_stats_recent},
+    [PROTOCOL_OP_VOLUME_SET] = {"volume_set", cmd_volume_set, true},
+    [PROTOCOL_OP_NETWORK_STATS] = {"network_stats", cmd_network_stats},
+    [PROTOCOL_OP_SUBSCRIBE] = {"subscribe", cmd_subscribe},
+    [PROTOCOL_OP_UNSUBSCRIBE] = {"unsubscribe", cmd_subscribe},
+    [PROTOCOL_OP_IMPORT_SONGS] = {"import_songs", cmd_import_songs},
+    [PROTOCOL_OP_IMPORT_STATUS] = {"import_status", cmd_import_status},
+    [PROTOCOL_OP_STREAM_LIMITS] = {"stream_limits", cmd_stream_limits},
+    [PROTOCOL_OP_INPUT_STATS] = {"input_stats", cmd_input_stats},
+    [PROTOCOL_OP_SYNC_LEAD] = {"sync_lead", cmd_sync_lead},
+    [PROTOCOL_OP_SYNC_FOLLOW] = {"sync_follow", cmd_sync_follow},
+    [PROTOCOL_OP_SYNC_OFF] = {"sync_off", cmd_sync_off},
+    [PROTOCOL_OP_SYNC_STATS] = {"sync_stats", cmd_sync_stats},
+    [PROTOCOL_OP_OUTPUT_START] = {"output_start", cmd_output_start},
+    [PROTOCOL_OP_OUTPUT_STOP] = {"output_stop", cmd_output_stop},
+    [PROTOCOL_OP_OUTPUT_STATS] = {"output_stats", cmd_output_stats},
+    [PROTOCOL_OP_TRACE_START] = {"trace_start", cmd_trace_start},
+    [PROTOCOL_OP_TRACE_STOP] = {"trace_stop", cmd_trace_stop},
+};
+
+// parse the received command name and return the matching opcode
+static protocol_opcode_t parse_command(const char *name)
+{
+    for (int opcode = 0; opcode < PROTOCOL_OP_COUNT; opcode++)
+    {
+        if (commands[opcode].name != NULL && strcmp(name, commands[opcode].name) == 0)
+        {
+            return opcode;
+        }
+    }
+    return PROTOCOL_OP_UNKNOWN;
+}
+
+// run the command and write its result into "reply", returns whether it worked
+static protocol_status_t run_command(protocol_opcode_t cur_command, const command_args_t *args, command_reply_t *reply)
+{
+    if (cur_command >= PROTOCOL_OP_COUNT || commands[cur_command].handler == NULL)
+    {
+        LOG_DEBUG("unkown command");
+        return PROTOCOL_STATUS_UNKNOWN_COMMAND;
+    }
+    trace_begin(commands[cur_command].name);
+    protocol_status_t status = commands[cur_command].handler(args, reply);
+    trace_end(commands[cur_command].name);
+    return status;
+}
+
+// parse the binary frame in "message"
+static void parse_binary(const uint8_t *message, size_t size, command_request_t *request)
+{
+    protocol_header_t header;
+    protocol_reader_t fields;
+    if (!protocol_parseFrame(message, size, &header, &fields))
+    {
+        // cut short: not even the request id can be trusted
+        request->status = PROTOCOL_STATUS_BAD_REQUEST;
+        return;
+    }
+    request->opcode = header.opcode;
+    request->request_id = header.request_id;
+    if (header.version != PROTOCOL_VERSION)
+    {
+        request->status = PROTOCOL_STATUS_BAD_VERSION;
+        return;
+    }
+    command_args_t *args = &request->args;
+    while (args->count < PROTOCOL_MAX_FIELDS && protocol_readField(&fields, &args->fields[args->count]))
+    {
+        args->count++;
+    }
+    if (fields.next != fields.end)
+    {
+        request->status = PROTOCOL_STATUS_BAD_REQUEST;
+    }
+}
+
+// parse the text command in "message", its fields point into it
+static void parse_text(char *message, command_request_t *request)
+{
+    // the command, then one argument per line
+    char *save = NULL;
+    char *name = strtok_r(message, "\n", &save);
+    request->opcode = (name != NULL) ? parse_command(name) : PROTOCOL_OP_UNKNOWN;
+    command_args_t *args = &request->args;
+    char *line = NULL;
+    while (args->count < PROTOCOL_MAX_FIELDS && (line = strtok_r(NULL, "\n", &save)) != NULL)
+    {
+        protocol_field_t *field = &args->fields[args->count++];
+        field->type = PROTOCOL_FIELD_STRING;
+        field->string = line;
+        field->length = strlen(line);
+    }
+}
+
+// parse "message", binary or text, into "request"
+static void parse_message(char *message, size_t size, command_request_t *request)
+{
+    memset(request, 0, sizeof(*request));
+    request->opcode = PROTOCOL_OP_UNKNOWN;
+    request->status = PROTOCOL_STATUS_OK;
+    request->args.repeat = 1;
+    request->binary = size > 0 && (uint8_t)message[0] == PROTOCOL_MAGIC;
+    if (request->binary)
+    {
+        parse_binary((uint8_t *)message, size, request);
+    }
+    else
+    {
+        parse_text(message, request);
+    }
+}
+
+// start a reply of the protocol of the command in "messageTx"
+static void begin_reply(command_reply_t *reply, bool binary, char *messageTx, size_t tx_size)
+{
+    *reply = (command_reply_t){.binary = binary, .text = messageTx, .text_size = tx_size};
+    if (binary)
+    {
+        protocol_beginFrame(&reply->frame, (uint8_t *)messageTx, tx_size);
+    }
+    else
+    {
+        messageTx[0] = '\0';
+    }
+}
+
+// end "reply" with the status of the command, returns its size
+static size_t end_reply(command_reply_t *reply, uint8_t opcode, protocol_status_t status, uint32_t request_id)
+{
+    if (reply->binary)
+    {
+        if (status != PROTOCOL_STATUS_OK)
+        {
+            // a failed command has no result
+            reply->frame.length = PROTOCOL_HEADER_SIZE;
+        }
+        return protocol_endFrame(&reply->frame, opcode, status, request_id);
+    }
+    if (status != PROTOCOL_STATUS_OK || reply->text_length == 0)
+    {
+        snprintf(reply->text, reply->text_size, "%s\n", protocol_getStatusName(status));
+    }
+    return strlen(reply->text);
+}
+
+// run "request" of "sender" unless it was coalesced and write its reply into "messageTx", returns the reply
+// size, 0 if it is sent later
+static size_t answer_request(const command_request_t *request, const command_sender_t *sender, char *messageTx,
+                             size_t tx_size)
+{
+    command_reply_t reply;
+    begin_reply(&reply, request->binary, messageTx, tx_size);
+    reply.request = request;
+    reply.sender = sender;
+
+    protocol_status_t status = request->status;
+    if (status == PROTOCOL_STATUS_OK && request->args.repeat > 0)
+    {
+        bool is_action = request->opcode < PROTOCOL_OP_COUNT && commands[request->opcode].is_action;
+        if (is_action)
+        {
+            latency_beginAction(LATENCY_SOURCE_NETWORK, commands[request->opcode].name, request->arrival_us);
+        }
+        long long start = metrics_getTimeInUs();
+        status = run_command(request->opcode, &request->args, &reply);
+        metrics_observe(&command_metric, metrics_getTimeInUs() - start);
+        if (is_action)
+        {
+            latency_endAction();
+        }
+    }
+    if (reply.deferred && status == PROTOCOL_STATUS_OK)
+    {
+        return 0;
+    }
+    if (request->args.repeat > 0 || status != PROTOCOL_STATUS_OK)
+    {
+        metrics_increment(&commands_metrics[(status < PROTOCOL_STATUS_COUNT) ? status : PROTOCOL_STATUS_FAILED]);
+    }
+    return end_reply(&reply, request->opcode, status, request->request_id);
+}
+
+// drops the commands of a batch that later ones make useless, returns how many were dropped
+static int coalesce_batch(command_request_t *requests, int count)
+{
+    int coalesced = 0;
+    command_request_t *last_volume = NULL;
+    command_request_t *previous = NULL;
+    for (int i = 0; i < count; i++)
+    {
+        command_request_t *request = &requests[i];
+        if (request->status != PROTOCOL_STATUS_OK)
+        {
+            previous = NULL;
+            continue;
+        }
+        // only the last volume wins; a malformed one is kept so it gets its BAD_REQUEST
+        int volume = 0;
+        if (request->opcode == PROTOCOL_OP_VOLUME_SET && arg_volume(&request->args, &volume))
+        {
+            if (last_volume != NULL)
+            {
+                last_volume->args.repeat = 0;
+                coalesced++;
+            }
+            last_volume = request;
+        }
+        // consecutive skips the same way become one skip over as many songs
+        bool skip = request->opcode == PROTOCOL_OP_SONG_NEXT || request->opcode == PROTOCOL_OP_SONG_PREVIOUS;
+        if (skip && previous != NULL && previous->opcode == request->opcode)
+        {
+            request->args.repeat += previous->args.repeat;
+            previous->args.repeat = 0;
+            coalesced++;
+        }
+        previous = request;
+    }
+    return coalesced;
+}
+
+static void set_nonblocking(int fd)
+{
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+static bool watch_fd(int fd, uint32_t events, uint32_t tag)
+{
+    struct epoll_event event = {.events = events, .data.u32 = tag};
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+// create a non-blocking socket bound to PORT on every interface
+static int open_inet_socket(int type)
+{
+    struct sockaddr_in sin;
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;                // connection may be from network
+    sin.sin_addr.s_addr = htonl(INADDR_ANY); // host to network long
+    sin.sin_port = htons(PORT);              // host to network short
+
+    int fd = socket(PF_INET, type, 0);
+    if (fd == -1)
+    {
+        return -1;
+    }
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (bind(fd, (struct sockaddr *)&sin, sizeof(sin)) != 0 || (type == SOCK_STREAM && listen(fd, MAX_CONNECTIONS) != 0))
+    {
+        close(fd);
+        return -1;
+    }
+    set_nonblocking(fd);
+    return fd;
+}
+
+// create a non-blocking listening socket at "path", replacing the one a previous run left behind
+static int open_unix_socket(const char *path)
+{
+    struct sockaddr_un sun;
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    snprintf(sun.sun_path, sizeof(sun.sun_path), "%s", path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1)
+    {
+        return -1;
+    }
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&sun, sizeof(sun)) != 0 || listen(fd, MAX_CONNECTIONS) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    set_nonblocking(fd);
+    return fd;
+}
+
+static time_t get_seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec;
+}
+
+// answer every datagram waiting on the UDP socket, a batch at a time
+static void receive_datagrams(void)
+{
+    // only the network thread uses them, too big for its stack
+    static char messagesRx[BATCH_SIZE][MSG_MAX_LEN];
+    static char messagesTx[BATCH_SIZE][MSG_MAX_LEN];
+    static struct sockaddr_in remotes[BATCH_SIZE]; // set to the senders' addresses. Use to reply
+    static command_request_t requests[BATCH_SIZE];
+    struct iovec iovRx[BATCH_SIZE];
+    struct iovec iovTx[BATCH_SIZE];
+    struct mmsghdr rx[BATCH_SIZE];
+    struct mmsghdr tx[BATCH_SIZE];
+
+    int count = BATCH_SIZE;
+    while (!network_stopping && count == BATCH_SIZE)
+    {
+        for (int i = 0; i < BATCH_SIZE; i++)
+        {
+            // buffer size: maximum length minus one to allow null termination (string data)
+            iovRx[i] = (struct iovec){.iov_base = messagesRx[i], .iov_len = MSG_MAX_LEN - 1};
+            rx[i].msg_hdr = (struct msghdr){.msg_name = &remotes[i], .msg_namelen = sizeof(remotes[i]),
+                                            .msg_iov = &iovRx[i], .msg_iovlen = 1};
+        }
+        count = recvmmsg(udp_fd, rx, BATCH_SIZE, MSG_DONTWAIT, NULL);
+        if (count == -1)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                LOG_ERROR("Failed to receive");
+            }
+            return;
+        }
+
+        long long received_us = metrics_getTimeInUs();
+        for (int i = 0; i < count; i++)
+        {
+            // make the received message null terminated so string functions work
+            size_t bytesRx = rx[i].msg_len;
+            messagesRx[i][bytesRx] = 0;
+            parse_message(messagesRx[i], bytesRx, &requests[i]);
+            requests[i].arrival_us = received_us;
+            if (rx[i].msg_hdr.msg_flags & MSG_TRUNC)
+            {
+                requests[i].status = PROTOCOL_STATUS_BAD_REQUEST;
+            }
+        }
+        int coalesced = coalesce_batch(requests, count);
+
+        // every command is answered, so the client learns whether it worked
+        int replies = 0;
+        for (int i = 0; i < count && !network_stopping; i++)
+        {
+            command_sender_t sender = {.remote = remotes[i], .remote_length = rx[i].msg_hdr.msg_namelen};
+            size_t reply_size = answer_request(&requests[i], &sender, messagesTx[i], MSG_MAX_LEN);
+            if (reply_size > 0)
+            {
+                iovTx[replies] = (struct iovec){.iov_base = messagesTx[i], .iov_len = reply_size};
+                tx[replies].msg_hdr = (struct msghdr){.msg_name = &remotes[i], .msg_namelen = rx[i].msg_hdr.msg_namelen,
+                                                      .msg_iov = &iovTx[replies], .msg_iovlen = 1};
+                replies++;
+            }
+        }
+        for (int sent = 0; sent < replies;)
+        {
+            int result = sendmmsg(udp_fd, tx + sent, replies - sent, 0);
+            if (result == -1 && errno != EINTR)
+            {
+                break;
+            }
+            sent += (result > 0) ? result : 0;
+        }
+
+        batch_stats.batches++;
+        batch_stats.datagrams += count;
+        batch_stats.coalesced += coalesced;
+        metrics_add(&datagrams_metric, count);
+        metrics_add(&coalesced_metric, coalesced);
+        if (count > batch_stats.largest_batch)
+        {
+            batch_stats.largest_batch = count;
+        }
+        if (coalesced > 0)
+        {
+            LOG_DEBUG("batch of %d commands, %d coalesced (%" PRIu64 " of %" PRIu64 " in %" PRIu64 " batches so far)",
+                      count, coalesced, batch_stats.coalesced, batch_stats.datagrams, batch_stats.batches);
+        }
+    }
+}
+
+static void broadcast_status(void);
+static bool answer_commands(connection_t *connection, long long received_us);
+
+static void close_connection(connection_t *connection)
+{
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, connection->fd, NULL);
+    close(connection->fd);
+    connection->fd = -1;
+}
+
+// take every client waiting on the listening socket "listen_fd"
+static void accept_connections(int listen_fd)
+{
+    int fd = -1;
+    while ((fd = accept(listen_fd, NULL, NULL)) != -1)
+    {
+        connection_t *connection = NULL;
+        for (int i = 0; i < MAX_CONNECTIONS && connection == NULL; i++)
+        {
+            if (connections[i].fd == -1)
+            {
+                connection = &connections[i];
+            }
+        }
+        if (connection == NULL)
+        {
+            LOG_WARNING("too many network clients, one was turned away");
+            close(fd);
+            continue;
+        }
+        set_nonblocking(fd);
+        if (!watch_fd(fd, EPOLLIN | EPOLLRDHUP, CONNECTION_TAG + (connection - connections)))
+        {
+            close(fd);
+            continue;
+        }
+        connection->fd = fd;
+        connection->in_length = 0;
+        connection->out_length = 0;
+        connection->last_active = get_seconds();
+        connection->subscription = SUBSCRIPTION_NONE;
+        connection->needs_snapshot = false;
+        connection->closing = false;
+        connection->loading = false;
+        connection->generation++;
+    }
+}
+
+// send the replies waiting for "connection", returns false once it was closed
+static bool flush_connection(connection_t *connection)
+{
+    size_t sent = 0;
+    while (sent < connection->out_length)
+    {
+        ssize_t bytes = send(connection->fd, connection->out + sent, connection->out_length - sent, MSG_NOSIGNAL);
+        if (bytes == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (bytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            break;
+        }
+        if (bytes == -1)
+        {
+            close_connection(connection);
+            return false;
+        }
+        sent += bytes;
+    }
+    memmove(connection->out, connection->out + sent, connection->out_length - sent);
+    connection->out_length -= sent;
+    // a client done sending still gets the reply of its add_song
+    if (connection->closing && connection->out_length == 0 && !connection->loading)
+    {
+        close_connection(connection);
+        return false;
+    }
+
+    // wait for room in the socket only while replies are waiting, and for commands once they can run
+    uint32_t events = (connection->loading ? 0 : EPOLLIN | EPOLLRDHUP) | (connection->out_length > 0 ? EPOLLOUT : 0);
+    struct epoll_event event = {.events = events, .data.u32 = CONNECTION_TAG + (connection - connections)};
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, connection->fd, &event);
+    return true;
+}
+
+// queue "size" bytes of "data" to send to "connection", returns false if they do not fit
+static bool queue_output(connection_t *connection, const void *data, size_t size)
+{
+    if (size > CONNECTION_OUT_SIZE - connection->out_length)
+    {
+        return false;
+    }
+    memcpy(connection->out + connection->out_length, data, size);
+    connection->out_length += size;
+    return true;
+}
+
+// drop the first "size" bytes of the input of "connection"
+static void consume_input(connection_t *connection, size_t size)
+{
+    memmove(connection->in, connection->in + size, connection->in_length - size);
+    connection->in_length -= size;
+}
+
+// returns the size of the first command in the input of "connection", 0 while it is incomplete
+static size_t next_command_size(connection_t *connection, bool *invalid)
+{
+    *invalid = false;
+    if ((uint8_t)connection->in[0] == PROTOCOL_MAGIC)
+    {
+        size_t size = protocol_getFrameSize((uint8_t *)connection->in, connection->in_length);
+        *invalid = size > MSG_MAX_LEN;
+        return (size > 0 && size <= connection->in_length) ? size : 0;
+    }
+    // a text command ends with an empty line
+    connection->in[connection->in_length] = '\0';
+    char *end = strstr(connection->in, "\n\n");
+    if (end == NULL)
+    {
+        // too long, or binary data that is not a frame
+        *invalid = connection->in_length == MSG_MAX_LEN || strlen(connection->in) < connection->in_length;
+        return 0;
+    }
+    return end - connection->in + 2;
+}
+
+// answer the HTTP request of a browser opening the status stream, returns false while it is incomplete
+static bool receive_upgrade(connection_t *connection, bool *invalid)
+{
+    size_t size = webSocket_getRequestSize(connection->in, connection->in_length);
+    *invalid = size == 0 && connection->in_length == MSG_MAX_LEN;
+    if (size == 0)
+    {
+        return false;
+    }
+    connection->in[size - 1] = '\0';
+    char response[MSG_MAX_LEN];
+    bool upgraded = false;
+    size_t response_size = webSocket_writeHandshake(connection->in, STATUS_STREAM_PATH, &upgraded, response, sizeof(response));
+    consume_input(connection, size);
+    queue_output(connection, response, response_size);
+    if (upgraded)
+    {
+        connection->subscription = SUBSCRIPTION_WEB_SOCKET;
+        connection->needs_snapshot = true;
+    }
+    else
+    {
+        connection->closing = true;
+    }
+    return true;
+}
+
+// answer the control frames of a browser; what it sends otherwise is ignored
+static void receive_web_socket_frames(connection_t *connection, bool *invalid)
+{
+    webSocket_frame_t frame;
+    size_t size = 0;
+    while (!connection->closing &&
+           (size = webSocket_readFrame((uint8_t *)connection->in, connection->in_length, &frame)) != 0)
+    {
+        if (size == SIZE_MAX)
+        {
+            *invalid = true;
+            return;
+        }
+        uint8_t header[WEB_SOCKET_MAX_HEADER_SIZE];
+        if (frame.opcode == WEB_SOCKET_OP_PING || frame.opcode == WEB_SOCKET_OP_CLOSE)
+        {
+            // a close is answered with a close, then the connection ends
+            uint8_t opcode = (frame.opcode == WEB_SOCKET_OP_PING) ? WEB_SOCKET_OP_PONG : WEB_SOCKET_OP_CLOSE;
+            size_t header_size = webSocket_writeFrameHeader(opcode, frame.length, header);
+            if (frame.length > 125 || !queue_output(connection, header, header_size) ||
+                !queue_output(connection, frame.payload, frame.length))
+            {
+                *invalid = true;
+                return;
+            }
+            connection->closing = frame.opcode == WEB_SOCKET_OP_CLOSE;
+        }
+        consume_input(connection, size);
+    }
+    *invalid = connection->in_length == MSG_MAX_LEN;
+}
+
+// run the commands "connection" sent, returns false once it was closed
+static bool receive_commands(connection_t *connection)
+{
+    ssize_t bytes = recv(connection->fd, connection->in + connection->in_length, MSG_MAX_LEN - connection->in_length, 0);
+    if (bytes == 0)
+    {
+        // the client is done sending, it may still wait for the last replies
+        connection->closing = true;
+        return flush_connection(connection);
+    }
+    if (bytes == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+    {
+        close_connection(connection);
+        return false;
+    }
+    if (bytes == -1 || connection->closing)
+    {
+        return true;
+    }
+    connection->in_length += bytes;
+    connection->last_active = get_seconds();
+    return answer_commands(connection, metrics_getTimeInUs());
+}
+
+// run the commands waiting in the input of "connection", returns false once it was closed
+static bool answer_commands(connection_t *connection, long long received_us)
+{
+    bool invalid = false;
+    size_t size = 0;
+    if (connection->subscription == SUBSCRIPTION_WEB_SOCKET)
+    {
+        receive_web_socket_frames(connection, &invalid);
+    }
+    // a browser opens the status stream with an HTTP request, no command starts like it
+    else if (strncmp(connection->in, "GET ", connection->in_length < 4 ? connection->in_length : 4) == 0)
+    {
+        receive_upgrade(connection, &invalid);
+    }
+    else
+    {
+        // the commands after an add_song run once it is answered
+        while (!connection->loading && connection->in_length > 0 && (size = next_command_size(connection, &invalid)) > 0)
+        {
+            command_request_t request;
+            char messageTx[MSG_MAX_LEN];
+            char saved = connection->in[size];
+            connection->in[size] = '\0';
+            parse_message(connection->in, size, &request);
+            request.arrival_us = received_us;
+            // only stream clients can subscribe, the status is then pushed to them
+            bool subscribe = request.opcode == PROTOCOL_OP_SUBSCRIBE;
+            if (request.status == PROTOCOL_STATUS_OK && (subscribe || request.opcode == PROTOCOL_OP_UNSUBSCRIBE))
+            {
+                connection->subscription = subscribe ? (request.binary ? SUBSCRIPTION_BINARY : SUBSCRIPTION_TEXT)
+                                                     : SUBSCRIPTION_NONE;
+                connection->subscribe_request_id = request.request_id;
+                connection->needs_snapshot = subscribe;
+                request.args.repeat = 0;
+            }
+            command_sender_t sender = {.connection = connection, .generation = connection->generation};
+            size_t reply_size = answer_request(&request, &sender, messageTx, sizeof(messageTx));
+            connection->in[size] = saved;
+            consume_input(connection, size);
+
+            if (!queue_output(connection, messageTx, reply_size))
+            {
+                LOG_WARNING("network client does not read its replies, closing it");
+                close_connection(connection);
+                return false;
+            }
+        }
+    }
+    if (invalid)
+    {
+        // the stream cannot be resynchronized after a command that does not fit
+        LOG_ERROR("invalid network command, closing the connection");
+        connection->closing = true;
+    }
+    // a new subscriber gets the whole status right away
+    if (connection->needs_snapshot)
+    {
+        broadcast_status();
+    }
+    return connection->fd != -1 && flush_connection(connection);
+}
+
+// send the reply of "add" to its sender
+static void answer_add(const pending_add_t *add)
+{
+    char messageTx[MSG_MAX_LEN];
+    command_reply_t reply;
+    begin_reply(&reply, add->binary, messageTx, sizeof(messageTx));
+    protocol_status_t status = (add->id != SONG_ID_INVALID) ? PROTOCOL_STATUS_OK : PROTOCOL_STATUS_FAILED;
+    if (status == PROTOCOL_STATUS_OK)
+    {
+        // the client deletes the song with this id
+        reply_number(&reply, add->id);
+        reply_end_line(&reply);
+    }
+    metrics_increment(&commands_metrics[status]);
+    size_t reply_size = end_reply(&reply, add->opcode, status, add->request_id);
+
+    const command_sender_t *sender = &add->sender;
+    connection_t *connection = sender->connection;
+    if (connection == NULL)
+    {
+        sendto(udp_fd, messageTx, reply_size, 0, (const struct sockaddr *)&sender->remote, sender->remote_length);
+        return;
+    }
+    // the client may have left meanwhile
+    if (connection->fd == -1 || connection->generation != sender->generation)
+    {
+        return;
+    }
+    connection->loading = false;
+    if (!queue_output(connection, messageTx, reply_size))
+    {
+        LOG_WARNING("network client does not read its replies, closing it");
+        close_connection(connection);
+        return;
+    }
+    answer_commands(connection, metrics_getTimeInUs());
+}
+
+// send the replies of the add_song commands whose song was read
+static void answer_loaded_songs(void)
+{
+    uint64_t loaded = 0;
+    if (read(loaded_fd, &loaded, sizeof(loaded)) != sizeof(loaded))
+    {
+        return;
+    }
+    for (int i = 0; i < MAX_PENDING_ADDS; i++)
+    {
+        pthread_mutex_lock(&pendingAddsMutex);
+        bool answer = pending_adds[i].in_use && pending_adds[i].loaded;
+        pthread_mutex_unlock(&pendingAddsMutex);
+        if (answer)
+        {
+            answer_add(&pending_adds[i]);
+            pthread_mutex_lock(&pendingAddsMutex);
+            pending_adds[i].in_use = false;
+            pthread_mutex_unlock(&pendingAddsMutex);
+        }
+    }
+}
+
+// writes the status update for subscribers of kind "subscription" into "update"
+static void encode_status(const statusStream_status_t *status, unsigned fields, subscription_t subscription,
+                          status_update_t *update)
+{
+    update->size = 0;
+    if (subscription == SUBSCRIPTION_BINARY)
+    {
+        // the request id of each subscriber is written when the frame is queued
+        protocol_writer_t frame;
+        protocol_beginFrame(&frame, (uint8_t *)update->data, PROTOCOL_MAX_FRAME_SIZE);
+        statusStream_writeFrame(status, fields, &frame);
+        update->size = protocol_endFrame(&frame, PROTOCOL_OP_STATUS, PROTOCOL_STATUS_OK, 0);
+        return;
+    }
+    if (subscription == SUBSCRIPTION_TEXT)
+    {
+        update->size = statusStream_writeJson(status, fields, update->data, sizeof(update->data));
+        return;
+    }
+    char json[STATUS_UPDATE_SIZE - WEB_SOCKET_MAX_HEADER_SIZE];
+    size_t length = statusStream_writeJson(status, fields, json, sizeof(json));
+    if (length > 0)
+    {
+        update->size = webSocket_writeFrameHeader(WEB_SOCKET_OP_TEXT, length, (uint8_t *)update->data);
+        memcpy(update->data + update->size, json, length);
+        update->size += length;
+    }
+}
+
+// push what changed since the last update to every subscriber
+static void broadcast_status(void)
+{
+    bool subscribed = false;
+    for (int i = 0; i < MAX_CONNECTIONS; i++)
+    {
+        subscribed = subscribed || (connections[i].fd != -1 && connections[i].subscription != SUBSCRIPTION_NONE);
+    }
+    if (!subscribed)
+    {
+        return;
+    }
+
+    statusStream_status_t now;
+    statusStream_sample(&now);
+    unsigned changed = statusStream_diff(&sent_status, &now);
+
+    // each kind of update is encoded once, however many clients subscribed
+    static status_update_t updates[2][SUBSCRIPTION_COUNT];
+    bool encoded[2][SUBSCRIPTION_COUNT] = {{false}};
+    for (int i = 0; i < MAX_CONNECTIONS; i++)
+    {
+        connection_t *connection = &connections[i];
+        bool snapshot = connection->needs_snapshot;
+        unsigned fields = snapshot ? STATUS_STREAM_ALL : changed;
+        if (connection->fd == -1 || connection->subscription == SUBSCRIPTION_NONE || connection->closing || fields == 0)
+        {
+            continue;
+        }
+        status_update_t *update = &updates[snapshot][connection->subscription];
+        if (!encoded[snapshot][connection->subscription])
+        {
+            encode_status(&now, fields, connection->subscription, update);
+            encoded[snapshot][connection->subscription] = true;
+        }
+        size_t start = connection->out_length;
+        // a client too slow for this update gets every field once it caught up
+        connection->needs_snapshot = update->size == 0 || !queue_output(connection, update->data, update->size);
+        if (connection->needs_snapshot)
+        {
+            continue;
+        }
+        if (connection->subscription == SUBSCRIPTION_BINARY)
+        {
+            protocol_writer_t frame = {.buffer = (uint8_t *)connection->out + start, .size = update->size, .length = update->size};
+            protocol_endFrame(&frame, PROTOCOL_OP_STATUS, PROTOCOL_STATUS_OK, connection->subscribe_request_id);
+        }
+        flush_connection(connection);
+    }
+}
+
+// close the connections that sent nothing for CONNECTION_IDLE_S and push the status
+static void on_timer(void)
+{
+    uint64_t expirations = 0;
+    if (read(timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+    {
+        return;
+    }
+    time_t now = get_seconds();
+    for (int i = 0; i < MAX_CONNECTIONS; i++)
+    {
+        // subscribers only listen
+        if (connections[i].fd != -1 && connections[i].subscription == SUBSCRIPTION_NONE &&
+            now - connections[i].last_active >= CONNECTION_IDLE_S)
+        {
+            close_connection(&connections[i]);
+        }
+    }
+    broadcast_status();
+}
+
+static void network_logic(void)
+{
+    struct epoll_event events[MAX_EVENTS];
+    while (!network_stopping)
+    {
+        int count = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        if (count == -1 && errno != EINTR)
+        {
+            LOG_ERROR("Failed to wait for network events");
+            exit(-1);
+        }
+        for (int i = 0; i < count && !network_stopping; i++)
+        {
+            uint32_t tag = events[i].data.u32;
+            if (tag == UDP_TAG)
+            {
+                receive_datagrams();
+            }
+            else if (tag == TCP_LISTEN_TAG)
+            {
+                accept_connections(tcp_fd);
+            }
+            else if (tag == UNIX_LISTEN_TAG)
+            {
+                accept_connections(unix_fd);
+            }
+            else if (tag == EVENT_TAG)
+            {
+                // only Network_cleanup() writes to it
+                network_stopping = true;
+            }
+            else if (tag == LOADED_TAG)
+            {
+                answer_loaded_songs();
+            }
+            else if (tag == TIMER_TAG)
+            {
+                on_timer();
+            }
+            else
+            {
+                connection_t *connection = &connections[tag - CONNECTION_TAG];
+                // the connection may have been closed by an earlier event of this round
+                if (connection->fd == -1)
+                {
+                    continue;
+                }
+                bool open = true;
+                if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                {
+                    open = receive_commands(connection);
+                }
+                if (open && (events[i].events & EPOLLOUT))
+                {
+                    flush_connection(connection);
+                }
+            }
+        }
+    }
+}
+
+// thread function to manage networking logics
+static void *network_thread(void *params)
+{
+    trace_nameThread("network");
+    network_logic();
+    return NULL;
+}
+
+// open the sockets and start a new thread to respond to the commands
+void Network_init()
+{
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    loaded_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    udp_fd = open_inet_socket(SOCK_DGRAM);
+    // check for errors
+    if (epoll_fd == -1 || event_fd == -1 || loaded_fd == -1 || timer_fd == -1 || udp_fd == -1)
+    {
+        LOG_ERROR("Failed to create the socket");
+        exit(-1);
+    }
+    // the UDP socket is enough for the web interface, the others are optional
+    tcp_fd = open_inet_socket(SOCK_STREAM);
+    if (tcp_fd == -1)
+    {
+        LOG_WARNING("Failed to open the TCP socket");
+    }
+    unix_fd = open_unix_socket(NETWORK_UNIX_SOCKET_PATH);
+    if (unix_fd == -1)
+    {
+        LOG_WARNING("Failed to open the Unix domain socket <%s>", NETWORK_UNIX_SOCKET_PATH);
+    }
+
+    for (int i = 0; i < MAX_CONNECTIONS; i++)
+    {
+        connections[i].fd = -1;
+    }
+    memset(pending_adds, 0, sizeof(pending_adds));
+    bool watched = watch_fd(udp_fd, EPOLLIN, UDP_TAG) && watch_fd(event_fd, EPOLLIN, EVENT_TAG) &&
+                   watch_fd(loaded_fd, EPOLLIN, LOADED_TAG) && watch_fd(timer_fd, EPOLLIN, TIMER_TAG);
+    watched = watched && (tcp_fd == -1 || watch_fd(tcp_fd, EPOLLIN, TCP_LISTEN_TAG));
+    watched = watched && (unix_fd == -1 || watch_fd(unix_fd, EPOLLIN, UNIX_LISTEN_TAG));
+    if (!watched)
+    {
+        LOG_ERROR("Failed to watch the sockets");
+        exit(-1);
+    }
+    struct timespec tick = {0, STATUS_INTERVAL_MS * 1000000L};
+    struct itimerspec interval = {.it_interval = tick, .it_value = tick};
+    timerfd_settime(timer_fd, 0, &interval, NULL);
+
+    for (int i = 0; i < PROTOCOL_STATUS_COUNT; i++)
+    {
+        snprintf(status_labels[i], sizeof(status_labels[i]), "status=\"%s\"", protocol_getStatusName(i));
+        metrics_registerCounter(&commands_metrics[i], "beaglepod_network_commands_total", status_labels[i],
+                                "Commands answered, by the status of the reply");
+    }
+    metrics_registerHistogram(&command_metric, "beaglepod_network_command_seconds", NULL,
+                              "Time taken to run a command", command_bounds_us,
+                              sizeof(command_bounds_us) / sizeof(command_bounds_us[0]));
+    metrics_registerCounter(&datagrams_metric, "beaglepod_network_datagrams_total", NULL,
+                            "Commands received over UDP");
+    metrics_registerCounter(&coalesced_metric, "beaglepod_network_coalesced_total", NULL,
+                            "Commands over UDP dropped because a later one of the same batch made them useless");
+
+    // start network thread
+    network_stopping = false;
+    pthread_create(&thread_id, NULL, &network_thread, NULL);
+
+    is_module_initialized = true;
+}
+
+// stop network thread
+void Network_cleanup()
+{
+    assert(is_module_initialized);
+
+    // wake the thread up, it stops before handling anything else
+    uint64_t stop = 1;
+    if (write(event_fd, &stop, sizeof(stop)) != sizeof(stop))
+    {
+        LOG_ERROR("Failed to stop the network thread");
+    }
     pthread_join(thread_id, NULL);
+
+    for (int i = 0; i < MAX_CONNECTIONS; i++)
+    {
+        if (connections[i].fd != -1)
+        {
+            close_connection(&connections[i]);
+        }
+    }
+    int fds[] = {udp_fd, tcp_fd, unix_fd, event_fd, loaded_fd, timer_fd, epoll_fd};
+    for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++)
+    {
+        if (fds[i] != -1)
+        {
+            close(fds[i]);
+        }
+    }
+    if (unix_fd != -1)
+    {
+        unlink(NETWORK_UNIX_SOCKET_PATH);
+    }
+    udp_fd = tcp_fd = unix_fd = event_fd = loaded_fd = timer_fd = epoll_fd = -1;
+    is_module_initialized = false;
 }
 
 // #include "sleep.h"
@@ -13,10 +13,14 @@
 #if !defined(_NETWORK_H_)
 #define _NETWORK_H_
 
+// Local clients can send the same commands to this Unix domain socket
+#define NETWORK_UNIX_SOCKET_PATH "/tmp/beaglepod.sock"
+
 // Start a new thread to listen to the incoming packets and responds to the commands
 void Network_init();
 
-// Wait until network thread stops
+// Stop the network thread right away and close its sockets
+// Note: call songWatcher_cleanup() first, its thread answers the add_song commands
 void Network_cleanup();
 
 #endif // _NETWORK_H_
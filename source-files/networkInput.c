@@ -0,0 +1,734 @@
+/**
+ * @file networkInput.c
+ * @brief This is a source file for the networkInput module.
+ *
+ * This source file contains the declaration of the functions
+ * for the networkInput module, which plays the audio another machine
+ * sends instead of the songs (see networkInput.h).
+ *
+ * A thread receives the streams into a ring of BUFFER_FRAMES frames,
+ * indexed by the position of each frame in the stream: an RTP packet
+ * lands at the place of its timestamp whatever order it arrived in, and
+ * a frame that never arrived is played as silence. The playback thread of
+ * the audio player takes the frames out (see fillFromNetwork()).
+ *
+ * The delay kept in the ring is the jitter buffer. It starts at
+ * NETWORK_INPUT_START_DELAY_MS and follows the jitter measured on the
+ * arrivals: it grows at once when the jitter grows or the ring runs dry,
+ * and shrinks slowly when the network calms down.
+ *
+ * The clock of the sender and the one of the sound card never run at
+ * exactly the same speed, so the ring would slowly fill up or run dry.
+ * Since the audio player takes the frames out at the pace of the sound
+ * card, the average delay in the ring tells how far apart the clocks are:
+ * the frames are resampled, by linear interpolation, slightly faster
+ * while the delay is above its target and slower while it is below.
+ *
+ * @author Amirhossein Etaati
+ * @date 2023-04-15
+ */
+
+// for accept4()
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "networkInput.h"
+#include "audio_player.h"
+#include "metrics.h"
+
+// Frames the ring holds, a power of two (1.4 seconds)
+#define BUFFER_FRAMES 65536
+#define FRAME_SIZE (NUM_CHANNELS * SAMPLE_SIZE)
+#define PACKET_MAX_SIZE 8192
+// Time between checks for the end of a stream
+#define POLL_MS 20
+// Time between checks for room in the ring while a TCP sender is ahead
+#define THROTTLED_POLL_MS 2
+
+#define RTP_HEADER_SIZE 12
+#define RTP_VERSION 2
+// L16 at 48 kHz in stereo has no static payload type (RFC 3551, section 6)
+#define RTP_FIRST_DYNAMIC_TYPE 96
+
+// Weight of a new interarrival difference in the jitter (RFC 3550, section 6.4.1)
+#define JITTER_DIVISOR 16
+// The target delay stays above this many times the jitter, and above two packets
+#define JITTER_FACTOR 4
+// Added to the target delay each time the ring runs dry
+#define UNDERRUN_STEP_MS 20
+// Speed at which the target delay goes down, which the resampling can follow
+#define TARGET_DECAY_PPM (NETWORK_INPUT_MAX_CORRECTION_PPM / 2)
+// Calls of the playback thread the delay is averaged over
+#define DELAY_AVERAGE_DIVISOR 64
+
+#define MS_TO_FRAMES(ms) ((ms) * SAMPLE_RATE / 1000)
+
+typedef enum
+{
+    SOURCE_RTP,
+    SOURCE_UDP,
+    SOURCE_TCP
+} source_t;
+
+typedef struct
+{
+    uint32_t ssrc;
+    int64_t position; // of the latest timestamp received
+    uint32_t timestamp;
+    int64_t first_sequence;
+    int64_t highest_sequence; // extended past 16 bits
+    long long received;
+} rtp_stream_t;
+
+static pthread_t networkInputThreadId;
+static bool stoppingInput = false;
+static bool is_module_initialized = false;
+
+static int rtp_fd = -1;
+static int pcm_fd = -1;
+static int listen_fd = -1;
+static int tcp_fd = -1; // the TCP sender, -1 while there is none
+
+// used by the receiving thread only
+static unsigned char packet[PACKET_MAX_SIZE];
+// TCP reads end on any byte, the start of an incomplete frame waits here
+static unsigned char pending[FRAME_SIZE];
+static size_t pending_length = 0;
+
+// protected by inputMutex
+static pthread_mutex_t inputMutex = PTHREAD_MUTEX_INITIALIZER;
+static short ring[BUFFER_FRAMES * NUM_CHANNELS];
+static int64_t read_position; // frame played next
+static int64_t write_end;     // end of the latest frame received
+static double phase;          // between the frame at read_position and the next one
+static double average_delay;  // in frames
+static double target_frames;
+static source_t source;
+static rtp_stream_t rtp;
+static long long lost_before; // in the streams before this one
+static bool ran_dry;          // counted as an underrun if the stream goes on
+static long long last_data_us;
+static long long previous_arrival_us;
+static int64_t previous_arrival_position;
+static double jitter_us;
+static networkInput_stats_t stats;
+
+// Metrics, see metrics.h
+static metrics_gauge_t state_metric;
+static metrics_counter_t packets_metric;
+static metrics_counter_t bytes_metric;
+static metrics_counter_t lost_metric;
+static metrics_counter_t late_metric;
+static metrics_counter_t duplicates_metric;
+static metrics_counter_t overflows_metric;
+static metrics_counter_t rejected_metric;
+static metrics_counter_t underruns_metric;
+static metrics_gauge_t jitter_metric;
+static metrics_gauge_t delay_metric;
+static metrics_gauge_t correction_metric;
+
+// Private functions definitions
+static void *networkInputThread(void *arg);
+static int openSocket(int type, int port);
+static void receiveRtp(void);
+static void receivePcm(void);
+static void acceptSender(void);
+static void receiveTcp(void);
+static bool isTcpThrottled(void);
+static void checkIdle(void);
+static void startStream(source_t kind);
+static void endStream(void);
+static void storeFrames(const unsigned char *data, int frames, int64_t position, bool big_endian, long long now_us);
+static void updateJitter(int64_t position, int frames, long long now_us);
+static bool fillFromNetwork(short *buffer, int numSamples);
+static void resample(short *buffer, int frames);
+static short *frameAt(int64_t position);
+static uint32_t readBigEndian(const unsigned char *bytes, int size);
+static void registerMetrics(void);
+static void collectMetrics(void);
+static long long getTimeInUs(void);
+
+//------------------------------------------------
+//////////////// Public Functions ////////////////
+//------------------------------------------------
+
+void networkInput_init(void)
+{
+    registerMetrics();
+    rtp_fd = openSocket(SOCK_DGRAM, NETWORK_INPUT_RTP_PORT);
+    pcm_fd = openSocket(SOCK_DGRAM, NETWORK_INPUT_PCM_PORT);
+    listen_fd = openSocket(SOCK_STREAM, NETWORK_INPUT_PCM_PORT);
+    if (rtp_fd < 0 || pcm_fd < 0 || listen_fd < 0)
+    {
+        fprintf(stderr, "ERROR: Unable to receive audio on ports %d and %d.\n", NETWORK_INPUT_RTP_PORT,
+                NETWORK_INPUT_PCM_PORT);
+        int fds[] = {rtp_fd, pcm_fd, listen_fd};
+        for (int i = 0; i < 3; i++)
+        {
+            if (fds[i] >= 0)
+            {
+                close(fds[i]);
+            }
+        }
+        rtp_fd = pcm_fd = listen_fd = -1;
+        return;
+    }
+
+    stats.state = NETWORK_INPUT_IDLE;
+    stoppingInput = false;
+    pthread_create(&networkInputThreadId, NULL, networkInputThread, NULL);
+    AudioPlayer_setSource(fillFromNetwork);
+    is_module_initialized = true;
+}
+
+void networkInput_cleanup(void)
+{
+    if (!is_module_initialized)
+    {
+        return;
+    }
+    AudioPlayer_setSource(NULL);
+    __atomic_store_n(&stoppingInput, true, __ATOMIC_RELEASE);
+    pthread_join(networkInputThreadId, NULL);
+
+    pthread_mutex_lock(&inputMutex);
+    if (stats.state != NETWORK_INPUT_IDLE)
+    {
+        endStream();
+    }
+    pthread_mutex_unlock(&inputMutex);
+    int fds[] = {rtp_fd, pcm_fd, listen_fd, tcp_fd};
+    for (int i = 0; i < 4; i++)
+    {
+        if (fds[i] >= 0)
+        {
+            close(fds[i]);
+        }
+    }
+    rtp_fd = pcm_fd = listen_fd = tcp_fd = -1;
+    is_module_initialized = false;
+}
+
+void networkInput_getStats(networkInput_stats_t *stats_out)
+{
+    pthread_mutex_lock(&inputMutex);
+    *stats_out = stats;
+    pthread_mutex_unlock(&inputMutex);
+}
+
+//------------------------------------------------
+/////////////// Private Functions ////////////////
+//------------------------------------------------
+
+static void *networkInputThread(void *arg)
+{
+    while (!__atomic_load_n(&stoppingInput, __ATOMIC_ACQUIRE))
+    {
+        bool throttled = isTcpThrottled();
+        // a negative fd is left out by poll()
+        struct pollfd fds[] = {
+            {.fd = rtp_fd, .events = POLLIN},
+            {.fd = pcm_fd, .events = POLLIN},
+            {.fd = listen_fd, .events = POLLIN},
+            {.fd = throttled ? -1 : tcp_fd, .events = POLLIN},
+        };
+        if (poll(fds, 4, throttled ? THROTTLED_POLL_MS : POLL_MS) > 0)
+        {
+            if (fds[0].revents & POLLIN)
+            {
+                receiveRtp();
+            }
+            if (fds[1].revents & POLLIN)
+            {
+                receivePcm();
+            }
+            if (fds[2].revents & POLLIN)
+            {
+                acceptSender();
+            }
+            if (fds[3].revents != 0)
+            {
+                receiveTcp();
+            }
+        }
+        checkIdle();
+    }
+    return NULL;
+}
+
+// Returns a socket of "type" bound to "port", -1 on failure
+static int openSocket(int type, int port)
+{
+    struct sockaddr_in sin;
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_ANY);
+    sin.sin_port = htons(port);
+
+    int fd = socket(PF_INET, type | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    int reuse = 1;
+    if (fd < 0 || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0 ||
+        bind(fd, (struct sockaddr *)&sin, sizeof(sin)) != 0 || (type == SOCK_STREAM && listen(fd, 1) != 0))
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return -1;
+    }
+    return fd;
+}
+
+static void receiveRtp(void)
+{
+    ssize_t size = recv(rtp_fd, packet, sizeof(packet), 0);
+    if (size <= 0)
+    {
+        return;
+    }
+    long long now_us = getTimeInUs();
+    size_t header_size = RTP_HEADER_SIZE + 4 * (packet[0] & 0x0F);
+    if (size >= RTP_HEADER_SIZE && (packet[0] & 0x10) && (size_t)size >= header_size + 4)
+    {
+        header_size += 4 + 4 * readBigEndian(packet + header_size + 2, 2);
+    }
+    size_t padding = (size >= RTP_HEADER_SIZE && (packet[0] & 0x20)) ? packet[size - 1] : 0;
+    size_t payload_size = ((size_t)size > header_size + padding) ? size - header_size - padding : 0;
+
+    pthread_mutex_lock(&inputMutex);
+    stats.packets++;
+    stats.bytes += size;
+    uint32_t ssrc = (size >= RTP_HEADER_SIZE) ? readBigEndian(packet + 8, 4) : 0;
+    if (size < RTP_HEADER_SIZE || (packet[0] >> 6) != RTP_VERSION || (packet[1] & 0x7F) < RTP_FIRST_DYNAMIC_TYPE ||
+        payload_size == 0 || payload_size % FRAME_SIZE != 0 ||
+        (stats.state != NETWORK_INPUT_IDLE && (source != SOURCE_RTP || ssrc != rtp.ssrc)))
+    {
+        stats.rejected++;
+        pthread_mutex_unlock(&inputMutex);
+        return;
+    }
+
+    uint16_t sequence = readBigEndian(packet + 2, 2);
+    uint32_t timestamp = readBigEndian(packet + 4, 4);
+    int64_t position = rtp.position + (int32_t)(timestamp - rtp.timestamp);
+    if (stats.state != NETWORK_INPUT_IDLE &&
+        (position < read_position - BUFFER_FRAMES || position > read_position + 2 * BUFFER_FRAMES))
+    {
+        // the sender started over
+        endStream();
+    }
+    if (stats.state == NETWORK_INPUT_IDLE)
+    {
+        startStream(SOURCE_RTP);
+        rtp.ssrc = ssrc;
+        rtp.position = position = 0;
+        rtp.timestamp = timestamp;
+        rtp.first_sequence = sequence;
+        rtp.highest_sequence = sequence - 1;
+        rtp.received = 0;
+    }
+
+    int16_t delta = sequence - (uint16_t)rtp.highest_sequence;
+    if (delta == 0)
+    {
+        stats.duplicates++;
+        pthread_mutex_unlock(&inputMutex);
+        return;
+    }
+    if (delta > 0)
+    {
+        rtp.highest_sequence += delta;
+    }
+    rtp.received++;
+    long long expected = rtp.highest_sequence - rtp.first_sequence + 1;
+    stats.lost = lost_before + ((expected > rtp.received) ? expected - rtp.received : 0);
+    if (position > rtp.position)
+    {
+        rtp.position = position;
+        rtp.timestamp = timestamp;
+    }
+    storeFrames(packet + header_size, payload_size / FRAME_SIZE, position, true, now_us);
+    pthread_mutex_unlock(&inputMutex);
+}
+
+static void receivePcm(void)
+{
+    ssize_t size = recv(pcm_fd, packet, sizeof(packet), 0);
+    if (size <= 0)
+    {
+        return;
+    }
+    long long now_us = getTimeInUs();
+    pthread_mutex_lock(&inputMutex);
+    stats.packets++;
+    stats.bytes += size;
+    if (size % FRAME_SIZE != 0 || (stats.state != NETWORK_INPUT_IDLE && source != SOURCE_UDP))
+    {
+        stats.rejected++;
+    }
+    else
+    {
+        if (stats.state == NETWORK_INPUT_IDLE)
+        {
+            startStream(SOURCE_UDP);
+        }
+        // raw PCM has no timestamps: the frames follow the ones received before
+        storeFrames(packet, size / FRAME_SIZE, write_end, false, now_us);
+    }
+    pthread_mutex_unlock(&inputMutex);
+}
+
+// Takes a TCP sender, if there is none already
+static void acceptSender(void)
+{
+    int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if (fd < 0)
+    {
+        return;
+    }
+    if (tcp_fd >= 0)
+    {
+        pthread_mutex_lock(&inputMutex);
+        stats.rejected++;
+        pthread_mutex_unlock(&inputMutex);
+        close(fd);
+        return;
+    }
+    tcp_fd = fd;
+    pending_length = 0;
+}
+
+// Reads no further than the target delay: a sender ahead of time is held back by TCP
+static void receiveTcp(void)
+{
+    pthread_mutex_lock(&inputMutex);
+    size_t wanted = sizeof(packet) - pending_length;
+    if (stats.state != NETWORK_INPUT_IDLE && source == SOURCE_TCP)
+    {
+        int64_t room = target_frames - (write_end - read_position);
+        room = (room < 1) ? 1 : room;
+        if ((size_t)room * FRAME_SIZE < wanted)
+        {
+            wanted = room * FRAME_SIZE;
+        }
+    }
+    pthread_mutex_unlock(&inputMutex);
+
+    memcpy(packet, pending, pending_length);
+    ssize_t size = recv(tcp_fd, packet + pending_length, wanted, 0);
+    if (size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+    {
+        return;
+    }
+    if (size <= 0)
+    {
+        // the stream plays out and ends once the ring is empty
+        close(tcp_fd);
+        tcp_fd = -1;
+        pending_length = 0;
+        return;
+    }
+    long long now_us = getTimeInUs();
+    size_t length = pending_length + size;
+    int frames = length / FRAME_SIZE;
+
+    pthread_mutex_lock(&inputMutex);
+    stats.packets++;
+    stats.bytes += size;
+    if (stats.state != NETWORK_INPUT_IDLE && source != SOURCE_TCP)
+    {
+        stats.rejected++;
+    }
+    else if (frames > 0)
+    {
+        if (stats.state == NETWORK_INPUT_IDLE)
+        {
+            startStream(SOURCE_TCP);
+        }
+        storeFrames(packet, frames, write_end, false, now_us);
+    }
+    pthread_mutex_unlock(&inputMutex);
+
+    pending_length = length - frames * FRAME_SIZE;
+    memcpy(pending, packet + frames * FRAME_SIZE, pending_length);
+}
+
+// Returns true while the TCP stream holds its target delay
+static bool isTcpThrottled(void)
+{
+    if (tcp_fd < 0)
+    {
+        return false;
+    }
+    pthread_mutex_lock(&inputMutex);
+    bool throttled = stats.state != NETWORK_INPUT_IDLE && source == SOURCE_TCP &&
+                     write_end - read_position >= target_frames;
+    pthread_mutex_unlock(&inputMutex);
+    return throttled;
+}
+
+// Ends the stream once no data came for NETWORK_INPUT_IDLE_MS
+static void checkIdle(void)
+{
+    pthread_mutex_lock(&inputMutex);
+    bool idle = stats.state != NETWORK_INPUT_IDLE && getTimeInUs() - last_data_us > NETWORK_INPUT_IDLE_MS * 1000LL;
+    if (idle)
+    {
+        endStream();
+    }
+    pthread_mutex_unlock(&inputMutex);
+    if (idle && tcp_fd >= 0)
+    {
+        close(tcp_fd);
+        tcp_fd = -1;
+        pending_length = 0;
+    }
+}
+
+// Note: caller must hold inputMutex
+static void startStream(source_t kind)
+{
+    static const char *names[] = {"RTP", "UDP", "TCP"};
+    printf("networkInput: Playing a stream received over %s\n", names[kind]);
+    memset(ring, 0, sizeof(ring));
+    source = kind;
+    read_position = 0;
+    write_end = 0;
+    phase = 0;
+    average_delay = 0;
+    target_frames = MS_TO_FRAMES(NETWORK_INPUT_START_DELAY_MS);
+    ran_dry = false;
+    previous_arrival_us = 0;
+    jitter_us = 0;
+    stats.jitter_us = 0;
+    stats.state = NETWORK_INPUT_BUFFERING;
+}
+
+// Note: caller must hold inputMutex
+static void endStream(void)
+{
+    printf("networkInput: The stream ended (%lld lost, %lld late, %lld underruns so far)\n", stats.lost, stats.late,
+           stats.underruns);
+    lost_before = stats.lost;
+    stats.state = NETWORK_INPUT_IDLE;
+    stats.delay_ms = 0;
+    stats.correction_ppm = 0;
+}
+
+// Writes "frames" frames of "data" in the ring from "position" on
+// Note: caller must hold inputMutex
+static void storeFrames(const unsigned char *data, int frames, int64_t position, bool big_endian, long long now_us)
+{
+    last_data_us = now_us;
+    if (ran_dry)
+    {
+        stats.underruns++;
+        ran_dry = false;
+    }
+    if (position + frames <= read_position)
+    {
+        stats.late++;
+        return;
+    }
+    if (position + frames > read_position + BUFFER_FRAMES)
+    {
+        stats.overflows++;
+        return;
+    }
+
+    // the part already played is left out
+    int first = (position < read_position) ? read_position - position : 0;
+    for (int frame = first; frame < frames; frame++)
+    {
+        short *slot = frameAt(position + frame);
+        const unsigned char *bytes = data + frame * FRAME_SIZE;
+        for (int channel = 0; channel < NUM_CHANNELS; channel++)
+        {
+            const unsigned char *sample = bytes + channel * SAMPLE_SIZE;
+            slot[channel] = big_endian ? (short)(sample[0] << 8 | sample[1]) : (short)(sample[1] << 8 | sample[0]);
+        }
+    }
+    if (position + frames > write_end)
+    {
+        write_end = position + frames;
+    }
+    // TCP reads come as the sender is let in, their spacing tells nothing about the network
+    if (source != SOURCE_TCP)
+    {
+        updateJitter(position, frames, now_us);
+    }
+}
+
+// Updates the jitter with a packet of "frames" at "position" that arrived at "now_us", and the target delay with it
+// Note: caller must hold inputMutex
+static void updateJitter(int64_t position, int frames, long long now_us)
+{
+    if (previous_arrival_us != 0)
+    {
+        double difference = (now_us - previous_arrival_us) -
+                            (double)(position - previous_arrival_position) * 1000000 / SAMPLE_RATE;
+        difference = (difference < 0) ? -difference : difference;
+        jitter_us += (difference - jitter_us) / JITTER_DIVISOR;
+    }
+    previous_arrival_us = now_us;
+    previous_arrival_position = position;
+    stats.jitter_us = jitter_us;
+
+    double desired = JITTER_FACTOR * jitter_us * SAMPLE_RATE / 1000000;
+    desired = (desired < 2 * frames) ? 2 * frames : desired;
+    desired = (desired < MS_TO_FRAMES(NETWORK_INPUT_MIN_DELAY_MS)) ? MS_TO_FRAMES(NETWORK_INPUT_MIN_DELAY_MS) : desired;
+    desired = (desired > MS_TO_FRAMES(NETWORK_INPUT_MAX_DELAY_MS)) ? MS_TO_FRAMES(NETWORK_INPUT_MAX_DELAY_MS) : desired;
+    // going down faster than the resampling can drain the ring would leave the delay behind
+    double decay = frames * TARGET_DECAY_PPM / 1000000.0;
+    if (desired > target_frames)
+    {
+        target_frames = desired;
+    }
+    else
+    {
+        target_frames = (target_frames - decay > desired) ? target_frames - decay : desired;
+    }
+}
+
+// The source of the audio player: fills "buffer" while a stream is on, returns false otherwise
+static bool fillFromNetwork(short *buffer, int numSamples)
+{
+    pthread_mutex_lock(&inputMutex);
+    bool streaming = stats.state != NETWORK_INPUT_IDLE;
+    if (stats.state == NETWORK_INPUT_BUFFERING && write_end - read_position >= target_frames)
+    {
+        stats.state = NETWORK_INPUT_PLAYING;
+        average_delay = write_end - read_position;
+    }
+    if (stats.state == NETWORK_INPUT_PLAYING)
+    {
+        resample(buffer, numSamples / NUM_CHANNELS);
+    }
+    if (streaming)
+    {
+        stats.delay_ms = (write_end - read_position) * 1000 / SAMPLE_RATE;
+        stats.target_ms = target_frames * 1000 / SAMPLE_RATE;
+    }
+    pthread_mutex_unlock(&inputMutex);
+    return streaming;
+}
+
+// Plays "frames" frames from the ring, a little faster or slower to bring the delay to its target
+// Note: caller must hold inputMutex
+static void resample(short *buffer, int frames)
+{
+    average_delay += ((write_end - read_position) - average_delay) / DELAY_AVERAGE_DIVISOR;
+    // the whole correction half a target away from it
+    double correction = (average_delay - target_frames) / (target_frames / 2.0);
+    correction = (correction > 1) ? 1 : (correction < -1) ? -1 : correction;
+    stats.correction_ppm = correction * NETWORK_INPUT_MAX_CORRECTION_PPM;
+    double step = 1 + correction * NETWORK_INPUT_MAX_CORRECTION_PPM / 1000000;
+
+    for (int i = 0; i < frames; i++)
+    {
+        if (write_end - read_position < 2)
+        {
+            // silence until a longer delay is back
+            stats.state = NETWORK_INPUT_BUFFERING;
+            ran_dry = true;
+            target_frames += MS_TO_FRAMES(UNDERRUN_STEP_MS);
+            if (target_frames > MS_TO_FRAMES(NETWORK_INPUT_MAX_DELAY_MS))
+            {
+                target_frames = MS_TO_FRAMES(NETWORK_INPUT_MAX_DELAY_MS);
+            }
+            return;
+        }
+        const short *current = frameAt(read_position);
+        const short *next = frameAt(read_position + 1);
+        for (int channel = 0; channel < NUM_CHANNELS; channel++)
+        {
+            buffer[i * NUM_CHANNELS + channel] = current[channel] + (next[channel] - current[channel]) * phase;
+        }
+        phase += step;
+        while (phase >= 1)
+        {
+            // played frames are cleared, a frame that never arrives is silence
+            memset(frameAt(read_position), 0, FRAME_SIZE);
+            read_position++;
+            phase -= 1;
+        }
+    }
+}
+
+static short *frameAt(int64_t position)
+{
+    return &ring[(position & (BUFFER_FRAMES - 1)) * NUM_CHANNELS];
+}
+
+static uint32_t readBigEndian(const unsigned char *bytes, int size)
+{
+    uint32_t value = 0;
+    for (int i = 0; i < size; i++)
+    {
+        value = (value << 8) | bytes[i];
+    }
+    return value;
+}
+
+static void registerMetrics(void)
+{
+    metrics_registerGauge(&state_metric, "beaglepod_input_stream_state", NULL,
+                          "0 while no stream is received, 1 while buffering, 2 while playing");
+    metrics_registerCounter(&packets_metric, "beaglepod_input_stream_packets_total", NULL,
+                            "Datagrams, or reads on TCP, of the streams received");
+    metrics_registerCounter(&bytes_metric, "beaglepod_input_stream_bytes_total", NULL,
+                            "Bytes of the streams received");
+    metrics_registerCounter(&lost_metric, "beaglepod_input_stream_lost_total", NULL, "RTP packets that never arrived");
+    metrics_registerCounter(&late_metric, "beaglepod_input_stream_late_total", NULL,
+                            "Packets that arrived after their time to be played");
+    metrics_registerCounter(&duplicates_metric, "beaglepod_input_stream_duplicates_total", NULL,
+                            "RTP packets received twice");
+    metrics_registerCounter(&overflows_metric, "beaglepod_input_stream_overflows_total", NULL,
+                            "Packets dropped because the buffer was full");
+    metrics_registerCounter(&rejected_metric, "beaglepod_input_stream_rejected_total", NULL,
+                            "Packets not understood, or of another stream than the one playing");
+    metrics_registerCounter(&underruns_metric, "beaglepod_input_stream_underruns_total", NULL,
+                            "Times the buffer ran dry while the stream went on");
+    metrics_registerGauge(&jitter_metric, "beaglepod_input_stream_jitter_us", NULL, "Interarrival jitter");
+    metrics_registerGauge(&delay_metric, "beaglepod_input_stream_delay_ms", NULL, "Audio in the buffer");
+    metrics_registerGauge(&correction_metric, "beaglepod_input_stream_correction_ppm", NULL,
+                          "Playback speed change, positive while the sender's clock is faster");
+    metrics_registerCollector(collectMetrics);
+}
+
+static void collectMetrics(void)
+{
+    networkInput_stats_t current;
+    networkInput_getStats(&current);
+    metrics_set(&state_metric, current.state);
+    metrics_setCounter(&packets_metric, current.packets);
+    metrics_setCounter(&bytes_metric, current.bytes);
+    metrics_setCounter(&lost_metric, current.lost);
+    metrics_setCounter(&late_metric, current.late);
+    metrics_setCounter(&duplicates_metric, current.duplicates);
+    metrics_setCounter(&overflows_metric, current.overflows);
+    metrics_setCounter(&rejected_metric, current.rejected);
+    metrics_setCounter(&underruns_metric, current.underruns);
+    metrics_set(&jitter_metric, current.jitter_us);
+    metrics_set(&delay_metric, current.delay_ms);
+    metrics_set(&correction_metric, current.correction_ppm);
+}
+
+static long long getTimeInUs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
@@ -0,0 +1,68 @@
+/**
+ * @file networkInput.h
+ * @brief This is a header file for the networkInput module.
+ *
+ * This header file contains the definitions of the functions
+ * for the networkInput module, which plays the audio another machine
+ * sends instead of the songs, for as long as it arrives:
+ * - RTP (RFC 3550) carrying L16 samples (RFC 3551) at 48 kHz in stereo,
+ *   with any dynamic payload type, on UDP port NETWORK_INPUT_RTP_PORT
+ * - raw PCM in the format of the songs (16 bit little endian samples at
+ *   48 kHz in stereo) on UDP and TCP port NETWORK_INPUT_PCM_PORT
+ *
+ * A single stream plays at a time; the song playing goes on where it
+ * stopped once no data arrived for NETWORK_INPUT_IDLE_MS.
+ * benchmarks/streamBench.c sends it a stream over loopback, with jitter,
+ * losses and drifting clocks, and follows its stats ("make stream").
+ *
+ * @author Amirhossein Etaati
+ * @date 2023-04-15
+ */
+
+#if !defined(NETWORK_INPUT_H)
+#define NETWORK_INPUT_H
+
+#define NETWORK_INPUT_RTP_PORT 5004
+#define NETWORK_INPUT_PCM_PORT 5006
+// Audio held back to absorb the jitter of the network, adapted between these bounds
+#define NETWORK_INPUT_MIN_DELAY_MS 20
+#define NETWORK_INPUT_MAX_DELAY_MS 500
+#define NETWORK_INPUT_START_DELAY_MS 60
+// Largest change of the playback speed made to follow the clock of the sender
+#define NETWORK_INPUT_MAX_CORRECTION_PPM 2000
+// Time without data after which the stream is over
+#define NETWORK_INPUT_IDLE_MS 1000
+
+typedef enum
+{
+    NETWORK_INPUT_IDLE,
+    NETWORK_INPUT_BUFFERING, // silence until the delay is reached
+    NETWORK_INPUT_PLAYING
+} networkInput_state_t;
+
+typedef struct
+{
+    networkInput_state_t state;
+    long long packets; // datagrams, or reads on TCP
+    long long bytes;
+    long long lost;       // RTP packets that never arrived
+    long long late;       // arrived after their time to be played
+    long long duplicates; // RTP packets received twice
+    long long overflows;  // dropped because the buffer was full
+    long long rejected;   // not understood, or of another stream than the one playing
+    long long underruns;  // times the buffer ran dry while the stream went on
+    int jitter_us;        // interarrival jitter (RFC 3550, section 6.4.1)
+    int target_ms;        // delay the buffer aims at
+    int delay_ms;         // audio in the buffer
+    int correction_ppm;   // playback speed change, positive while the sender's clock is faster
+} networkInput_stats_t;
+
+// Starts receiving streams and makes them a source of the audio player
+// Note: the audio player must be initialized first
+void networkInput_init(void);
+
+void networkInput_cleanup(void);
+
+void networkInput_getStats(networkInput_stats_t *stats);
+
+#endif // NETWORK_INPUT_H
@@ -0,0 +1,427 @@
+/**
+ * @file networkOutput.c
+ * @brief This is a source file for the networkOutput module.
+ *
+ * This source file contains the declaration of the functions
+ * for the networkOutput module, which sends what the BeaglePod plays
+ * to a multicast group as RTP (see networkOutput.h).
+ *
+ * The audio player hands every buffer it wrote to the sound card to
+ * storeFrames(), which copies it into a ring of BUFFER_FRAMES frames and
+ * returns at once, so the playback never waits for the network. A thread
+ * cuts the ring into packets of NETWORK_OUTPUT_PACKET_MS. The pace comes
+ * from the sound card: a buffer is handed over when the card took it, and
+ * its packets are spread over the time it plays, from that moment on.
+ * The RTP timestamp is the position of the frame in the stream, so the
+ * receivers follow the clock of the sound card too.
+ *
+ * Sending to a multicast group costs the same for one receiver as for
+ * any number of them.
+ *
+ * @author Amirhossein Etaati
+ * @date 2023-04-16
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "networkOutput.h"
+#include "audio_player.h"
+#include "metrics.h"
+
+// Frames the ring holds, a power of two (170 ms)
+#define BUFFER_FRAMES 8192
+#define PACKET_FRAMES (SAMPLE_RATE * NETWORK_OUTPUT_PACKET_MS / 1000)
+#define RTP_HEADER_SIZE 12
+#define RTP_VERSION 2
+#define PACKET_MAX_SIZE (RTP_HEADER_SIZE + PACKET_FRAMES * NUM_CHANNELS * SAMPLE_SIZE)
+// Time between checks for the end of the stream while nothing is played
+#define WAIT_MS 100
+
+// Weight of a new difference in the jitter (RFC 3550, section 6.4.1)
+#define JITTER_DIVISOR 16
+
+// G.711 mu-law: added to the magnitude so every segment starts on a power of two
+#define MU_LAW_BIAS 0x84
+#define MU_LAW_CLIP 32635
+
+#define FRAMES_TO_US(frames) ((frames) * 1000000LL / SAMPLE_RATE)
+
+static pthread_t networkOutputThreadId;
+static bool stoppingOutput = false;
+static bool is_module_initialized = false;
+// serializes starting and stopping
+static pthread_mutex_t controlMutex = PTHREAD_MUTEX_INITIALIZER;
+static char sdp_path[256];
+static int output_fd = -1;
+
+// used by the sending thread only
+static unsigned char packet[PACKET_MAX_SIZE];
+static uint16_t sequence;
+static uint32_t first_timestamp;
+static uint32_t ssrc;
+static long long previous_send_us;
+static int64_t previous_send_position;
+static double jitter_us;
+
+// protected by outputMutex
+static pthread_mutex_t outputMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t framesStored = PTHREAD_COND_INITIALIZER;
+static short ring[BUFFER_FRAMES * NUM_CHANNELS];
+static int64_t read_position;  // frame sent next
+static int64_t write_end;      // end of the frames played
+static int64_t anchor_position; // first frame of the latest buffer played,
+static long long anchor_us;     // and when the sound card took it
+static networkOutput_stats_t stats;
+
+// Metrics, see metrics.h
+static metrics_gauge_t sending_metric;
+static metrics_counter_t packets_metric;
+static metrics_counter_t bytes_metric;
+static metrics_counter_t errors_metric;
+static metrics_counter_t overruns_metric;
+static metrics_gauge_t jitter_metric;
+
+// Private functions definitions
+static void stopOutput(void);
+static void *networkOutputThread(void *arg);
+static void storeFrames(const short *buffer, int numSamples);
+static void sendPacket(int64_t position, long long due_us);
+static void writeSessionDescription(const char *group, int port);
+static unsigned char encodeMuLaw(int sample);
+static void writeBigEndian(unsigned char *bytes, uint32_t value, int size);
+static uint32_t getRandom(void);
+static void collectMetrics(void);
+static long long getTimeInUs(void);
+
+//------------------------------------------------
+//////////////// Public Functions ////////////////
+//------------------------------------------------
+
+void networkOutput_init(const char *sdp_file)
+{
+    snprintf(sdp_path, sizeof(sdp_path), "%s", sdp_file);
+    metrics_registerGauge(&sending_metric, "beaglepod_output_sending", NULL,
+                          "1 while the audio played is sent to a multicast group");
+    metrics_registerCounter(&packets_metric, "beaglepod_output_packets_total", NULL,
+                            "RTP packets sent since the output started");
+    metrics_registerCounter(&bytes_metric, "beaglepod_output_bytes_total", NULL,
+                            "Bytes sent since the output started, RTP headers included");
+    metrics_registerCounter(&errors_metric, "beaglepod_output_errors_total", NULL, "Packets the network refused");
+    metrics_registerCounter(&overruns_metric, "beaglepod_output_overruns_total", NULL,
+                            "Frames dropped because the sending fell behind the playback");
+    metrics_registerGauge(&jitter_metric, "beaglepod_output_jitter_us", NULL,
+                          "Jitter of the send times against the timestamps");
+    metrics_registerCollector(collectMetrics);
+    is_module_initialized = true;
+}
+
+void networkOutput_cleanup(void)
+{
+    if (!is_module_initialized)
+    {
+        return;
+    }
+    networkOutput_stop();
+    is_module_initialized = false;
+}
+
+bool networkOutput_start(const char *group, int port, bool compressed)
+{
+    struct sockaddr_in sin;
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(port);
+    if (inet_pton(AF_INET, group, &sin.sin_addr) != 1 || !IN_MULTICAST(ntohl(sin.sin_addr.s_addr)))
+    {
+        fprintf(stderr, "ERROR: %s is not an IPv4 multicast group.\n", group);
+        return false;
+    }
+
+    pthread_mutex_lock(&controlMutex);
+    stopOutput();
+    int fd = socket(PF_INET, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    unsigned char ttl = NETWORK_OUTPUT_TTL;
+    // receivers on this BeaglePod get the stream as well
+    unsigned char loop = 1;
+    if (fd < 0 || setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) != 0 ||
+        setsockopt(fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) != 0 ||
+        connect(fd, (struct sockaddr *)&sin, sizeof(sin)) != 0)
+    {
+        fprintf(stderr, "ERROR: Unable to send audio to %s:%d.\n", group, port);
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        pthread_mutex_unlock(&controlMutex);
+        return false;
+    }
+
+    output_fd = fd;
+    sequence = getRandom();
+    first_timestamp = getRandom();
+    ssrc = getRandom();
+    previous_send_us = 0;
+    jitter_us = 0;
+    pthread_mutex_lock(&outputMutex);
+    read_position = write_end = anchor_position = 0;
+    anchor_us = 0;
+    memset(&stats, 0, sizeof(stats));
+    stats.sending = true;
+    stats.compressed = compressed;
+    pthread_mutex_unlock(&outputMutex);
+    writeSessionDescription(group, port);
+
+    stoppingOutput = false;
+    pthread_create(&networkOutputThreadId, NULL, networkOutputThread, NULL);
+    AudioPlayer_setSink(storeFrames);
+    pthread_mutex_unlock(&controlMutex);
+    return true;
+}
+
+void networkOutput_stop(void)
+{
+    pthread_mutex_lock(&controlMutex);
+    stopOutput();
+    pthread_mutex_unlock(&controlMutex);
+}
+
+void networkOutput_getStats(networkOutput_stats_t *stats_out)
+{
+    pthread_mutex_lock(&outputMutex);
+    *stats_out = stats;
+    pthread_mutex_unlock(&outputMutex);
+}
+
+//------------------------------------------------
+/////////////// Private Functions ////////////////
+//------------------------------------------------
+
+// Note: caller must hold controlMutex
+static void stopOutput(void)
+{
+    if (output_fd < 0)
+    {
+        return;
+    }
+    AudioPlayer_setSink(NULL);
+    pthread_mutex_lock(&outputMutex);
+    __atomic_store_n(&stoppingOutput, true, __ATOMIC_RELEASE);
+    pthread_cond_signal(&framesStored);
+    pthread_mutex_unlock(&outputMutex);
+    pthread_join(networkOutputThreadId, NULL);
+    close(output_fd);
+    output_fd = -1;
+
+    pthread_mutex_lock(&outputMutex);
+    stats.sending = false;
+    pthread_mutex_unlock(&outputMutex);
+}
+
+static void *networkOutputThread(void *arg)
+{
+    pthread_mutex_lock(&outputMutex);
+    while (!__atomic_load_n(&stoppingOutput, __ATOMIC_ACQUIRE))
+    {
+        if (write_end - read_position < PACKET_FRAMES)
+        {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += WAIT_MS * 1000000L;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+            deadline.tv_nsec %= 1000000000L;
+            pthread_cond_timedwait(&framesStored, &outputMutex, &deadline);
+            continue;
+        }
+        // the packet is due when the sound card plays it, counted from when it took the buffer
+        int64_t position = read_position;
+        long long due_us = anchor_us + FRAMES_TO_US(position - anchor_position);
+        sendPacket(position, due_us);
+    }
+    pthread_mutex_unlock(&outputMutex);
+    return NULL;
+}
+
+// The sink of the audio player: keeps what was played for the sending thread
+static void storeFrames(const short *buffer, int numSamples)
+{
+    int frames = numSamples / NUM_CHANNELS;
+    long long now = getTimeInUs();
+    pthread_mutex_lock(&outputMutex);
+    for (int i = 0; i < frames; i++)
+    {
+        memcpy(&ring[((write_end + i) & (BUFFER_FRAMES - 1)) * NUM_CHANNELS], &buffer[i * NUM_CHANNELS],
+               NUM_CHANNELS * SAMPLE_SIZE);
+    }
+    anchor_position = write_end;
+    anchor_us = now;
+    write_end += frames;
+    if (write_end - read_position > BUFFER_FRAMES)
+    {
+        // the oldest frames were overwritten before they were sent
+        stats.overruns += write_end - BUFFER_FRAMES - read_position;
+        read_position = write_end - BUFFER_FRAMES;
+    }
+    pthread_cond_signal(&framesStored);
+    pthread_mutex_unlock(&outputMutex);
+}
+
+// Sends the packet starting at frame "position" once it is "due_us"
+// Note: caller must hold outputMutex, which is released while waiting and sending
+static void sendPacket(int64_t position, long long due_us)
+{
+    bool compressed = stats.compressed;
+    unsigned char *payload = packet + RTP_HEADER_SIZE;
+    for (int i = 0; i < PACKET_FRAMES; i++)
+    {
+        const short *frame = &ring[((position + i) & (BUFFER_FRAMES - 1)) * NUM_CHANNELS];
+        for (int channel = 0; channel < NUM_CHANNELS; channel++)
+        {
+            if (compressed)
+            {
+                *payload++ = encodeMuLaw(frame[channel]);
+            }
+            else
+            {
+                writeBigEndian(payload, (uint16_t)frame[channel], 2);
+                payload += 2;
+            }
+        }
+    }
+    read_position = position + PACKET_FRAMES;
+    pthread_mutex_unlock(&outputMutex);
+
+    packet[0] = RTP_VERSION << 6;
+    packet[1] = compressed ? NETWORK_OUTPUT_PCMU_PAYLOAD_TYPE : NETWORK_OUTPUT_L16_PAYLOAD_TYPE;
+    writeBigEndian(packet + 2, sequence++, 2);
+    writeBigEndian(packet + 4, first_timestamp + (uint32_t)position, 4);
+    writeBigEndian(packet + 8, ssrc, 4);
+
+    long long now = getTimeInUs();
+    // never longer than a packet, the sound card took the buffer before the packet is due
+    due_us = (due_us > now + FRAMES_TO_US(PACKET_FRAMES)) ? now + FRAMES_TO_US(PACKET_FRAMES) : due_us;
+    if (due_us > now)
+    {
+        struct timespec wait = {.tv_sec = (due_us - now) / 1000000, .tv_nsec = (due_us - now) % 1000000 * 1000};
+        nanosleep(&wait, NULL);
+        now = getTimeInUs();
+    }
+    size_t size = payload - packet;
+    bool sent = send(output_fd, packet, size, 0) == (ssize_t)size;
+
+    // how regular the packets leave, as a receiver next to the BeaglePod would measure it
+    if (previous_send_us != 0)
+    {
+        long long difference = (now - previous_send_us) - FRAMES_TO_US(position - previous_send_position);
+        difference = (difference < 0) ? -difference : difference;
+        jitter_us += (difference - jitter_us) / JITTER_DIVISOR;
+    }
+    previous_send_us = now;
+    previous_send_position = position;
+
+    pthread_mutex_lock(&outputMutex);
+    if (sent)
+    {
+        stats.packets++;
+        stats.bytes += size;
+    }
+    else
+    {
+        stats.errors++;
+    }
+    stats.jitter_us = jitter_us;
+}
+
+// Writes the session description receivers open to play the stream
+static void writeSessionDescription(const char *group, int port)
+{
+    FILE *file = fopen(sdp_path, "w");
+    if (file == NULL)
+    {
+        fprintf(stderr, "networkOutput: Unable to write the session description to %s.\n", sdp_path);
+        return;
+    }
+    bool compressed = stats.compressed;
+    int payload_type = compressed ? NETWORK_OUTPUT_PCMU_PAYLOAD_TYPE : NETWORK_OUTPUT_L16_PAYLOAD_TYPE;
+    fprintf(file, "v=0\r\n");
+    fprintf(file, "o=- %u 1 IN IP4 0.0.0.0\r\n", ssrc);
+    fprintf(file, "s=BeaglePod\r\n");
+    fprintf(file, "c=IN IP4 %s/%d\r\n", group, NETWORK_OUTPUT_TTL);
+    fprintf(file, "t=0 0\r\n");
+    fprintf(file, "m=audio %d RTP/AVP %d\r\n", port, payload_type);
+    fprintf(file, "a=rtpmap:%d %s/%d/%d\r\n", payload_type, compressed ? "PCMU" : "L16", SAMPLE_RATE, NUM_CHANNELS);
+    fprintf(file, "a=ptime:%d\r\n", NETWORK_OUTPUT_PACKET_MS);
+    fprintf(file, "a=recvonly\r\n");
+    fclose(file);
+}
+
+// G.711 mu-law of a 16 bit sample
+static unsigned char encodeMuLaw(int sample)
+{
+    int sign = (sample < 0) ? 0x80 : 0;
+    int magnitude = (sample < 0) ? -sample : sample;
+    magnitude = (magnitude > MU_LAW_CLIP) ? MU_LAW_CLIP : magnitude;
+    magnitude += MU_LAW_BIAS;
+    int exponent = 7;
+    for (int mask = 0x4000; (magnitude & mask) == 0 && exponent > 0; mask >>= 1)
+    {
+        exponent--;
+    }
+    int mantissa = (magnitude >> (exponent + 3)) & 0x0f;
+    return ~(sign | (exponent << 4) | mantissa);
+}
+
+static void writeBigEndian(unsigned char *bytes, uint32_t value, int size)
+{
+    for (int i = size - 1; i >= 0; i--)
+    {
+        bytes[i] = value & 0xff;
+        value >>= 8;
+    }
+}
+
+// Random starting values of the stream (RFC 3550, section 5.1)
+static uint32_t getRandom(void)
+{
+    uint32_t value = (uint32_t)time(NULL) ^ ((uint32_t)getpid() << 16) ^ (uint32_t)getTimeInUs();
+    int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    if (fd >= 0)
+    {
+        if (read(fd, &value, sizeof(value)) != sizeof(value))
+        {
+            value ^= (uint32_t)getTimeInUs();
+        }
+        close(fd);
+    }
+    return value;
+}
+
+static void collectMetrics(void)
+{
+    networkOutput_stats_t current;
+    networkOutput_getStats(&current);
+    metrics_set(&sending_metric, current.sending);
+    metrics_setCounter(&packets_metric, current.packets);
+    metrics_setCounter(&bytes_metric, current.bytes);
+    metrics_setCounter(&errors_metric, current.errors);
+    metrics_setCounter(&overruns_metric, current.overruns);
+    metrics_set(&jitter_metric, current.jitter_us);
+}
+
+static long long getTimeInUs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
@@ -0,0 +1,60 @@
+/**
+ * @file networkOutput.h
+ * @brief This is a header file for the networkOutput module.
+ *
+ * This header file contains the definitions of the functions
+ * for the networkOutput module, which sends what the BeaglePod plays
+ * to a multicast group as RTP (RFC 3550), so any number of receivers on
+ * the local network can play along for the cost of a single stream.
+ *
+ * The samples are sent at 48 kHz in stereo, either as L16 (RFC 3551,
+ * payload type NETWORK_OUTPUT_L16_PAYLOAD_TYPE) or, at half the rate, as
+ * G.711 mu-law (payload type NETWORK_OUTPUT_PCMU_PAYLOAD_TYPE). Both
+ * types are dynamic: receivers learn them from the session description
+ * (RFC 4566) written to the file given to networkOutput_init(), e.g.
+ *   ffplay -protocol_whitelist file,udp,rtp beaglepod.sdp
+ *
+ * @author Amirhossein Etaati
+ * @date 2023-04-16
+ */
+
+#if !defined(NETWORK_OUTPUT_H)
+#define NETWORK_OUTPUT_H
+
+#include <stdbool.h>
+
+#define NETWORK_OUTPUT_DEFAULT_PORT 5004
+#define NETWORK_OUTPUT_DEFAULT_SDP_FILE "/mnt/remote/myApps/beaglepod.sdp"
+// Routers the packets go through, 1 keeps them on the local network
+#define NETWORK_OUTPUT_TTL 1
+// Audio in each packet
+#define NETWORK_OUTPUT_PACKET_MS 5
+#define NETWORK_OUTPUT_L16_PAYLOAD_TYPE 96
+#define NETWORK_OUTPUT_PCMU_PAYLOAD_TYPE 97
+
+typedef struct
+{
+    bool sending;
+    bool compressed;    // mu-law instead of L16
+    long long packets;
+    long long bytes;    // RTP headers included
+    long long errors;   // packets the network refused
+    long long overruns; // frames dropped because the sending fell behind the playback
+    int jitter_us;      // of the send times against the timestamps (RFC 3550, section 6.4.1)
+} networkOutput_stats_t;
+
+// "sdp_file" is where the session description of the stream is written
+// Note: the audio player must be initialized first
+void networkOutput_init(const char *sdp_file);
+
+void networkOutput_cleanup(void);
+
+// Sends what is played to the multicast "group" (an IPv4 address) on "port", as mu-law if "compressed"
+// Returns false if the stream cannot be sent there
+bool networkOutput_start(const char *group, int port, bool compressed);
+
+void networkOutput_stop(void);
+
+void networkOutput_getStats(networkOutput_stats_t *stats);
+
+#endif // NETWORK_OUTPUT_H
@@ -0,0 +1,505 @@
+/**
+ * @file playOrder.c
+ * @brief This is a source file for the playOrder module.
+ *
+ * This source file contains the declaration of the functions
+ * for the playOrder module, which decides which song of the
+ * library plays next or previous (in order, shuffled or repeated).
+ *
+ * The order is kept as a permutation of the positions of the songs being
+ * played (the library or the active playlist), together
+ * with its inverse, so next/previous are array lookups. The permutation
+ * (Fisher-Yates when shuffling) is only regenerated when the library or
+ * the mode changes, and only once the next song is actually requested.
+ * A song named by its id (the one playing, or one in the history) is
+ * found through a map of the ids to the positions, built on the first
+ * lookup after a change and kept until the next one. The history keeps
+ * the position each song had too, so the map is only needed once songs
+ * moved.
+ *
+ * @author Mehdi Esmaeilzadeh
+ * @date 2023-04-02
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "playOrder.h"
+#include "songManager.h"
+#include "hashMap.h"
+
+// How far ahead the artist spread looks for a song by a different artist
+#define ARTIST_SPREAD_WINDOW 16
+
+typedef struct
+{
+    song_id_t id;
+    int idx; // its position when it was played
+} history_entry_t;
+
+static pthread_mutex_t playOrderMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static bool shuffle = false;
+static bool artist_spread = false;
+static REPEAT_MODE repeat_mode = REPEAT_OFF;
+
+// order[pos] = song position, position_of[song position] = pos
+static int *order = NULL;
+static int *position_of = NULL;
+static int order_capacity = 0;
+static int order_size = 0;
+static bool order_dirty = true;
+// the position of each song id plus one, valid while positions_mapped: until what is being played changes
+static hashMap_t *position_by_id = NULL;
+static bool positions_mapped = false;
+
+// position in "order" and song position of the song currently playing (-1 if none)
+static int cursor = -1;
+static int current_idx = -1;
+// song to continue from, looked up into current_idx by the next regenerate()
+static song_id_t playing_id = SONG_ID_INVALID;
+
+// ring buffer of the previously played songs
+static history_entry_t history[PLAY_ORDER_HISTORY_SIZE];
+static int history_head = 0;
+static int history_count = 0;
+
+static uint32_t rng_state = 1;
+
+// Private functions definitions
+static void setCurrent(int idx);
+static void regenerate(void);
+static void mapPositions(void);
+static int findPosition(song_id_t id);
+static void spreadArtists(void);
+static bool sameArtist(int idx1, int idx2);
+static void swapPositions(int pos1, int pos2);
+static uint32_t randomBelow(uint32_t bound);
+static void historyPush(int idx);
+static int historyPop(void);
+
+//------------------------------------------------
+//////////////// Public Functions ////////////////
+//------------------------------------------------
+
+void playOrder_init(void)
+{
+    rng_state = (uint32_t)time(NULL) ^ ((uint32_t)getpid() << 16);
+    if (rng_state == 0)
+    {
+        rng_state = 1;
+    }
+    order_dirty = true;
+    cursor = -1;
+    current_idx = -1;
+    playing_id = SONG_ID_INVALID;
+    history_count = 0;
+}
+
+void playOrder_cleanup(void)
+{
+    pthread_mutex_lock(&playOrderMutex);
+    free(order);
+    free(position_of);
+    hashMap_destroy(position_by_id);
+    order = NULL;
+    position_of = NULL;
+    position_by_id = NULL;
+    positions_mapped = false;
+    order_capacity = 0;
+    order_size = 0;
+    pthread_mutex_unlock(&playOrderMutex);
+}
+
+void playOrder_setShuffle(bool enabled)
+{
+    pthread_mutex_lock(&playOrderMutex);
+    if (shuffle != enabled)
+    {
+        shuffle = enabled;
+        order_dirty = true;
+    }
+    pthread_mutex_unlock(&playOrderMutex);
+}
+
+bool playOrder_isShuffle(void)
+{
+    return shuffle;
+}
+
+void playOrder_setRepeatMode(REPEAT_MODE mode)
+{
+    if (mode >= 0 && mode < NUM_REPEAT_MODES)
+    {
+        repeat_mode = mode;
+    }
+}
+
+REPEAT_MODE playOrder_getRepeatMode(void)
+{
+    return repeat_mode;
+}
+
+void playOrder_setArtistSpread(bool enabled)
+{
+    pthread_mutex_lock(&playOrderMutex);
+    if (artist_spread != enabled)
+    {
+        artist_spread = enabled;
+        order_dirty = order_dirty || shuffle;
+    }
+    pthread_mutex_unlock(&playOrderMutex);
+}
+
+bool playOrder_isArtistSpread(void)
+{
+    return artist_spread;
+}
+
+void playOrder_invalidate(song_id_t id)
+{
+    pthread_mutex_lock(&playOrderMutex);
+    order_dirty = true;
+    current_idx = -1;
+    playing_id = id;
+    positions_mapped = false;
+    pthread_mutex_unlock(&playOrderMutex);
+}
+
+void playOrder_setCurrent(int idx)
+{
+    pthread_mutex_lock(&playOrderMutex);
+    if (order_dirty)
+    {
+        regenerate();
+    }
+    setCurrent(idx);
+    pthread_mutex_unlock(&playOrderMutex);
+}
+
+void playOrder_setCurrentById(song_id_t id)
+{
+    pthread_mutex_lock(&playOrderMutex);
+    if (order_dirty)
+    {
+        regenerate();
+    }
+    setCurrent(findPosition(id));
+    pthread_mutex_unlock(&playOrderMutex);
+}
+
+int playOrder_next(void)
+{
+    pthread_mutex_lock(&playOrderMutex);
+    if (order_dirty)
+    {
+        regenerate();
+    }
+    if (order_size == 0)
+    {
+        pthread_mutex_unlock(&playOrderMutex);
+        return -1;
+    }
+    if (repeat_mode == REPEAT_ONE && current_idx >= 0)
+    {
+        int idx = current_idx;
+        pthread_mutex_unlock(&playOrderMutex);
+        return idx;
+    }
+
+    int next_pos = cursor + 1;
+    if (next_pos >= order_size)
+    {
+        if (repeat_mode != REPEAT_ALL)
+        {
+            pthread_mutex_unlock(&playOrderMutex);
+            return -1;
+        }
+        if (shuffle)
+        {
+            // new cycle: reshuffle with the song that just finished in front so it is not repeated
+            regenerate();
+            next_pos = (order_size > 1) ? cursor + 1 : 0;
+        }
+        else
+        {
+            next_pos = 0;
+        }
+    }
+
+    if (current_idx >= 0)
+    {
+        historyPush(current_idx);
+    }
+    cursor = next_pos;
+    current_idx = order[cursor];
+    int idx = current_idx;
+    pthread_mutex_unlock(&playOrderMutex);
+    return idx;
+}
+
+int playOrder_previous(void)
+{
+    pthread_mutex_lock(&playOrderMutex);
+    if (order_dirty)
+    {
+        regenerate();
+    }
+
+    int idx = historyPop();
+    if (idx >= 0 && idx < order_size)
+    {
+        cursor = position_of[idx];
+        current_idx = idx;
+    }
+    else if (cursor > 0)
+    {
+        cursor--;
+        current_idx = order[cursor];
+        idx = current_idx;
+    }
+    else
+    {
+        idx = -1;
+    }
+    pthread_mutex_unlock(&playOrderMutex);
+    return idx;
+}
+
+//------------------------------------------------
+/////////////// Private Functions ////////////////
+//------------------------------------------------
+
+// Makes the song at "idx" the one playing, unless it is not being played
+// Note: caller must hold playOrderMutex, with the order regenerated
+static void setCurrent(int idx)
+{
+    if (idx < 0 || idx >= order_size)
+    {
+        return;
+    }
+    if (current_idx >= 0 && current_idx != idx)
+    {
+        historyPush(current_idx);
+    }
+
+    int pos = position_of[idx];
+    if (shuffle && pos > cursor + 1)
+    {
+        // keep the songs not played yet in this shuffle after the picked one
+        swapPositions(pos, cursor + 1);
+        pos = cursor + 1;
+    }
+    cursor = pos;
+    current_idx = idx;
+}
+
+// Rebuilds the permutation for the current library size and mode
+// Note: caller must hold playOrderMutex
+static void regenerate(void)
+{
+    int size = songManager_getNumberSongs();
+    if (size > order_capacity)
+    {
+        int new_capacity = order_capacity ? order_capacity : 16;
+        while (new_capacity < size)
+        {
+            new_capacity *= 2;
+        }
+        int *new_order = realloc(order, new_capacity * sizeof(*order));
+        int *new_position_of = realloc(position_of, new_capacity * sizeof(*position_of));
+        if (new_order == NULL || new_position_of == NULL)
+        {
+            fprintf(stderr, "%s\n", "playOrder_regenerate(): Error - There was a problem allocating memory.");
+            exit(1);
+        }
+        order = new_order;
+        position_of = new_position_of;
+        order_capacity = new_capacity;
+    }
+    order_size = size;
+
+    if (playing_id != SONG_ID_INVALID)
+    {
+        current_idx = findPosition(playing_id);
+        playing_id = SONG_ID_INVALID;
+    }
+    if (current_idx >= size)
+    {
+        current_idx = -1;
+    }
+
+    for (int i = 0; i < size; i++)
+    {
+        order[i] = i;
+    }
+
+    if (shuffle && size > 1)
+    {
+        // Fisher-Yates
+        for (int i = size - 1; i > 0; i--)
+        {
+            int j = randomBelow(i + 1);
+            int temp = order[i];
+            order[i] = order[j];
+            order[j] = temp;
+        }
+        // the song that is playing starts the new order
+        if (current_idx >= 0)
+        {
+            for (int i = 0; i < size; i++)
+            {
+                if (order[i] == current_idx)
+                {
+                    order[i] = order[0];
+                    order[0] = current_idx;
+                    break;
+                }
+            }
+        }
+        if (artist_spread)
+        {
+            spreadArtists();
+        }
+    }
+
+    for (int i = 0; i < size; i++)
+    {
+        position_of[order[i]] = i;
+    }
+
+    cursor = (current_idx >= 0) ? position_of[current_idx] : -1;
+    order_dirty = false;
+}
+
+// Maps the ids of the songs being played to their positions
+// Note: caller must hold playOrderMutex
+static void mapPositions(void)
+{
+    hashMap_destroy(position_by_id);
+    position_by_id = hashMap_create(order_size);
+    songManager_readLock();
+    // backwards, so a song in a playlist twice is found at its first position
+    for (int i = order_size - 1; i >= 0; i--)
+    {
+        song_info *song = songManager_getSongAt(i);
+        if (song != NULL)
+        {
+            hashMap_put(position_by_id, song->id, (void *)(intptr_t)(i + 1));
+        }
+    }
+    songManager_readUnlock();
+    positions_mapped = true;
+}
+
+// Returns the position of the song with "id" in what is being played, -1 if it is not in it
+// Note: caller must hold playOrderMutex, with the order regenerated; O(1) but for the first call after a change
+static int findPosition(song_id_t id)
+{
+    if (!positions_mapped)
+    {
+        mapPositions();
+    }
+    void *position = hashMap_get(position_by_id, id);
+    return (position != NULL) ? (int)(intptr_t)position - 1 : -1;
+}
+
+// Swaps songs forward so that two consecutive songs in the order have different artists
+// whenever one can be found within ARTIST_SPREAD_WINDOW positions
+static void spreadArtists(void)
+{
+    for (int i = 1; i < order_size; i++)
+    {
+        if (!sameArtist(order[i - 1], order[i]))
+        {
+            continue;
+        }
+        int last = i + ARTIST_SPREAD_WINDOW;
+        if (last > order_size)
+        {
+            last = order_size;
+        }
+        for (int j = i + 1; j < last; j++)
+        {
+            if (!sameArtist(order[i - 1], order[j]))
+            {
+                int temp = order[i];
+                order[i] = order[j];
+                order[j] = temp;
+                break;
+            }
+        }
+    }
+}
+
+static bool sameArtist(int idx1, int idx2)
+{
+    songManager_readLock();
+    song_info *song1 = songManager_getSongAt(idx1);
+    song_info *song2 = songManager_getSongAt(idx2);
+    bool same = song1 != NULL && song2 != NULL && strcmp(song1->author_name, song2->author_name) == 0;
+    songManager_readUnlock();
+    return same;
+}
+
+static void swapPositions(int pos1, int pos2)
+{
+    int temp = order[pos1];
+    order[pos1] = order[pos2];
+    order[pos2] = temp;
+    position_of[order[pos1]] = pos1;
+    position_of[order[pos2]] = pos2;
+}
+
+// xorshift32, mapped to [0, bound) without division
+static uint32_t randomBelow(uint32_t bound)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return (uint32_t)(((uint64_t)rng_state * bound) >> 32);
+}
+
+// Note: caller must hold playOrderMutex, with the order regenerated
+static void historyPush(int idx)
+{
+    songManager_readLock();
+    song_info *song = songManager_getSongAt(idx);
+    song_id_t id = (song != NULL) ? song->id : SONG_ID_INVALID;
+    songManager_readUnlock();
+    if (id == SONG_ID_INVALID)
+    {
+        return;
+    }
+    history[history_head] = (history_entry_t){.id = id, .idx = idx};
+    history_head = (history_head + 1) % PLAY_ORDER_HISTORY_SIZE;
+    if (history_count < PLAY_ORDER_HISTORY_SIZE)
+    {
+        history_count++;
+    }
+}
+
+// Returns the position of the last song played that is still being played, -1 if there is none
+// Note: caller must hold playOrderMutex, with the order regenerated
+static int historyPop(void)
+{
+    int idx = -1;
+    while (idx < 0 && history_count > 0)
+    {
+        history_head = (history_head + PLAY_ORDER_HISTORY_SIZE - 1) % PLAY_ORDER_HISTORY_SIZE;
+        history_count--;
+        const history_entry_t *entry = &history[history_head];
+        songManager_readLock();
+        song_info *song = songManager_getSongAt(entry->idx);
+        bool moved = song == NULL || song->id != entry->id;
+        songManager_readUnlock();
+        // the songs removed since are dropped
+        idx = moved ? findPosition(entry->id) : entry->idx;
+    }
+    return idx;
+}
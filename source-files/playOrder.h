@@ -0,0 +1,72 @@
+/**
+ * @file playOrder.h
+ * @brief This is a header file for the playOrder module.
+ *
+ * This header file contains the definitions of the functions
+ * for the playOrder module, which decides which song of the
+ * library plays next or previous (in order, shuffled or repeated).
+ *
+ * Songs are referred to by their position in what is being played,
+ * see songManager_getSongAt(), except across a change of what is being
+ * played: positions shift then, so the song playing is named by its id.
+ *
+ * @author Mehdi Esmaeilzadeh
+ * @date 2023-04-02
+ */
+
+#if !defined(PLAY_ORDER_H)
+#define PLAY_ORDER_H
+
+#include <stdbool.h>
+
+#include "songManager.h"
+
+// Number of previously played songs remembered for "previous", by id so they survive changes of the library
+#define PLAY_ORDER_HISTORY_SIZE 32
+
+typedef enum
+{
+  REPEAT_OFF,
+  REPEAT_ALL,
+  REPEAT_ONE,
+  NUM_REPEAT_MODES
+} REPEAT_MODE;
+
+// Initializes the module. Shuffle, repeat and artist spread start disabled
+void playOrder_init(void);
+
+// Frees the memory used for the play order
+void playOrder_cleanup(void);
+
+// Turns shuffle on/off. The new order is generated lazily on the next request
+void playOrder_setShuffle(bool enabled);
+bool playOrder_isShuffle(void);
+
+void playOrder_setRepeatMode(REPEAT_MODE mode);
+REPEAT_MODE playOrder_getRepeatMode(void);
+
+// When enabled, the shuffle avoids playing two songs by the same artist back to back
+void playOrder_setArtistSpread(bool enabled);
+bool playOrder_isArtistSpread(void);
+
+// Must be called whenever songs are added to or removed from what is being played
+// "playing_id" is the song to continue from after the change (SONG_ID_INVALID if none)
+// Note: O(1), its position is only looked up once the next song is requested.
+// The play history is kept, songs that were removed are skipped by playOrder_previous()
+void playOrder_invalidate(song_id_t playing_id);
+
+// Tells the module that the song at position "idx" was picked by the user
+void playOrder_setCurrent(int idx);
+
+// Same as playOrder_setCurrent(), for the song with "id"; nothing happens if it is not being played
+// Note: O(1) except for the first lookup by id after what is being played changed
+void playOrder_setCurrentById(song_id_t id);
+
+// Returns the position of the next song to play, or -1 if playback should stop
+// Note: O(1) except for the first call after the library or the mode changed
+int playOrder_next(void);
+
+// Returns the position of the previously played song, or -1 if there is none
+int playOrder_previous(void);
+
+#endif // PLAY_ORDER_H
@@ -0,0 +1,196 @@
+/**
+ * @file playQueue.c
+ * @brief This is a source file for the playQueue module.
+ *
+ * This source file contains the declaration of the functions
+ * for the playQueue module, which keeps the "Up Next" songs that
+ * play before the play order (see playOrder.h) continues.
+ *
+ * The queue is a deque stored in a fixed ring buffer: adding and taking
+ * at either end is O(1) and never allocates. Songs are stored by id, so
+ * a song deleted from the library is simply skipped when it comes up.
+ *
+ * @author Mehdi Esmaeilzadeh
+ * @date 2023-04-09
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "playQueue.h"
+
+#define RING_MASK (PLAY_QUEUE_CAPACITY - 1)
+
+static pthread_mutex_t playQueueMutex = PTHREAD_MUTEX_INITIALIZER;
+static song_id_t ring[PLAY_QUEUE_CAPACITY];
+static int head = 0; // ring slot of the front of the queue
+static int size = 0;
+static bool changed = false;
+
+// Private functions definitions
+static song_id_t *slotAt(int position);
+
+//------------------------------------------------
+//////////////// Public Functions ////////////////
+//------------------------------------------------
+
+void playQueue_init(void)
+{
+    playQueue_clear();
+}
+
+void playQueue_cleanup(void)
+{
+    playQueue_clear();
+}
+
+bool playQueue_pushFront(song_id_t id)
+{
+    pthread_mutex_lock(&playQueueMutex);
+    bool added = size < PLAY_QUEUE_CAPACITY;
+    if (added)
+    {
+        head = (head - 1) & RING_MASK;
+        ring[head] = id;
+        size++;
+        changed = true;
+    }
+    pthread_mutex_unlock(&playQueueMutex);
+    return added;
+}
+
+bool playQueue_pushBack(song_id_t id)
+{
+    pthread_mutex_lock(&playQueueMutex);
+    bool added = size < PLAY_QUEUE_CAPACITY;
+    if (added)
+    {
+        *slotAt(size) = id;
+        size++;
+        changed = true;
+    }
+    pthread_mutex_unlock(&playQueueMutex);
+    return added;
+}
+
+bool playQueue_popFront(song_id_t *id)
+{
+    pthread_mutex_lock(&playQueueMutex);
+    bool taken = size > 0;
+    if (taken)
+    {
+        *id = ring[head];
+        head = (head + 1) & RING_MASK;
+        size--;
+        changed = true;
+    }
+    pthread_mutex_unlock(&playQueueMutex);
+    return taken;
+}
+
+bool playQueue_move(int from, int to)
+{
+    pthread_mutex_lock(&playQueueMutex);
+    if (from < 0 || from >= size || to < 0 || to >= size)
+    {
+        pthread_mutex_unlock(&playQueueMutex);
+        return false;
+    }
+    song_id_t id = *slotAt(from);
+    int step = (to > from) ? 1 : -1;
+    for (int position = from; position != to; position += step)
+    {
+        *slotAt(position) = *slotAt(position + step);
+    }
+    *slotAt(to) = id;
+    changed = true;
+    pthread_mutex_unlock(&playQueueMutex);
+    return true;
+}
+
+bool playQueue_removeAt(int position)
+{
+    pthread_mutex_lock(&playQueueMutex);
+    if (position < 0 || position >= size)
+    {
+        pthread_mutex_unlock(&playQueueMutex);
+        return false;
+    }
+    // close the gap from the nearer end
+    if (position < size / 2)
+    {
+        for (int i = position; i > 0; i--)
+        {
+            *slotAt(i) = *slotAt(i - 1);
+        }
+        head = (head + 1) & RING_MASK;
+    }
+    else
+    {
+        for (int i = position; i < size - 1; i++)
+        {
+            *slotAt(i) = *slotAt(i + 1);
+        }
+    }
+    size--;
+    changed = true;
+    pthread_mutex_unlock(&playQueueMutex);
+    return true;
+}
+
+void playQueue_clear(void)
+{
+    pthread_mutex_lock(&playQueueMutex);
+    head = 0;
+    size = 0;
+    changed = true;
+    pthread_mutex_unlock(&playQueueMutex);
+}
+
+int playQueue_getSize(void)
+{
+    pthread_mutex_lock(&playQueueMutex);
+    int queue_size = size;
+    pthread_mutex_unlock(&playQueueMutex);
+    return queue_size;
+}
+
+song_id_t playQueue_getAt(int position)
+{
+    pthread_mutex_lock(&playQueueMutex);
+    song_id_t id = (position >= 0 && position < size) ? *slotAt(position) : SONG_ID_INVALID;
+    pthread_mutex_unlock(&playQueueMutex);
+    return id;
+}
+
+int playQueue_copyIds(song_id_t *ids, int max)
+{
+    pthread_mutex_lock(&playQueueMutex);
+    int copied = (size < max) ? size : max;
+    for (int i = 0; i < copied; i++)
+    {
+        ids[i] = *slotAt(i);
+    }
+    pthread_mutex_unlock(&playQueueMutex);
+    return copied;
+}
+
+bool playQueue_consumeChanged(void)
+{
+    pthread_mutex_lock(&playQueueMutex);
+    bool was_changed = changed;
+    changed = false;
+    pthread_mutex_unlock(&playQueueMutex);
+    return was_changed;
+}
+
+//------------------------------------------------
+/////////////// Private Functions ////////////////
+//------------------------------------------------
+
+// Note: caller must hold playQueueMutex
+static song_id_t *slotAt(int position)
+{
+    return &ring[(head + position) & RING_MASK];
+}
@@ -0,0 +1,61 @@
+/**
+ * @file playQueue.h
+ * @brief This is a header file for the playQueue module.
+ *
+ * This header file contains the definitions of the functions
+ * for the playQueue module, which keeps the "Up Next" songs that
+ * play before the play order (see playOrder.h) continues.
+ *
+ * @author Mehdi Esmaeilzadeh
+ * @date 2023-04-09
+ */
+
+#if !defined(PLAY_QUEUE_H)
+#define PLAY_QUEUE_H
+
+#include <stdbool.h>
+#include "songManager.h"
+
+// Maximum number of songs waiting in the queue (must be a power of two)
+#define PLAY_QUEUE_CAPACITY 256
+
+// Empties the queue
+// Note: caller should call playQueue_cleanup() when done
+void playQueue_init(void);
+
+void playQueue_cleanup(void);
+
+// Adds "id" to the front of the queue so it plays next
+// Returns false if the queue is full
+bool playQueue_pushFront(song_id_t id);
+
+// Adds "id" to the back of the queue
+// Returns false if the queue is full
+bool playQueue_pushBack(song_id_t id);
+
+// Takes the song at the front of the queue into "id"
+// Returns false if the queue is empty
+bool playQueue_popFront(song_id_t *id);
+
+// Moves the song at position "from" to position "to", shifting the songs in between
+// Returns false if a position is out of bounds
+bool playQueue_move(int from, int to);
+
+// Removes the song at "position"
+// Returns false if position is out of bounds
+bool playQueue_removeAt(int position);
+
+void playQueue_clear(void);
+
+int playQueue_getSize(void);
+
+// Returns the id at "position", SONG_ID_INVALID if position is out of bounds
+song_id_t playQueue_getAt(int position);
+
+// Copies up to "max" ids from the front of the queue into "ids" and returns how many were copied
+int playQueue_copyIds(song_id_t *ids, int max);
+
+// Returns true once after the queue changed, so the Up Next menu can be redrawn
+bool playQueue_consumeChanged(void);
+
+#endif // PLAY_QUEUE_H
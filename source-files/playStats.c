@@ -0,0 +1,570 @@
+/**
+ * @file playStats.c
+ * @brief This is a source file for the playStats module.
+ *
+ * This source file contains the declaration of the functions
+ * for the playStats module, which counts plays and skips of every
+ * song and keeps them across reboots in a compact binary log.
+ *
+ * Recording a play only copies a small event into a fixed ring; a
+ * background thread folds the events into the statistics table and
+ * appends the new totals of the songs that changed to the log with a
+ * single write. Each record holds the full totals of one song, so on
+ * startup the last record of a song wins and a torn record at the end
+ * of the log is simply cut off. Once the log holds many more records
+ * than songs it is rewritten with one record per song and renamed over
+ * the old one.
+ *
+ * The "most played" and "recently played" views are kept up to date as
+ * each event is applied instead of sorting the whole table: play counts
+ * only grow, so a song can only move up in the most played view.
+ *
+ * @author Mehdi Esmaeilzadeh
+ * @date 2023-04-10
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include "playStats.h"
+#include "hashMap.h"
+
+// Events waiting for the flush thread; events recorded while it is full are dropped
+#define EVENT_RING_SIZE 256
+#define EVENT_RING_MASK (EVENT_RING_SIZE - 1)
+// Time between flushes while events trickle in
+#define FLUSH_INTERVAL_S 2
+// The log is compacted once it holds this many records more than there are songs
+#define COMPACT_SLACK_RECORDS 4096
+
+#define LOG_MAGIC 0x54535042u // "BPST"
+#define LOG_VERSION 1u
+#define RECORD_CHECK_SEED 0x9e3779b9u
+
+typedef enum
+{
+    EVENT_PLAY,
+    EVENT_SKIP
+} event_type_t;
+
+typedef struct
+{
+    uint64_t song_key;
+    uint32_t time;
+    uint32_t type;
+} stats_event_t;
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+} log_header_t;
+
+// One song's totals as stored in the log (host byte order)
+typedef struct
+{
+    uint64_t song_key;
+    uint32_t plays;
+    uint32_t skips;
+    uint32_t last_played;
+    uint32_t check;
+} log_record_t;
+
+static pthread_t playStatsThreadId;
+static bool stoppingStats = false;
+static bool is_module_initialized = false;
+
+// the event ring is the only state shared with the playback path
+static pthread_mutex_t eventMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t eventCond = PTHREAD_COND_INITIALIZER;
+static stats_event_t events[EVENT_RING_SIZE];
+static unsigned int events_head = 0;
+static unsigned int events_count = 0;
+
+// statistics table and views, guarded by statsMutex
+static pthread_mutex_t statsMutex = PTHREAD_MUTEX_INITIALIZER;
+static playStats_entry_t entries[PLAY_STATS_MAX_SONGS];
+static bool entry_dirty[PLAY_STATS_MAX_SONGS];
+static int num_entries = 0;
+static hashMap_t *entries_by_key = NULL;
+static int most_played[PLAY_STATS_VIEW_SIZE]; // entry indices, most plays first
+static int num_most_played = 0;
+static int recently_played[PLAY_STATS_VIEW_SIZE]; // entry indices, latest first
+static int num_recently_played = 0;
+
+// log file, only touched by init, the flush thread and cleanup
+static char log_path[PATH_MAX];
+static int log_fd = -1;
+static unsigned int log_records = 0;
+static int dirty_indices[PLAY_STATS_MAX_SONGS];
+static int num_dirty = 0;
+static log_record_t record_buffer[PLAY_STATS_MAX_SONGS];
+
+// Private functions definitions
+static void *playStatsThread(void *arg);
+static void recordEvent(uint64_t song_key, event_type_t type);
+static void flushEvents(void);
+static void applyEvent(const stats_event_t *event);
+static int findOrAddEntry(uint64_t song_key);
+static void updateMostPlayed(int index);
+static void updateRecentlyPlayed(int index);
+static int copyView(const int *view, int view_size, playStats_entry_t *out, int max);
+static void loadLog(void);
+static bool writeRecords(int fd, const log_record_t *records, int count);
+static void compactLog(void);
+static uint32_t recordCheck(const log_record_t *record);
+
+//------------------------------------------------
+//////////////// Public Functions ////////////////
+//------------------------------------------------
+
+void playStats_init(const char *path)
+{
+    snprintf(log_path, sizeof(log_path), "%s", path);
+
+    entries_by_key = hashMap_create(PLAY_STATS_MAX_SONGS);
+    if (entries_by_key == NULL)
+    {
+        fprintf(stderr, "playStats_init: Error - There was a problem allocating memory.");
+        exit(1);
+    }
+    loadLog();
+
+    stoppingStats = false;
+    pthread_create(&playStatsThreadId, NULL, playStatsThread, NULL);
+    is_module_initialized = true;
+}
+
+void playStats_cleanup(void)
+{
+    if (!is_module_initialized)
+    {
+        return;
+    }
+    pthread_mutex_lock(&eventMutex);
+    stoppingStats = true;
+    pthread_cond_signal(&eventCond);
+    pthread_mutex_unlock(&eventMutex);
+    pthread_join(playStatsThreadId, NULL);
+
+    if (log_fd >= 0)
+    {
+        close(log_fd);
+        log_fd = -1;
+    }
+    hashMap_destroy(entries_by_key);
+    entries_by_key = NULL;
+    num_entries = 0;
+    num_most_played = 0;
+    num_recently_played = 0;
+    is_module_initialized = false;
+}
+
+void playStats_recordPlay(uint64_t song_key)
+{
+    recordEvent(song_key, EVENT_PLAY);
+}
+
+void playStats_recordSkip(uint64_t song_key)
+{
+    recordEvent(song_key, EVENT_SKIP);
+}
+
+bool playStats_get(uint64_t song_key, playStats_entry_t *entry)
+{
+    pthread_mutex_lock(&statsMutex);
+    playStats_entry_t *found = (entries_by_key != NULL) ? hashMap_get(entries_by_key, song_key) : NULL;
+    if (found != NULL)
+    {
+        *entry = *found;
+    }
+    pthread_mutex_unlock(&statsMutex);
+    return found != NULL;
+}
+
+int playStats_getMostPlayed(playStats_entry_t *out, int max)
+{
+    pthread_mutex_lock(&statsMutex);
+    int copied = copyView(most_played, num_most_played, out, max);
+    pthread_mutex_unlock(&statsMutex);
+    return copied;
+}
+
+int playStats_getRecentlyPlayed(playStats_entry_t *out, int max)
+{
+    pthread_mutex_lock(&statsMutex);
+    int copied = copyView(recently_played, num_recently_played, out, max);
+    pthread_mutex_unlock(&statsMutex);
+    return copied;
+}
+
+//------------------------------------------------
+/////////////// Private Functions ////////////////
+//------------------------------------------------
+
+static void recordEvent(uint64_t song_key, event_type_t type)
+{
+    uint32_t now = (uint32_t)time(NULL);
+    pthread_mutex_lock(&eventMutex);
+    if (events_count < EVENT_RING_SIZE)
+    {
+        stats_event_t *event = &events[(events_head + events_count) & EVENT_RING_MASK];
+        event->song_key = song_key;
+        event->time = now;
+        event->type = type;
+        events_count++;
+        // wake the flush thread early rather than let the ring fill up
+        if (events_count == EVENT_RING_SIZE / 2)
+        {
+            pthread_cond_signal(&eventCond);
+        }
+    }
+    pthread_mutex_unlock(&eventMutex);
+}
+
+static void *playStatsThread(void *arg)
+{
+    bool stopping = false;
+    while (!stopping)
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += FLUSH_INTERVAL_S;
+
+        pthread_mutex_lock(&eventMutex);
+        while (!stoppingStats && events_count < EVENT_RING_SIZE / 2)
+        {
+            if (pthread_cond_timedwait(&eventCond, &eventMutex, &deadline) == ETIMEDOUT)
+            {
+                break;
+            }
+        }
+        stopping = stoppingStats;
+        pthread_mutex_unlock(&eventMutex);
+
+        flushEvents();
+    }
+    return NULL;
+}
+
+// Applies the pending events and appends the songs that changed to the log
+static void flushEvents(void)
+{
+    static stats_event_t batch[EVENT_RING_SIZE];
+
+    pthread_mutex_lock(&eventMutex);
+    unsigned int num_events = events_count;
+    for (unsigned int i = 0; i < num_events; i++)
+    {
+        batch[i] = events[(events_head + i) & EVENT_RING_MASK];
+    }
+    events_head = (events_head + num_events) & EVENT_RING_MASK;
+    events_count = 0;
+    pthread_mutex_unlock(&eventMutex);
+
+    if (num_events == 0)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&statsMutex);
+    for (unsigned int i = 0; i < num_events; i++)
+    {
+        applyEvent(&batch[i]);
+    }
+    int num_records = num_dirty;
+    for (int i = 0; i < num_records; i++)
+    {
+        int index = dirty_indices[i];
+        log_record_t *record = &record_buffer[i];
+        record->song_key = entries[index].song_key;
+        record->plays = entries[index].plays;
+        record->skips = entries[index].skips;
+        record->last_played = entries[index].last_played;
+        record->check = recordCheck(record);
+        entry_dirty[index] = false;
+    }
+    num_dirty = 0;
+    int songs = num_entries;
+    pthread_mutex_unlock(&statsMutex);
+
+    // the disk is only touched outside of statsMutex so readers never wait on it
+    if (log_fd < 0)
+    {
+        return;
+    }
+    if (!writeRecords(log_fd, record_buffer, num_records))
+    {
+        fprintf(stderr, "ERROR: Unable to write play statistics to <%s>.\n", log_path);
+        return;
+    }
+    fdatasync(log_fd);
+    log_records += num_records;
+    if (log_records > (unsigned int)songs + COMPACT_SLACK_RECORDS)
+    {
+        compactLog();
+    }
+}
+
+// Note: caller must hold statsMutex
+static void applyEvent(const stats_event_t *event)
+{
+    int index = findOrAddEntry(event->song_key);
+    if (index < 0)
+    {
+        return;
+    }
+    playStats_entry_t *entry = &entries[index];
+    if (event->type == EVENT_PLAY)
+    {
+        entry->plays++;
+        entry->last_played = event->time;
+        updateMostPlayed(index);
+        updateRecentlyPlayed(index);
+    }
+    else
+    {
+        entry->skips++;
+    }
+    if (!entry_dirty[index])
+    {
+        entry_dirty[index] = true;
+        dirty_indices[num_dirty++] = index;
+    }
+}
+
+// Returns the index of the entry for "song_key", adding it if needed, or -1 if the table is full
+// Note: caller must hold statsMutex
+static int findOrAddEntry(uint64_t song_key)
+{
+    playStats_entry_t *entry = hashMap_get(entries_by_key, song_key);
+    if (entry != NULL)
+    {
+        return (int)(entry - entries);
+    }
+    if (num_entries == PLAY_STATS_MAX_SONGS)
+    {
+        return -1;
+    }
+    entry = &entries[num_entries];
+    memset(entry, 0, sizeof(*entry));
+    entry->song_key = song_key;
+    hashMap_put(entries_by_key, song_key, entry);
+    return num_entries++;
+}
+
+// Moves the entry at "index" to its place in most_played after its play count grew
+// Note: caller must hold statsMutex
+static void updateMostPlayed(int index)
+{
+    int position = 0;
+    while (position < num_most_played && most_played[position] != index)
+    {
+        position++;
+    }
+    if (position == num_most_played)
+    {
+        if (num_most_played < PLAY_STATS_VIEW_SIZE)
+        {
+            num_most_played++;
+        }
+        else if (entries[index].plays <= entries[most_played[position - 1]].plays)
+        {
+            return;
+        }
+        position = num_most_played - 1;
+    }
+    while (position > 0 && entries[most_played[position - 1]].plays < entries[index].plays)
+    {
+        most_played[position] = most_played[position - 1];
+        position--;
+    }
+    most_played[position] = index;
+}
+
+// Moves the entry at "index" to its place in recently_played after its last play changed
+// Note: caller must hold statsMutex
+static void updateRecentlyPlayed(int index)
+{
+    int position = 0;
+    while (position < num_recently_played && recently_played[position] != index)
+    {
+        position++;
+    }
+    if (position == num_recently_played)
+    {
+        if (num_recently_played < PLAY_STATS_VIEW_SIZE)
+        {
+            num_recently_played++;
+        }
+        else if (entries[index].last_played < entries[recently_played[position - 1]].last_played)
+        {
+            return;
+        }
+        position = num_recently_played - 1;
+    }
+    while (position > 0 && entries[recently_played[position - 1]].last_played <= entries[index].last_played)
+    {
+        recently_played[position] = recently_played[position - 1];
+        position--;
+    }
+    recently_played[position] = index;
+}
+
+// Note: caller must hold statsMutex
+static int copyView(const int *view, int view_size, playStats_entry_t *out, int max)
+{
+    int copied = (view_size < max) ? view_size : max;
+    for (int i = 0; i < copied; i++)
+    {
+        out[i] = entries[view[i]];
+    }
+    return copied;
+}
+
+// Rebuilds the statistics from the log, cutting off a torn record at its end
+static void loadLog(void)
+{
+    log_fd = open(log_path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (log_fd < 0)
+    {
+        fprintf(stderr, "ERROR: Unable to open play statistics <%s>, they will not be saved.\n", log_path);
+        return;
+    }
+
+    log_header_t header;
+    off_t valid_size = 0;
+    if (read(log_fd, &header, sizeof(header)) == sizeof(header) &&
+        header.magic == LOG_MAGIC && header.version == LOG_VERSION)
+    {
+        valid_size = sizeof(header);
+        bool torn = false;
+        ssize_t bytes_read;
+        while (!torn && (bytes_read = read(log_fd, record_buffer, sizeof(record_buffer))) > 0)
+        {
+            int num_records = bytes_read / sizeof(log_record_t);
+            for (int i = 0; i < num_records; i++)
+            {
+                const log_record_t *record = &record_buffer[i];
+                if (record->check != recordCheck(record))
+                {
+                    torn = true;
+                    break;
+                }
+                int index = findOrAddEntry(record->song_key);
+                if (index >= 0)
+                {
+                    entries[index].plays = record->plays;
+                    entries[index].skips = record->skips;
+                    entries[index].last_played = record->last_played;
+                }
+                valid_size += sizeof(log_record_t);
+                log_records++;
+            }
+            torn = torn || bytes_read % sizeof(log_record_t) != 0;
+        }
+    }
+
+    if (valid_size == 0)
+    {
+        header.magic = LOG_MAGIC;
+        header.version = LOG_VERSION;
+        if (ftruncate(log_fd, 0) != 0 || write(log_fd, &header, sizeof(header)) != sizeof(header))
+        {
+            fprintf(stderr, "ERROR: Unable to write play statistics to <%s>.\n", log_path);
+        }
+    }
+    else if (ftruncate(log_fd, valid_size) != 0)
+    {
+        fprintf(stderr, "ERROR: Unable to repair play statistics <%s>.\n", log_path);
+    }
+
+    for (int i = 0; i < num_entries; i++)
+    {
+        updateMostPlayed(i);
+        updateRecentlyPlayed(i);
+    }
+}
+
+static bool writeRecords(int fd, const log_record_t *records, int count)
+{
+    const char *data = (const char *)records;
+    size_t remaining = count * sizeof(log_record_t);
+    while (remaining > 0)
+    {
+        ssize_t written = write(fd, data, remaining);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        remaining -= written;
+    }
+    return true;
+}
+
+// Rewrites the log with one record per song and swaps it in
+// Note: only called from the flush thread
+static void compactLog(void)
+{
+    char tmp_path[PATH_MAX + 4];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", log_path);
+    int tmp_fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (tmp_fd < 0)
+    {
+        fprintf(stderr, "ERROR: Unable to compact play statistics <%s>.\n", log_path);
+        return;
+    }
+
+    pthread_mutex_lock(&statsMutex);
+    int num_records = num_entries;
+    for (int i = 0; i < num_records; i++)
+    {
+        log_record_t *record = &record_buffer[i];
+        record->song_key = entries[i].song_key;
+        record->plays = entries[i].plays;
+        record->skips = entries[i].skips;
+        record->last_played = entries[i].last_played;
+        record->check = recordCheck(record);
+    }
+    pthread_mutex_unlock(&statsMutex);
+
+    log_header_t header = {LOG_MAGIC, LOG_VERSION};
+    bool written = write(tmp_fd, &header, sizeof(header)) == sizeof(header) &&
+                   writeRecords(tmp_fd, record_buffer, num_records) &&
+                   fsync(tmp_fd) == 0;
+    if (!written || rename(tmp_path, log_path) != 0)
+    {
+        fprintf(stderr, "ERROR: Unable to compact play statistics <%s>.\n", log_path);
+        close(tmp_fd);
+        unlink(tmp_path);
+        return;
+    }
+    close(log_fd);
+    log_fd = tmp_fd;
+    log_records = num_records;
+}
+
+static uint32_t recordCheck(const log_record_t *record)
+{
+    uint32_t check = RECORD_CHECK_SEED;
+    check = (check ^ (uint32_t)record->song_key) * 16777619u;
+    check = (check ^ (uint32_t)(record->song_key >> 32)) * 16777619u;
+    check = (check ^ record->plays) * 16777619u;
+    check = (check ^ record->skips) * 16777619u;
+    check = (check ^ record->last_played) * 16777619u;
+    return check;
+}
@@ -0,0 +1,63 @@
+/**
+ * @file playStats.h
+ * @brief This is a header file for the playStats module.
+ *
+ * This header file contains the definitions of the functions
+ * for the playStats module, which counts plays and skips of every
+ * song and keeps them across reboots in a compact binary log.
+ *
+ * Songs are identified by the 64-bit hash of their path (see
+ * hashMap_hashString()), which unlike song ids survives a restart.
+ *
+ * @author Mehdi Esmaeilzadeh
+ * @date 2023-04-10
+ */
+
+#if !defined(PLAY_STATS_H)
+#define PLAY_STATS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// File the statistics are kept in on the BeaglePod
+#define PLAY_STATS_DEFAULT_LOG "/mnt/remote/myApps/playStats.bin"
+
+// Maximum number of songs with statistics, songs played after that are not counted
+#define PLAY_STATS_MAX_SONGS 4096
+
+// Number of songs in the "most played" and "recently played" views
+#define PLAY_STATS_VIEW_SIZE 16
+
+typedef struct
+{
+    uint64_t song_key;     // hash of the song's path
+    uint32_t plays;        // times the song started playing
+    uint32_t skips;        // times it was replaced before it finished
+    uint32_t last_played;  // seconds since the epoch, 0 if never played
+} playStats_entry_t;
+
+// Loads the statistics from "log_path" and starts the thread that writes new ones to it
+// Note: caller should call playStats_cleanup() to write the last ones
+void playStats_init(const char *log_path);
+
+// Writes the statistics not saved yet and stops the thread
+void playStats_cleanup(void);
+
+// Counts a play of the song with "song_key"
+// Note: never allocates nor touches the disk, safe to call on the playback path
+void playStats_recordPlay(uint64_t song_key);
+
+// Counts a skip of the song with "song_key"
+// Note: never allocates nor touches the disk, safe to call on the playback path
+void playStats_recordSkip(uint64_t song_key);
+
+// Fills "entry" with the statistics of "song_key", returns false if it was never played
+bool playStats_get(uint64_t song_key, playStats_entry_t *entry);
+
+// Copies up to "max" songs with the most plays, most played first, and returns how many were copied
+int playStats_getMostPlayed(playStats_entry_t *entries, int max);
+
+// Copies up to "max" songs played last, latest first, and returns how many were copied
+int playStats_getRecentlyPlayed(playStats_entry_t *entries, int max);
+
+#endif // PLAY_STATS_H
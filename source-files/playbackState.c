@@ -0,0 +1,289 @@
+/**
+ * @file playbackState.c
+ * @brief This is a source file for the playbackState module.
+ *
+ * This source file contains the declaration of the functions
+ * for the playbackState module, which saves what is playing, where,
+ * the Up Next queue and the volume every few seconds, and picks up
+ * from there when the BeaglePod starts again.
+ *
+ * The state is a short text file written to a temporary file and renamed
+ * over the old one, so a power loss leaves either the old or the new
+ * state. Songs are saved by path with their metadata since song ids do
+ * not survive a restart. On startup only the song that was playing is
+ * read before init returns, and only from where it stopped (see
+ * AudioPlayer_readWaveFileFrom()); the queued songs are added by the
+ * background thread.
+ *
+ * @author Mehdi Esmaeilzadeh
+ * @date 2023-04-11
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "playbackState.h"
+#include "songManager.h"
+#include "playQueue.h"
+#include "audio_player.h"
+
+#define STATE_HEADER "BeaglePod playback state 1"
+#define WAV_HEADER_SIZE 44
+// artist, album, title and path
+#define SONG_FIELDS 4
+
+static pthread_t playbackStateThreadId;
+static pthread_mutex_t stateMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t stateCond = PTHREAD_COND_INITIALIZER;
+static bool stoppingState = false;
+static bool is_module_initialized = false;
+
+static char state_path[PATH_MAX];
+// Last state written, so an unchanged state is not written again
+static char *saved_state = NULL;
+
+// Private functions definitions
+static void *playbackStateThread(void *arg);
+static void restoreState(bool queue);
+static void restoreQueuedSong(char **fields);
+static bool splitFields(char *text, char **fields, int count);
+static bool isPlayable(const char *path);
+static void saveState(void);
+static void writeSong(FILE *out, const char *prefix, song_info *song);
+static bool writeStateFile(const char *text, size_t size);
+
+//------------------------------------------------
+//////////////// Public Functions ////////////////
+//------------------------------------------------
+
+void playbackState_init(const char *path)
+{
+    snprintf(state_path, sizeof(state_path), "%s", path);
+    restoreState(false);
+
+    stoppingState = false;
+    pthread_create(&playbackStateThreadId, NULL, playbackStateThread, NULL);
+    is_module_initialized = true;
+}
+
+void playbackState_cleanup(void)
+{
+    if (!is_module_initialized)
+    {
+        return;
+    }
+    pthread_mutex_lock(&stateMutex);
+    stoppingState = true;
+    pthread_cond_signal(&stateCond);
+    pthread_mutex_unlock(&stateMutex);
+    pthread_join(playbackStateThreadId, NULL);
+
+    saveState();
+    free(saved_state);
+    saved_state = NULL;
+    is_module_initialized = false;
+}
+
+//------------------------------------------------
+/////////////// Private Functions ////////////////
+//------------------------------------------------
+
+static void *playbackStateThread(void *arg)
+{
+    // the state file still holds the queue until the first save
+    restoreState(true);
+
+    pthread_mutex_lock(&stateMutex);
+    while (!stoppingState)
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += PLAYBACK_STATE_INTERVAL_S;
+        if (pthread_cond_timedwait(&stateCond, &stateMutex, &deadline) == ETIMEDOUT)
+        {
+            pthread_mutex_unlock(&stateMutex);
+            saveState();
+            pthread_mutex_lock(&stateMutex);
+        }
+    }
+    pthread_mutex_unlock(&stateMutex);
+    return NULL;
+}
+
+// Restores the volume and the song playing, or with "queue" the Up Next songs
+static void restoreState(bool queue)
+{
+    FILE *file = fopen(state_path, "r");
+    if (file == NULL)
+    {
+        return;
+    }
+
+    char *line = NULL;
+    size_t line_size = 0;
+    bool valid = getline(&line, &line_size, file) > 0 && strncmp(line, STATE_HEADER, strlen(STATE_HEADER)) == 0;
+    while (valid && getline(&line, &line_size, file) > 0)
+    {
+        line[strcspn(line, "\n")] = '\0';
+        char *fields[SONG_FIELDS];
+        int volume = 0;
+        int location = 0;
+        int prefix_length = 0;
+        if (!queue && sscanf(line, "volume %d", &volume) == 1)
+        {
+            AudioPlayer_setVolume(volume / 100.0);
+        }
+        else if (!queue && sscanf(line, "playing %d\t%n", &location, &prefix_length) == 1 && prefix_length > 0 &&
+                 splitFields(line + prefix_length, fields, SONG_FIELDS) && isPlayable(fields[3]))
+        {
+            songManager_resumeSong(fields[0], fields[1], fields[3], fields[2], location);
+        }
+        else if (queue && strncmp(line, "queued\t", strlen("queued\t")) == 0 &&
+                 splitFields(line + strlen("queued\t"), fields, SONG_FIELDS))
+        {
+            restoreQueuedSong(fields);
+        }
+    }
+    free(line);
+    fclose(file);
+}
+
+// Queues the song in "fields", adding it to the library first if the songs directory was not scanned yet
+static void restoreQueuedSong(char **fields)
+{
+    songManager_readLock();
+    song_info *song = songManager_findByPath(fields[3]);
+    song_id_t id = (song != NULL) ? song->id : SONG_ID_INVALID;
+    songManager_readUnlock();
+
+    if (id == SONG_ID_INVALID)
+    {
+        if (!isPlayable(fields[3]))
+        {
+            return;
+        }
+        song = create_song_struct(fields[0], fields[1], fields[3], fields[2]);
+        id = song->id;
+        songManager_addSongBack(song);
+    }
+    playQueue_pushBack(id);
+}
+
+// Splits "text" at its tabs into exactly "count" fields
+static bool splitFields(char *text, char **fields, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        fields[i] = text;
+        text = strchr(text, '\t');
+        if (text == NULL)
+        {
+            return i == count - 1;
+        }
+        *text++ = '\0';
+    }
+    return false;
+}
+
+// A song whose file went away while the BeaglePod was off is not restored
+static bool isPlayable(const char *path)
+{
+    struct stat info;
+    return stat(path, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > WAV_HEADER_SIZE;
+}
+
+static void saveState(void)
+{
+    char *text = NULL;
+    size_t size = 0;
+    FILE *out = open_memstream(&text, &size);
+    if (out == NULL)
+    {
+        fprintf(stderr, "playbackState_saveState: Error - There was a problem allocating memory.");
+        exit(1);
+    }
+    fprintf(out, "%s\nvolume %d\n", STATE_HEADER, AudioPlayer_getVolume());
+
+    // a song that played to its end is not resumed
+    song_info *playing = songManager_getCurrentSongPlaying();
+    if (playing != NULL)
+    {
+        int location = AudioPlayer_getLocation(playing->pSong_DWave);
+        if (location >= 0 && location < playing->pSong_DWave->numSamples)
+        {
+            char prefix[32];
+            snprintf(prefix, sizeof(prefix), "playing %d", location);
+            writeSong(out, prefix, playing);
+        }
+        songManager_releaseSong(playing);
+    }
+
+    song_id_t ids[PLAY_QUEUE_CAPACITY];
+    int queue_size = playQueue_copyIds(ids, PLAY_QUEUE_CAPACITY);
+    songManager_readLock();
+    for (int i = 0; i < queue_size; i++)
+    {
+        song_info *song = songManager_findById(ids[i]);
+        if (song != NULL)
+        {
+            writeSong(out, "queued", song);
+        }
+    }
+    songManager_readUnlock();
+    fclose(out);
+
+    if (saved_state == NULL || strcmp(saved_state, text) != 0)
+    {
+        if (writeStateFile(text, size))
+        {
+            free(saved_state);
+            saved_state = text;
+            text = NULL;
+        }
+    }
+    free(text);
+}
+
+// Writes a line with "prefix" and the fields of "song", unless one of them would break the line apart
+static void writeSong(FILE *out, const char *prefix, song_info *song)
+{
+    const char *fields[SONG_FIELDS] = {song->author_name, song->album, song->song_name, song->song_path};
+    for (int i = 0; i < SONG_FIELDS; i++)
+    {
+        if (strpbrk(fields[i], "\t\n") != NULL)
+        {
+            return;
+        }
+    }
+    fprintf(out, "%s\t%s\t%s\t%s\t%s\n", prefix, fields[0], fields[1], fields[2], fields[3]);
+}
+
+// Replaces the state file with "text" so it is never seen half written
+static bool writeStateFile(const char *text, size_t size)
+{
+    char tmp_path[PATH_MAX + 4];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", state_path);
+    FILE *file = fopen(tmp_path, "w");
+    if (file == NULL)
+    {
+        fprintf(stderr, "ERROR: Unable to save playback state to <%s>.\n", state_path);
+        return false;
+    }
+    bool written = fwrite(text, 1, size, file) == size && fflush(file) == 0 && fsync(fileno(file)) == 0;
+    written = fclose(file) == 0 && written;
+    if (!written || rename(tmp_path, state_path) != 0)
+    {
+        fprintf(stderr, "ERROR: Unable to save playback state to <%s>.\n", state_path);
+        unlink(tmp_path);
+        return false;
+    }
+    return true;
+}
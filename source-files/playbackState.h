@@ -0,0 +1,31 @@
+/**
+ * @file playbackState.h
+ * @brief This is a header file for the playbackState module.
+ *
+ * This header file contains the definitions of the functions
+ * for the playbackState module, which saves what is playing, where,
+ * the Up Next queue and the volume every few seconds, and picks up
+ * from there when the BeaglePod starts again.
+ *
+ * @author Mehdi Esmaeilzadeh
+ * @date 2023-04-11
+ */
+
+#if !defined(PLAYBACK_STATE_H)
+#define PLAYBACK_STATE_H
+
+// File the playback state is kept in on the BeaglePod
+#define PLAYBACK_STATE_DEFAULT_FILE "/mnt/remote/myApps/playbackState.txt"
+
+// Time between two saves of the playback state
+#define PLAYBACK_STATE_INTERVAL_S 5
+
+// Resumes the song saved in "state_path" and starts saving the state to it
+// Note: call once the song manager and the audio player are initialized, before
+// the slower modules, and call playbackState_cleanup() to save the last state
+void playbackState_init(const char *state_path);
+
+// Saves the state one last time and stops the thread
+void playbackState_cleanup(void);
+
+#endif // PLAYBACK_STATE_H
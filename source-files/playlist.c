@@ -0,0 +1,355 @@
+/**
+ * @file playlist.c
+ * @brief This is a source file for the playlist module.
+ *
+ * This source file contains the declaration of the functions
+ * for the playlist module, which provides named playlists of
+ * library songs and M3U/M3U8 import and export.
+ *
+ * A playlist only stores the ids of its songs, so each entry costs
+ * sizeof(song_id_t) bytes no matter how long the song's path is.
+ *
+ * @author Mehdi Esmaeilzadeh
+ * @date 2023-04-04
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "playlist.h"
+#include "songManager.h"
+#include "audio_player.h"
+
+// Longest M3U line (path) that is accepted, longer entries are skipped
+#define M3U_MAX_LINE_LEN 1024
+#define M3U_HEADER "#EXTM3U"
+#define UTF8_BOM "\xEF\xBB\xBF"
+
+typedef struct
+{
+    char name[PLAYLIST_NAME_MAX_LEN];
+    song_id_t *ids;
+    int size;
+    int capacity;
+} playlist_t;
+
+static pthread_mutex_t playlistMutex = PTHREAD_MUTEX_INITIALIZER;
+static playlist_t playlists[PLAYLIST_MAX_PLAYLISTS];
+static int num_playlists = 0;
+
+// Private functions definitions
+static bool isValidPlaylist(int playlist);
+static int findByName(const char *name);
+static void stripLineEnding(char *line);
+static void resolvePath(const char *m3u_path, const char *entry, char *resolved, int size);
+
+//------------------------------------------------
+//////////////// Public Functions ////////////////
+//------------------------------------------------
+
+void playlist_init(void)
+{
+    num_playlists = 0;
+}
+
+void playlist_cleanup(void)
+{
+    pthread_mutex_lock(&playlistMutex);
+    for (int i = 0; i < num_playlists; i++)
+    {
+        free(playlists[i].ids);
+        playlists[i].ids = NULL;
+    }
+    num_playlists = 0;
+    pthread_mutex_unlock(&playlistMutex);
+}
+
+int playlist_create(const char *name)
+{
+    int playlist = -1;
+    pthread_mutex_lock(&playlistMutex);
+    if (num_playlists < PLAYLIST_MAX_PLAYLISTS && name[0] != '\0' && findByName(name) < 0)
+    {
+        playlist = num_playlists;
+        snprintf(playlists[playlist].name, PLAYLIST_NAME_MAX_LEN, "%s", name);
+        playlists[playlist].ids = NULL;
+        playlists[playlist].size = 0;
+        playlists[playlist].capacity = 0;
+        num_playlists++;
+    }
+    pthread_mutex_unlock(&playlistMutex);
+    return playlist;
+}
+
+bool playlist_delete(int playlist)
+{
+    pthread_mutex_lock(&playlistMutex);
+    if (!isValidPlaylist(playlist))
+    {
+        pthread_mutex_unlock(&playlistMutex);
+        return false;
+    }
+    free(playlists[playlist].ids);
+    memmove(&playlists[playlist], &playlists[playlist + 1],
+            (num_playlists - playlist - 1) * sizeof(playlists[0]));
+    num_playlists--;
+    pthread_mutex_unlock(&playlistMutex);
+    return true;
+}
+
+int playlist_findByName(const char *name)
+{
+    pthread_mutex_lock(&playlistMutex);
+    int playlist = findByName(name);
+    pthread_mutex_unlock(&playlistMutex);
+    return playlist;
+}
+
+int playlist_getNumberPlaylists(void)
+{
+    return num_playlists;
+}
+
+bool playlist_getName(int playlist, char *name, int size)
+{
+    pthread_mutex_lock(&playlistMutex);
+    bool valid = isValidPlaylist(playlist);
+    if (valid)
+    {
+        snprintf(name, size, "%s", playlists[playlist].name);
+    }
+    pthread_mutex_unlock(&playlistMutex);
+    return valid;
+}
+
+int playlist_getSize(int playlist)
+{
+    pthread_mutex_lock(&playlistMutex);
+    int size = isValidPlaylist(playlist) ? playlists[playlist].size : -1;
+    pthread_mutex_unlock(&playlistMutex);
+    return size;
+}
+
+bool playlist_addSong(int playlist, song_id_t id)
+{
+    pthread_mutex_lock(&playlistMutex);
+    if (!isValidPlaylist(playlist))
+    {
+        pthread_mutex_unlock(&playlistMutex);
+        return false;
+    }
+    playlist_t *list = &playlists[playlist];
+    if (list->size == list->capacity)
+    {
+        int new_capacity = list->capacity ? list->capacity * 2 : 16;
+        song_id_t *new_ids = realloc(list->ids, new_capacity * sizeof(*new_ids));
+        if (new_ids == NULL)
+        {
+            fprintf(stderr, "%s\n", "playlist_addSong(): Error - There was a problem allocating memory.");
+            exit(1);
+        }
+        list->ids = new_ids;
+        list->capacity = new_capacity;
+    }
+    list->ids[list->size++] = id;
+    pthread_mutex_unlock(&playlistMutex);
+    return true;
+}
+
+bool playlist_removeSongAt(int playlist, int position)
+{
+    pthread_mutex_lock(&playlistMutex);
+    if (!isValidPlaylist(playlist) || position < 0 || position >= playlists[playlist].size)
+    {
+        pthread_mutex_unlock(&playlistMutex);
+        return false;
+    }
+    playlist_t *list = &playlists[playlist];
+    memmove(&list->ids[position], &list->ids[position + 1],
+            (list->size - position - 1) * sizeof(*list->ids));
+    list->size--;
+    pthread_mutex_unlock(&playlistMutex);
+    return true;
+}
+
+int playlist_copySongIds(int playlist, song_id_t **ids)
+{
+    pthread_mutex_lock(&playlistMutex);
+    if (!isValidPlaylist(playlist))
+    {
+        pthread_mutex_unlock(&playlistMutex);
+        return -1;
+    }
+    int size = playlists[playlist].size;
+    *ids = malloc((size ? size : 1) * sizeof(**ids));
+    if (*ids == NULL)
+    {
+        fprintf(stderr, "%s\n", "playlist_copySongIds(): Error - There was a problem allocating memory.");
+        exit(1);
+    }
+    memcpy(*ids, playlists[playlist].ids, size * sizeof(**ids));
+    pthread_mutex_unlock(&playlistMutex);
+    return size;
+}
+
+int playlist_importM3U(const char *m3u_path, const char *name, int *unresolved)
+{
+    FILE *file = fopen(m3u_path, "r");
+    if (file == NULL)
+    {
+        fprintf(stderr, "ERROR: Unable to open playlist file <%s>.\n", m3u_path);
+        return -1;
+    }
+    int playlist = playlist_create(name);
+    if (playlist < 0)
+    {
+        fprintf(stderr, "ERROR: Unable to create playlist <%s>.\n", name);
+        fclose(file);
+        return -1;
+    }
+
+    int missing = 0;
+    char line[M3U_MAX_LINE_LEN];
+    char resolved[M3U_MAX_LINE_LEN];
+    bool first_line = true;
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        bool truncated = strchr(line, '\n') == NULL && !feof(file);
+        if (truncated)
+        {
+            // entry too long: skip the rest of it
+            int c;
+            while ((c = fgetc(file)) != EOF && c != '\n')
+            {
+            }
+            missing++;
+            continue;
+        }
+        stripLineEnding(line);
+
+        char *entry = line;
+        if (first_line && strncmp(entry, UTF8_BOM, strlen(UTF8_BOM)) == 0)
+        {
+            entry += strlen(UTF8_BOM);
+        }
+        first_line = false;
+
+        // comments and extended M3U directives (#EXTM3U, #EXTINF, ...)
+        if (entry[0] == '\0' || entry[0] == '#')
+        {
+            continue;
+        }
+
+        resolvePath(m3u_path, entry, resolved, sizeof(resolved));
+        songManager_readLock();
+        song_info *song = songManager_findByPath(resolved);
+        song_id_t id = (song != NULL) ? song->id : SONG_ID_INVALID;
+        songManager_readUnlock();
+        if (id == SONG_ID_INVALID)
+        {
+            missing++;
+            continue;
+        }
+        playlist_addSong(playlist, id);
+    }
+    fclose(file);
+
+    if (unresolved != NULL)
+    {
+        *unresolved = missing;
+    }
+    return playlist;
+}
+
+int playlist_exportM3U(int playlist, const char *m3u_path)
+{
+    song_id_t *ids = NULL;
+    int size = playlist_copySongIds(playlist, &ids);
+    if (size < 0)
+    {
+        return -1;
+    }
+
+    FILE *file = fopen(m3u_path, "w");
+    if (file == NULL)
+    {
+        fprintf(stderr, "ERROR: Unable to open playlist file <%s> for writing.\n", m3u_path);
+        free(ids);
+        return -1;
+    }
+
+    int written = 0;
+    fprintf(file, "%s\n", M3U_HEADER);
+    for (int i = 0; i < size; i++)
+    {
+        songManager_readLock();
+        song_info *song = songManager_findById(ids[i]);
+        if (song == NULL)
+        {
+            songManager_readUnlock();
+            continue;
+        }
+        int seconds = -1;
+        if (song->pSong_DWave != NULL)
+        {
+            seconds = song->pSong_DWave->numSamples / (SAMPLE_RATE * NUM_CHANNELS);
+        }
+        fprintf(file, "#EXTINF:%d,%s - %s\n%s\n", seconds, song->author_name, song->song_name, song->song_path);
+        songManager_readUnlock();
+        written++;
+    }
+    free(ids);
+
+    if (fclose(file) != 0)
+    {
+        fprintf(stderr, "ERROR: Unable to write playlist file <%s>.\n", m3u_path);
+        return -1;
+    }
+    return written;
+}
+
+//------------------------------------------------
+/////////////// Private Functions ////////////////
+//------------------------------------------------
+
+static bool isValidPlaylist(int playlist)
+{
+    return playlist >= 0 && playlist < num_playlists;
+}
+
+// Note: caller must hold playlistMutex
+static int findByName(const char *name)
+{
+    for (int i = 0; i < num_playlists; i++)
+    {
+        if (strncmp(playlists[i].name, name, PLAYLIST_NAME_MAX_LEN - 1) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Removes trailing '\n' and '\r' (files written on Windows) and spaces
+static void stripLineEnding(char *line)
+{
+    int len = strlen(line);
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r' || line[len - 1] == ' '))
+    {
+        line[--len] = '\0';
+    }
+}
+
+// Relative entries are relative to the directory that holds the M3U file
+static void resolvePath(const char *m3u_path, const char *entry, char *resolved, int size)
+{
+    const char *last_slash = strrchr(m3u_path, '/');
+    if (entry[0] == '/' || last_slash == NULL)
+    {
+        snprintf(resolved, size, "%s", entry);
+        return;
+    }
+    snprintf(resolved, size, "%.*s/%s", (int)(last_slash - m3u_path), m3u_path, entry);
+}
@@ -0,0 +1,70 @@
+/**
+ * @file playlist.h
+ * @brief This is a header file for the playlist module.
+ *
+ * This header file contains the definitions of the functions
+ * for the playlist module, which provides named playlists of
+ * library songs and M3U/M3U8 import and export.
+ *
+ * @author Mehdi Esmaeilzadeh
+ * @date 2023-04-04
+ */
+
+#if !defined(PLAYLIST_H)
+#define PLAYLIST_H
+
+#include <stdbool.h>
+#include "songManager.h"
+
+#define PLAYLIST_MAX_PLAYLISTS 16
+#define PLAYLIST_NAME_MAX_LEN 32
+
+// Playlists are referred to by their index: 0 .. playlist_getNumberPlaylists() - 1
+// Note: deleting a playlist shifts the index of the playlists after it
+
+void playlist_init(void);
+
+// Frees the memory for all playlists
+void playlist_cleanup(void);
+
+// Returns the index of the new empty playlist, or -1 if the name is taken or there is no room left
+int playlist_create(const char *name);
+
+// Returns false if "playlist" does not exist
+bool playlist_delete(int playlist);
+
+// Returns the index of the playlist called "name" or -1 if there is none
+int playlist_findByName(const char *name);
+
+int playlist_getNumberPlaylists(void);
+
+// Copies the name of the playlist into "name" (at most "size" bytes, null terminated)
+// Returns false if "playlist" does not exist
+bool playlist_getName(int playlist, char *name, int size);
+
+// Returns the number of songs in the playlist or -1 if it does not exist
+int playlist_getSize(int playlist);
+
+// Appends the song with "id" to the end of the playlist
+bool playlist_addSong(int playlist, song_id_t id);
+
+// Removes the song at "position" (zero-indexed) of the playlist
+bool playlist_removeSongAt(int playlist, int position);
+
+// Returns the number of songs and stores a newly allocated copy of the song ids into "ids"
+// Note: caller should free() "ids". Returns -1 if "playlist" does not exist
+int playlist_copySongIds(int playlist, song_id_t **ids);
+
+// Creates the playlist "name" from the M3U/M3U8 file at "m3u_path", reading it line by line.
+// Entries are matched against the library by path; relative paths are resolved against
+// the directory of the M3U file. "unresolved" (if not NULL) gets the number of entries
+// that are not in the library.
+// Returns the index of the new playlist or -1 on error
+int playlist_importM3U(const char *m3u_path, const char *name, int *unresolved);
+
+// Writes the playlist as an extended M3U file (UTF-8) to "m3u_path"
+// Songs that were removed from the library are skipped
+// Returns the number of songs written or -1 on error
+int playlist_exportM3U(int playlist, const char *m3u_path);
+
+#endif // PLAYLIST_H
@@ -0,0 +1,221 @@
+/**
+ * @file protocol.c
+ * @brief This is a source file for the protocol module.
+ *
+ * This source file contains the declaration of the functions
+ * for the protocol module, which encodes and decodes the binary
+ * control protocol of the BeaglePod (see protocol.h for the format).
+ *
+ * @author Amirhossein Etaati
+ * @date 2023-04-12
+ */
+
+#include <string.h>
+#include <stdint.h>
+
+#include "protocol.h"
+
+static const char *status_names[PROTOCOL_STATUS_COUNT] = {
+    [PROTOCOL_STATUS_OK] = "ACK",
+    [PROTOCOL_STATUS_NOT_FOUND] = "NOT_FOUND",
+    [PROTOCOL_STATUS_BAD_REQUEST] = "BAD_REQUEST",
+    [PROTOCOL_STATUS_UNKNOWN_COMMAND] = "UNKNOWN_COMMAND",
+    [PROTOCOL_STATUS_FAILED] = "FAILED",
+    [PROTOCOL_STATUS_BAD_VERSION] = "BAD_VERSION",
+};
+
+// Private functions definitions
+static uint16_t readU16(const uint8_t *data);
+static uint32_t readU32(const uint8_t *data);
+static void writeU16(uint8_t *data, uint16_t value);
+static void writeU32(uint8_t *data, uint32_t value);
+static uint8_t *reserve(protocol_writer_t *writer, size_t size);
+
+//------------------------------------------------
+//////////////// Public Functions ////////////////
+//------------------------------------------------
+
+size_t protocol_getFrameSize(const uint8_t *data, size_t size)
+{
+    if (size < PROTOCOL_HEADER_SIZE)
+    {
+        return 0;
+    }
+    uint32_t length = readU32(data + 9);
+    // a bogus length must not wrap around on 32-bit targets
+    return (length > SIZE_MAX - PROTOCOL_HEADER_SIZE) ? SIZE_MAX : PROTOCOL_HEADER_SIZE + (size_t)length;
+}
+
+bool protocol_parseFrame(const uint8_t *data, size_t size, protocol_header_t *header, protocol_reader_t *fields)
+{
+    if (size < PROTOCOL_HEADER_SIZE || data[0] != PROTOCOL_MAGIC || readU32(data + 9) > size - PROTOCOL_HEADER_SIZE)
+    {
+        return false;
+    }
+    size_t frame_size = PROTOCOL_HEADER_SIZE + (size_t)readU32(data + 9);
+    header->version = data[1];
+    header->opcode = data[2];
+    header->status = readU16(data + 3);
+    header->request_id = readU32(data + 5);
+    header->length = readU32(data + 9);
+    fields->next = data + PROTOCOL_HEADER_SIZE;
+    fields->end = data + frame_size;
+    return true;
+}
+
+bool protocol_readField(protocol_reader_t *reader, protocol_field_t *field)
+{
+    const uint8_t *next = reader->next;
+    size_t left = reader->end - next;
+    if (left < 1)
+    {
+        return false;
+    }
+    field->type = next[0];
+    if (field->type == PROTOCOL_FIELD_NUMBER && left >= 9)
+    {
+        field->number = ((uint64_t)readU32(next + 1) << 32) | readU32(next + 5);
+        field->string = NULL;
+        field->length = 0;
+        reader->next = next + 9;
+        return true;
+    }
+    if (field->type == PROTOCOL_FIELD_STRING && left >= 3)
+    {
+        size_t size = readU16(next + 1);
+        // the string must end within the field, with its '\0'
+        if (size == 0 || size > left - 3 || next[3 + size - 1] != '\0')
+        {
+            return false;
+        }
+        field->number = 0;
+        field->string = (const char *)next + 3;
+        field->length = size - 1;
+        reader->next = next + 3 + size;
+        return true;
+    }
+    return false;
+}
+
+bool protocol_readNumber(protocol_reader_t *reader, uint64_t *number)
+{
+    protocol_reader_t start = *reader;
+    protocol_field_t field;
+    if (!protocol_readField(reader, &field) || field.type != PROTOCOL_FIELD_NUMBER)
+    {
+        *reader = start;
+        return false;
+    }
+    *number = field.number;
+    return true;
+}
+
+bool protocol_readString(protocol_reader_t *reader, const char **string)
+{
+    protocol_reader_t start = *reader;
+    protocol_field_t field;
+    if (!protocol_readField(reader, &field) || field.type != PROTOCOL_FIELD_STRING)
+    {
+        *reader = start;
+        return false;
+    }
+    *string = field.string;
+    return true;
+}
+
+void protocol_beginFrame(protocol_writer_t *writer, uint8_t *buffer, size_t size)
+{
+    writer->buffer = buffer;
+    writer->size = size;
+    writer->length = PROTOCOL_HEADER_SIZE;
+    writer->overflow = size < PROTOCOL_HEADER_SIZE;
+}
+
+void protocol_writeNumber(protocol_writer_t *writer, uint64_t number)
+{
+    uint8_t *field = reserve(writer, 9);
+    if (field != NULL)
+    {
+        field[0] = PROTOCOL_FIELD_NUMBER;
+        writeU32(field + 1, (uint32_t)(number >> 32));
+        writeU32(field + 5, (uint32_t)number);
+    }
+}
+
+void protocol_writeString(protocol_writer_t *writer, const char *string)
+{
+    size_t size = strlen(string) + 1;
+    uint8_t *field = (size <= UINT16_MAX) ? reserve(writer, 3 + size) : NULL;
+    if (field != NULL)
+    {
+        field[0] = PROTOCOL_FIELD_STRING;
+        writeU16(field + 1, (uint16_t)size);
+        memcpy(field + 3, string, size);
+    }
+    else
+    {
+        writer->overflow = true;
+    }
+}
+
+size_t protocol_endFrame(protocol_writer_t *writer, uint8_t opcode, uint16_t status, uint32_t request_id)
+{
+    if (writer->overflow)
+    {
+        return 0;
+    }
+    uint8_t *header = writer->buffer;
+    header[0] = PROTOCOL_MAGIC;
+    header[1] = PROTOCOL_VERSION;
+    header[2] = opcode;
+    writeU16(header + 3, status);
+    writeU32(header + 5, request_id);
+    writeU32(header + 9, (uint32_t)(writer->length - PROTOCOL_HEADER_SIZE));
+    return writer->length;
+}
+
+const char *protocol_getStatusName(protocol_status_t status)
+{
+    return (status < PROTOCOL_STATUS_COUNT) ? status_names[status] : "FAILED";
+}
+
+//------------------------------------------------
+/////////////// Private Functions ////////////////
+//------------------------------------------------
+
+static uint16_t readU16(const uint8_t *data)
+{
+    return (uint16_t)((data[0] << 8) | data[1]);
+}
+
+static uint32_t readU32(const uint8_t *data)
+{
+    return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+}
+
+static void writeU16(uint8_t *data, uint16_t value)
+{
+    data[0] = value >> 8;
+    data[1] = value;
+}
+
+static void writeU32(uint8_t *data, uint32_t value)
+{
+    data[0] = value >> 24;
+    data[1] = value >> 16;
+    data[2] = value >> 8;
+    data[3] = value;
+}
+
+// Returns where the next "size" bytes go, NULL (and overflow is set) if they do not fit
+static uint8_t *reserve(protocol_writer_t *writer, size_t size)
+{
+    if (writer->overflow || size > writer->size - writer->length)
+    {
+        writer->overflow = true;
+        return NULL;
+    }
+    uint8_t *field = writer->buffer + writer->length;
+    writer->length += size;
+    return field;
+}
@@ -0,0 +1,166 @@
+/**
+ * @file protocol.h
+ * @brief This is a header file for the protocol module.
+ *
+ * This header file contains the definitions of the functions
+ * for the protocol module, which encodes and decodes the binary
+ * control protocol of the BeaglePod. It is used by the network module
+ * and can be dropped as is into C clients.
+ *
+ * A frame is a 13 byte header followed by "length" bytes of fields, all
+ * integers in network byte order:
+ *
+ *   magic (1) | version (1) | opcode (1) | status (2) | request id (4) | length (4)
+ *
+ * The magic byte tells a frame from a text command, which never starts
+ * with it. The header keeps this layout in every version, so a frame of
+ * any version can be cut out of a stream and answered.
+ *
+ * A field is a type byte followed by its value: 'U' and 8 bytes for a
+ * number, 'S' and a 2 byte length for a string that includes its
+ * terminating '\0'. The reply to a request carries the same opcode and
+ * request id, its status and its result fields. Strings are read in
+ * place, the reader never copies nor allocates.
+ *
+ * @author Amirhossein Etaati
+ * @date 2023-04-12
+ */
+
+#if !defined(PROTOCOL_H)
+#define PROTOCOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Not ASCII, so no text command starts with it
+#define PROTOCOL_MAGIC 0xBE
+// Frames of another version are answered with PROTOCOL_STATUS_BAD_VERSION
+#define PROTOCOL_VERSION 1
+#define PROTOCOL_HEADER_SIZE 13
+// Largest frame, header included, either side sends
+#define PROTOCOL_MAX_FRAME_SIZE 1024
+// Largest number of fields in a request
+#define PROTOCOL_MAX_FIELDS 8
+
+#define PROTOCOL_FIELD_NUMBER 'U'
+#define PROTOCOL_FIELD_STRING 'S'
+
+// Requests and their fields (replies only list their result fields)
+typedef enum
+{
+    PROTOCOL_OP_ADD_SONG = 1,       // path, name, artist, album -> song id
+    PROTOCOL_OP_REMOVE_SONG,        // song id
+    PROTOCOL_OP_VOLUME_UP,          //
+    PROTOCOL_OP_VOLUME_DOWN,        //
+    PROTOCOL_OP_SONG_NEXT,          //
+    PROTOCOL_OP_SONG_PREVIOUS,      //
+    PROTOCOL_OP_STOP,               //
+    PROTOCOL_OP_PLAYLIST_CREATE,    // name
+    PROTOCOL_OP_PLAYLIST_DELETE,    // name
+    PROTOCOL_OP_PLAYLIST_ADD,       // name, song path
+    PROTOCOL_OP_PLAYLIST_REMOVE,    // name, position
+    PROTOCOL_OP_PLAYLIST_IMPORT,    // m3u path, name -> songs not in the library
+    PROTOCOL_OP_PLAYLIST_EXPORT,    // name, m3u path
+    PROTOCOL_OP_PLAYLIST_PLAY,      // name
+    PROTOCOL_OP_MEMORY_REPORT,      //
+    PROTOCOL_OP_QUEUE_NEXT,         // song id
+    PROTOCOL_OP_QUEUE_ADD,          // song id
+    PROTOCOL_OP_QUEUE_MOVE,         // from position, to position
+    PROTOCOL_OP_QUEUE_REMOVE,       // position
+    PROTOCOL_OP_QUEUE_CLEAR,        //
+    PROTOCOL_OP_QUEUE_LIST,         // -> song ids
+    PROTOCOL_OP_STATS_TOP,          // -> song id, plays, skips, last played for each song
+    PROTOCOL_OP_STATS_RECENT,       // -> song id, plays, skips, last played for each song
+    PROTOCOL_OP_VOLUME_SET,         // volume in percent
+    PROTOCOL_OP_NETWORK_STATS,      // -> UDP batches, datagrams, commands coalesced, largest batch
+    PROTOCOL_OP_SUBSCRIBE,          // TCP and Unix domain only: PROTOCOL_OP_STATUS frames follow
+    PROTOCOL_OP_UNSUBSCRIBE,        //
+    PROTOCOL_OP_STATUS,             // pushed with the subscribe request id: the fields of a status
+                                    // update (see statusStream_writeFrame())
+    PROTOCOL_OP_IMPORT_SONGS,       // directory -> MP3 files queued for conversion
+    PROTOCOL_OP_IMPORT_STATUS,      // -> queued, converting, converted, failed, seconds of audio converted
+    PROTOCOL_OP_STREAM_LIMITS,      // [max streams, buffer KB] -> max streams, buffer KB, streaming, served, rejected
+    PROTOCOL_OP_INPUT_STATS,        // -> state, packets, lost, late, duplicates, overflows, rejected, underruns,
+                                    // jitter us, target ms, delay ms, speed in ppm of the network input
+    PROTOCOL_OP_SYNC_LEAD,          // [port]
+    PROTOCOL_OP_SYNC_FOLLOW,        // leader address, [port]
+    PROTOCOL_OP_SYNC_OFF,           //
+    PROTOCOL_OP_SYNC_STATS,         // -> role, requests, replies, seeks, song changes, missing songs, round trip us,
+                                    // error us, ahead, speed in ppm of the multi-room playback
+    PROTOCOL_OP_OUTPUT_START,       // multicast group, [port, compressed]
+    PROTOCOL_OP_OUTPUT_STOP,        //
+    PROTOCOL_OP_OUTPUT_STATS,       // -> sending, compressed, packets, bytes, errors, overruns, jitter us
+                                    // of the audio sent to the network
+    PROTOCOL_OP_TRACE_START,        // the trace is served as GET /trace by the HTTP server
+    PROTOCOL_OP_TRACE_STOP,         //
+    PROTOCOL_OP_UNKNOWN,
+    PROTOCOL_OP_COUNT
+} protocol_opcode_t;
+
+typedef enum
+{
+    PROTOCOL_STATUS_OK = 0,
+    PROTOCOL_STATUS_NOT_FOUND,       // the song, playlist or position does not exist
+    PROTOCOL_STATUS_BAD_REQUEST,     // missing or malformed fields
+    PROTOCOL_STATUS_UNKNOWN_COMMAND, // the opcode is not known
+    PROTOCOL_STATUS_FAILED,          // the command was valid but could not be carried out
+    PROTOCOL_STATUS_BAD_VERSION,     // the frame has another protocol version
+    PROTOCOL_STATUS_COUNT
+} protocol_status_t;
+
+typedef struct
+{
+    uint8_t version;
+    uint8_t opcode;
+    uint16_t status;
+    uint32_t request_id;
+    uint32_t length; // bytes of fields after the header
+} protocol_header_t;
+
+typedef struct
+{
+    uint8_t type;       // PROTOCOL_FIELD_NUMBER or PROTOCOL_FIELD_STRING
+    uint64_t number;
+    const char *string; // points into the frame, null-terminated
+    size_t length;      // string length without the '\0'
+} protocol_field_t;
+
+typedef struct
+{
+    const uint8_t *next;
+    const uint8_t *end;
+} protocol_reader_t;
+
+typedef struct
+{
+    uint8_t *buffer;
+    size_t size;
+    size_t length;
+    bool overflow; // a field did not fit, the frame must not be sent as is
+} protocol_writer_t;
+
+// Returns the size of the frame starting at "data" once its header arrived, 0 before
+// Note: used to cut frames out of a byte stream
+size_t protocol_getFrameSize(const uint8_t *data, size_t size);
+
+// Reads the header of the frame in "data" and points "fields" at its fields
+// Returns false if "data" is shorter than the frame it starts or does not start with PROTOCOL_MAGIC
+bool protocol_parseFrame(const uint8_t *data, size_t size, protocol_header_t *header, protocol_reader_t *fields);
+
+// Reads the next field, returns false at the end or if the field is malformed
+bool protocol_readField(protocol_reader_t *reader, protocol_field_t *field);
+bool protocol_readNumber(protocol_reader_t *reader, uint64_t *number);
+bool protocol_readString(protocol_reader_t *reader, const char **string);
+
+// Starts a frame in "buffer", the header is written by protocol_endFrame()
+void protocol_beginFrame(protocol_writer_t *writer, uint8_t *buffer, size_t size);
+void protocol_writeNumber(protocol_writer_t *writer, uint64_t number);
+void protocol_writeString(protocol_writer_t *writer, const char *string);
+// Writes the header and returns the size of the frame, 0 if a field did not fit
+size_t protocol_endFrame(protocol_writer_t *writer, uint8_t opcode, uint16_t status, uint32_t request_id);
+
+// Returns the name of "status", as used in the replies of the text protocol
+const char *protocol_getStatusName(protocol_status_t status);
+
+#endif // PROTOCOL_H
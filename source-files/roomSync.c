@@ -0,0 +1,623 @@
+/**
+ * @file roomSync.c
+ * @brief This is a source file for the roomSync module.
+ *
+ * This source file contains the declaration of the functions
+ * for the roomSync module, which keeps several BeaglePods playing the
+ * same song at the same sample (see roomSync.h).
+ *
+ * Every ROOM_SYNC_INTERVAL_MS a follower sends a request stamped with its
+ * clock (t1). The leader stamps its arrival (t2) and the departure of the
+ * answer (t3), the follower its return (t4). The leader's clock is then
+ * ((t2 - t1) + (t3 - t4)) / 2 ahead, give or take half the time the
+ * messages spent on the network both ways; the request of the last
+ * OFFSET_SAMPLES that made the fastest round trip gives the best measure.
+ *
+ * The answer also carries the timeline of the leader: the song it plays
+ * and the sample of it heard at a time of its clock, as measured by its
+ * audio player after each write to the sound card (see
+ * AudioPlayer_getPosition()). With the offset of the clocks, the follower
+ * knows which sample the leader plays at any time of its own clock and
+ * compares it with the sample it plays itself. The difference is averaged
+ * over a few answers, then corrected by playing slightly faster or slower
+ * in proportion to it. The sound cards' clocks never run at exactly the
+ * same speed either: the part of the correction that keeps coming back is
+ * summed up into the difference of their speeds, which is corrected as
+ * well, so a follower does not stay a little behind or ahead for good.
+ *
+ * @author Amirhossein Etaati
+ * @date 2023-04-16
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "roomSync.h"
+#include "audio_player.h"
+#include "songManager.h"
+#include "metrics.h"
+
+// "BPRS", first of every message
+#define MESSAGE_MAGIC 0x42505253
+#define MESSAGE_REQUEST 1
+#define MESSAGE_ANSWER 2
+#define MESSAGE_FLAG_PLAYING 0x01
+// magic (4) | type (1) | flags (1) | path length (2) | t1 (8) | t2 (8) | t3 (8) |
+// time heard (8) | sample heard (8) | path, all in network byte order
+#define MESSAGE_HEADER_SIZE 48
+// Fits in an Ethernet frame
+#define MESSAGE_MAX_SIZE 1472
+
+// Round trips the fastest one is picked from
+#define OFFSET_SAMPLES 8
+// Answers the error is averaged over
+#define ERROR_AVERAGE_DIVISOR 4
+// Time the player needs before it is heard where it was moved to
+#define SETTLE_MS 500
+// Speed change for each millisecond of error
+#define CORRECTION_PPM_PER_MS 500
+// Change of the difference of the sound cards' speeds for each millisecond of error during a second,
+// (CORRECTION_PPM_PER_MS / 2)^2 / 1000 so the error goes away without overshooting
+#define DRIFT_PPM_PER_MS_S 62.5
+// Time between checks for the end of a role
+#define POLL_MS 50
+
+#define SAMPLES_PER_US (SAMPLE_RATE * NUM_CHANNELS / 1000000.0)
+
+typedef struct
+{
+    bool playing;
+    long long time_us; // of the leader's clock
+    long long location;
+    char path[MESSAGE_MAX_SIZE];
+} timeline_t;
+
+typedef struct
+{
+    long long offset_us; // leader's clock minus the follower's
+    long long rtt_us;
+} clock_sample_t;
+
+static pthread_t roomSyncThreadId;
+static bool stoppingSync = false;
+// serializes the changes of role
+static pthread_mutex_t roleMutex = PTHREAD_MUTEX_INITIALIZER;
+static roomSync_role_t role = ROOM_SYNC_OFF;
+static int sync_fd = -1;
+
+// used by the thread of the role only
+static unsigned char message[MESSAGE_MAX_SIZE];
+static timeline_t leader_timeline;
+static long long request_t1 = 0;
+static clock_sample_t clock_samples[OFFSET_SAMPLES];
+static int clock_sample_count = 0;
+static int next_clock_sample = 0;
+static double average_error_us = 0;
+static bool has_average = false;
+static long long settle_until_us = 0;
+static int correction_ppm = 0;
+static double drift_ppm = 0;
+// the leader's song this follower does not have, not looked for again
+static char missing_path[MESSAGE_MAX_SIZE];
+
+// protected by statsMutex
+static pthread_mutex_t statsMutex = PTHREAD_MUTEX_INITIALIZER;
+static roomSync_stats_t stats;
+
+// Metrics, see metrics.h
+static metrics_gauge_t role_metric;
+static metrics_counter_t requests_metric;
+static metrics_counter_t replies_metric;
+static metrics_counter_t seeks_metric;
+static metrics_counter_t song_changes_metric;
+static metrics_counter_t missing_metric;
+static metrics_gauge_t rtt_metric;
+static metrics_gauge_t error_metric;
+static metrics_gauge_t correction_metric;
+
+// Private functions definitions
+static bool startRole(roomSync_role_t new_role, int fd);
+static void stopRole(void);
+static void *roomSyncThread(void *arg);
+static void answerRequest(void);
+static void sendRequest(void);
+static void receiveAnswer(void);
+static void readTimeline(timeline_t *timeline);
+static void followLeader(const timeline_t *leader, long long offset_us);
+static void moveTo(const timeline_t *leader, long long offset_us, const AudioPlayer_position_t *position,
+                   bool new_song);
+static double getLeaderLocation(const timeline_t *leader, long long offset_us, long long when_us);
+static void setCorrection(int ppm, int error_us);
+static void writeBigEndian(unsigned char *bytes, uint64_t value, int size);
+static uint64_t readBigEndian(const unsigned char *bytes, int size);
+static void collectMetrics(void);
+static long long getTimeInUs(void);
+
+//------------------------------------------------
+//////////////// Public Functions ////////////////
+//------------------------------------------------
+
+void roomSync_init(void)
+{
+    metrics_registerGauge(&role_metric, "beaglepod_sync_role", NULL, "0 when off, 1 when leading, 2 when following");
+    metrics_registerCounter(&requests_metric, "beaglepod_sync_requests_total", NULL,
+                            "Time requests answered by a leader, sent by a follower, in the current role");
+    metrics_registerCounter(&replies_metric, "beaglepod_sync_replies_total", NULL,
+                            "Answers a follower received in time");
+    metrics_registerCounter(&seeks_metric, "beaglepod_sync_seeks_total", NULL,
+                            "Jumps of a follower to the position of the leader");
+    metrics_registerCounter(&song_changes_metric, "beaglepod_sync_song_changes_total", NULL,
+                            "Songs a follower started because the leader played them");
+    metrics_registerCounter(&missing_metric, "beaglepod_sync_missing_total", NULL,
+                            "Songs of the leader not in the library of the follower");
+    metrics_registerGauge(&rtt_metric, "beaglepod_sync_rtt_us", NULL,
+                          "Round trip of the request the clock offset is measured with");
+    metrics_registerGauge(&error_metric, "beaglepod_sync_error_us", NULL,
+                          "How far a follower is ahead of the leader, behind if negative");
+    metrics_registerGauge(&correction_metric, "beaglepod_sync_correction_ppm", NULL,
+                          "Playback speed change of a follower");
+    metrics_registerCollector(collectMetrics);
+}
+
+bool roomSync_lead(int port)
+{
+    struct sockaddr_in sin;
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_ANY);
+    sin.sin_port = htons(port);
+
+    pthread_mutex_lock(&roleMutex);
+    stopRole();
+    int fd = socket(PF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    int reuse = 1;
+    if (fd < 0 || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0 ||
+        bind(fd, (struct sockaddr *)&sin, sizeof(sin)) != 0)
+    {
+        fprintf(stderr, "ERROR: Unable to lead on port %d.\n", port);
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        pthread_mutex_unlock(&roleMutex);
+        return false;
+    }
+    bool started = startRole(ROOM_SYNC_LEADER, fd);
+    pthread_mutex_unlock(&roleMutex);
+    return started;
+}
+
+bool roomSync_follow(const char *address, int port)
+{
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    char service[16];
+    snprintf(service, sizeof(service), "%d", port);
+    struct addrinfo *leader = NULL;
+    if (getaddrinfo(address, service, &hints, &leader) != 0)
+    {
+        fprintf(stderr, "ERROR: Unable to find the leader %s.\n", address);
+        return false;
+    }
+
+    pthread_mutex_lock(&roleMutex);
+    stopRole();
+    // connected, so only the leader's answers are received
+    int fd = socket(PF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, leader->ai_addr, leader->ai_addrlen) != 0)
+    {
+        fprintf(stderr, "ERROR: Unable to follow %s.\n", address);
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        freeaddrinfo(leader);
+        pthread_mutex_unlock(&roleMutex);
+        return false;
+    }
+    freeaddrinfo(leader);
+    bool started = startRole(ROOM_SYNC_FOLLOWER, fd);
+    pthread_mutex_unlock(&roleMutex);
+    return started;
+}
+
+void roomSync_stop(void)
+{
+    pthread_mutex_lock(&roleMutex);
+    stopRole();
+    pthread_mutex_unlock(&roleMutex);
+}
+
+void roomSync_getStats(roomSync_stats_t *stats_out)
+{
+    pthread_mutex_lock(&statsMutex);
+    *stats_out = stats;
+    pthread_mutex_unlock(&statsMutex);
+}
+
+void roomSync_cleanup(void)
+{
+    roomSync_stop();
+}
+
+//------------------------------------------------
+/////////////// Private Functions ////////////////
+//------------------------------------------------
+
+// Starts the thread of "new_role" on "fd", with the counters of the previous role cleared
+// Note: caller must hold roleMutex, no role must be running
+static bool startRole(roomSync_role_t new_role, int fd)
+{
+    sync_fd = fd;
+    request_t1 = 0;
+    clock_sample_count = 0;
+    next_clock_sample = 0;
+    has_average = false;
+    settle_until_us = 0;
+    correction_ppm = 0;
+    drift_ppm = 0;
+    missing_path[0] = '\0';
+    pthread_mutex_lock(&statsMutex);
+    memset(&stats, 0, sizeof(stats));
+    stats.role = new_role;
+    pthread_mutex_unlock(&statsMutex);
+
+    role = new_role;
+    stoppingSync = false;
+    if (pthread_create(&roomSyncThreadId, NULL, roomSyncThread, NULL) != 0)
+    {
+        close(fd);
+        sync_fd = -1;
+        role = ROOM_SYNC_OFF;
+        pthread_mutex_lock(&statsMutex);
+        stats.role = ROOM_SYNC_OFF;
+        pthread_mutex_unlock(&statsMutex);
+        return false;
+    }
+    return true;
+}
+
+// Note: caller must hold roleMutex
+static void stopRole(void)
+{
+    if (role == ROOM_SYNC_OFF)
+    {
+        return;
+    }
+    __atomic_store_n(&stoppingSync, true, __ATOMIC_RELEASE);
+    pthread_join(roomSyncThreadId, NULL);
+    close(sync_fd);
+    sync_fd = -1;
+    if (role == ROOM_SYNC_FOLLOWER)
+    {
+        setCorrection(0, 0);
+    }
+    role = ROOM_SYNC_OFF;
+    pthread_mutex_lock(&statsMutex);
+    stats.role = ROOM_SYNC_OFF;
+    pthread_mutex_unlock(&statsMutex);
+}
+
+static void *roomSyncThread(void *arg)
+{
+    bool following = role == ROOM_SYNC_FOLLOWER;
+    long long next_request_us = getTimeInUs();
+    while (!__atomic_load_n(&stoppingSync, __ATOMIC_ACQUIRE))
+    {
+        int timeout_ms = POLL_MS;
+        if (following)
+        {
+            long long now = getTimeInUs();
+            if (now >= next_request_us)
+            {
+                sendRequest();
+                next_request_us = now + ROOM_SYNC_INTERVAL_MS * 1000LL;
+            }
+            timeout_ms = (next_request_us - now) / 1000;
+            timeout_ms = (timeout_ms > POLL_MS) ? POLL_MS : timeout_ms;
+        }
+
+        struct pollfd fds = {.fd = sync_fd, .events = POLLIN};
+        if (poll(&fds, 1, timeout_ms) > 0 && (fds.revents & POLLIN))
+        {
+            if (following)
+            {
+                receiveAnswer();
+            }
+            else
+            {
+                answerRequest();
+            }
+        }
+    }
+    return NULL;
+}
+
+// Leader: stamps the request of a follower and sends it back with the timeline
+static void answerRequest(void)
+{
+    struct sockaddr_storage follower;
+    socklen_t follower_size = sizeof(follower);
+    ssize_t size = recvfrom(sync_fd, message, sizeof(message), 0, (struct sockaddr *)&follower, &follower_size);
+    long long t2 = getTimeInUs();
+    if (size < MESSAGE_HEADER_SIZE || readBigEndian(message, 4) != MESSAGE_MAGIC || message[4] != MESSAGE_REQUEST)
+    {
+        return;
+    }
+
+    timeline_t *timeline = &leader_timeline;
+    readTimeline(timeline);
+    size_t path_length = timeline->playing ? strlen(timeline->path) : 0;
+    if (path_length > MESSAGE_MAX_SIZE - MESSAGE_HEADER_SIZE)
+    {
+        // a path this long cannot be sent, followers take it as nothing playing
+        path_length = 0;
+        timeline->playing = false;
+    }
+    message[4] = MESSAGE_ANSWER;
+    message[5] = timeline->playing ? MESSAGE_FLAG_PLAYING : 0;
+    writeBigEndian(message + 6, path_length, 2);
+    // t1 is left as the follower sent it
+    writeBigEndian(message + 16, t2, 8);
+    writeBigEndian(message + 32, timeline->time_us, 8);
+    writeBigEndian(message + 40, (uint64_t)timeline->location, 8);
+    memcpy(message + MESSAGE_HEADER_SIZE, timeline->path, path_length);
+    writeBigEndian(message + 24, getTimeInUs(), 8);
+    sendto(sync_fd, message, MESSAGE_HEADER_SIZE + path_length, 0, (struct sockaddr *)&follower, follower_size);
+
+    pthread_mutex_lock(&statsMutex);
+    stats.requests++;
+    pthread_mutex_unlock(&statsMutex);
+}
+
+// Follower: asks the leader for its time and timeline
+static void sendRequest(void)
+{
+    memset(message, 0, MESSAGE_HEADER_SIZE);
+    writeBigEndian(message, MESSAGE_MAGIC, 4);
+    message[4] = MESSAGE_REQUEST;
+    request_t1 = getTimeInUs();
+    writeBigEndian(message + 8, request_t1, 8);
+    // an unreachable leader only shows as requests without replies
+    send(sync_fd, message, MESSAGE_HEADER_SIZE, 0);
+
+    pthread_mutex_lock(&statsMutex);
+    stats.requests++;
+    pthread_mutex_unlock(&statsMutex);
+}
+
+// Follower: measures the clock of the leader with its answer and follows its timeline
+static void receiveAnswer(void)
+{
+    ssize_t size = recv(sync_fd, message, sizeof(message) - 1, 0);
+    long long t4 = getTimeInUs();
+    if (size < MESSAGE_HEADER_SIZE || readBigEndian(message, 4) != MESSAGE_MAGIC || message[4] != MESSAGE_ANSWER)
+    {
+        return;
+    }
+    long long t1 = readBigEndian(message + 8, 8);
+    size_t path_length = readBigEndian(message + 6, 2);
+    // only the answer to the latest request, older ones took too long
+    if (t1 != request_t1 || MESSAGE_HEADER_SIZE + path_length > (size_t)size)
+    {
+        return;
+    }
+    long long t2 = readBigEndian(message + 16, 8);
+    long long t3 = readBigEndian(message + 24, 8);
+
+    clock_sample_t *sample = &clock_samples[next_clock_sample];
+    sample->offset_us = ((t2 - t1) + (t3 - t4)) / 2;
+    sample->rtt_us = (t4 - t1) - (t3 - t2);
+    next_clock_sample = (next_clock_sample + 1) % OFFSET_SAMPLES;
+    clock_sample_count += (clock_sample_count < OFFSET_SAMPLES) ? 1 : 0;
+    const clock_sample_t *best = &clock_samples[0];
+    for (int i = 1; i < clock_sample_count; i++)
+    {
+        if (clock_samples[i].rtt_us < best->rtt_us)
+        {
+            best = &clock_samples[i];
+        }
+    }
+
+    timeline_t *leader = &leader_timeline;
+    leader->playing = (message[5] & MESSAGE_FLAG_PLAYING) != 0 && path_length > 0;
+    leader->time_us = readBigEndian(message + 32, 8);
+    leader->location = (int64_t)readBigEndian(message + 40, 8);
+    memcpy(leader->path, message + MESSAGE_HEADER_SIZE, path_length);
+    leader->path[path_length] = '\0';
+
+    pthread_mutex_lock(&statsMutex);
+    stats.replies++;
+    stats.rtt_us = best->rtt_us;
+    pthread_mutex_unlock(&statsMutex);
+    followLeader(leader, best->offset_us);
+}
+
+// Leader: fills "timeline" with the song playing and the sample of it heard last
+static void readTimeline(timeline_t *timeline)
+{
+    AudioPlayer_position_t position;
+    AudioPlayer_getPosition(&position);
+    song_info *song = songManager_getCurrentSongPlaying();
+    // silent while another source plays, or between two songs
+    timeline->playing = song != NULL && position.pSound == song->pSong_DWave;
+    timeline->time_us = position.time_us;
+    timeline->location = position.location;
+    timeline->path[0] = '\0';
+    if (timeline->playing)
+    {
+        snprintf(timeline->path, sizeof(timeline->path), "%s", song->song_path);
+    }
+    if (song != NULL)
+    {
+        songManager_releaseSong(song);
+    }
+}
+
+// Follower: plays the song of the leader, jumps to the sample it plays if it is too far from it,
+// and otherwise corrects the playback speed to catch up with it
+static void followLeader(const timeline_t *leader, long long offset_us)
+{
+    if (!leader->playing)
+    {
+        setCorrection(0, 0);
+        return;
+    }
+
+    AudioPlayer_position_t position;
+    AudioPlayer_getPosition(&position);
+    song_info *song = songManager_getCurrentSongPlaying();
+    bool same_song = song != NULL && strcmp(song->song_path, leader->path) == 0;
+    bool heard = same_song && position.pSound == song->pSong_DWave;
+    if (song != NULL)
+    {
+        songManager_releaseSong(song);
+    }
+
+    long long now = getTimeInUs();
+    if (!same_song && strcmp(leader->path, missing_path) == 0)
+    {
+        return;
+    }
+    if (!same_song)
+    {
+        moveTo(leader, offset_us, &position, true);
+        return;
+    }
+    if (!heard || now < settle_until_us)
+    {
+        // what the sound card holds is not from where the song was moved to yet
+        return;
+    }
+
+    double location = position.location + (now - position.time_us) * SAMPLES_PER_US * (1 + correction_ppm / 1000000.0);
+    double error_us = (location - getLeaderLocation(leader, offset_us, now)) / SAMPLES_PER_US;
+    if (!has_average)
+    {
+        average_error_us = error_us;
+        has_average = true;
+    }
+    else
+    {
+        average_error_us += (error_us - average_error_us) / ERROR_AVERAGE_DIVISOR;
+    }
+
+    if (average_error_us > ROOM_SYNC_SEEK_THRESHOLD_MS * 1000 || average_error_us < -ROOM_SYNC_SEEK_THRESHOLD_MS * 1000)
+    {
+        moveTo(leader, offset_us, &position, false);
+        return;
+    }
+    // slower while ahead, faster while behind
+    double correction = drift_ppm - average_error_us * CORRECTION_PPM_PER_MS / 1000;
+    if (correction > ROOM_SYNC_MAX_CORRECTION_PPM || correction < -ROOM_SYNC_MAX_CORRECTION_PPM)
+    {
+        // the difference of the speeds is only learned once the error is small enough
+        correction = (correction > 0) ? ROOM_SYNC_MAX_CORRECTION_PPM : -ROOM_SYNC_MAX_CORRECTION_PPM;
+    }
+    else
+    {
+        drift_ppm -= average_error_us / 1000 * DRIFT_PPM_PER_MS_S * ROOM_SYNC_INTERVAL_MS / 1000;
+    }
+    setCorrection(correction, average_error_us);
+}
+
+// Follower: plays the leader's song from the sample the leader plays when the follower is heard
+// again, once the sound card and the audio player played what they hold
+static void moveTo(const timeline_t *leader, long long offset_us, const AudioPlayer_position_t *position,
+                   bool new_song)
+{
+    setCorrection(0, 0);
+    has_average = false;
+    settle_until_us = getTimeInUs() + SETTLE_MS * 1000LL;
+
+    long long heard_us = position->time_us + (position->delay_samples + position->buffer_samples) / SAMPLES_PER_US;
+    double location = getLeaderLocation(leader, offset_us, heard_us);
+    bool found = songManager_playPathAt(leader->path, (location > 0) ? location : 0);
+    if (!found)
+    {
+        snprintf(missing_path, sizeof(missing_path), "%s", leader->path);
+    }
+    pthread_mutex_lock(&statsMutex);
+    if (!found)
+    {
+        stats.missing++;
+    }
+    else if (new_song)
+    {
+        stats.song_changes++;
+    }
+    else
+    {
+        stats.seeks++;
+    }
+    pthread_mutex_unlock(&statsMutex);
+}
+
+// Returns the sample the leader plays at "when_us" of the follower's clock
+static double getLeaderLocation(const timeline_t *leader, long long offset_us, long long when_us)
+{
+    return leader->location + (when_us + offset_us - leader->time_us) * SAMPLES_PER_US;
+}
+
+static void setCorrection(int ppm, int error_us)
+{
+    AudioPlayer_setRateCorrection(ppm);
+    correction_ppm = ppm;
+    pthread_mutex_lock(&statsMutex);
+    stats.correction_ppm = ppm;
+    stats.error_us = error_us;
+    pthread_mutex_unlock(&statsMutex);
+}
+
+static void writeBigEndian(unsigned char *bytes, uint64_t value, int size)
+{
+    for (int i = size - 1; i >= 0; i--)
+    {
+        bytes[i] = value & 0xff;
+        value >>= 8;
+    }
+}
+
+static uint64_t readBigEndian(const unsigned char *bytes, int size)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < size; i++)
+    {
+        value = (value << 8) | bytes[i];
+    }
+    return value;
+}
+
+static void collectMetrics(void)
+{
+    roomSync_stats_t current;
+    roomSync_getStats(&current);
+    metrics_set(&role_metric, current.role);
+    metrics_setCounter(&requests_metric, current.requests);
+    metrics_setCounter(&replies_metric, current.replies);
+    metrics_setCounter(&seeks_metric, current.seeks);
+    metrics_setCounter(&song_changes_metric, current.song_changes);
+    metrics_setCounter(&missing_metric, current.missing);
+    metrics_set(&rtt_metric, current.rtt_us);
+    metrics_set(&error_metric, current.error_us);
+    metrics_set(&correction_metric, current.correction_ppm);
+}
+
+static long long getTimeInUs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
@@ -0,0 +1,80 @@
+/**
+ * @file roomSync.h
+ * @brief This is a header file for the roomSync module.
+ *
+ * This header file contains the definitions of the functions
+ * for the roomSync module, which keeps several BeaglePods playing the
+ * same song at the same sample, so they can play together in one space.
+ *
+ * One BeaglePod leads: it answers the time requests of the others on UDP
+ * port ROOM_SYNC_DEFAULT_PORT. The followers measure how far their clock
+ * is from the leader's with these requests (the four timestamps of NTP),
+ * learn from the answers which song the leader plays and which of its
+ * samples was heard when, and play that song, from the same sample, at
+ * the same time: they jump to it when they are more than
+ * ROOM_SYNC_SEEK_THRESHOLD_MS away, and otherwise play slightly faster or
+ * slower until they are on time.
+ *
+ * The songs are matched by their path, so every BeaglePod needs the songs
+ * of the leader at the same place (the songs directory, see songWatcher.h).
+ * benchmarks/syncBench.c runs a leader and a follower on a host, their
+ * sound cards drifting apart, and measures how far apart they play
+ * ("make sync").
+ *
+ * @author Amirhossein Etaati
+ * @date 2023-04-16
+ */
+
+#if !defined(ROOM_SYNC_H)
+#define ROOM_SYNC_H
+
+#include <stdbool.h>
+
+#define ROOM_SYNC_DEFAULT_PORT 5010
+// Time between two time requests of a follower
+#define ROOM_SYNC_INTERVAL_MS 250
+// A follower further than this from the leader jumps to where the leader is
+#define ROOM_SYNC_SEEK_THRESHOLD_MS 20
+// Largest change of the playback speed of a follower, below the limit of the audio player
+#define ROOM_SYNC_MAX_CORRECTION_PPM 1000
+
+typedef enum
+{
+    ROOM_SYNC_OFF,
+    ROOM_SYNC_LEADER,
+    ROOM_SYNC_FOLLOWER
+} roomSync_role_t;
+
+typedef struct
+{
+    roomSync_role_t role;
+    long long requests;     // answered by a leader, sent by a follower
+    long long replies;      // answers a follower received in time
+    long long seeks;        // jumps of a follower to the position of the leader
+    long long song_changes; // songs a follower started because the leader played them
+    long long missing;      // songs of the leader not in the library of the follower
+    int rtt_us;             // round trip of the request the clock offset is measured with
+    int error_us;           // how far a follower is ahead of the leader, behind if negative
+    int correction_ppm;     // playback speed change of a follower
+} roomSync_stats_t;
+
+// Registers the metrics of the module, see metrics.h; it neither leads nor follows until asked to
+void roomSync_init(void);
+
+// Answers the time requests of followers on "port"
+// Returns false if the port cannot be used
+bool roomSync_lead(int port);
+
+// Follows the leader at "address" (a host name or an IPv4 address) and "port"
+// Returns false if the address cannot be resolved
+bool roomSync_follow(const char *address, int port);
+
+// Stops leading or following; a follower goes on at the normal speed
+void roomSync_stop(void);
+
+void roomSync_getStats(roomSync_stats_t *stats);
+
+// Must be called before the audio player is cleaned up
+void roomSync_cleanup(void);
+
+#endif // ROOM_SYNC_H
@@ -16,48 +16,114 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <stdbool.h>
+#include <pthread.h>
 
 #include "songManager.h"
 #include "doublyLinkedList.h"
+#include "playOrder.h"
+#include "playlist.h"
+#include "playQueue.h"
+#include "hashMap.h"
+#include "epoch.h"
+#include "stringPool.h"
+#include "playStats.h"
+#include "metrics.h"
+#include "logger.h"
+#include "trace.h"
 
 #include "lcd_4line.h"
 
+// Longest artist name shown on a line of the song menu
+#define DISPLAY_LINE_LEN 21
+
+// What a song takes in the library: one list element holding the song,
+// its wave header, then its path and name; artist and album live in the stringPool
+typedef struct
+{
+    song_info info; // must stay first
+    wavedata_t wave;
+    char strings[];
+} song_block_t;
+
+// Bytes taken by the song blocks of songs not freed yet
+static size_t song_block_bytes = 0;
+
+// Holds a reference so the audio thread never reads freed wave data
+// Note: only changed with playbackMutex held
 static song_info *current_song_playing = NULL;
+static pthread_mutex_t playbackMutex = PTHREAD_MUTEX_INITIALIZER;
+// Set once the playing song ran to its end, a song replaced before that counts as skipped
+// Note: only changed with playbackMutex held
+static bool current_song_finished = false;
+
+// Serializes every change to the library, its indexes and the active playlist;
+// readers never take it (see songManager_readLock())
+static pthread_mutex_t libraryWriteMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// id -> song and path hash -> song, pointing at the list's copy of each song
+static hashMap_t *songs_by_id = NULL;
+static hashMap_t *songs_by_path = NULL;
+// The upper half is the boot time, so ids handed out before a restart never match a new song
+static song_id_t next_song_id = SONG_ID_INVALID + 1;
+
+// ids of the playlist being played, NULL when playing through the whole library
+// Replaced as a whole, never modified, so readers can use it without a lock
+typedef struct
+{
+    int size;
+    song_id_t ids[];
+} playlist_snapshot_t;
+static playlist_snapshot_t *active_playlist = NULL;
+
+// Song the cursor of the song menu is on
+// Note: only used by the menu thread
+static int cursor_idx = 0;
+
+// Set when songs were added or deleted so the menu thread redraws the list
+static bool library_changed = false;
 
 static SONG_CURSOR_LINE previous_song_cursor = CURSOR_LINE_NOT_SET;
 
 // Song manager for display
 static int previous_song_start_from = -1;
-static int CURRENT_AUTOPLAY_SONG = 0;
+
+// Metrics, see metrics.h
+static metrics_counter_t added_metric;
+static metrics_counter_t deleted_metric;
+static metrics_counter_t plays_metric;
+static metrics_counter_t skips_metric;
+static metrics_gauge_t songs_metric;
+static metrics_gauge_t queued_metric;
+static metrics_gauge_t memory_metric;
 
 /********************************PRIVATE FUNCTIONS***********************************************************/
 // static song_info *create_song_struct(char *name, char *album, char *path);
-static void playSong(wavedata_t *song);
+static void playSong(wavedata_t *song, int location);
 static void displaySongs(SONG_CURSOR_LINE current_song, int from_song_number);
 // static bool previously_displayed(SONG_CURSOR_LINE current_song, int from_song_number);
 static void setSongs(SONG_CURSOR_LINE current_song, char *song1, char *song2, char *song3, char *song4);
 static SONG_CURSOR_LINE getsongCursor(int current_song_number);
 static int getfromSongForDisplay(int current_song_number);
 static int getCurrentSongNumber();
-
-// static void moveCursorNextPage();
-// static void moveCursorPreviousPage();
-// static void clean_passed_song(song_info* song);
-
-// static void moveCursorNextPage()
-// {
-//     doublyLinkedList_iteratorNext(); // 2
-//     doublyLinkedList_iteratorNext(); // 3
-//     doublyLinkedList_iteratorNext(); // 4
-//     doublyLinkedList_iteratorNext(); // 5
-// }
-// static void moveCursorPreviousPage()
-// {
-//     doublyLinkedList_iteratorPrev(); // 4
-//     doublyLinkedList_iteratorPrev(); // 3
-//     doublyLinkedList_iteratorPrev(); // 2
-//     doublyLinkedList_iteratorPrev(); // 1
-// }
+static song_id_t getPlayingSongId(void);
+static song_info *acquireSongAtIndex(int idx);
+static song_info *acquireSongWithId(song_id_t id);
+static void setPlayingSong(song_info *song);
+static void setPlayingSongAt(song_info *song, int location);
+static song_info *allocSong(char *name, char *album, char *path, char *song_name_local);
+static void playFollowingSong(void);
+static song_info *takeFollowingSong(void);
+static song_info *takePreviousSong(void);
+static void indexSong(song_info *song);
+static void unindexSong(song_info *song);
+static void playWholeLibrary(void);
+static void publishActivePlaylist(playlist_snapshot_t *snapshot);
+static void releaseLibraryReference(void *data);
+static void freeSong(song_info *song);
+static void collectMetrics(void);
+static void unlinkSameFile(song_info *song);
+static bool removeSong(song_info *song);
 
 static void setSongs(SONG_CURSOR_LINE current_song, char *song1, char *song2, char *song3, char *song4)
 {
@@ -113,53 +179,289 @@ static void setSongs(SONG_CURSOR_LINE current_song, char *song1, char *song2, ch
 
 static int getCurrentSongNumber()
 {
-    return doublyLinkedList_getCurrentIdx() + 1;
+    // songs deleted from the network can leave the cursor past the end
+    int size = doublyLinkedList_getSize();
+    if (cursor_idx >= size)
+    {
+        cursor_idx = size > 0 ? size - 1 : 0;
+    }
+    return cursor_idx + 1;
 }
 
-static void playSong(wavedata_t *song)
+static void playSong(wavedata_t *song, int location)
 {
-    AudioPlayer_playWAV(song);
+    AudioPlayer_playWAVAt(song, location);
 }
-// static void clean_passed_song(song_info* song) {
-//     if(song != NULL) {
-//         // if(song->album != NULL) {
-//         //     free(song->album);
-//         // }
-//         // if(song->author_name != NULL) {
-//         //     free(song->author_name);
-//         // }
-//         // if(song->song_path != NULL) {
-//         //     free(song->song_path);
-//         // }
-//         free(song);
-//     }
-// }
 
-song_info *create_song_struct(char *name, char *album, char *path, char *song_name_local)
+// Returns the id of the song playing, SONG_ID_INVALID if there is none
+static song_id_t getPlayingSongId(void)
+{
+    pthread_mutex_lock(&playbackMutex);
+    song_id_t id = (current_song_playing != NULL) ? current_song_playing->id : SONG_ID_INVALID;
+    pthread_mutex_unlock(&playbackMutex);
+    return id;
+}
+
+// Returns the song at "idx" with a reference on it, NULL if it was removed from the library
+static song_info *acquireSongAtIndex(int idx)
+{
+    songManager_readLock();
+    song_info *song = songManager_getSongAt(idx);
+    if (song != NULL)
+    {
+        songManager_acquireSong(song);
+    }
+    songManager_readUnlock();
+    return song;
+}
+
+// Returns the song with "id" with a reference on it, NULL if it was removed from the library
+static song_info *acquireSongWithId(song_id_t id)
+{
+    songManager_readLock();
+    song_info *song = songManager_findById(id);
+    if (song != NULL)
+    {
+        songManager_acquireSong(song);
+    }
+    songManager_readUnlock();
+    return song;
+}
+
+// Plays "song", taking over the reference the caller acquired on it
+static void setPlayingSong(song_info *song)
+{
+    setPlayingSongAt(song, 0);
+}
+
+// Plays "song" from sample "location", taking over the reference the caller acquired on it
+static void setPlayingSongAt(song_info *song, int location)
 {
-    song_info *song = malloc(sizeof(*song));
+    trace_begin("setPlayingSongAt");
+    pthread_mutex_lock(&playbackMutex);
+    song_info *previous = current_song_playing;
+    bool skipped = previous != NULL && !current_song_finished;
+    uint64_t previous_key = skipped ? hashMap_hashString(previous->song_path) : 0;
+    uint64_t song_key = hashMap_hashString(song->song_path);
+    playSong(song->pSong_DWave, location);
+    __atomic_store_n(&current_song_playing, song, __ATOMIC_RELEASE);
+    current_song_finished = false;
+    pthread_mutex_unlock(&playbackMutex);
 
-    printf("aritist: <%s>\n", name);
-    printf("album: <%s>\n", album);
-    printf("path: <%s>\n", path);
-    printf("song name: <%s>\n", song_name_local);
+    if (skipped)
+    {
+        playStats_recordSkip(previous_key);
+        metrics_increment(&skips_metric);
+    }
+    playStats_recordPlay(song_key);
+    metrics_increment(&plays_metric);
 
-    song->author_name = (char *)malloc(strlen(name) + 1);
-    song->album = (char *)malloc(strlen(album) + 1);
-    song->song_path = (char *)malloc(strlen(path) + 1);
-    song->song_name = (char *)malloc(strlen(song_name_local) + 1);
+    // the audio thread switched to the new wave data, the old one can go
+    if (previous != NULL)
+    {
+        songManager_releaseSong(previous);
+    }
+    trace_end("setPlayingSongAt");
+}
+
+// Note: caller must hold libraryWriteMutex
+static void indexSong(song_info *song)
+{
+    hashMap_put(songs_by_id, song->id, song);
+    hashMap_put(songs_by_path, hashMap_hashString(song->song_path), song);
+}
 
-    strcpy(song->author_name, name);
-    strcpy(song->album, album);
-    strcpy(song->song_path, path);
-    strcpy(song->song_name, song_name_local);
+// Note: caller must hold libraryWriteMutex
+static void unindexSong(song_info *song)
+{
+    hashMap_remove(songs_by_id, song->id);
+    uint64_t path_key = hashMap_hashString(song->song_path);
+    if (hashMap_get(songs_by_path, path_key) == song)
+    {
+        hashMap_remove(songs_by_path, path_key);
+    }
+}
 
-    song->pSong_DWave = malloc(sizeof(*song->pSong_DWave));
+// Switches back from a playlist to playing through the library
+static void playWholeLibrary(void)
+{
+    pthread_mutex_lock(&libraryWriteMutex);
+    bool was_playlist = active_playlist != NULL;
+    publishActivePlaylist(NULL);
+    pthread_mutex_unlock(&libraryWriteMutex);
+    if (was_playlist)
+    {
+        playOrder_invalidate(SONG_ID_INVALID);
+    }
+}
+
+// Note: caller must hold libraryWriteMutex
+static void publishActivePlaylist(playlist_snapshot_t *snapshot)
+{
+    playlist_snapshot_t *old_snapshot = active_playlist;
+    __atomic_store_n(&active_playlist, snapshot, __ATOMIC_RELEASE);
+    if (old_snapshot != NULL)
+    {
+        Epoch_retire(old_snapshot, free);
+    }
+}
+
+// Drops the reference the library holds once no reader can see the song anymore
+static void releaseLibraryReference(void *data)
+{
+    songManager_releaseSong(data);
+}
+
+// A file that is added again (rewritten, or reported by both the web interface and
+// the songs directory watcher) replaces the song read from it before
+// Note: caller must hold libraryWriteMutex
+static void unlinkSameFile(song_info *song)
+{
+    song_info *old_song = songManager_findByPath(song->song_path);
+    if (old_song != NULL)
+    {
+        unindexSong(old_song);
+        doublyLinkedList_deleteElement(old_song);
+    }
+}
+
+// Removes "song" from the library and returns false if it is NULL
+// Note: caller must hold libraryWriteMutex, which this releases
+static bool removeSong(song_info *song)
+{
+    if (song == NULL)
+    {
+        pthread_mutex_unlock(&libraryWriteMutex);
+        return false;
+    }
+    // playlist positions do not move, the removed song is skipped when its turn comes
+    bool playing_library = active_playlist == NULL;
+    bool was_playing = song == __atomic_load_n(&current_song_playing, __ATOMIC_ACQUIRE);
+    // the song that took the place of a removed playing song plays next
+    song_id_t playing_id = SONG_ID_INVALID;
+    if (playing_library && was_playing)
+    {
+        song_info *previous = doublyLinkedList_getPreviousElement(song);
+        playing_id = (previous != NULL) ? previous->id : SONG_ID_INVALID;
+    }
+
+    // the song is freed once no reader can see it and it stopped playing
+    unindexSong(song);
+    doublyLinkedList_deleteElement(song);
+    pthread_mutex_unlock(&libraryWriteMutex);
+    metrics_increment(&deleted_metric);
+
+    if (playing_library)
+    {
+        playOrder_invalidate(was_playing ? playing_id : getPlayingSongId());
+    }
+    __atomic_store_n(&library_changed, true, __ATOMIC_RELEASE);
+    return true;
+}
+
+static void freeSong(song_info *song)
+{
+    size_t strings_size = strlen(song->song_path) + strlen(song->song_name) + 2;
+    __atomic_sub_fetch(&song_block_bytes, sizeof(song_block_t) + strings_size, __ATOMIC_RELAXED);
+    AudioPlayer_freeWaveFileData(song->pSong_DWave);
+    doublyLinkedList_freeElement(song);
+}
+
+// Updates the gauges of the library when the metrics are exported
+static void collectMetrics(void)
+{
+    stringPool_stats_t pool;
+    stringPool_getStats(&pool);
+    metrics_set(&songs_metric, doublyLinkedList_getSize());
+    metrics_set(&queued_metric, playQueue_getSize());
+    metrics_set(&memory_metric, __atomic_load_n(&song_block_bytes, __ATOMIC_RELAXED) + pool.allocated_bytes);
+}
+
+song_info *create_song_struct(char *name, char *album, char *path, char *song_name_local)
+{
+    song_info *song = allocSong(name, album, path, song_name_local);
     AudioPlayer_readWaveFileIntoMemory(song->song_path, song->pSong_DWave);
+    return song;
+}
 
+// Returns a new song with its strings set, its wave data is not read yet
+static song_info *allocSong(char *name, char *album, char *path, char *song_name_local)
+{
+    LOG_DEBUG("song <%s>, artist <%s>, album <%s>, path <%s>", song_name_local, name, album, path);
+
+    // the song, its wave header and its own strings share the list element
+    size_t path_size = strlen(path) + 1;
+    size_t name_size = strlen(song_name_local) + 1;
+    song_block_t *block = doublyLinkedList_allocElement(sizeof(*block) + path_size + name_size);
+    song_info *song = &block->info;
+
+    // artists and albums repeat across songs, they are shared
+    song->author_name = stringPool_intern(name);
+    song->album = stringPool_intern(album);
+    song->song_path = block->strings;
+    song->song_name = block->strings + path_size;
+    memcpy(song->song_path, path, path_size);
+    memcpy(song->song_name, song_name_local, name_size);
+
+    song->pSong_DWave = &block->wave;
+    song->id = __atomic_fetch_add(&next_song_id, 1, __ATOMIC_RELAXED);
+    // the reference held by the library
+    song->refcount = 1;
+
+    __atomic_add_fetch(&song_block_bytes, sizeof(*block) + path_size + name_size, __ATOMIC_RELAXED);
     return song;
 }
 
+void songManager_destroySongStruct(song_info *song)
+{
+    freeSong(song);
+}
+
+void songManager_resumeSong(char *name, char *album, char *path, char *song_name_local, int location)
+{
+    // only the part about to play is read before playback starts
+    song_info *song = allocSong(name, album, path, song_name_local);
+    AudioPlayer_readWaveFileFrom(song->song_path, song->pSong_DWave, location);
+    // the reference handed over to setPlayingSongAt()
+    songManager_acquireSong(song);
+    songManager_addSongBack(song);
+
+    playWholeLibrary();
+    playOrder_setCurrentById(song->id);
+    setPlayingSongAt(song, location);
+}
+
+bool songManager_playPathAt(const char *path, int location)
+{
+    pthread_mutex_lock(&playbackMutex);
+    song_info *playing = current_song_playing;
+    if (playing != NULL && strcmp(playing->song_path, path) == 0)
+    {
+        playSong(playing->pSong_DWave, location);
+        pthread_mutex_unlock(&playbackMutex);
+        return true;
+    }
+    pthread_mutex_unlock(&playbackMutex);
+
+    songManager_readLock();
+    song_info *song = songManager_findByPath(path);
+    if (song != NULL)
+    {
+        // the reference handed over to setPlayingSongAt()
+        songManager_acquireSong(song);
+    }
+    songManager_readUnlock();
+    if (song == NULL)
+    {
+        return false;
+    }
+
+    playWholeLibrary();
+    playOrder_setCurrentById(song->id);
+    setPlayingSongAt(song, location);
+    return true;
+}
+
 // Returns where the song cursor is located at -- Cursor can be #1, #2, #3, #4
 static SONG_CURSOR_LINE getsongCursor(int current_song_number)
 {
@@ -221,144 +523,43 @@ static int getfromSongForDisplay(int current_song_number)
 // Displays all the songs
 static void displaySongs(SONG_CURSOR_LINE current_song, int from_song_number)
 {
-    // if(previously_displayed(current_song, from_song_number)) {
-    //     return;
-    // }
-    song_info *temp1;
-    song_info *temp2;
-    song_info *temp3;
-    song_info *temp4;
+    char lines[4][DISPLAY_LINE_LEN];
 
-    temp1 = doublyLinkedList_getCurrentIteratorElement();
-    if (doublyLinkedList_iteratorNext())
-    {
-        temp2 = doublyLinkedList_getCurrentIteratorElement();
-    }
-    else
-    {
-        temp2 = NULL;
-    }
-    if (doublyLinkedList_iteratorNext())
-    {
-        temp3 = doublyLinkedList_getCurrentIteratorElement();
-    }
-    else
+    // copy the names so the LCD is not written while songs are pinned
+    songManager_readLock();
+    for (int i = 0; i < 4; i++)
     {
-        temp3 = NULL;
+        song_info *song = doublyLinkedList_getElementAtIndex(from_song_number - 1 + i);
+        snprintf(lines[i], DISPLAY_LINE_LEN, "%s", song != NULL ? song->author_name : "  ");
     }
-    if (doublyLinkedList_iteratorNext())
-    {
-        temp4 = doublyLinkedList_getCurrentIteratorElement();
-    }
-    else
-    {
-        temp4 = NULL;
-    }
-    // char songtemp1[strlen(temp1->author_name) + strlen(temp1->album) + 1];
-    // char songtemp2[strlen(temp2->author_name) + strlen(temp2->album) + 1];
-    // char songtemp3[strlen(temp3->author_name) + strlen(temp3->album) + 1];
-    // char songtemp4[strlen(temp4->author_name) + strlen(temp4->album) + 1];
+    songManager_readUnlock();
 
-    char *songtemp1 = NULL;
-    char *songtemp2 = NULL;
-    char *songtemp3 = NULL;
-    char *songtemp4 = NULL;
-    if (temp1 != NULL)
-    {
-        songtemp1 = (char *)malloc(strlen(temp1->author_name) + 1);
-    }
-    else
-    {
-        songtemp1 = (char *)malloc(3);
-    }
-    if (temp2 != NULL)
-    {
-        songtemp2 = (char *)malloc(strlen(temp2->author_name) + 1);
-    }
-    else
-    {
-        songtemp2 = (char *)malloc(3);
-    }
-    if (temp3 != NULL)
-    {
-        songtemp3 = (char *)malloc(strlen(temp3->author_name) + 1);
-    }
-    else
-    {
-        songtemp3 = (char *)malloc(3);
-    }
-    if (temp4 != NULL)
-    {
-        songtemp4 = (char *)malloc(strlen(temp4->author_name) + 1);
-    }
-    else
-    {
-        songtemp4 = (char *)malloc(3);
-    }
-
-    //     char songtemp1[strlen(temp1->author_name) + 1];
-    //     char songtemp2[strlen(temp2->author_name) + 1];
-    //     char songtemp3[strlen(temp3->author_name) + 1];
-    //     char songtemp4[strlen(temp4->author_name) + 1];
-
-    if (temp1 != NULL)
-    {
-        strcpy(songtemp1, temp1->author_name);
-        // strcat(songtemp1, temp1->album);
-    }
-    else
-    {
-        char *cpy = "  ";
-        strcpy(songtemp1, cpy);
-    }
-
-    if (temp2 != NULL)
-    {
-        strcpy(songtemp2, temp2->author_name);
-        // strcat(songtemp2, temp2->album);
-    }
-    else
-    {
-        char *cpy = "  ";
-        strcpy(songtemp2, cpy);
-    }
-    if (temp3 != NULL)
-    {
-        strcpy(songtemp3, temp3->author_name);
-        //  strcat(songtemp3, temp3->album);
-    }
-    else
-    {
-        char *cpy = "  ";
-        strcpy(songtemp3, cpy);
-    }
-    if (temp4 != NULL)
-    {
-        strcpy(songtemp4, temp4->author_name);
-        // strcat(songtemp4, temp4->album);
-    }
-    else
-    {
-        char *cpy = "  ";
-        strcpy(songtemp4, cpy);
-    }
-
-    setSongs(current_song, songtemp1, songtemp2, songtemp3, songtemp4);
+    setSongs(current_song, lines[0], lines[1], lines[2], lines[3]);
     previous_song_cursor = current_song;
     previous_song_start_from = from_song_number;
-    free(songtemp1);
-    free(songtemp2);
-    free(songtemp3);
-    free(songtemp4);
-    doublyLinkedList_setIteratorStartPosition();
-
-    // iterate_through_all_songs();
 }
 
 /***************************************PUBLIC FUNCTIONS****************************************************************/
 void songManager_init()
 {
-    doublyLinkedList_init();
+    next_song_id = ((song_id_t)time(NULL) << 32) | 1;
+    doublyLinkedList_init(releaseLibraryReference);
+    stringPool_init();
+    playOrder_init();
+    playlist_init();
+    playQueue_init();
+    songs_by_id = hashMap_create(64);
+    songs_by_path = hashMap_create(64);
+
+    metrics_registerCounter(&added_metric, "beaglepod_library_added_total", NULL, "Songs added to the library");
+    metrics_registerCounter(&deleted_metric, "beaglepod_library_deleted_total", NULL, "Songs deleted from the library");
+    metrics_registerCounter(&plays_metric, "beaglepod_library_plays_total", NULL, "Songs started");
+    metrics_registerCounter(&skips_metric, "beaglepod_library_skips_total", NULL, "Songs left before their end");
+    metrics_registerGauge(&songs_metric, "beaglepod_library_songs", NULL, "Songs in the library");
+    metrics_registerGauge(&queued_metric, "beaglepod_library_queued_songs", NULL, "Songs in the up next queue");
+    metrics_registerGauge(&memory_metric, "beaglepod_library_memory_bytes", NULL,
+                          "Memory taken by the songs and their metadata, the audio excluded");
+    metrics_registerCollector(collectMetrics);
 
     /**** TESTING********/
 
@@ -410,33 +611,273 @@ void songManager_init()
 
 void songManager_playSong()
 {
-    song_info *temp = doublyLinkedList_getCurrentElement();
-    CURRENT_AUTOPLAY_SONG = doublyLinkedList_getCurrentIdx();
+    songManager_readLock();
+    song_info *temp = doublyLinkedList_getElementAtIndex(cursor_idx);
+    if (temp != NULL)
+    {
+        songManager_acquireSong(temp);
+    }
+    songManager_readUnlock();
+
     if (temp == NULL)
     {
-        printf("Song does not exist\n");
+        LOG_WARNING("Song does not exist");
     }
     else
     {
-        current_song_playing = temp;
-        playSong(current_song_playing->pSong_DWave);
+        playWholeLibrary();
+        playOrder_setCurrent(cursor_idx);
+        setPlayingSong(temp);
+    }
+}
+
+void songManager_enqueueSong(void)
+{
+    songManager_readLock();
+    song_info *song = doublyLinkedList_getElementAtIndex(cursor_idx);
+    song_id_t id = (song != NULL) ? song->id : SONG_ID_INVALID;
+    songManager_readUnlock();
+
+    if (id != SONG_ID_INVALID && !playQueue_pushBack(id))
+    {
+        LOG_WARNING("Up Next is full");
     }
 }
 
 void songManager_AutoPlayNext(void)
 {
-    CURRENT_AUTOPLAY_SONG++;
-    song_info *song = (song_info *)doublyLinkedList_getElementAtIndex(CURRENT_AUTOPLAY_SONG);
-    playSong(song->pSong_DWave);
+    pthread_mutex_lock(&playbackMutex);
+    current_song_finished = true;
+    pthread_mutex_unlock(&playbackMutex);
+    playFollowingSong();
+}
+
+void songManager_playNext(void)
+{
+    playFollowingSong();
+}
+
+// Plays what comes after the current song without marking it finished
+static void playFollowingSong(void)
+{
+    song_info *song = takeFollowingSong();
+    if (song != NULL)
+    {
+        setPlayingSong(song);
+    }
+}
+
+// Moves to the song that comes next and returns it with a reference on it, NULL at the end
+static song_info *takeFollowingSong(void)
+{
+    // songs queued with "Up Next" play first, deleted ones are skipped
+    song_id_t id;
+    while (playQueue_popFront(&id))
+    {
+        song_info *song = acquireSongWithId(id);
+        if (song != NULL)
+        {
+            return song;
+        }
+    }
+
+    // songs of a playlist that were removed from the library are skipped
+    int attempts = songManager_getNumberSongs();
+    for (int i = 0; i < attempts; i++)
+    {
+        int idx = playOrder_next();
+        song_info *song = (idx >= 0) ? acquireSongAtIndex(idx) : NULL;
+        if (idx < 0 || song != NULL)
+        {
+            return song;
+        }
+    }
+    return NULL;
+}
+
+// Moves to the song that came before and returns it with a reference on it, NULL at the start
+static song_info *takePreviousSong(void)
+{
+    int attempts = songManager_getNumberSongs();
+    for (int i = 0; i < attempts; i++)
+    {
+        int idx = playOrder_previous();
+        song_info *song = (idx >= 0) ? acquireSongAtIndex(idx) : NULL;
+        if (idx < 0 || song != NULL)
+        {
+            return song;
+        }
+    }
+    return NULL;
+}
+
+void songManager_playPrevious(void)
+{
+    song_info *song = takePreviousSong();
+    if (song != NULL)
+    {
+        setPlayingSong(song);
+    }
+}
+
+void songManager_skip(int count)
+{
+    // the songs passed over are never started, nor counted as skipped
+    song_info *song = NULL;
+    for (int i = 0; i < abs(count); i++)
+    {
+        song_info *next = (count > 0) ? takeFollowingSong() : takePreviousSong();
+        if (next == NULL)
+        {
+            break;
+        }
+        if (song != NULL)
+        {
+            songManager_releaseSong(song);
+        }
+        song = next;
+    }
+    if (song != NULL)
+    {
+        setPlayingSong(song);
+    }
+}
+
+void songManager_playPlaylist(int playlist)
+{
+    song_id_t *ids = NULL;
+    int size = playlist_copySongIds(playlist, &ids);
+    if (size < 0)
+    {
+        LOG_WARNING("Playlist does not exist");
+        return;
+    }
+    playlist_snapshot_t *snapshot = malloc(sizeof(*snapshot) + size * sizeof(song_id_t));
+    if (snapshot == NULL)
+    {
+        fprintf(stderr, "%s\n", "songManager_playPlaylist(): Error - There was a problem allocating memory.");
+        exit(1);
+    }
+    snapshot->size = size;
+    memcpy(snapshot->ids, ids, size * sizeof(song_id_t));
+    free(ids);
+
+    pthread_mutex_lock(&libraryWriteMutex);
+    publishActivePlaylist(snapshot);
+    pthread_mutex_unlock(&libraryWriteMutex);
+    playOrder_invalidate(SONG_ID_INVALID);
+    playFollowingSong();
+}
+
+int songManager_getNumberSongs(void)
+{
+    Epoch_enter();
+    playlist_snapshot_t *snapshot = __atomic_load_n(&active_playlist, __ATOMIC_ACQUIRE);
+    int size = (snapshot != NULL) ? snapshot->size : doublyLinkedList_getSize();
+    Epoch_exit();
+    return size;
+}
+
+song_info *songManager_getSongAt(int position)
+{
+    song_info *song = NULL;
+    Epoch_enter();
+    playlist_snapshot_t *snapshot = __atomic_load_n(&active_playlist, __ATOMIC_ACQUIRE);
+    if (snapshot == NULL)
+    {
+        song = doublyLinkedList_getElementAtIndex(position);
+    }
+    else if (position >= 0 && position < snapshot->size)
+    {
+        song = songManager_findById(snapshot->ids[position]);
+    }
+    Epoch_exit();
+    return song;
+}
+
+song_info *songManager_findById(song_id_t id)
+{
+    return hashMap_get(songs_by_id, id);
+}
+
+song_id_t songManager_getIdByPathKey(uint64_t path_key)
+{
+    Epoch_enter();
+    song_info *song = hashMap_get(songs_by_path, path_key);
+    song_id_t id = (song != NULL) ? song->id : SONG_ID_INVALID;
+    Epoch_exit();
+    return id;
+}
+
+song_info *songManager_findByPath(const char *path)
+{
+    Epoch_enter();
+    song_info *song = hashMap_get(songs_by_path, hashMap_hashString(path));
+    if (song != NULL && strcmp(song->song_path, path) != 0)
+    {
+        song = NULL;
+    }
+    Epoch_exit();
+    return song;
+}
+
+void songManager_readLock(void)
+{
+    Epoch_enter();
+}
+
+void songManager_readUnlock(void)
+{
+    Epoch_exit();
+}
+
+void songManager_acquireSong(song_info *song)
+{
+    __atomic_add_fetch(&song->refcount, 1, __ATOMIC_RELAXED);
+}
+
+void songManager_releaseSong(song_info *song)
+{
+    if (__atomic_sub_fetch(&song->refcount, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        freeSong(song);
+    }
+}
+
+bool songManager_consumeLibraryChanged(void)
+{
+    return __atomic_exchange_n(&library_changed, false, __ATOMIC_ACQ_REL);
 }
 
 void songManager_addSongFront(song_info *song)
 {
-    doublyLinkedList_prependItem(song, sizeof(*song));
+    pthread_mutex_lock(&libraryWriteMutex);
+    unlinkSameFile(song);
+    doublyLinkedList_prependElement(song);
+    indexSong(song);
+    bool playing_library = active_playlist == NULL;
+    pthread_mutex_unlock(&libraryWriteMutex);
+    metrics_increment(&added_metric);
+    if (playing_library)
+    {
+        playOrder_invalidate(getPlayingSongId());
+    }
+    __atomic_store_n(&library_changed, true, __ATOMIC_RELEASE);
 }
 void songManager_addSongBack(song_info *song)
 {
-    doublyLinkedList_appendItem(song, sizeof(*song));
+    pthread_mutex_lock(&libraryWriteMutex);
+    unlinkSameFile(song);
+    doublyLinkedList_appendElement(song);
+    indexSong(song);
+    bool playing_library = active_playlist == NULL;
+    pthread_mutex_unlock(&libraryWriteMutex);
+    metrics_increment(&added_metric);
+    if (playing_library)
+    {
+        playOrder_invalidate(getPlayingSongId());
+    }
+    __atomic_store_n(&library_changed, true, __ATOMIC_RELEASE);
 }
 
 void songManager_displaySongs()
@@ -449,47 +890,104 @@ void songManager_displaySongs()
     }
     int current_song_number = getCurrentSongNumber();
     int from_song = getfromSongForDisplay(current_song_number);
-    doublyLinkedList_setIterator(from_song - 1);
 
     SONG_CURSOR_LINE song_cursor = getsongCursor(current_song_number);
     displaySongs(song_cursor, from_song);
-    printf("finished displaying, current_song_number: %d, song_cursor: %d from song: %d\n", current_song_number, song_cursor, from_song);
+    LOG_DEBUG("finished displaying, current_song_number: %d, song_cursor: %d from song: %d", current_song_number,
+              song_cursor, from_song);
 }
 
 void songManager_reset()
 {
     // current_song_number = 1;
-    doublyLinkedList_setCurrent(0);
-    doublyLinkedList_setIteratorStartPosition();
+    cursor_idx = 0;
     previous_song_cursor = CURSOR_LINE_NOT_SET;
     previous_song_start_from = -1;
 }
 void songManager_moveCursorDown()
 {
-    doublyLinkedList_next();
+    if (cursor_idx + 1 < doublyLinkedList_getSize())
+    {
+        cursor_idx++;
+    }
     songManager_displaySongs();
 }
 
 void songManager_moveCursorUp()
 {
-    doublyLinkedList_prev();
+    if (cursor_idx > 0)
+    {
+        cursor_idx--;
+    }
     songManager_displaySongs();
 }
 
-void songManager_deleteSong(int index)
+bool songManager_deleteSongById(song_id_t id)
 {
-    doublyLinkedList_delete(index);
-    songManager_displaySongs();
+    pthread_mutex_lock(&libraryWriteMutex);
+    return removeSong(songManager_findById(id));
+}
+
+bool songManager_deleteSongByPath(const char *path)
+{
+    pthread_mutex_lock(&libraryWriteMutex);
+    song_info *song = songManager_findByPath(path);
+    return removeSong(song);
+}
+
+void songManager_printMemoryReport(FILE *out)
+{
+    stringPool_stats_t pool;
+    stringPool_getStats(&pool);
+    int num_songs = doublyLinkedList_getSize();
+    size_t block_bytes = __atomic_load_n(&song_block_bytes, __ATOMIC_RELAXED);
+    size_t total = block_bytes + pool.allocated_bytes;
+
+    fprintf(out, "songs: %d\n", num_songs);
+    fprintf(out, "song blocks: %zu bytes\n", block_bytes);
+    fprintf(out, "shared strings: %zu stored for %zu uses (%zu bytes used, %zu bytes allocated)\n",
+            pool.num_strings, pool.num_lookups, pool.string_bytes, pool.allocated_bytes);
+    if (num_songs > 0)
+    {
+        fprintf(out, "metadata per song: %zu bytes\n", total / num_songs);
+    }
 }
 
-// Gets the data of the "current"
 song_info *songManager_getCurrentSongPlaying(void)
 {
-    return current_song_playing;
+    pthread_mutex_lock(&playbackMutex);
+    song_info *song = current_song_playing;
+    if (song != NULL)
+    {
+        songManager_acquireSong(song);
+    }
+    pthread_mutex_unlock(&playbackMutex);
+    return song;
 }
 
 // Frees the memory for all nodes, the data, and the List struct
 void songManager_cleanup(void)
 {
+    pthread_mutex_lock(&playbackMutex);
+    if (current_song_playing != NULL)
+    {
+        songManager_releaseSong(current_song_playing);
+        current_song_playing = NULL;
+    }
+    pthread_mutex_unlock(&playbackMutex);
+
+    playlist_cleanup();
+    playQueue_cleanup();
+    playOrder_cleanup();
+
+    pthread_mutex_lock(&libraryWriteMutex);
+    publishActivePlaylist(NULL);
+    pthread_mutex_unlock(&libraryWriteMutex);
+
+    // deleted songs still waiting for readers go first, they need the list
+    Epoch_cleanup();
+    hashMap_destroy(songs_by_id);
+    hashMap_destroy(songs_by_path);
     doublyLinkedList_cleanup();
+    stringPool_cleanup();
 }
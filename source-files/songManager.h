@@ -6,21 +6,36 @@
  * for the songManager module, which provides the utilities for
  * for playing, stopping and traversing in the list of songs.
  *
+ * Thread safety: changes to the library are serialized internally. Reads
+ * never block: a song returned by a lookup stays valid until the matching
+ * songManager_readUnlock(), or until songManager_releaseSong() for a song
+ * that was acquired.
+ *
  * @author Mehdi Esmaeilzadeh
  * @date 2023-03-10
  */
 
 #if !defined(SONG_MANAGER_H)
 #define SONG_MANAGER_H
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
 #include "audio_player.h"
 
+// Identifies a song for as long as it is in the library; ids are never reused,
+// not even across restarts, so a stale id from a client can never match another song
+typedef uint64_t song_id_t;
+#define SONG_ID_INVALID 0
+
 typedef struct
 {
   char *song_path;
-  char *author_name;
-  char *album;
+  const char *author_name; // shared with the songs of the same artist
+  const char *album;       // shared with the songs of the same album
   char *song_name;
   wavedata_t *pSong_DWave;
+  song_id_t id;
+  int refcount; // the library and every acquired reference hold one
 } song_info;
 
 typedef enum
@@ -33,10 +48,22 @@ typedef enum
   NUM_CURSOR_POSITIONS
 } SONG_CURSOR_LINE;
 
+/* Plays the next song of the Up Next queue (see playQueue.h), or else of the play order
+   (see playOrder.h), once the current one ends */
 void songManager_AutoPlayNext(void);
 void songManager_init(void);
+/* Skips to the next song of the play order */
+void songManager_playNext(void);
+/* Goes back to the previously played song */
+void songManager_playPrevious(void);
+/* Moves "count" songs forward (backward if negative) like as many next/previous presses,
+   but only starts the song it ends on */
+void songManager_skip(int count);
 /* Plays the song that the cursor is pointing at */
 void songManager_playSong();
+/* Adds the song that the cursor is pointing at to the end of the Up Next queue */
+void songManager_enqueueSong(void);
+// Note: a song already in the library with the same path is replaced
 /* Adds the song to the front of the list*/
 void songManager_addSongFront(song_info *);
 /* Adds the song to the back of the list*/
@@ -51,14 +78,58 @@ void songManager_moveCursorUp(void);
 void songManager_displaySongs();
 
 /*Create Song struct */
+// The strings are copied; the song is handed to the library as is by songManager_addSongFront()
+// or songManager_addSongBack(), otherwise it must be freed with songManager_destroySongStruct()
 song_info *create_song_struct(char *name, char *album, char *path, char *song_name_local);
+/* Frees a song from create_song_struct() that was not added to the library */
+void songManager_destroySongStruct(song_info *song);
+/* Adds the song stored at "path" and plays it from sample "location", as soon as
+   the samples from there on start to be read (see AudioPlayer_readWaveFileFrom()) */
+void songManager_resumeSong(char *name, char *album, char *path, char *song_name_local, int location);
+/* Plays the library song stored at "path" from sample "location", returns false if it is not in the library */
+// Note: the song playing only moves to "location" if it is the one stored at "path"
+bool songManager_playPathAt(const char *path, int location);
 /* Song Mananger Delete a song*/
-void songManager_deleteSong();
+// Deletes the song with "id", returns false if it is not in the library
+// Note: a song that is playing keeps playing until the next one starts
+bool songManager_deleteSongById(song_id_t id);
+/* Deletes the song stored at "path", returns false if it is not in the library */
+bool songManager_deleteSongByPath(const char *path);
+
+/* Starts a read section: songs looked up until songManager_readUnlock() are not freed */
+// Note: never blocks; sections can be nested
+void songManager_readLock(void);
+/* Ends the read section started by songManager_readLock() */
+void songManager_readUnlock(void);
+/* Keeps "song" alive past the end of the read section it was looked up in */
+void songManager_acquireSong(song_info *song);
+/* Drops a reference from songManager_acquireSong(); the last one frees the song */
+void songManager_releaseSong(song_info *song);
+/* Returns true once after songs were added or deleted, so the song menu can be redrawn */
+bool songManager_consumeLibraryChanged(void);
+
+/* Returns the song with "id" or NULL if it is not in the library */
+song_info *songManager_findById(song_id_t id);
+/* Returns the song stored at "path" or NULL if it is not in the library */
+song_info *songManager_findByPath(const char *path);
+/* Returns the id of the song whose path hashes to "path_key" (see playStats.h), SONG_ID_INVALID if there is none */
+song_id_t songManager_getIdByPathKey(uint64_t path_key);
+
+/* Plays the songs of a playlist (see playlist.h) instead of the whole library */
+void songManager_playPlaylist(int playlist);
+/* Returns the number of songs in what is being played (the library or a playlist) */
+int songManager_getNumberSongs(void);
+/* Returns the song at "position" of what is being played, NULL if it was removed */
+song_info *songManager_getSongAt(int position);
 
 /* Returns song_info struct to the user*/
-// Gets current song_playing
+// Gets current song_playing, or NULL if nothing was played yet
+// Note: caller must call songManager_releaseSong() on the result
 song_info *songManager_getCurrentSongPlaying(void);
 
+// Prints the memory used by the song metadata of the library (wave data excluded)
+void songManager_printMemoryReport(FILE *out);
+
 // Frees the memory for all data
 void songManager_cleanup(void);
 
@@ -0,0 +1,615 @@
+/**
+ * @file songWatcher.c
+ * @brief This is a source file for the songWatcher module.
+ *
+ * This source file contains the declaration of the functions
+ * for the songWatcher module, which keeps the song library in sync
+ * with the WAV files of a songs directory using inotify.
+ *
+ * Only finished files are picked up: a file is considered once its writer
+ * closed it (IN_CLOSE_WRITE) or it was moved in (IN_MOVED_TO), and its WAV
+ * header must match its size. Events are collected per file name, the
+ * last one winning, and applied together once the directory was quiet
+ * for SETTLE_TIME_MS, so copying a whole album is one batch.
+ *
+ * Songs added over the network are read by the same thread, in the order
+ * songWatcher_loadSong() queued them, so the thread that queued them is
+ * free as soon as they are queued. An eventfd wakes the thread up for them.
+ *
+ * Collections of MP3 files are imported through the conversions queued
+ * in the mp3ToWav module: each song is converted into a hidden file and
+ * added by songWatcher_addFile() once it is complete, with the name of
+ * its directory as its album.
+ *
+ * @author Amirhossein Etaati
+ * @date 2023-04-08
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+
+#include "songWatcher.h"
+#include "songManager.h"
+#include "mp3ToWav.h"
+#include "logger.h"
+
+// Time without events before a batch is applied
+#define SETTLE_TIME_MS 500
+// Time between checks for cleanup while nothing is pending
+#define IDLE_POLL_MS 250
+// File names waiting in a batch; a full batch is applied right away
+#define MAX_PENDING_FILES 64
+// Files added by songWatcher_addFile() whose events were not seen yet; more than a full batch,
+// which is applied right away, so an import adding songs faster than batches settle never overflows
+#define MAX_ADDED_FILES (2 * MAX_PENDING_FILES)
+// Songs of songWatcher_loadSong() waiting to be read
+#define MAX_QUEUED_LOADS 8
+// Directories an import goes down into
+#define IMPORT_MAX_DEPTH 8
+
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_DELETE_SELF | IN_MOVE_SELF)
+#define EVENT_BUFFER_SIZE (16 * (sizeof(struct inotify_event) + NAME_MAX + 1))
+
+#define WAV_HEADER_SIZE 44
+#define UNKNOWN_ARTIST "Unknown artist"
+#define UNKNOWN_ALBUM "Unknown album"
+
+typedef struct
+{
+    char name[NAME_MAX + 1];
+    bool present; // false once the file was deleted or moved away
+} pending_file_t;
+
+// A song being converted by an import
+typedef struct
+{
+    char name[NAME_MAX + 1]; // of its WAV file
+    char album[NAME_MAX + 1];
+} import_t;
+
+// A song queued by songWatcher_loadSong()
+typedef struct
+{
+    char path[PATH_MAX];
+    char artist[NAME_MAX + 1];
+    char album[NAME_MAX + 1];
+    char title[NAME_MAX + 1];
+    songWatcher_loaded_t done;
+    void *context;
+} load_t;
+
+static pthread_t songWatcherThreadId;
+static bool stoppingWatcher = false;
+static bool is_module_initialized = false;
+
+static char songs_directory[PATH_MAX];
+static int inotify_fd = -1;
+// written by songWatcher_loadSong() to wake the thread up
+static int wake_fd = -1;
+
+static load_t loads[MAX_QUEUED_LOADS];
+static int first_load = 0;
+static int num_loads = 0;
+static pthread_mutex_t loadsMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static pending_file_t pending[MAX_PENDING_FILES];
+static int num_pending = 0;
+
+// the song of such a file was already added with its metadata, its event must not replace it
+static char added_files[MAX_ADDED_FILES][NAME_MAX + 1];
+static int next_added_file = 0;
+static pthread_mutex_t addedFilesMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int next_import = 0;
+
+// Private functions definitions
+static void *songWatcherThread(void *arg);
+static void scanDirectory(void);
+static bool readEvents(void);
+static void addPending(const char *name, bool present);
+static void applyPending(void);
+static void runLoads(void);
+static void ingestFile(const char *name, bool reread);
+static bool consumeAddedFile(const char *name);
+static void parseFileName(const char *name, char *artist, char *title);
+static int importFrom(const char *directory, const char *album, int depth);
+static bool importFile(const char *path, const char *file_name, const char *album);
+static void importDone(const char *mp3_path, const char *wav_path, bool converted, void *context);
+static bool hasExtension(const char *name, const char *extension);
+static bool buildPath(const char *name, char *path, size_t size);
+static bool isWavName(const char *name);
+static bool isCompleteWav(const char *path);
+static long long getTimeInMs(void);
+
+//------------------------------------------------
+//////////////// Public Functions ////////////////
+//------------------------------------------------
+
+void songWatcher_init(const char *songs_dir)
+{
+    snprintf(songs_directory, sizeof(songs_directory), "%s", songs_dir);
+
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd < 0)
+    {
+        LOG_ERROR("Unable to create the eventfd of the song watcher");
+        return;
+    }
+    // the songs of songWatcher_loadSong() are still read without the directory
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd < 0 || inotify_add_watch(inotify_fd, songs_directory, WATCH_EVENTS) < 0)
+    {
+        LOG_ERROR("Unable to watch songs directory <%s>", songs_directory);
+        if (inotify_fd >= 0)
+        {
+            close(inotify_fd);
+            inotify_fd = -1;
+        }
+    }
+
+    num_loads = 0;
+    stoppingWatcher = false;
+    pthread_create(&songWatcherThreadId, NULL, songWatcherThread, NULL);
+    is_module_initialized = true;
+}
+
+bool songWatcher_addFile(const char *file_path, const char *name, const char *artist, const char *album, const char *title)
+{
+    char path[PATH_MAX];
+    if (!isWavName(name) || strchr(name, '/') != NULL || !buildPath(name, path, sizeof(path)) || !isCompleteWav(file_path))
+    {
+        return false;
+    }
+
+    pthread_mutex_lock(&addedFilesMutex);
+    snprintf(added_files[next_added_file], sizeof(added_files[next_added_file]), "%s", name);
+    next_added_file = (next_added_file + 1) % MAX_ADDED_FILES;
+    pthread_mutex_unlock(&addedFilesMutex);
+
+    if (rename(file_path, path) != 0)
+    {
+        consumeAddedFile(name);
+        LOG_ERROR("Unable to move <%s> to <%s>", file_path, path);
+        return false;
+    }
+    songManager_addSongBack(create_song_struct((char *)artist, (char *)album, path, (char *)title));
+    return true;
+}
+
+bool songWatcher_loadSong(const char *path, const char *artist, const char *album, const char *title,
+                          songWatcher_loaded_t done, void *context)
+{
+    if (!is_module_initialized || strlen(path) >= PATH_MAX)
+    {
+        return false;
+    }
+    pthread_mutex_lock(&loadsMutex);
+    bool queued = num_loads < MAX_QUEUED_LOADS;
+    if (queued)
+    {
+        load_t *load = &loads[(first_load + num_loads) % MAX_QUEUED_LOADS];
+        snprintf(load->path, sizeof(load->path), "%s", path);
+        snprintf(load->artist, sizeof(load->artist), "%s", artist);
+        snprintf(load->album, sizeof(load->album), "%s", album);
+        snprintf(load->title, sizeof(load->title), "%s", title);
+        load->done = done;
+        load->context = context;
+        num_loads++;
+    }
+    pthread_mutex_unlock(&loadsMutex);
+
+    uint64_t wake = 1;
+    if (queued && write(wake_fd, &wake, sizeof(wake)) != sizeof(wake))
+    {
+        LOG_ERROR("Unable to wake the song watcher up");
+    }
+    return queued;
+}
+
+int songWatcher_importDirectory(const char *directory)
+{
+    DIR *dir = opendir(directory);
+    if (dir == NULL)
+    {
+        LOG_ERROR("Unable to open <%s>", directory);
+        return -1;
+    }
+    closedir(dir);
+    return importFrom(directory, UNKNOWN_ALBUM, 0);
+}
+
+void songWatcher_cleanup(void)
+{
+    if (!is_module_initialized)
+    {
+        return;
+    }
+    __atomic_store_n(&stoppingWatcher, true, __ATOMIC_RELEASE);
+    pthread_join(songWatcherThreadId, NULL);
+    if (inotify_fd >= 0)
+    {
+        close(inotify_fd);
+        inotify_fd = -1;
+    }
+    close(wake_fd);
+    wake_fd = -1;
+    is_module_initialized = false;
+}
+
+//------------------------------------------------
+/////////////// Private Functions ////////////////
+//------------------------------------------------
+
+static void *songWatcherThread(void *arg)
+{
+    // files that arrived while the BeaglePod was off; events queue up meanwhile
+    if (inotify_fd >= 0)
+    {
+        scanDirectory();
+    }
+
+    long long batch_deadline = 0;
+    while (!__atomic_load_n(&stoppingWatcher, __ATOMIC_ACQUIRE))
+    {
+        int timeout = IDLE_POLL_MS;
+        if (num_pending > 0)
+        {
+            long long left = batch_deadline - getTimeInMs();
+            timeout = left > 0 ? (int)(left < IDLE_POLL_MS ? left : IDLE_POLL_MS) : 0;
+        }
+
+        // poll() skips inotify_fd once the directory is no longer watched
+        struct pollfd pfds[2] = {{.fd = inotify_fd, .events = POLLIN}, {.fd = wake_fd, .events = POLLIN}};
+        int ready = poll(pfds, 2, timeout);
+        if (ready > 0 && (pfds[0].revents & POLLIN))
+        {
+            if (!readEvents())
+            {
+                close(inotify_fd);
+                inotify_fd = -1;
+            }
+            batch_deadline = getTimeInMs() + SETTLE_TIME_MS;
+        }
+        if (ready > 0 && (pfds[1].revents & POLLIN))
+        {
+            uint64_t wakes = 0;
+            if (read(wake_fd, &wakes, sizeof(wakes)) == sizeof(wakes))
+            {
+                runLoads();
+            }
+        }
+
+        if (num_pending == MAX_PENDING_FILES || (num_pending > 0 && getTimeInMs() >= batch_deadline))
+        {
+            applyPending();
+        }
+    }
+    applyPending();
+    return NULL;
+}
+
+// Adds the WAV files of the directory that are not in the library yet
+static void scanDirectory(void)
+{
+    DIR *dir = opendir(songs_directory);
+    if (dir == NULL)
+    {
+        LOG_ERROR("Unable to open songs directory <%s>", songs_directory);
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL && !__atomic_load_n(&stoppingWatcher, __ATOMIC_ACQUIRE))
+    {
+        if (isWavName(entry->d_name))
+        {
+            ingestFile(entry->d_name, false);
+        }
+    }
+    closedir(dir);
+}
+
+// Returns false once the directory can no longer be watched
+static bool readEvents(void)
+{
+    char buffer[EVENT_BUFFER_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t length;
+    while ((length = read(inotify_fd, buffer, sizeof(buffer))) > 0)
+    {
+        for (char *ptr = buffer; ptr < buffer + length;)
+        {
+            const struct inotify_event *event = (const struct inotify_event *)ptr;
+            ptr += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))
+            {
+                LOG_ERROR("Songs directory <%s> went away, no longer watching it", songs_directory);
+                return false;
+            }
+            if (event->mask & IN_Q_OVERFLOW)
+            {
+                // events were dropped: pick up whatever was added meanwhile
+                applyPending();
+                scanDirectory();
+                continue;
+            }
+            if (event->len == 0 || !isWavName(event->name))
+            {
+                continue;
+            }
+            addPending(event->name, (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) != 0);
+        }
+    }
+    return true;
+}
+
+static void addPending(const char *name, bool present)
+{
+    for (int i = 0; i < num_pending; i++)
+    {
+        if (strcmp(pending[i].name, name) == 0)
+        {
+            pending[i].present = present;
+            return;
+        }
+    }
+    if (num_pending == MAX_PENDING_FILES)
+    {
+        applyPending();
+    }
+    snprintf(pending[num_pending].name, sizeof(pending[num_pending].name), "%s", name);
+    pending[num_pending].present = present;
+    num_pending++;
+}
+
+static void applyPending(void)
+{
+    char path[PATH_MAX];
+    for (int i = 0; i < num_pending; i++)
+    {
+        if (pending[i].present)
+        {
+            // a file written again is read again
+            if (!consumeAddedFile(pending[i].name))
+            {
+                ingestFile(pending[i].name, true);
+            }
+        }
+        else if (buildPath(pending[i].name, path, sizeof(path)))
+        {
+            songManager_deleteSongByPath(path);
+        }
+    }
+    num_pending = 0;
+}
+
+// Reads the songs queued by songWatcher_loadSong(), in order
+static void runLoads(void)
+{
+    load_t load;
+    while (!__atomic_load_n(&stoppingWatcher, __ATOMIC_ACQUIRE))
+    {
+        pthread_mutex_lock(&loadsMutex);
+        bool queued = num_loads > 0;
+        if (queued)
+        {
+            load = loads[first_load];
+            first_load = (first_load + 1) % MAX_QUEUED_LOADS;
+            num_loads--;
+        }
+        pthread_mutex_unlock(&loadsMutex);
+        if (!queued)
+        {
+            return;
+        }
+
+        // the audio player stops on a file it cannot open
+        song_id_t id = SONG_ID_INVALID;
+        if (access(load.path, R_OK) == 0)
+        {
+            song_info *song = create_song_struct(load.artist, load.album, load.path, load.title);
+            // the song may be deleted by another client as soon as it is added
+            id = song->id;
+            songManager_addSongBack(song);
+        }
+        else
+        {
+            LOG_ERROR("Unable to read <%s>", load.path);
+        }
+        load.done(id, load.context);
+    }
+}
+
+// Adds the song stored in "name" unless it is incomplete or, without "reread", already known
+static void ingestFile(const char *name, bool reread)
+{
+    char path[PATH_MAX];
+    if (!buildPath(name, path, sizeof(path)))
+    {
+        return;
+    }
+
+    songManager_readLock();
+    bool known = songManager_findByPath(path) != NULL;
+    songManager_readUnlock();
+    if ((known && !reread) || !isCompleteWav(path))
+    {
+        return;
+    }
+
+    char title[NAME_MAX + 1];
+    char artist[NAME_MAX + 1];
+    parseFileName(name, artist, title);
+    songManager_addSongBack(create_song_struct(artist, UNKNOWN_ALBUM, path, title));
+}
+
+// "Artist - Title.wav" gives the artist, otherwise the file name is the title
+static void parseFileName(const char *name, char *artist, char *title)
+{
+    snprintf(title, NAME_MAX + 1, "%.*s", (int)(strlen(name) - strlen(".wav")), name);
+    snprintf(artist, NAME_MAX + 1, "%s", UNKNOWN_ARTIST);
+    char *separator = strstr(title, " - ");
+    if (separator != NULL && separator != title && separator[3] != '\0')
+    {
+        snprintf(artist, NAME_MAX + 1, "%.*s", (int)(separator - title), title);
+        memmove(title, separator + 3, strlen(separator + 3) + 1);
+    }
+}
+
+// Queues the MP3 files of "directory" and of the directories in it, returns how many were queued
+static int importFrom(const char *directory, const char *album, int depth)
+{
+    DIR *dir = opendir(directory);
+    if (dir == NULL)
+    {
+        return 0;
+    }
+    int queued = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        char path[PATH_MAX];
+        struct stat info;
+        int length = snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
+        if (entry->d_name[0] == '.' || length < 0 || (size_t)length >= sizeof(path) || stat(path, &info) != 0)
+        {
+            continue;
+        }
+        if (S_ISDIR(info.st_mode) && depth < IMPORT_MAX_DEPTH)
+        {
+            // "Artist/Album/Song.mp3": the songs are named after the directory they are in
+            queued += importFrom(path, entry->d_name, depth + 1);
+        }
+        else if (S_ISREG(info.st_mode) && hasExtension(entry->d_name, ".mp3") && importFile(path, entry->d_name, album))
+        {
+            queued++;
+        }
+    }
+    closedir(dir);
+    return queued;
+}
+
+// Returns false if the song of "file_name" is already in the songs directory or could not be queued
+static bool importFile(const char *path, const char *file_name, const char *album)
+{
+    // the import goes on without this song, the player keeps running
+    import_t *import = malloc(sizeof(*import));
+    if (import == NULL)
+    {
+        LOG_ERROR("Unable to allocate the import of <%s>", path);
+        return false;
+    }
+    int length = snprintf(import->name, sizeof(import->name), "%.*s.wav", (int)(strlen(file_name) - strlen(".mp3")), file_name);
+    snprintf(import->album, sizeof(import->album), "%s", album);
+
+    char song_path[PATH_MAX];
+    char temp_name[NAME_MAX + 1];
+    char temp_path[PATH_MAX];
+    struct stat info;
+    snprintf(temp_name, sizeof(temp_name), ".import-%d.wav", __atomic_fetch_add(&next_import, 1, __ATOMIC_RELAXED));
+    if (length < 0 || (size_t)length >= sizeof(import->name) || !buildPath(import->name, song_path, sizeof(song_path)) ||
+        stat(song_path, &info) == 0 || !buildPath(temp_name, temp_path, sizeof(temp_path)) ||
+        !mp3ToWave_queue(path, temp_path, NULL, importDone, import))
+    {
+        free(import);
+        return false;
+    }
+    return true;
+}
+
+// Adds the song of a converted file, called by the mp3ToWav workers
+static void importDone(const char *mp3_path, const char *wav_path, bool converted, void *context)
+{
+    import_t *import = context;
+    char title[NAME_MAX + 1];
+    char artist[NAME_MAX + 1];
+    parseFileName(import->name, artist, title);
+    if (!converted || !songWatcher_addFile(wav_path, import->name, artist, import->album, title))
+    {
+        LOG_ERROR("Unable to import <%s>", mp3_path);
+        unlink(wav_path);
+    }
+    free(import);
+}
+
+// Returns true once for a file added by songWatcher_addFile()
+static bool consumeAddedFile(const char *name)
+{
+    bool added = false;
+    pthread_mutex_lock(&addedFilesMutex);
+    for (int i = 0; i < MAX_ADDED_FILES && !added; i++)
+    {
+        if (strcmp(added_files[i], name) == 0)
+        {
+            added_files[i][0] = '\0';
+            added = true;
+        }
+    }
+    pthread_mutex_unlock(&addedFilesMutex);
+    return added;
+}
+
+// Returns false if the path of "name" does not fit in "path"
+static bool buildPath(const char *name, char *path, size_t size)
+{
+    int length = snprintf(path, size, "%s/%s", songs_directory, name);
+    return length > 0 && (size_t)length < size;
+}
+
+static bool isWavName(const char *name)
+{
+    return name[0] != '.' && hasExtension(name, ".wav");
+}
+
+static bool hasExtension(const char *name, const char *extension)
+{
+    size_t length = strlen(name);
+    return length > strlen(extension) && strcasecmp(name + length - strlen(extension), extension) == 0;
+}
+
+// A WAV file still being written is shorter than its RIFF header says
+static bool isCompleteWav(const char *path)
+{
+    struct stat info;
+    if (stat(path, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size <= WAV_HEADER_SIZE)
+    {
+        return false;
+    }
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        return false;
+    }
+    unsigned char header[12];
+    bool complete = fread(header, 1, sizeof(header), file) == sizeof(header) &&
+                    memcmp(header, "RIFF", 4) == 0 && memcmp(header + 8, "WAVE", 4) == 0;
+    fclose(file);
+    if (!complete)
+    {
+        LOG_ERROR("<%s> is not a WAV file", path);
+        return false;
+    }
+
+    uint32_t riff_size = header[4] | (header[5] << 8) | (header[6] << 16) | ((uint32_t)header[7] << 24);
+    // streaming writers leave 0 or 0xFFFFFFFF until they are done
+    return riff_size != 0 && riff_size != UINT32_MAX && (off_t)riff_size + 8 <= info.st_size;
+}
+
+static long long getTimeInMs(void)
+{
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return spec.tv_sec * 1000LL + spec.tv_nsec / 1000000;
+}
@@ -0,0 +1,58 @@
+/**
+ * @file songWatcher.h
+ * @brief This is a header file for the songWatcher module.
+ *
+ * This header file contains the definitions of the functions
+ * for the songWatcher module, which keeps the song library in sync
+ * with the WAV files of a songs directory using inotify, and imports
+ * collections of MP3 files into it.
+ *
+ * @author Amirhossein Etaati
+ * @date 2023-04-08
+ */
+
+#if !defined(SONG_WATCHER_H)
+#define SONG_WATCHER_H
+
+#include <stdbool.h>
+
+#include "songManager.h"
+
+// Directory the web interface stores the converted songs in
+#define SONG_WATCHER_DEFAULT_DIR "/mnt/remote/myApps/songs"
+
+// Starts the thread that adds the WAV files of "songs_dir" to the library,
+// then follows files written, renamed and deleted in it, and reads the songs of songWatcher_loadSong()
+// Note: the thread runs even if "songs_dir" cannot be watched
+// Note: caller should call songWatcher_cleanup() to stop the thread
+void songWatcher_init(const char *songs_dir);
+
+// Moves the finished WAV file "file_path" into the songs directory as "name" and adds it to the
+// library with the given metadata right away, instead of what the file name says
+// Note: "file_path" must be on the same file system, e.g. a hidden file of the songs directory
+// Returns false if it is not a complete WAV file or could not be moved
+bool songWatcher_addFile(const char *file_path, const char *name, const char *artist, const char *album, const char *title);
+
+// Called on the thread of the module once the song queued by songWatcher_loadSong() is in the library,
+// with its id, or with SONG_ID_INVALID if its file could not be read
+typedef void (*songWatcher_loaded_t)(song_id_t id, void *context);
+
+// Queues the WAV file "path" to be read and added to the library with the given metadata on the
+// thread of the module, which then calls "done" with "context"; the caller does not wait for the read
+// Note: the songs still queued when songWatcher_cleanup() is called are dropped without calling "done"
+// Returns false if too many songs are queued already or the thread is not running
+bool songWatcher_loadSong(const char *path, const char *artist, const char *album, const char *title,
+                          songWatcher_loaded_t done, void *context);
+
+// Queues the conversion of the MP3 files of "directory" and of the directories in it, in the
+// background at a low priority (see mp3ToWav.h); each song is added to the library once it is
+// converted, with the name of its directory as its album
+// Note: the progress of the import is exported through the metrics of the conversions
+// Note: songs already in the songs directory are skipped; mp3ToWave_init() must have been called
+// Returns the number of files queued, -1 if "directory" cannot be read
+int songWatcher_importDirectory(const char *directory);
+
+// Stops the thread
+void songWatcher_cleanup(void);
+
+#endif // SONG_WATCHER_H
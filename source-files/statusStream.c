@@ -0,0 +1,263 @@
+/**
+ * @file statusStream.c
+ * @brief This is a source file for the statusStream module.
+ *
+ * This source file contains the declaration of the functions
+ * for the statusStream module, which samples what the BeaglePod is
+ * playing and encodes what changed since the last sample
+ * (see statusStream.h).
+ *
+ * @author Amirhossein Etaati
+ * @date 2023-04-12
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "statusStream.h"
+#include "menuManager.h"
+#include "playQueue.h"
+#include "audio_player.h"
+
+typedef struct
+{
+    char *buffer;
+    size_t size;
+    size_t length;
+    bool overflow;
+} json_writer_t;
+
+// Private functions definitions
+static long long getTimeInMs(void);
+static int samplesToMs(long long samples);
+static void copyName(char *name, const char *source);
+static void jsonAppend(json_writer_t *json, const char *format, ...);
+static void jsonAppendString(json_writer_t *json, const char *string);
+
+//------------------------------------------------
+//////////////// Public Functions ////////////////
+//------------------------------------------------
+
+void statusStream_sample(statusStream_status_t *status)
+{
+    memset(status, 0, sizeof(*status));
+    status->sampled_ms = getTimeInMs();
+
+    song_info *playing = MenuManager_GetCurrentSongPlaying();
+    if (playing != NULL)
+    {
+        status->track = playing->id;
+        status->duration_ms = samplesToMs(playing->pSong_DWave->numSamples);
+        copyName(status->title, playing->song_name);
+        copyName(status->artist, playing->author_name);
+        int location = AudioPlayer_getLocation(playing->pSong_DWave);
+        status->position_ms = (location > 0) ? samplesToMs(location) : 0;
+        songManager_releaseSong(playing);
+    }
+    status->volume = AudioPlayer_getVolume();
+    status->queue_size = playQueue_copyIds(status->queue, STATUS_STREAM_QUEUE_MAX);
+    if (status->queue_size == STATUS_STREAM_QUEUE_MAX)
+    {
+        status->queue_size = playQueue_getSize();
+    }
+}
+
+unsigned statusStream_diff(statusStream_status_t *sent, const statusStream_status_t *now)
+{
+    unsigned fields = 0;
+    if (now->track != sent->track || now->duration_ms != sent->duration_ms)
+    {
+        fields |= STATUS_STREAM_TRACK | STATUS_STREAM_POSITION;
+    }
+    long long expected_ms = sent->position_ms + (now->sampled_ms - sent->sampled_ms);
+    if (expected_ms > sent->duration_ms)
+    {
+        expected_ms = sent->duration_ms;
+    }
+    if (llabs(now->position_ms - expected_ms) > STATUS_STREAM_POSITION_TOLERANCE_MS)
+    {
+        fields |= STATUS_STREAM_POSITION;
+    }
+    if (now->volume != sent->volume)
+    {
+        fields |= STATUS_STREAM_VOLUME;
+    }
+    int queue_sent = (now->queue_size < STATUS_STREAM_QUEUE_MAX) ? now->queue_size : STATUS_STREAM_QUEUE_MAX;
+    if (now->queue_size != sent->queue_size || memcmp(now->queue, sent->queue, queue_sent * sizeof(song_id_t)) != 0)
+    {
+        fields |= STATUS_STREAM_QUEUE;
+    }
+
+    if (fields & STATUS_STREAM_TRACK)
+    {
+        sent->track = now->track;
+        sent->duration_ms = now->duration_ms;
+        memcpy(sent->title, now->title, sizeof(sent->title));
+        memcpy(sent->artist, now->artist, sizeof(sent->artist));
+    }
+    // an unsent position stays the base the clients extrapolate from
+    if (fields & STATUS_STREAM_POSITION)
+    {
+        sent->position_ms = now->position_ms;
+        sent->sampled_ms = now->sampled_ms;
+    }
+    sent->volume = now->volume;
+    sent->queue_size = now->queue_size;
+    memcpy(sent->queue, now->queue, sizeof(sent->queue));
+    return fields;
+}
+
+size_t statusStream_writeJson(const statusStream_status_t *status, unsigned fields, char *buffer, size_t size)
+{
+    json_writer_t json = {.buffer = buffer, .size = size};
+    jsonAppend(&json, "{");
+    if (fields & STATUS_STREAM_TRACK)
+    {
+        jsonAppend(&json, "\"track\":\"%" PRIu64 "\",\"duration_ms\":%d,\"title\":", status->track, status->duration_ms);
+        jsonAppendString(&json, status->title);
+        jsonAppend(&json, ",\"artist\":");
+        jsonAppendString(&json, status->artist);
+        jsonAppend(&json, ",");
+    }
+    if (fields & STATUS_STREAM_POSITION)
+    {
+        jsonAppend(&json, "\"position_ms\":%d,", status->position_ms);
+    }
+    if (fields & STATUS_STREAM_VOLUME)
+    {
+        jsonAppend(&json, "\"volume\":%d,", status->volume);
+    }
+    if (fields & STATUS_STREAM_QUEUE)
+    {
+        jsonAppend(&json, "\"queue_size\":%d,\"queue\":[", status->queue_size);
+        for (int i = 0; i < status->queue_size && i < STATUS_STREAM_QUEUE_MAX; i++)
+        {
+            jsonAppend(&json, "%s\"%" PRIu64 "\"", (i > 0) ? "," : "", status->queue[i]);
+        }
+        jsonAppend(&json, "],");
+    }
+    // replaces the last comma, or follows the opening brace of an empty status
+    if (json.length > 1 && !json.overflow)
+    {
+        json.length--;
+    }
+    jsonAppend(&json, "}\n");
+    return json.overflow ? 0 : json.length;
+}
+
+void statusStream_writeFrame(const statusStream_status_t *status, unsigned fields, protocol_writer_t *writer)
+{
+    protocol_writeNumber(writer, fields);
+    if (fields & STATUS_STREAM_TRACK)
+    {
+        protocol_writeNumber(writer, status->track);
+        protocol_writeNumber(writer, status->duration_ms);
+        protocol_writeString(writer, status->title);
+        protocol_writeString(writer, status->artist);
+    }
+    if (fields & STATUS_STREAM_POSITION)
+    {
+        protocol_writeNumber(writer, status->position_ms);
+    }
+    if (fields & STATUS_STREAM_VOLUME)
+    {
+        protocol_writeNumber(writer, status->volume);
+    }
+    if (fields & STATUS_STREAM_QUEUE)
+    {
+        int count = (status->queue_size < STATUS_STREAM_QUEUE_MAX) ? status->queue_size : STATUS_STREAM_QUEUE_MAX;
+        protocol_writeNumber(writer, status->queue_size);
+        protocol_writeNumber(writer, count);
+        for (int i = 0; i < count; i++)
+        {
+            protocol_writeNumber(writer, status->queue[i]);
+        }
+    }
+}
+
+//------------------------------------------------
+/////////////// Private Functions ////////////////
+//------------------------------------------------
+
+static long long getTimeInMs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+}
+
+static int samplesToMs(long long samples)
+{
+    return (int)(samples / NUM_CHANNELS * 1000 / SAMPLE_RATE);
+}
+
+// Copies "source" into "name", cutting it between UTF-8 characters if it is too long
+static void copyName(char *name, const char *source)
+{
+    snprintf(name, STATUS_STREAM_NAME_MAX, "%s", (source != NULL) ? source : "");
+    size_t length = strlen(name);
+    if (source == NULL || length == strlen(source))
+    {
+        return;
+    }
+    size_t start = length;
+    while (start > 0 && ((unsigned char)name[start - 1] & 0xC0) == 0x80)
+    {
+        start--;
+    }
+    // "start - 1" is the lead byte of the last character, which may be missing bytes
+    if (start > 0 && ((unsigned char)name[start - 1] & 0x80) != 0)
+    {
+        unsigned char lead = name[start - 1];
+        size_t expected = (lead >= 0xF0) ? 4 : (lead >= 0xE0) ? 3 : 2;
+        if (length - (start - 1) < expected)
+        {
+            name[start - 1] = '\0';
+        }
+    }
+}
+
+static void jsonAppend(json_writer_t *json, const char *format, ...)
+{
+    if (json->overflow)
+    {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(json->buffer + json->length, json->size - json->length, format, args);
+    va_end(args);
+    if (length < 0 || (size_t)length >= json->size - json->length)
+    {
+        json->overflow = true;
+        return;
+    }
+    json->length += length;
+}
+
+// Appends "string" as a quoted JSON string
+static void jsonAppendString(json_writer_t *json, const char *string)
+{
+    jsonAppend(json, "\"");
+    for (const unsigned char *c = (const unsigned char *)string; *c != '\0'; c++)
+    {
+        if (*c == '"' || *c == '\\')
+        {
+            jsonAppend(json, "\\%c", *c);
+        }
+        else if (*c < 0x20)
+        {
+            jsonAppend(json, "\\u%04x", *c);
+        }
+        else
+        {
+            jsonAppend(json, "%c", *c);
+        }
+    }
+    jsonAppend(json, "\"");
+}
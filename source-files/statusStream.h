@@ -0,0 +1,71 @@
+/**
+ * @file statusStream.h
+ * @brief This is a header file for the statusStream module.
+ *
+ * This header file contains the definitions of the functions
+ * for the statusStream module, which samples what the BeaglePod is
+ * playing and encodes what changed since the last sample, for the
+ * clients subscribed to the status through the network module.
+ *
+ * A status update only holds the fields that changed. The position is
+ * only resent when the track changes or when it drifts from where the
+ * clients can extrapolate it (e.g. after a seek or a stall), so a song
+ * playing along sends nothing at all.
+ *
+ * @author Amirhossein Etaati
+ * @date 2023-04-12
+ */
+
+#if !defined(STATUS_STREAM_H)
+#define STATUS_STREAM_H
+
+#include <stddef.h>
+#include "songManager.h"
+#include "protocol.h"
+
+// Queued songs sent in a status, the size of the queue is always sent
+#define STATUS_STREAM_QUEUE_MAX 32
+// Longest title or artist sent, longer ones are cut
+#define STATUS_STREAM_NAME_MAX 64
+// Drift from the extrapolated position after which the position is resent
+#define STATUS_STREAM_POSITION_TOLERANCE_MS 1000
+
+// Fields of a status, in the order they are encoded
+typedef enum
+{
+    STATUS_STREAM_TRACK = 1 << 0,    // song id, duration, title and artist
+    STATUS_STREAM_POSITION = 1 << 1, // position in the song
+    STATUS_STREAM_VOLUME = 1 << 2,   // volume in percent
+    STATUS_STREAM_QUEUE = 1 << 3,    // size and first ids of the Up Next queue
+    STATUS_STREAM_ALL = (1 << 4) - 1
+} statusStream_field_t;
+
+typedef struct
+{
+    song_id_t track; // SONG_ID_INVALID while nothing plays
+    int duration_ms;
+    char title[STATUS_STREAM_NAME_MAX];
+    char artist[STATUS_STREAM_NAME_MAX];
+    int position_ms;
+    long long sampled_ms; // when "position_ms" was sampled, to extrapolate it
+    int volume;
+    int queue_size;
+    song_id_t queue[STATUS_STREAM_QUEUE_MAX];
+} statusStream_status_t;
+
+// Fills "status" with what is playing now
+void statusStream_sample(statusStream_status_t *status);
+
+// Returns the fields of "now" that changed since "sent" and copies them into "sent"
+unsigned statusStream_diff(statusStream_status_t *sent, const statusStream_status_t *now);
+
+// Writes "fields" of "status" as a line of JSON, e.g. {"track":"7",...,"volume":80}
+// Note: the ids are strings, they do not fit in a JavaScript number
+// Returns its length, 0 if it does not fit in "size"
+size_t statusStream_writeJson(const statusStream_status_t *status, unsigned fields, char *buffer, size_t size);
+
+// Writes "fields" of "status" as the fields of a PROTOCOL_OP_STATUS frame
+// Note: the first field is the "fields" mask, then the values of each field in order
+void statusStream_writeFrame(const statusStream_status_t *status, unsigned fields, protocol_writer_t *writer);
+
+#endif // STATUS_STREAM_H
@@ -0,0 +1,124 @@
+/**
+ * @file stringPool.c
+ * @brief This is a source file for the stringPool module.
+ *
+ * This source file contains the declaration of the functions
+ * for the stringPool module, which stores one shared copy of
+ * repetitive song metadata (artists, albums) in a memory arena.
+ *
+ * Strings are packed back to back in large chunks, so storing one costs
+ * its length plus the terminator instead of a malloc'd block with its
+ * header and rounding. A hash map from the string's hash to its copy
+ * finds strings that are already stored.
+ *
+ * @author Amirhossein Etaati
+ * @date 2023-04-07
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "stringPool.h"
+#include "hashMap.h"
+
+#define CHUNK_SIZE 4096
+
+struct Chunk
+{
+    struct Chunk *next;
+    size_t used;
+    size_t size;
+    char data[];
+};
+
+static pthread_mutex_t poolMutex = PTHREAD_MUTEX_INITIALIZER;
+static struct Chunk *chunks = NULL;
+static hashMap_t *strings = NULL;
+static stringPool_stats_t stats;
+
+// Private functions definitions
+static char *arenaAlloc(size_t size);
+
+//------------------------------------------------
+//////////////// Public Functions ////////////////
+//------------------------------------------------
+
+void stringPool_init(void)
+{
+    strings = hashMap_create(64);
+    memset(&stats, 0, sizeof(stats));
+}
+
+const char *stringPool_intern(const char *str)
+{
+    uint64_t key = hashMap_hashString(str);
+    pthread_mutex_lock(&poolMutex);
+    stats.num_lookups++;
+    const char *copy = hashMap_get(strings, key);
+    if (copy == NULL || strcmp(copy, str) != 0)
+    {
+        size_t size = strlen(str) + 1;
+        char *new_copy = arenaAlloc(size);
+        memcpy(new_copy, str, size);
+        // on a hash collision the first string keeps the slot and this one is not shared
+        if (copy == NULL)
+        {
+            hashMap_put(strings, key, new_copy);
+        }
+        stats.num_strings++;
+        stats.string_bytes += size;
+        copy = new_copy;
+    }
+    pthread_mutex_unlock(&poolMutex);
+    return copy;
+}
+
+void stringPool_getStats(stringPool_stats_t *pool_stats)
+{
+    pthread_mutex_lock(&poolMutex);
+    *pool_stats = stats;
+    pthread_mutex_unlock(&poolMutex);
+}
+
+void stringPool_cleanup(void)
+{
+    pthread_mutex_lock(&poolMutex);
+    while (chunks != NULL)
+    {
+        struct Chunk *next = chunks->next;
+        free(chunks);
+        chunks = next;
+    }
+    hashMap_destroy(strings);
+    strings = NULL;
+    pthread_mutex_unlock(&poolMutex);
+}
+
+//------------------------------------------------
+/////////////// Private Functions ////////////////
+//------------------------------------------------
+
+// Note: caller must hold poolMutex
+static char *arenaAlloc(size_t size)
+{
+    if (chunks == NULL || chunks->size - chunks->used < size)
+    {
+        size_t chunk_size = size > CHUNK_SIZE ? size : CHUNK_SIZE;
+        struct Chunk *chunk = malloc(sizeof(struct Chunk) + chunk_size);
+        if (chunk == NULL)
+        {
+            fprintf(stderr, "%s\n", "stringPool_arenaAlloc(): Error - There was a problem allocating memory.");
+            exit(1);
+        }
+        chunk->used = 0;
+        chunk->size = chunk_size;
+        chunk->next = chunks;
+        chunks = chunk;
+        stats.allocated_bytes += sizeof(struct Chunk) + chunk_size;
+    }
+    char *ptr = chunks->data + chunks->used;
+    chunks->used += size;
+    return ptr;
+}
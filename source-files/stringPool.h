@@ -0,0 +1,40 @@
+/**
+ * @file stringPool.h
+ * @brief This is a header file for the stringPool module.
+ *
+ * This header file contains the definitions of the functions
+ * for the stringPool module, which stores one shared copy of
+ * repetitive song metadata (artists, albums) in a memory arena.
+ *
+ * @author Amirhossein Etaati
+ * @date 2023-04-07
+ */
+
+#if !defined(STRING_POOL_H)
+#define STRING_POOL_H
+
+#include <stddef.h>
+
+typedef struct
+{
+    size_t num_strings;     // distinct strings stored
+    size_t num_lookups;     // calls to stringPool_intern()
+    size_t string_bytes;    // bytes used by the strings, terminators included
+    size_t allocated_bytes; // bytes taken from the heap by the arena
+} stringPool_stats_t;
+
+// Allocates the pool
+// Note: caller should call stringPool_cleanup() to free the memory
+void stringPool_init(void);
+
+// Returns the pool's copy of "str", storing it on first use
+// Note: the copy is never freed before stringPool_cleanup(); thread safe
+const char *stringPool_intern(const char *str);
+
+// Fills "stats" with the memory used by the pool
+void stringPool_getStats(stringPool_stats_t *stats);
+
+// Frees every string of the pool
+void stringPool_cleanup(void);
+
+#endif // STRING_POOL_H
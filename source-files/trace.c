@@ -0,0 +1,408 @@
+/**
+ * @file trace.c
+ * @brief This is a source file for the trace module.
+ *
+ * This source file contains the declaration of the functions
+ * for the trace module, which records when the threads of the BeaglePod
+ * begin and end their steps and writes them as Chrome JSON.
+ *
+ * Each thread claims a ring the first time it traces, with a compare and
+ * swap, and is the only one to write into it. The rings are only read
+ * while tracing is paused: a thread marks its ring busy while it writes
+ * an event and checks that tracing is still on once marked, so after
+ * turning tracing off, waiting for the rings to be idle is enough for no
+ * event to be written anymore. A dump only pauses tracing to copy the
+ * rings, and frees the rings of the threads that exited once copied; the
+ * copy is written out with tracing back on.
+ *
+ * @author Amirhossein Etaati
+ * @date 2023-04-18
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "trace.h"
+
+// Text of the dump sent at a time
+#define DUMP_CHUNK_SIZE 4096
+
+typedef enum
+{
+    RING_FREE,
+    RING_OWNED,
+    RING_RELEASED // its thread exited, kept until the next dump or until tracing starts again
+} ring_state_t;
+
+typedef struct
+{
+    long long time_us;
+    const char *name;
+    char phase; // 'B' or 'E', as in the Chrome format
+} event_t;
+
+typedef struct
+{
+    event_t *events;
+    unsigned int head; // events written so far, the last TRACE_RING_EVENTS are kept
+    bool busy;         // while its thread writes an event
+    const char *thread_name;
+    ring_state_t state;
+} ring_t;
+
+// Events of a ring copied by a dump, oldest first
+typedef struct
+{
+    int tid;
+    const char *thread_name;
+    const event_t *events;
+    unsigned int count;
+} ring_copy_t;
+
+// Dump being written through a trace_writer_t
+typedef struct
+{
+    trace_writer_t write;
+    void *context;
+    char text[DUMP_CHUNK_SIZE];
+    size_t length;
+    bool failed;
+} dump_t;
+
+static bool is_module_initialized = false;
+static bool enabled = false;
+// serializes starting, stopping and dumping
+static pthread_mutex_t controlMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t ring_key;
+static pthread_key_t name_key;
+static ring_t rings[TRACE_MAX_THREADS];
+// the events of all the rings, allocated the first time tracing starts
+static event_t *events = NULL;
+
+// Private functions definitions
+static void addEvent(const char *name, char phase);
+static ring_t *getRing(void);
+static void releaseRing(void *ring);
+static void pauseTracing(void);
+static unsigned int copyRing(int index, ring_copy_t *copy, event_t *events);
+static int dumpRing(dump_t *dump, const ring_copy_t *copy);
+static void append(dump_t *dump, const char *format, ...);
+static void flushDump(dump_t *dump);
+static long long getTimeInUs(void);
+
+//------------------------------------------------
+//////////////// Public Functions ////////////////
+//------------------------------------------------
+
+void trace_init(void)
+{
+    pthread_key_create(&ring_key, releaseRing);
+    pthread_key_create(&name_key, NULL);
+    memset(rings, 0, sizeof(rings));
+    is_module_initialized = true;
+}
+
+void trace_cleanup(void)
+{
+    if (!is_module_initialized)
+    {
+        return;
+    }
+    pthread_mutex_lock(&controlMutex);
+    pauseTracing();
+    free(events);
+    events = NULL;
+    pthread_key_delete(ring_key);
+    pthread_key_delete(name_key);
+    is_module_initialized = false;
+    pthread_mutex_unlock(&controlMutex);
+}
+
+void trace_start(void)
+{
+    if (!is_module_initialized)
+    {
+        return;
+    }
+    pthread_mutex_lock(&controlMutex);
+    pauseTracing();
+    if (events == NULL)
+    {
+        events = malloc(TRACE_MAX_THREADS * TRACE_RING_EVENTS * sizeof(*events));
+        if (events == NULL)
+        {
+            fprintf(stderr, "trace: Error - There was a problem allocating memory.");
+            exit(1);
+        }
+    }
+    for (int i = 0; i < TRACE_MAX_THREADS; i++)
+    {
+        rings[i].events = events + i * TRACE_RING_EVENTS;
+        rings[i].head = 0;
+        if (__atomic_load_n(&rings[i].state, __ATOMIC_ACQUIRE) == RING_RELEASED)
+        {
+            __atomic_store_n(&rings[i].state, RING_FREE, __ATOMIC_RELEASE);
+        }
+    }
+    __atomic_store_n(&enabled, true, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&controlMutex);
+}
+
+void trace_stop(void)
+{
+    pthread_mutex_lock(&controlMutex);
+    pauseTracing();
+    pthread_mutex_unlock(&controlMutex);
+}
+
+bool trace_isEnabled(void)
+{
+    return __atomic_load_n(&enabled, __ATOMIC_RELAXED);
+}
+
+void trace_nameThread(const char *name)
+{
+    if (!is_module_initialized)
+    {
+        return;
+    }
+    pthread_setspecific(name_key, name);
+    ring_t *ring = pthread_getspecific(ring_key);
+    if (ring != NULL)
+    {
+        __atomic_store_n(&ring->thread_name, name, __ATOMIC_RELAXED);
+    }
+}
+
+void trace_begin(const char *name)
+{
+    addEvent(name, 'B');
+}
+
+void trace_end(const char *name)
+{
+    addEvent(name, 'E');
+}
+
+int trace_dump(trace_writer_t write, void *context)
+{
+    dump_t *dump = malloc(sizeof(*dump));
+    if (dump == NULL)
+    {
+        fprintf(stderr, "trace: Error - There was a problem allocating memory.");
+        exit(1);
+    }
+    dump->write = write;
+    dump->context = context;
+    dump->length = 0;
+    dump->failed = false;
+
+    // the rings are copied while tracing is paused, a slow writer only holds up the copy
+    ring_copy_t copies[TRACE_MAX_THREADS];
+    int num_copies = 0;
+    event_t *copied = NULL;
+    pthread_mutex_lock(&controlMutex);
+    bool was_enabled = __atomic_load_n(&enabled, __ATOMIC_RELAXED);
+    pauseTracing();
+    if (events != NULL)
+    {
+        size_t total = 0;
+        for (int i = 0; i < TRACE_MAX_THREADS; i++)
+        {
+            if (__atomic_load_n(&rings[i].state, __ATOMIC_ACQUIRE) != RING_FREE)
+            {
+                total += (rings[i].head < TRACE_RING_EVENTS) ? rings[i].head : TRACE_RING_EVENTS;
+            }
+        }
+        copied = malloc((total > 0 ? total : 1) * sizeof(*copied));
+        if (copied == NULL)
+        {
+            fprintf(stderr, "trace: Error - There was a problem allocating memory.");
+            exit(1);
+        }
+        size_t offset = 0;
+        for (int i = 0; i < TRACE_MAX_THREADS; i++)
+        {
+            if (__atomic_load_n(&rings[i].state, __ATOMIC_ACQUIRE) != RING_FREE)
+            {
+                offset += copyRing(i, &copies[num_copies++], copied + offset);
+            }
+        }
+    }
+    __atomic_store_n(&enabled, was_enabled, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&controlMutex);
+
+    int count = 0;
+    append(dump, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (int i = 0; i < num_copies && !dump->failed; i++)
+    {
+        count += dumpRing(dump, &copies[i]);
+    }
+    // a last event without a comma after it
+    append(dump, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"beaglepod\"}}\n]}\n");
+    flushDump(dump);
+
+    free(copied);
+    free(dump);
+    return count;
+}
+
+//------------------------------------------------
+/////////////// Private Functions ////////////////
+//------------------------------------------------
+
+static void addEvent(const char *name, char phase)
+{
+    if (!__atomic_load_n(&enabled, __ATOMIC_RELAXED))
+    {
+        return;
+    }
+    ring_t *ring = getRing();
+    if (ring == NULL)
+    {
+        return;
+    }
+    __atomic_store_n(&ring->busy, true, __ATOMIC_SEQ_CST);
+    // tracing may have been paused before the ring was marked, then the ring must not change
+    if (__atomic_load_n(&enabled, __ATOMIC_SEQ_CST))
+    {
+        event_t *event = &ring->events[ring->head % TRACE_RING_EVENTS];
+        event->time_us = getTimeInUs();
+        event->name = name;
+        event->phase = phase;
+        ring->head++;
+    }
+    __atomic_store_n(&ring->busy, false, __ATOMIC_RELEASE);
+}
+
+// Returns the ring of the calling thread, claiming one the first time, NULL if none is free
+static ring_t *getRing(void)
+{
+    ring_t *ring = pthread_getspecific(ring_key);
+    for (int i = 0; i < TRACE_MAX_THREADS && ring == NULL; i++)
+    {
+        ring_state_t expected = RING_FREE;
+        if (__atomic_compare_exchange_n(&rings[i].state, &expected, RING_OWNED, false, __ATOMIC_ACQUIRE,
+                                        __ATOMIC_RELAXED))
+        {
+            ring = &rings[i];
+            __atomic_store_n(&ring->thread_name, pthread_getspecific(name_key), __ATOMIC_RELAXED);
+            pthread_setspecific(ring_key, ring);
+        }
+    }
+    return ring;
+}
+
+// Called by a thread with a ring as it exits
+static void releaseRing(void *ring)
+{
+    __atomic_store_n(&((ring_t *)ring)->state, RING_RELEASED, __ATOMIC_RELEASE);
+}
+
+// Turns tracing off and waits for the events being written
+// Note: caller must hold controlMutex
+static void pauseTracing(void)
+{
+    __atomic_store_n(&enabled, false, __ATOMIC_SEQ_CST);
+    for (int i = 0; i < TRACE_MAX_THREADS; i++)
+    {
+        while (__atomic_load_n(&rings[i].busy, __ATOMIC_SEQ_CST))
+        {
+            sched_yield();
+        }
+    }
+}
+
+// Copies the events kept in rings[index] into "events" and describes them in "copy", returns how many
+// The ring of a thread that exited is freed for another thread
+// Note: caller must hold controlMutex, with tracing paused
+static unsigned int copyRing(int index, ring_copy_t *copy, event_t *events)
+{
+    ring_t *ring = &rings[index];
+    unsigned int count = (ring->head < TRACE_RING_EVENTS) ? ring->head : TRACE_RING_EVENTS;
+    unsigned int first = (ring->head - count) % TRACE_RING_EVENTS;
+    // the oldest events are at the end of the ring once it wrapped around
+    unsigned int until_end = (first + count > TRACE_RING_EVENTS) ? TRACE_RING_EVENTS - first : count;
+    memcpy(events, ring->events + first, until_end * sizeof(*events));
+    memcpy(events + until_end, ring->events, (count - until_end) * sizeof(*events));
+
+    copy->tid = index + 1;
+    copy->thread_name = __atomic_load_n(&ring->thread_name, __ATOMIC_RELAXED);
+    copy->events = events;
+    copy->count = count;
+    if (__atomic_load_n(&ring->state, __ATOMIC_ACQUIRE) == RING_RELEASED)
+    {
+        ring->head = 0;
+        __atomic_store_n(&ring->state, RING_FREE, __ATOMIC_RELEASE);
+    }
+    return count;
+}
+
+// Writes the events of "copy", returns how many
+static int dumpRing(dump_t *dump, const ring_copy_t *copy)
+{
+    if (copy->thread_name != NULL)
+    {
+        append(dump, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}},\n",
+               copy->tid, copy->thread_name);
+    }
+
+    int depth = 0;
+    int count = 0;
+    for (unsigned int i = 0; i < copy->count && !dump->failed; i++)
+    {
+        const event_t *event = &copy->events[i];
+        if (event->phase == 'E' && depth == 0)
+        {
+            // its beginning was overwritten
+            continue;
+        }
+        depth += (event->phase == 'B') ? 1 : -1;
+        append(dump, "{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%lld,\"pid\":1,\"tid\":%d},\n", event->name,
+               event->phase, event->time_us, copy->tid);
+        count++;
+    }
+    return count;
+}
+
+static void append(dump_t *dump, const char *format, ...)
+{
+    char line[256];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (length < 0)
+    {
+        return;
+    }
+    length = ((size_t)length < sizeof(line)) ? length : (int)sizeof(line) - 1;
+    if (dump->length + length > sizeof(dump->text))
+    {
+        flushDump(dump);
+    }
+    memcpy(dump->text + dump->length, line, length);
+    dump->length += length;
+}
+
+static void flushDump(dump_t *dump)
+{
+    if (dump->length > 0 && !dump->failed)
+    {
+        dump->failed = !dump->write(dump->text, dump->length, dump->context);
+    }
+    dump->length = 0;
+}
+
+static long long getTimeInUs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
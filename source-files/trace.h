@@ -0,0 +1,61 @@
+/**
+ * @file trace.h
+ * @brief This is a header file for the trace module.
+ *
+ * This header file contains the definitions of the functions
+ * for the trace module, which records when the threads of the BeaglePod
+ * begin and end their steps (filling a playback buffer, writing it to the
+ * sound card, writing to the display, polling the joystick, running a
+ * command...), to see on the device where the time of e.g. a skip goes.
+ *
+ * Tracing is off until trace_start(): a trace point then costs an atomic
+ * load. Once started, each thread writes its events into a ring of its
+ * own, without locks, which keeps its last TRACE_RING_EVENTS events.
+ * trace_dump() writes them in the Chrome trace event format, which
+ * chrome://tracing and ui.perfetto.dev open; the HTTP server serves it as
+ * GET /trace.
+ *
+ * @author Amirhossein Etaati
+ * @date 2023-04-18
+ */
+
+#if !defined(TRACE_H)
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Threads traced at the same time, the events of the others are dropped
+#define TRACE_MAX_THREADS 32
+// Last events kept for each thread, a power of 2
+#define TRACE_RING_EVENTS 4096
+
+// Takes "length" bytes of the trace, returns false to stop the dump
+typedef bool (*trace_writer_t)(const char *text, size_t length, void *context);
+
+// Note: must be called before the threads to trace are started
+void trace_init(void);
+
+void trace_cleanup(void);
+
+// Drops the events kept and starts tracing
+void trace_start(void);
+
+void trace_stop(void);
+
+bool trace_isEnabled(void);
+
+// Names the calling thread in the traces, "name" must outlive the module, e.g. a string literal
+void trace_nameThread(const char *name);
+
+// Marks the beginning and the end of the step "name" on the calling thread; the steps of
+// a thread nest. "name" must outlive the module, e.g. a string literal
+void trace_begin(const char *name);
+void trace_end(const char *name);
+
+// Writes the events kept as Chrome JSON through "write"; tracing is only paused while they are copied
+// Note: the events of the threads that exited are dropped once dumped, their rings go to new threads
+// Returns the number of events written
+int trace_dump(trace_writer_t write, void *context);
+
+#endif // TRACE_H
@@ -0,0 +1,330 @@
+/**
+ * @file webSocket.c
+ * @brief This is a source file for the webSocket module.
+ *
+ * This source file contains the declaration of the functions
+ * for the webSocket module, which implements the server side of the
+ * WebSocket handshake and framing (RFC 6455). Only what the status
+ * stream needs is supported: unfragmented frames from the server, and
+ * client frames of any kind that the caller may ignore.
+ *
+ * @author Amirhossein Etaati
+ * @date 2023-04-12
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+
+#include "webSocket.h"
+
+// Appended to the client's key before hashing it (RFC 6455, section 1.3)
+#define WEB_SOCKET_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+#define SHA1_SIZE 20
+// Base64 of a SHA-1 and its '\0'
+#define ACCEPT_KEY_SIZE 29
+#define MAX_KEY_LENGTH 64
+
+// Private functions definitions
+static const char *findHeader(const char *request, const char *name, size_t *length);
+static bool hasToken(const char *value, size_t length, const char *token);
+static void sha1(const uint8_t *data, size_t size, uint8_t *digest);
+static void base64(const uint8_t *data, size_t size, char *text);
+
+//------------------------------------------------
+//////////////// Public Functions ////////////////
+//------------------------------------------------
+
+size_t webSocket_getRequestSize(const char *data, size_t size)
+{
+    for (size_t i = 3; i < size; i++)
+    {
+        if (memcmp(data + i - 3, "\r\n\r\n", 4) == 0)
+        {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+size_t webSocket_writeHandshake(const char *request, const char *path, bool *upgraded, char *buffer, size_t size)
+{
+    *upgraded = false;
+    size_t path_length = strlen(path);
+    if (strncmp(request, "GET ", 4) != 0 || strncmp(request + 4, path, path_length) != 0 ||
+        request[4 + path_length] != ' ')
+    {
+        return snprintf(buffer, size, "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+    }
+
+    size_t upgrade_length = 0;
+    size_t key_length = 0;
+    const char *upgrade = findHeader(request, "Upgrade", &upgrade_length);
+    const char *key = findHeader(request, "Sec-WebSocket-Key", &key_length);
+    if (upgrade == NULL || !hasToken(upgrade, upgrade_length, "websocket") || key == NULL || key_length > MAX_KEY_LENGTH)
+    {
+        return snprintf(buffer, size, "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+    }
+
+    char keyed[MAX_KEY_LENGTH + sizeof(WEB_SOCKET_GUID)];
+    memcpy(keyed, key, key_length);
+    memcpy(keyed + key_length, WEB_SOCKET_GUID, sizeof(WEB_SOCKET_GUID));
+    uint8_t digest[SHA1_SIZE];
+    sha1((const uint8_t *)keyed, key_length + strlen(WEB_SOCKET_GUID), digest);
+    char accept[ACCEPT_KEY_SIZE];
+    base64(digest, SHA1_SIZE, accept);
+
+    int length = snprintf(buffer, size,
+                          "HTTP/1.1 101 Switching Protocols\r\n"
+                          "Upgrade: websocket\r\n"
+                          "Connection: Upgrade\r\n"
+                          "Sec-WebSocket-Accept: %s\r\n\r\n",
+                          accept);
+    *upgraded = length > 0 && (size_t)length < size;
+    return *upgraded ? (size_t)length : 0;
+}
+
+size_t webSocket_writeFrameHeader(uint8_t opcode, size_t length, uint8_t *header)
+{
+    header[0] = 0x80 | opcode;
+    if (length < 126)
+    {
+        header[1] = length;
+        return 2;
+    }
+    if (length <= UINT16_MAX)
+    {
+        header[1] = 126;
+        header[2] = length >> 8;
+        header[3] = length;
+        return 4;
+    }
+    header[1] = 127;
+    for (int i = 0; i < 8; i++)
+    {
+        header[2 + i] = (uint64_t)length >> (56 - 8 * i);
+    }
+    return 10;
+}
+
+size_t webSocket_readFrame(uint8_t *data, size_t size, webSocket_frame_t *frame)
+{
+    if (size < 2)
+    {
+        return 0;
+    }
+    // clients must mask their frames
+    if ((data[1] & 0x80) == 0)
+    {
+        return SIZE_MAX;
+    }
+    size_t header_size = 2;
+    uint64_t length = data[1] & 0x7F;
+    if (length == 126)
+    {
+        header_size = 4;
+        length = (size >= 4) ? ((uint64_t)data[2] << 8 | data[3]) : 0;
+    }
+    else if (length == 127)
+    {
+        header_size = 10;
+        length = 0;
+        for (int i = 0; i < 8 && size >= 10; i++)
+        {
+            length = length << 8 | data[2 + i];
+        }
+    }
+    header_size += 4; // the mask
+    if (size < header_size)
+    {
+        return 0;
+    }
+    if (length > SIZE_MAX - header_size)
+    {
+        return SIZE_MAX;
+    }
+    if (size < header_size + length)
+    {
+        return 0;
+    }
+
+    const uint8_t *mask = data + header_size - 4;
+    frame->opcode = data[0] & 0x0F;
+    frame->final = (data[0] & 0x80) != 0;
+    frame->payload = data + header_size;
+    frame->length = length;
+    for (size_t i = 0; i < length; i++)
+    {
+        frame->payload[i] ^= mask[i % 4];
+    }
+    return header_size + length;
+}
+
+//------------------------------------------------
+/////////////// Private Functions ////////////////
+//------------------------------------------------
+
+// Returns the value of the header "name" of "request" and sets its "length", NULL if it is missing
+static const char *findHeader(const char *request, const char *name, size_t *length)
+{
+    size_t name_length = strlen(name);
+    // the request line is never a header
+    const char *line = strstr(request, "\r\n");
+    while (line != NULL && line[2] != '\r' && line[2] != '\0')
+    {
+        line += 2;
+        const char *end = strstr(line, "\r\n");
+        if (end == NULL)
+        {
+            return NULL;
+        }
+        if (strncasecmp(line, name, name_length) == 0 && line[name_length] == ':')
+        {
+            const char *value = line + name_length + 1;
+            while (value < end && (*value == ' ' || *value == '\t'))
+            {
+                value++;
+            }
+            const char *value_end = end;
+            while (value_end > value && (value_end[-1] == ' ' || value_end[-1] == '\t'))
+            {
+                value_end--;
+            }
+            *length = value_end - value;
+            return value;
+        }
+        line = end;
+    }
+    return NULL;
+}
+
+// Returns whether the comma separated "value" holds "token", ignoring case
+static bool hasToken(const char *value, size_t length, const char *token)
+{
+    size_t token_length = strlen(token);
+    const char *end = value + length;
+    while (value < end)
+    {
+        while (value < end && (*value == ' ' || *value == ','))
+        {
+            value++;
+        }
+        const char *token_end = value;
+        while (token_end < end && *token_end != ',' && *token_end != ' ')
+        {
+            token_end++;
+        }
+        if ((size_t)(token_end - value) == token_length && strncasecmp(value, token, token_length) == 0)
+        {
+            return true;
+        }
+        value = token_end;
+    }
+    return false;
+}
+
+static uint32_t rotateLeft(uint32_t value, int bits)
+{
+    return (value << bits) | (value >> (32 - bits));
+}
+
+// SHA-1 (FIPS 180-4), only used for the handshake
+static void sha1(const uint8_t *data, size_t size, uint8_t *digest)
+{
+    uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+    uint64_t bits = (uint64_t)size * 8;
+    // the data, the 0x80 byte and the length, padded to whole 64 byte blocks
+    size_t padded_size = ((size + 8) / 64 + 1) * 64;
+    for (size_t block = 0; block < padded_size; block += 64)
+    {
+        uint32_t w[80];
+        for (int i = 0; i < 16; i++)
+        {
+            w[i] = 0;
+            for (int j = 0; j < 4; j++)
+            {
+                size_t index = block + i * 4 + j;
+                uint8_t byte = 0;
+                if (index < size)
+                {
+                    byte = data[index];
+                }
+                else if (index == size)
+                {
+                    byte = 0x80;
+                }
+                else if (index >= padded_size - 8)
+                {
+                    byte = bits >> (8 * (padded_size - 1 - index));
+                }
+                w[i] = (w[i] << 8) | byte;
+            }
+        }
+        for (int i = 16; i < 80; i++)
+        {
+            w[i] = rotateLeft(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+        }
+
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int i = 0; i < 80; i++)
+        {
+            uint32_t f, k;
+            if (i < 20)
+            {
+                f = (b & c) | (~b & d);
+                k = 0x5A827999;
+            }
+            else if (i < 40)
+            {
+                f = b ^ c ^ d;
+                k = 0x6ED9EBA1;
+            }
+            else if (i < 60)
+            {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8F1BBCDC;
+            }
+            else
+            {
+                f = b ^ c ^ d;
+                k = 0xCA62C1D6;
+            }
+            uint32_t temp = rotateLeft(a, 5) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = rotateLeft(b, 30);
+            b = a;
+            a = temp;
+        }
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+    }
+    for (int i = 0; i < 5; i++)
+    {
+        digest[i * 4] = h[i] >> 24;
+        digest[i * 4 + 1] = h[i] >> 16;
+        digest[i * 4 + 2] = h[i] >> 8;
+        digest[i * 4 + 3] = h[i];
+    }
+}
+
+static void base64(const uint8_t *data, size_t size, char *text)
+{
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t length = 0;
+    for (size_t i = 0; i < size; i += 3)
+    {
+        uint32_t group = (uint32_t)data[i] << 16;
+        group |= (i + 1 < size) ? (uint32_t)data[i + 1] << 8 : 0;
+        group |= (i + 2 < size) ? data[i + 2] : 0;
+        text[length++] = alphabet[(group >> 18) & 0x3F];
+        text[length++] = alphabet[(group >> 12) & 0x3F];
+        text[length++] = (i + 1 < size) ? alphabet[(group >> 6) & 0x3F] : '=';
+        text[length++] = (i + 2 < size) ? alphabet[group & 0x3F] : '=';
+    }
+    text[length] = '\0';
+}
@@ -0,0 +1,53 @@
+/**
+ * @file webSocket.h
+ * @brief This is a header file for the webSocket module.
+ *
+ * This header file contains the definitions of the functions
+ * for the webSocket module, which implements the server side of the
+ * WebSocket handshake and framing (RFC 6455) used by the network module
+ * to push the status to browsers.
+ *
+ * @author Amirhossein Etaati
+ * @date 2023-04-12
+ */
+
+#if !defined(WEB_SOCKET_H)
+#define WEB_SOCKET_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define WEB_SOCKET_OP_TEXT 0x1
+#define WEB_SOCKET_OP_BINARY 0x2
+#define WEB_SOCKET_OP_CLOSE 0x8
+#define WEB_SOCKET_OP_PING 0x9
+#define WEB_SOCKET_OP_PONG 0xA
+
+// Largest header of a frame the server sends
+#define WEB_SOCKET_MAX_HEADER_SIZE 10
+
+typedef struct
+{
+    uint8_t opcode;
+    bool final;
+    uint8_t *payload; // unmasked, in the received data
+    size_t length;
+} webSocket_frame_t;
+
+// Returns the size of the HTTP request starting at "data" once all its headers arrived, 0 before
+size_t webSocket_getRequestSize(const char *data, size_t size);
+
+// Writes the response to the null-terminated HTTP request "request" into "buffer" and returns its size
+// Sets "upgraded" if it asked for a WebSocket on "path"; otherwise the response is an error
+// and the connection should be closed once it is sent
+size_t webSocket_writeHandshake(const char *request, const char *path, bool *upgraded, char *buffer, size_t size);
+
+// Writes the header of a server frame of "length" bytes into "header" and returns its size
+size_t webSocket_writeFrameHeader(uint8_t opcode, size_t length, uint8_t *header);
+
+// Reads the client frame starting at "data" and unmasks its payload in place
+// Returns the size of the frame, 0 while it is incomplete, SIZE_MAX if it is not a valid client frame
+size_t webSocket_readFrame(uint8_t *data, size_t size, webSocket_frame_t *frame);
+
+#endif // WEB_SOCKET_H
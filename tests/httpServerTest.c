@@ -0,0 +1,229 @@
+/**
+ * @file httpServerTest.c
+ * @brief This is a source file for the test of the httpServer module.
+ *
+ * This source file contains a host program that sends the httpServer
+ * module many more requests touching the library than there are reader
+ * slots in the epoch module (see EPOCH_MAX_THREADS), each on a connection
+ * and so a thread of its own: song lists, songs and deletes of every song.
+ * It runs the library, the audio player built with its file backend and
+ * the server, on HTTP_SERVER_PORT of the host. A few short WAV files are
+ * generated for the library.
+ *
+ * Each failed check is printed to stderr; the program exits with 1 if any
+ * did. Build and run it with "make test".
+ *
+ * @author Amirhossein Etaati
+ * @date 2023-04-13
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "songManager.h"
+#include "audio_player.h"
+#include "lcd_4line.h"
+#include "httpServer.h"
+#include "epoch.h"
+#include "logger.h"
+#include "trace.h"
+
+// Well beyond the reader slots, for each kind of request
+#define NUM_SONGS (EPOCH_MAX_THREADS + 8)
+#define SONG_FRAMES (SAMPLE_RATE / 10)
+#define REPLY_MAX_SIZE (64 * 1024)
+
+static char songs_directory[] = "/tmp/httpServerTest.XXXXXX";
+static song_id_t song_ids[NUM_SONGS];
+static int failures = 0;
+
+// Private functions definitions
+static void writeSongs(void);
+static void removeSongs(void);
+static int sendRequest(const char *request, char *reply, size_t size);
+static void check(bool passed, const char *what, int i);
+
+//------------------------------------------------
+////////////////// Stubbed menu //////////////////
+//------------------------------------------------
+
+song_info *MenuManager_GetCurrentSongPlaying(void)
+{
+    return songManager_getCurrentSongPlaying();
+}
+
+//------------------------------------------------
+////////////////////// Test //////////////////////
+//------------------------------------------------
+
+int main(void)
+{
+    if (freopen("/dev/null", "w", stdout) == NULL)
+    {
+        fprintf(stderr, "httpServerTest: Error - Unable to redirect the output.\n");
+        exit(1);
+    }
+    writeSongs();
+
+    logger_init();
+    trace_init();
+    songManager_init();
+    for (int i = 0; i < NUM_SONGS; i++)
+    {
+        char path[64];
+        char title[32];
+        snprintf(path, sizeof(path), "%s/Song %d.wav", songs_directory, i);
+        snprintf(title, sizeof(title), "Song %d", i);
+        song_info *song = create_song_struct("Artist", "Album", path, title);
+        song_ids[i] = song->id;
+        songManager_addSongBack(song);
+    }
+    AudioPlayer_init();
+    LCD_init();
+    httpServer_init(songs_directory);
+
+    char *reply = malloc(REPLY_MAX_SIZE);
+    if (reply == NULL)
+    {
+        fprintf(stderr, "httpServerTest: Error - There was a problem allocating memory.");
+        exit(1);
+    }
+    char request[512];
+    for (int i = 0; i < NUM_SONGS; i++)
+    {
+        check(sendRequest("GET /songs HTTP/1.1\r\n\r\n", reply, REPLY_MAX_SIZE) == 200 &&
+                  strstr(reply, "\"Song 0\"") != NULL,
+              "song list", i);
+    }
+    for (int i = 0; i < NUM_SONGS; i++)
+    {
+        snprintf(request, sizeof(request), "HEAD /songs/%llu HTTP/1.1\r\n\r\n", (unsigned long long)song_ids[i]);
+        check(sendRequest(request, reply, REPLY_MAX_SIZE) == 200, "song", i);
+    }
+    for (int i = 0; i < NUM_SONGS; i++)
+    {
+        char body[64];
+        int length = snprintf(body, sizeof(body), "{\"name\":\"Song %d.wav\"}", i);
+        snprintf(request, sizeof(request), "POST /delete HTTP/1.1\r\nContent-Length: %d\r\n\r\n%s", length, body);
+        check(sendRequest(request, reply, REPLY_MAX_SIZE) == 200, "delete", i);
+    }
+    check(songManager_getNumberSongs() == 0, "library emptied", NUM_SONGS);
+    check(sendRequest("GET /songs HTTP/1.1\r\n\r\n", reply, REPLY_MAX_SIZE) == 200, "song list", NUM_SONGS);
+    free(reply);
+
+    httpServer_cleanup();
+    AudioPlayer_cleanup();
+    LCD_cleanup();
+    songManager_cleanup();
+    trace_cleanup();
+    logger_cleanup();
+    removeSongs();
+    fprintf(stderr, "httpServerTest: %d requests, %d failed\n", 3 * NUM_SONGS + 1, failures);
+    return (failures == 0) ? 0 : 1;
+}
+
+// Sends "request" on a connection of its own, returns the status of the reply, -1 without one
+static int sendRequest(const char *request, char *reply, size_t size)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct timeval timeout = {.tv_sec = 5};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    struct sockaddr_in address = {.sin_family = AF_INET, .sin_port = htons(HTTP_SERVER_PORT)};
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    size_t length = 0;
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) == 0 &&
+        send(fd, request, strlen(request), 0) == (ssize_t)strlen(request))
+    {
+        // the server closes the connection after its reply
+        ssize_t received;
+        while (length < size - 1 && (received = recv(fd, reply + length, size - 1 - length, 0)) > 0)
+        {
+            length += received;
+        }
+    }
+    close(fd);
+    reply[length] = '\0';
+    int status = -1;
+    return (sscanf(reply, "HTTP/1.1 %d", &status) == 1) ? status : -1;
+}
+
+static void check(bool passed, const char *what, int i)
+{
+    if (!passed)
+    {
+        fprintf(stderr, "httpServerTest: Failed - %s, request %d\n", what, i);
+        failures++;
+    }
+}
+
+// Writes NUM_SONGS WAV files of SONG_FRAMES of silence into songs_directory
+static void writeSongs(void)
+{
+    if (mkdtemp(songs_directory) == NULL)
+    {
+        fprintf(stderr, "httpServerTest: Error - Unable to create %s.\n", songs_directory);
+        exit(1);
+    }
+    uint32_t data_size = SONG_FRAMES * NUM_CHANNELS * SAMPLE_SIZE;
+    short *samples = calloc(1, data_size);
+    if (samples == NULL)
+    {
+        fprintf(stderr, "httpServerTest: Error - There was a problem allocating memory.");
+        exit(1);
+    }
+    for (int i = 0; i < NUM_SONGS; i++)
+    {
+        // the canonical 44 byte header, little endian like the host
+        uint32_t byte_rate = SAMPLE_RATE * NUM_CHANNELS * SAMPLE_SIZE;
+        uint32_t riff_size = 36 + data_size;
+        uint32_t format_size = 16;
+        uint16_t format = 1;
+        uint16_t channels = NUM_CHANNELS;
+        uint32_t rate = SAMPLE_RATE;
+        uint16_t block_align = NUM_CHANNELS * SAMPLE_SIZE;
+        uint16_t bits = 8 * SAMPLE_SIZE;
+        char path[64];
+        snprintf(path, sizeof(path), "%s/Song %d.wav", songs_directory, i);
+        FILE *file = fopen(path, "wb");
+        if (file == NULL)
+        {
+            fprintf(stderr, "httpServerTest: Error - Unable to write %s.\n", path);
+            exit(1);
+        }
+        fwrite("RIFF", 1, 4, file);
+        fwrite(&riff_size, 4, 1, file);
+        fwrite("WAVEfmt ", 1, 8, file);
+        fwrite(&format_size, 4, 1, file);
+        fwrite(&format, 2, 1, file);
+        fwrite(&channels, 2, 1, file);
+        fwrite(&rate, 4, 1, file);
+        fwrite(&byte_rate, 4, 1, file);
+        fwrite(&block_align, 2, 1, file);
+        fwrite(&bits, 2, 1, file);
+        fwrite("data", 1, 4, file);
+        fwrite(&data_size, 4, 1, file);
+        fwrite(samples, 1, data_size, file);
+        fclose(file);
+    }
+    free(samples);
+}
+
+// The deletes removed the files already, unless they failed
+static void removeSongs(void)
+{
+    for (int i = 0; i < NUM_SONGS; i++)
+    {
+        char path[64];
+        snprintf(path, sizeof(path), "%s/Song %d.wav", songs_directory, i);
+        unlink(path);
+    }
+    rmdir(songs_directory);
+}
@@ -0,0 +1,312 @@
+/**
+ * @file networkTest.c
+ * @brief This is a source file for the test of the network module.
+ *
+ * This source file contains a host program that checks how the network
+ * module tells its two protocols apart (see protocol.h): a frame of the
+ * current version is answered, a frame of the next version gets
+ * PROTOCOL_STATUS_BAD_VERSION with its request id, and a text command is
+ * still a text command. Each is sent over UDP, then over TCP, where the
+ * frame of the next version must not hide the frame after it. An
+ * add_song must not hold up the commands sent after it over UDP, while
+ * over TCP its reply comes before theirs. The library, the audio player
+ * built with its file backend, the song watcher and the network module
+ * run on the host, on the port of the network module.
+ *
+ * Each failed check is printed to stderr; the program exits with 1 if any
+ * did. Build and run it with "make test".
+ *
+ * @author Amirhossein Etaati
+ * @date 2023-04-12
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "songManager.h"
+#include "audio_player.h"
+#include "lcd_4line.h"
+#include "network.h"
+#include "songWatcher.h"
+#include "protocol.h"
+#include "logger.h"
+#include "trace.h"
+
+// Same as the network module
+#define NETWORK_PORT 12345
+#define REQUEST_ID 0x01020304
+#define REPLY_MAX_SIZE 1024
+#define SONG_FRAMES (SAMPLE_RATE / 10)
+
+static char songs_directory[] = "/tmp/networkTest.XXXXXX";
+static char song_path[64];
+static int failures = 0;
+
+// Private functions definitions
+static size_t buildFrame(uint8_t *frame, uint8_t version, uint32_t request_id);
+static size_t buildAddSong(uint8_t *frame, uint32_t request_id);
+static ssize_t receiveFrames(int fd, uint8_t *reply, int count);
+static ssize_t receiveLines(int fd, char *reply, int count);
+static void checkReply(const uint8_t *reply, size_t size, uint8_t opcode, protocol_status_t status,
+                       uint32_t request_id, const char *what);
+static int openSocket(int type);
+static void writeSong(void);
+static void check(bool passed, const char *what);
+
+//------------------------------------------------
+////////////////// Stubbed menu //////////////////
+//------------------------------------------------
+
+song_info *MenuManager_GetCurrentSongPlaying(void)
+{
+    return songManager_getCurrentSongPlaying();
+}
+
+//------------------------------------------------
+////////////////////// Test //////////////////////
+//------------------------------------------------
+
+int main(void)
+{
+    if (freopen("/dev/null", "w", stdout) == NULL)
+    {
+        fprintf(stderr, "networkTest: Error - Unable to redirect the output.\n");
+        exit(1);
+    }
+    writeSong();
+    logger_init();
+    trace_init();
+    songManager_init();
+    AudioPlayer_init();
+    LCD_init();
+    Network_init();
+    songWatcher_init(songs_directory);
+
+    uint8_t frames[2 * PROTOCOL_MAX_FRAME_SIZE];
+    uint8_t reply[REPLY_MAX_SIZE];
+
+    // over UDP, a datagram per command
+    int fd = openSocket(SOCK_DGRAM);
+    size_t size = buildFrame(frames, PROTOCOL_VERSION, REQUEST_ID);
+    ssize_t received = (send(fd, frames, size, 0) == (ssize_t)size) ? recv(fd, reply, sizeof(reply), 0) : -1;
+    checkReply(reply, received, PROTOCOL_OP_NETWORK_STATS, PROTOCOL_STATUS_OK, REQUEST_ID, "UDP frame");
+    size = buildFrame(frames, PROTOCOL_VERSION + 1, REQUEST_ID + 1);
+    received = (send(fd, frames, size, 0) == (ssize_t)size) ? recv(fd, reply, sizeof(reply), 0) : -1;
+    checkReply(reply, received, PROTOCOL_OP_NETWORK_STATS, PROTOCOL_STATUS_BAD_VERSION, REQUEST_ID + 1,
+               "UDP frame of the next version");
+    const char *text = "network_stats";
+    received = (send(fd, text, strlen(text), 0) == (ssize_t)strlen(text)) ? recv(fd, reply, sizeof(reply), 0) : -1;
+    check(received > 0 && reply[0] != PROTOCOL_MAGIC && memchr(reply, '\n', received) != NULL, "UDP text command");
+
+    // the song is read for a second at least, the command after it is answered meanwhile
+    size = buildAddSong(frames, REQUEST_ID + 4);
+    size += buildFrame(frames + size, PROTOCOL_VERSION, REQUEST_ID + 5);
+    size_t add_size = protocol_getFrameSize(frames, size);
+    bool sent = send(fd, frames, add_size, 0) == (ssize_t)add_size &&
+                send(fd, frames + add_size, size - add_size, 0) == (ssize_t)(size - add_size);
+    received = sent ? recv(fd, reply, sizeof(reply), 0) : -1;
+    checkReply(reply, received, PROTOCOL_OP_NETWORK_STATS, PROTOCOL_STATUS_OK, REQUEST_ID + 5,
+               "UDP frame after add_song");
+    received = sent ? recv(fd, reply, sizeof(reply), 0) : -1;
+    checkReply(reply, received, PROTOCOL_OP_ADD_SONG, PROTOCOL_STATUS_OK, REQUEST_ID + 4, "UDP add_song");
+    check(songManager_getNumberSongs() == 1, "UDP add_song added the song");
+    close(fd);
+
+    // over TCP, the frame of the next version and a frame of this one in a single write
+    fd = openSocket(SOCK_STREAM);
+    size = buildFrame(frames, PROTOCOL_VERSION + 1, REQUEST_ID + 2);
+    size += buildFrame(frames + size, PROTOCOL_VERSION, REQUEST_ID + 3);
+    received = (send(fd, frames, size, 0) == (ssize_t)size) ? receiveFrames(fd, reply, 2) : -1;
+    checkReply(reply, received, PROTOCOL_OP_NETWORK_STATS, PROTOCOL_STATUS_BAD_VERSION, REQUEST_ID + 2,
+               "TCP frame of the next version");
+    size_t first = protocol_getFrameSize(reply, received);
+    checkReply(reply + first, (received > (ssize_t)first) ? received - first : 0, PROTOCOL_OP_NETWORK_STATS,
+               PROTOCOL_STATUS_OK, REQUEST_ID + 3, "TCP frame after it");
+
+    // in text, the id of the song then the statistics, after the song was read
+    char commands[256];
+    int length = snprintf(commands, sizeof(commands), "add_song\n%s\nSong\nArtist\nAlbum\n\nnetwork_stats\n\n",
+                          song_path);
+    char *lines = (char *)reply;
+    received = (send(fd, commands, length, 0) == length) ? receiveLines(fd, lines, 2) : -1;
+    unsigned long long id = 0;
+    char end = '\0';
+    check(received > 0 && sscanf(lines, "%llu%c", &id, &end) == 2 && end == '\n' && id != SONG_ID_INVALID,
+          "TCP add_song");
+    check(received > 0 && strchr(strchr(lines, '\n') + 1, ' ') != NULL, "TCP command after add_song");
+    // it took the place of the song of the same file
+    check(songManager_getNumberSongs() == 1, "TCP add_song added the song");
+    close(fd);
+
+    songWatcher_cleanup();
+    Network_cleanup();
+    AudioPlayer_cleanup();
+    LCD_cleanup();
+    songManager_cleanup();
+    trace_cleanup();
+    logger_cleanup();
+    unlink(song_path);
+    rmdir(songs_directory);
+    fprintf(stderr, "networkTest: %d failed\n", failures);
+    return (failures == 0) ? 0 : 1;
+}
+
+// Writes a network_stats request of "version" into "frame", returns its size
+static size_t buildFrame(uint8_t *frame, uint8_t version, uint32_t request_id)
+{
+    protocol_writer_t writer;
+    protocol_beginFrame(&writer, frame, PROTOCOL_MAX_FRAME_SIZE);
+    size_t size = protocol_endFrame(&writer, PROTOCOL_OP_NETWORK_STATS, PROTOCOL_STATUS_OK, request_id);
+    frame[1] = version;
+    return size;
+}
+
+// Writes an add_song request of the song at song_path into "frame", returns its size
+static size_t buildAddSong(uint8_t *frame, uint32_t request_id)
+{
+    protocol_writer_t writer;
+    protocol_beginFrame(&writer, frame, PROTOCOL_MAX_FRAME_SIZE);
+    protocol_writeString(&writer, song_path);
+    protocol_writeString(&writer, "Song");
+    protocol_writeString(&writer, "Artist");
+    protocol_writeString(&writer, "Album");
+    return protocol_endFrame(&writer, PROTOCOL_OP_ADD_SONG, PROTOCOL_STATUS_OK, request_id);
+}
+
+// Receives "count" lines from the stream "fd" into "reply", returns the bytes received, -1 if they did not come
+static ssize_t receiveLines(int fd, char *reply, int count)
+{
+    size_t received = 0;
+    reply[0] = '\0';
+    for (char *line = reply; count > 0;)
+    {
+        char *end = strchr(line, '\n');
+        if (end != NULL)
+        {
+            line = end + 1;
+            count--;
+            continue;
+        }
+        ssize_t part = recv(fd, reply + received, REPLY_MAX_SIZE - 1 - received, 0);
+        if (part <= 0)
+        {
+            return -1;
+        }
+        received += part;
+        reply[received] = '\0';
+    }
+    return received;
+}
+
+// Receives "count" frames from the stream "fd" into "reply", returns the bytes received
+static ssize_t receiveFrames(int fd, uint8_t *reply, int count)
+{
+    size_t received = 0;
+    size_t complete = 0; // bytes of the frames received whole
+    while (count > 0)
+    {
+        size_t size = protocol_getFrameSize(reply + complete, received - complete);
+        if (size > 0 && size <= received - complete)
+        {
+            complete += size;
+            count--;
+            continue;
+        }
+        ssize_t part = recv(fd, reply + received, REPLY_MAX_SIZE - received, 0);
+        if (part <= 0)
+        {
+            break;
+        }
+        received += part;
+    }
+    return received;
+}
+
+// Checks that "reply" is a reply of "opcode" to "request_id" with "status"
+static void checkReply(const uint8_t *reply, size_t size, uint8_t opcode, protocol_status_t status,
+                       uint32_t request_id, const char *what)
+{
+    protocol_header_t header;
+    protocol_reader_t fields;
+    check(size <= REPLY_MAX_SIZE && protocol_parseFrame(reply, size, &header, &fields) &&
+              header.version == PROTOCOL_VERSION && header.opcode == opcode &&
+              header.status == status && header.request_id == request_id,
+          what);
+}
+
+// Returns a socket of "type" connected to the network module
+static int openSocket(int type)
+{
+    int fd = socket(AF_INET, type, 0);
+    struct timeval timeout = {.tv_sec = 2};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    struct sockaddr_in address = {.sin_family = AF_INET, .sin_port = htons(NETWORK_PORT)};
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0)
+    {
+        fprintf(stderr, "networkTest: Error - Unable to connect.\n");
+        exit(1);
+    }
+    return fd;
+}
+
+// Writes a WAV file of SONG_FRAMES of silence to song_path, next to the watched songs_directory
+static void writeSong(void)
+{
+    if (mkdtemp(songs_directory) == NULL)
+    {
+        fprintf(stderr, "networkTest: Error - Unable to create %s.\n", songs_directory);
+        exit(1);
+    }
+    snprintf(song_path, sizeof(song_path), "%s.wav", songs_directory);
+    FILE *file = fopen(song_path, "wb");
+    if (file == NULL)
+    {
+        fprintf(stderr, "networkTest: Error - Unable to write %s.\n", song_path);
+        exit(1);
+    }
+    // the canonical 44 byte header, little endian like the host
+    uint32_t data_size = SONG_FRAMES * NUM_CHANNELS * SAMPLE_SIZE;
+    uint32_t riff_size = 36 + data_size;
+    uint32_t format_size = 16;
+    uint16_t format = 1;
+    uint16_t channels = NUM_CHANNELS;
+    uint32_t rate = SAMPLE_RATE;
+    uint32_t byte_rate = SAMPLE_RATE * NUM_CHANNELS * SAMPLE_SIZE;
+    uint16_t block_align = NUM_CHANNELS * SAMPLE_SIZE;
+    uint16_t bits = 8 * SAMPLE_SIZE;
+    fwrite("RIFF", 1, 4, file);
+    fwrite(&riff_size, 4, 1, file);
+    fwrite("WAVEfmt ", 1, 8, file);
+    fwrite(&format_size, 4, 1, file);
+    fwrite(&format, 2, 1, file);
+    fwrite(&channels, 2, 1, file);
+    fwrite(&rate, 4, 1, file);
+    fwrite(&byte_rate, 4, 1, file);
+    fwrite(&block_align, 2, 1, file);
+    fwrite(&bits, 2, 1, file);
+    fwrite("data", 1, 4, file);
+    fwrite(&data_size, 4, 1, file);
+    for (uint32_t i = 0; i < data_size; i++)
+    {
+        fputc(0, file);
+    }
+    fclose(file);
+}
+
+static void check(bool passed, const char *what)
+{
+    if (!passed)
+    {
+        fprintf(stderr, "networkTest: Failed - %s\n", what);
+        failures++;
+    }
+}
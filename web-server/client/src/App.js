@@ -3,6 +3,7 @@ import FileUpload from './components/FileUpload';
 import React, { useState } from 'react';
 import FileList from './components/FileList';
 import Message from "./components/Message";
+import SongLibrary from "./components/SongLibrary";
 
 function App() {
     const [files, setFiles] = useState([]);
@@ -21,6 +22,7 @@ function App() {
         <Message msg={message} />
         <FileUpload files={files} setFiles={setFiles} setMessage={setMessage} />
         <FileList files={files} removeFile={removeFile} />
+        <SongLibrary files={files} />
 
       </div>
     );
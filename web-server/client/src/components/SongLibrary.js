@@ -0,0 +1,31 @@
+import React, { useEffect, useState } from 'react'
+import axios from "axios";
+import { FontAwesomeIcon } from '@fortawesome/react-fontawesome'
+import { faMusic } from '@fortawesome/free-solid-svg-icons'
+
+// Lists the songs of the BeaglePod, each with a player streaming it on demand
+const SongLibrary = ({ files }) => {
+    const [songs, setSongs] = useState([]);
+
+    // reloaded after every upload or delete
+    useEffect(() => {
+        axios.get("/songs")
+            .then(res => setSongs(res.data))
+            .catch(() => console.log('Error loading the songs'));
+    }, [files]);
+
+    return (
+        <ul className="file-list">
+            {
+                songs.map(s => (
+                    <li className="file-item" key={s.id}>
+                        <FontAwesomeIcon icon={faMusic} />
+                        <p>{s.artist} - {s.name}</p>
+                        <audio controls preload="none" src={`/songs/${s.id}`} />
+                    </li>))
+            }
+        </ul>
+    )
+}
+
+export default SongLibrary
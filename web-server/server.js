@@ -15,7 +15,7 @@ app.use(fileUpload());
 
 var dgram = require('dgram');
 
-function sendUDP(data) {
+function sendUDP(data, onReply) {
     // Info for connecting to the local process via UDP
     var PORT = 12345;
     var HOST = '192.168.7.2';
@@ -30,6 +30,9 @@ function sendUDP(data) {
     client.on('message', function (message, remote) {
         var reply = message.toString('utf8')
         client.close();
+        if (onReply) {
+            onReply(reply.trim());
+        }
     });
 }
 
@@ -39,7 +42,9 @@ const bodyParser = require('body-parser');
 app.use(bodyParser.urlencoded({ extended: true }));
 app.use(bodyParser.json());
 
-// TODO keep track of all the songs added to be displayed and deleted
+// id the BeaglePod gave to each uploaded file, used to delete it
+// (ids stay valid when other songs are added or deleted, unlike positions)
+const songIds = new Map();
 
 // function to send udp message to C with the new file name to be added to the list
 // TODO
@@ -71,19 +76,28 @@ app.post('/upload', (req, res) => {
                 return res.status(500).send(err);
             }
 
-            console.log("before conversion");
-            // convert the file into wav.
-            ffmpeg(`/home/kingsteez/cmpt433/public/myApps/songs/${file.name}`).toFormat('wav').save(`/home/kingsteez/cmpt433/public/myApps/songs/${file.name.slice(0, -4)}.wav`);
-            // Call the UDP message handler here TODO
-            console.log("finished conversion");
-            
-
-            sendUDP(c_UDP_values);
-
-            setTimeout(() => {
-                return res.status(200).json({ result: true, msg: "File uploaded",fileName: file.name, filePath: `/uploads/${file.name}`});
-            }, 
-                100);
+            // convert the file into wav, in the format the BeaglePod plays
+            ffmpeg(`/home/kingsteez/cmpt433/public/myApps/songs/${file.name}`)
+                .audioFrequency(48000)
+                .audioChannels(2)
+                .audioCodec('pcm_s16le')
+                .outputOptions(['-map_metadata', '-1', '-fflags', '+bitexact'])
+                .toFormat('wav')
+                .on('error', (err) => {
+                    console.error(err);
+                    return res.status(500).send(err.message);
+                })
+                // the BeaglePod is only told about the song once the WAV file is complete
+                .on('end', () => {
+                    // the reply is the song id, or a status like NOT_FOUND if the BeaglePod could not read the file
+                    sendUDP(c_UDP_values, (reply) => {
+                        if (/^\d+$/.test(reply)) {
+                            songIds.set(file.name, reply);
+                        }
+                    });
+                    return res.status(200).json({ result: true, msg: "File uploaded",fileName: file.name, filePath: `/uploads/${file.name}`});
+                })
+                .save(`/home/kingsteez/cmpt433/public/myApps/songs/${file.name.slice(0, -4)}.wav`);
         });
     }
 });
@@ -107,8 +121,11 @@ app.post('/delete', (req, res) => {
     }
     });
     // Send a UDP message to the C program to delete the song
-
-    
+    const id = songIds.get(song_name);
+    if (id !== undefined) {
+        sendUDP(`${'remove_song'}\n${id}\n`);
+        songIds.delete(song_name);
+    }
 
     return res.status(200).json({result : true, mdg: 'Song deleted!'})
 });